@@ -0,0 +1,1090 @@
+/*
+ *  herbicide - removing flowers and rabbits in the game Mirror
+ *  Copyright (C) 2018 Mifan Bang <https://debug.tw>.
+ *
+ *  This program is free software: you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation, either version 3 of the License, or
+ *  (at your option) any later version.
+ *
+ *  This program is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+// Synthetic microbenchmarks of the filter engine of the payload. Results are
+// written to stdout as JSON so that they can be compared between builds.
+
+#include <atomic>
+#include <chrono>
+#include <cstdint>
+#include <cstdio>
+#include <cstdlib>
+#include <functional>
+#include <new>
+#include <random>
+#include <string>
+#include <thread>
+#include <vector>
+
+#include <windows.h>
+#include <wincodec.h>
+#include <wrl/client.h>
+
+#include "payload/BandedUpload.h"
+#include "payload/DrawSuppressor.h"
+#include "payload/DxgiFormat.h"
+#include "payload/HookArena.h"
+#include "payload/TextureFilter.h"
+#include "shared/bundle.h"
+#include "shared/imagecodec.h"
+#include "shared/logger.h"
+#include "shared/lz.h"
+#include "shared/patch.h"
+
+#pragma comment(lib, "windowscodecs.lib")
+
+
+
+// ---------------------------------------------------------------------------
+// allocation counting
+// ---------------------------------------------------------------------------
+
+namespace {
+
+std::atomic<uint64_t> s_allocCount(0);
+
+}  // unnamed namespace
+
+
+// counts what the hooks allocate as well, like the audit build of the payload does
+void* operator new(size_t size)
+{
+	s_allocCount.fetch_add(1, std::memory_order_relaxed);
+	NoteHeapAllocation();
+	void* ptr = malloc(size > 0 ? size : 1);
+	if (ptr == nullptr)
+		std::_Xbad_alloc();
+	return ptr;
+}
+
+
+void operator delete(void* ptr) noexcept
+{
+	free(ptr);
+}
+
+
+void operator delete(void* ptr, size_t) noexcept
+{
+	free(ptr);
+}
+
+
+
+namespace {
+
+
+
+// ---------------------------------------------------------------------------
+// parameters and results
+// ---------------------------------------------------------------------------
+
+struct Params
+{
+	unsigned int signatureCount = 64;
+	unsigned int width = 2048;
+	unsigned int height = 2048;
+	double hitRatio = 0.1;
+	unsigned int suspectCount = 256;
+	unsigned int threadCount = 1;
+	unsigned int iterations = 2000;
+	unsigned int rowPadding = 0;  // bytes after the pixels of each row, for the fingerprint benchmarks
+};
+
+
+struct Result
+{
+	const char* name;
+	unsigned int threadCount;
+	uint64_t ops;
+	double nsPerOp;
+	double bytesPerSec;
+	double allocsPerOp;
+	double hitsPerOp;  // only for benchmarks measuring coverage
+	double hashedBytesPerOp;  // by MatchHash()
+	double compressionRatio;  // only for encoders
+	bool mustNotAllocate;  // a steady state of the hooks, which fails the run if it allocates
+};
+
+
+bool ParseParams(int argc, wchar_t** argv, Params& params)
+{
+	for (int i = 1; i + 1 < argc; i += 2) {
+		const wchar_t* name = argv[i];
+		const wchar_t* value = argv[i + 1];
+		if (wcscmp(name, L"--signatures") == 0)
+			params.signatureCount = wcstoul(value, nullptr, 10);
+		else if (wcscmp(name, L"--width") == 0)
+			params.width = wcstoul(value, nullptr, 10);
+		else if (wcscmp(name, L"--height") == 0)
+			params.height = wcstoul(value, nullptr, 10);
+		else if (wcscmp(name, L"--hit-ratio") == 0)
+			params.hitRatio = wcstod(value, nullptr);
+		else if (wcscmp(name, L"--suspects") == 0)
+			params.suspectCount = wcstoul(value, nullptr, 10);
+		else if (wcscmp(name, L"--threads") == 0)
+			params.threadCount = wcstoul(value, nullptr, 10);
+		else if (wcscmp(name, L"--iterations") == 0)
+			params.iterations = wcstoul(value, nullptr, 10);
+		else if (wcscmp(name, L"--row-padding") == 0)
+			params.rowPadding = wcstoul(value, nullptr, 10);
+		else
+			return false;
+	}
+	return (argc & 1) == 1
+		&& params.signatureCount > 0
+		&& params.width > 0
+		&& params.height > 0
+		&& params.hitRatio >= 0.0 && params.hitRatio <= 1.0
+		&& params.threadCount > 0
+		&& params.iterations > 0;
+}
+
+
+// Runs $body on every thread for the configured number of iterations. Each thread gets its own
+// body from $makeBody so that setup work stays out of the measurement.
+Result RunBenchmark(const char* name, const Params& params, uint64_t bytesPerOp, const std::function<std::function<void()> (unsigned int)>& makeBody)
+{
+	std::vector<std::function<void()>> bodies;
+	for (unsigned int i = 0; i < params.threadCount; ++i)
+		bodies.push_back(makeBody(i));
+
+	std::atomic<unsigned int> readyCount(0);
+	std::atomic<bool> go(false);
+	std::vector<std::thread> threads;
+	for (unsigned int i = 0; i < params.threadCount; ++i) {
+		threads.emplace_back([&, i] {
+			auto& body = bodies[i];
+			readyCount.fetch_add(1);
+			while (!go.load())
+				std::this_thread::yield();
+			for (unsigned int n = 0; n < params.iterations; ++n)
+				body();
+		});
+	}
+	while (readyCount.load() < params.threadCount)
+		std::this_thread::yield();
+
+	const uint64_t allocCountBefore = s_allocCount.load();
+	const uint64_t hashedBytesBefore = GetHashedByteCount();
+	const auto timeBefore = std::chrono::steady_clock::now();
+	go.store(true);
+	for (auto& thread : threads)
+		thread.join();
+	const auto timeAfter = std::chrono::steady_clock::now();
+	const uint64_t allocCountAfter = s_allocCount.load();
+	const uint64_t hashedBytesAfter = GetHashedByteCount();
+
+	const double seconds = std::chrono::duration<double>(timeAfter - timeBefore).count();
+	const uint64_t ops = static_cast<uint64_t>(params.iterations) * params.threadCount;
+
+	Result result;
+	result.name = name;
+	result.threadCount = params.threadCount;
+	result.ops = ops;
+	result.nsPerOp = seconds * 1e9 * params.threadCount / static_cast<double>(ops);
+	result.bytesPerSec = seconds > 0 ? static_cast<double>(bytesPerOp * ops) / seconds : 0.0;
+	result.allocsPerOp = static_cast<double>(allocCountAfter - allocCountBefore) / static_cast<double>(ops);
+	result.hitsPerOp = 0.0;
+	result.hashedBytesPerOp = static_cast<double>(hashedBytesAfter - hashedBytesBefore) / static_cast<double>(ops);
+	result.compressionRatio = 0.0;
+	result.mustNotAllocate = false;
+	return result;
+}
+
+
+// ---------------------------------------------------------------------------
+// synthetic data
+// ---------------------------------------------------------------------------
+
+// a texture whose content is random, stored with tight row pitch unless $rowPadding is given
+struct SyntheticTexture
+{
+	D3D11_TEXTURE2D_DESC desc;
+	std::vector<uint8_t> pixels;
+	D3D11_MAPPED_SUBRESOURCE mapped;
+	gan::Hash<256> digest;  // as computed by the data condition of a padded signature
+	gan::Hash<256> packedDigest;  // ... and by that of a packed one
+
+	SyntheticTexture(unsigned int width, unsigned int height, uint32_t seed, unsigned int rowPadding = 0)
+		: desc()
+		, pixels()
+		, mapped()
+		, digest()
+		, packedDigest()
+	{
+		desc.Width = width;
+		desc.Height = height;
+		desc.MipLevels = 1;
+		desc.ArraySize = 1;
+		desc.Format = DXGI_FORMAT_R8G8B8A8_UNORM;
+		desc.SampleDesc.Count = 1;
+		desc.Usage = D3D11_USAGE_STAGING;
+		desc.CPUAccessFlags = D3D11_CPU_ACCESS_WRITE;
+
+		// MatchHash() always reads 256 rows, so never allocate fewer than that
+		const unsigned int rowPitch = width * 4 + rowPadding;
+		pixels.resize(static_cast<size_t>(rowPitch) * (height > 256 ? height : 256));
+		std::mt19937 rng(seed);
+		for (auto& byte : pixels)
+			byte = static_cast<uint8_t>(rng());
+
+		mapped.pData = pixels.data();
+		mapped.RowPitch = rowPitch;
+		mapped.DepthPitch = rowPitch * height;
+		gan::Hasher::GetSHA(mapped.pData, rowPitch << 8, digest);
+		GetPackedFingerprint(pixels.data(), rowPitch, width * 4, GetFingerprintRowCount(height), packedDigest.data);
+	}
+};
+
+
+// A 32-bit image shaped like a CG: flat fills, smooth gradients and a little noise. Random
+// content like that of SyntheticTexture can't be compressed, so encoders are measured on this.
+struct SyntheticArtwork
+{
+	ImageInfo info;
+	std::vector<uint8_t> pixels;  // BGRA with tight row pitch
+
+	SyntheticArtwork(unsigned int width, unsigned int height, uint32_t seed)
+		: info()
+		, pixels(static_cast<size_t>(width) * height * 4)
+	{
+		info.width = width;
+		info.height = height;
+		info.format = ImageFormat::Bgra8;
+		info.sourceFormat = DXGI_FORMAT_B8G8R8A8_UNORM;
+		info.rowSize = width * 4;
+		info.rowCount = height;
+
+		std::mt19937 rng(seed);
+		uint8_t* pixel = pixels.data();
+		for (unsigned int y = 0; y < height; ++y) {
+			for (unsigned int x = 0; x < width; ++x, pixel += 4) {
+				if ((x / 256 + y / 256) % 3 == 0) {
+					pixel[0] = 40;
+					pixel[1] = 80;
+					pixel[2] = 120;
+				}
+				else {
+					pixel[0] = static_cast<uint8_t>(x * 255 / width + rng() % 3);
+					pixel[1] = static_cast<uint8_t>(y * 255 / height);
+					pixel[2] = static_cast<uint8_t>((x + y) / 16);
+				}
+				pixel[3] = 255;
+			}
+		}
+	}
+};
+
+
+// The pixels of a rectangle before and after a sprite has been drawn over them: a disc of flat
+// color with a ragged rim, over a gradient with a little noise. Rows are of the rectangle alone.
+struct SyntheticOverlay
+{
+	uint32_t width;
+	uint32_t height;
+	uint32_t rowSize;
+	std::vector<uint8_t> base;
+	std::vector<uint8_t> overlay;
+
+	SyntheticOverlay(const D3D11_RECT& rect, uint32_t seed)
+		: width(static_cast<uint32_t>(rect.right - rect.left + 1))
+		, height(static_cast<uint32_t>(rect.bottom - rect.top + 1))
+		, rowSize(width * 4)
+		, base(static_cast<size_t>(rowSize) * height)
+		, overlay()
+	{
+		std::mt19937 rng(seed);
+		uint8_t* pixel = base.data();
+		for (uint32_t y = 0; y < height; ++y) {
+			for (uint32_t x = 0; x < width; ++x, pixel += 4) {
+				pixel[0] = static_cast<uint8_t>(x * 255 / width + rng() % 3);
+				pixel[1] = static_cast<uint8_t>(y * 255 / height);
+				pixel[2] = static_cast<uint8_t>((x + y) / 4);
+				pixel[3] = 255;
+			}
+		}
+
+		overlay = base;
+		pixel = overlay.data();
+		for (uint32_t y = 0; y < height; ++y) {
+			for (uint32_t x = 0; x < width; ++x, pixel += 4) {
+				const double dx = (x + 0.5) * 2.0 / width - 1.0;
+				const double dy = (y + 0.5) * 2.0 / height - 1.0;
+				const double distance = dx * dx + dy * dy;
+				if (distance < 0.64) {
+					pixel[0] = 0xD0;
+					pixel[1] = 0xE0;
+					pixel[2] = 0xF0;
+				}
+				else if (distance < 1.0 && (rng() & 1) != 0) {
+					pixel[0] = static_cast<uint8_t>(rng());
+					pixel[1] = static_cast<uint8_t>(rng());
+					pixel[2] = static_cast<uint8_t>(rng());
+				}
+			}
+		}
+	}
+};
+
+
+// encodes PNG into memory with WIC, the way dumps used to be written
+struct PngEncoder
+{
+	Microsoft::WRL::ComPtr<IWICImagingFactory> factory;
+	std::vector<uint8_t> buffer;
+	size_t encodedSize;
+
+	explicit PngEncoder(size_t capacity)
+		: factory()
+		, buffer(capacity)
+		, encodedSize(0)
+	{
+		if (FAILED(::CoCreateInstance(CLSID_WICImagingFactory, nullptr, CLSCTX_INPROC_SERVER, IID_PPV_ARGS(&factory))))
+			abort();
+	}
+
+	bool Encode(const SyntheticArtwork& image)
+	{
+		using Microsoft::WRL::ComPtr;
+
+		ComPtr<IWICStream> stream;
+		ComPtr<IWICBitmapEncoder> encoder;
+		ComPtr<IWICBitmapFrameEncode> frame;
+		WICPixelFormatGUID pixelFormat = GUID_WICPixelFormat32bppBGRA;
+		ULARGE_INTEGER position { };
+		const bool isOk = SUCCEEDED(factory->CreateStream(&stream))
+			&& SUCCEEDED(stream->InitializeFromMemory(buffer.data(), static_cast<DWORD>(buffer.size())))
+			&& SUCCEEDED(factory->CreateEncoder(GUID_ContainerFormatPng, nullptr, &encoder))
+			&& SUCCEEDED(encoder->Initialize(stream.Get(), WICBitmapEncoderNoCache))
+			&& SUCCEEDED(encoder->CreateNewFrame(&frame, nullptr))
+			&& SUCCEEDED(frame->Initialize(nullptr))
+			&& SUCCEEDED(frame->SetSize(image.info.width, image.info.height))
+			&& SUCCEEDED(frame->SetPixelFormat(&pixelFormat))
+			&& SUCCEEDED(frame->WritePixels(image.info.height, image.info.rowSize, static_cast<UINT>(image.pixels.size()), const_cast<BYTE*>(image.pixels.data())))
+			&& SUCCEEDED(frame->Commit())
+			&& SUCCEEDED(encoder->Commit())
+			&& SUCCEEDED(stream->Seek(LARGE_INTEGER { }, STREAM_SEEK_CUR, &position));
+		encodedSize = isOk ? static_cast<size_t>(position.QuadPart) : 0;
+		return isOk;
+	}
+};
+
+
+// a bundle of $entryCount entries shaped like PE images, with runs of zeros between random code
+std::vector<uint8_t> MakeSyntheticBundle(unsigned int entryCount, size_t entrySize, uint32_t seed)
+{
+	std::mt19937 rng(seed);
+	std::vector<std::vector<uint8_t>> contents(entryCount);
+	std::vector<BundleInput> inputs(entryCount);
+	for (unsigned int i = 0; i < entryCount; ++i) {
+		auto& content = contents[i];
+		content.resize(entrySize);
+		for (size_t pos = 0; pos < entrySize; ++pos)
+			content[pos] = (pos & 0x300) == 0 ? 0 : static_cast<uint8_t>(rng() & 0x1F);
+		inputs[i].name = "entry" + std::to_string(i);
+		inputs[i].arch = BundleArch::Any;
+		inputs[i].data = content.data();
+		inputs[i].size = content.size();
+	}
+
+	std::vector<uint8_t> bundle;
+	if (!BuildBundle(inputs, std::thread::hardware_concurrency(), bundle))
+		abort();
+	return bundle;
+}
+
+
+// Rabbit-sized rectangle in the bottom-left corner. Unless the texture is shorter than 411 rows,
+// erasing it doesn't touch the 256 rows being hashed, so repeated hits keep hitting.
+D3D11_RECT GetEraseRect(const Params& params)
+{
+	const LONG width = static_cast<LONG>(params.width < 184 ? params.width : 184);
+	const LONG height = static_cast<LONG>(params.height < 155 ? params.height : 155);
+	const LONG top = static_cast<LONG>(params.height) - height;
+	return { 0, top, width - 1, static_cast<LONG>(params.height) - 1 };
+}
+
+
+// The first signature matches $texture. The rest use descriptors that never match it.
+std::unique_ptr<DataFilterFactory> MakeFactory(const Params& params, const SyntheticTexture& texture)
+{
+	auto factory = std::make_unique<DataFilterFactory>();
+	std::mt19937 rng(1);
+	for (unsigned int i = 0; i < params.signatureCount; ++i) {
+		SignatureRecord record { };
+		record.width = i == 0 ? params.width : params.width + 1 + (rng() & 0xFF);
+		record.height = params.height;
+		record.format = DXGI_FORMAT_R8G8B8A8_UNORM;
+		if (i == 0)
+			memcpy(record.digest, texture.digest.data, sizeof(record.digest));
+		else
+			for (auto& byte : record.digest)
+				byte = static_cast<uint8_t>(rng());
+		const D3D11_RECT rect = GetEraseRect(params);
+		record.eraseX = static_cast<uint32_t>(rect.left);
+		record.eraseY = static_cast<uint32_t>(rect.top);
+		record.eraseWidth = static_cast<uint32_t>(rect.right - rect.left + 1);
+		record.eraseHeight = static_cast<uint32_t>(rect.bottom - rect.top + 1);
+		record.stride = 4;
+		factory->Register(DataFilterFactory::MakeEntry(record, nullptr, 0));
+	}
+	return std::move(factory);
+}
+
+
+// descriptors of textures created by the game, of which $hitRatio match a signature
+std::vector<D3D11_TEXTURE2D_DESC> MakeQueries(const Params& params, const SyntheticTexture& texture, uint32_t seed)
+{
+	std::vector<D3D11_TEXTURE2D_DESC> queries(1024, texture.desc);
+	std::mt19937 rng(seed);
+	std::uniform_real_distribution<double> dist(0.0, 1.0);
+	for (auto& desc : queries) {
+		if (dist(rng) >= params.hitRatio)
+			desc.Width = params.width + 512 + (rng() & 0x7FF);  // wider than any registered signature
+	}
+	return queries;
+}
+
+
+// stand-in for a mapping of a staging texture, which drivers often place in write-combined memory
+struct WriteCombinedMapping
+{
+	D3D11_MAPPED_SUBRESOURCE mapped;
+
+	explicit WriteCombinedMapping(const D3D11_MAPPED_SUBRESOURCE& layout)
+		: mapped(layout)
+	{
+		mapped.pData = ::VirtualAlloc(nullptr, layout.DepthPitch, MEM_COMMIT | MEM_RESERVE, PAGE_READWRITE | PAGE_WRITECOMBINE);
+		if (mapped.pData == nullptr)
+			abort();
+		memcpy(mapped.pData, layout.pData, layout.DepthPitch);
+	}
+
+	~WriteCombinedMapping()
+	{
+		::VirtualFree(mapped.pData, 0, MEM_RELEASE);
+	}
+
+	WriteCombinedMapping(const WriteCombinedMapping&) = delete;
+	WriteCombinedMapping& operator=(const WriteCombinedMapping&) = delete;
+};
+
+
+void* FakeResource(size_t index)
+{
+	return reinterpret_cast<void*>((index + 1) << 4);
+}
+
+
+// the layout of $desc, as CreateTexture2D() gives it to a suspect
+void SetSuspectLayout(ResourceSuspect& suspect, const D3D11_TEXTURE2D_DESC& desc)
+{
+	if (!GetFormatLayout(desc.Format, desc.Width, desc.Height, suspect.rowSize, suspect.rowCount)) {
+		suspect.rowSize = 0;
+		suspect.rowCount = desc.Height;
+	}
+}
+
+
+ResourceSuspect MakeSuspect(const DataFilterFactory& factory, const D3D11_TEXTURE2D_DESC& desc)
+{
+	ResourceSuspect suspect;
+	factory.Match(desc, suspect.filterList);
+	SetSuspectLayout(suspect, desc);
+	return suspect;
+}
+
+
+// ---------------------------------------------------------------------------
+// benchmarks
+// ---------------------------------------------------------------------------
+
+void RunAll(const Params& params, std::vector<Result>& results)
+{
+	const SyntheticTexture texture(params.width, params.height, 7);
+	const auto factory = MakeFactory(params, texture);
+	const uint64_t sizeHashed = static_cast<uint64_t>(texture.mapped.RowPitch) << 8;
+	const D3D11_RECT eraseRect = GetEraseRect(params);
+	const uint64_t sizeErased = static_cast<uint64_t>(eraseRect.right - eraseRect.left + 1) * (eraseRect.bottom - eraseRect.top + 1) * 4;
+
+	results.push_back(RunBenchmark("DataFilterFactory::Match", params, 0, [&](unsigned int threadIndex) {
+		auto queries = std::make_shared<std::vector<D3D11_TEXTURE2D_DESC>>(MakeQueries(params, texture, threadIndex + 1));
+		auto index = std::make_shared<size_t>(0);
+		return [&factory, queries, index] {
+			SharedDataFilterList filters;
+			factory->Match((*queries)[(*index)++ & 1023], filters);
+		};
+	}));
+
+	// an entry and a second signature both matching the descriptor of $texture, so the lists
+	// are combined; the first match builds the combination, the measured ones look it up
+	{
+		auto combinedFactory = MakeFactory(params, texture);
+		SignatureRecord record { };
+		record.width = params.width;
+		record.height = params.height;
+		record.format = DXGI_FORMAT_R8G8B8A8_UNORM;
+		record.stride = 4;
+		combinedFactory->Register(DataFilterFactory::MakeEntry(record, nullptr, 0));
+		results.push_back(RunBenchmark("DataFilterFactory::Match(combined)", params, 0, [&](unsigned int) {
+			const DataFilterFactory* pFactory = combinedFactory.get();
+			const D3D11_TEXTURE2D_DESC* pDesc = &texture.desc;
+			SharedDataFilterList warmUp;
+			if (!pFactory->Match(*pDesc, warmUp) || warmUp->size() != 2)
+				abort();
+			return [pFactory, pDesc] {
+				ScopedHookArena hookArena;
+				SharedDataFilterList filters;
+				pFactory->Match(*pDesc, filters);
+			};
+		}));
+		results.back().mustNotAllocate = true;
+	}
+
+	results.push_back(RunBenchmark("MatchHash", params, sizeHashed, [&](unsigned int threadIndex) {
+		auto data = std::make_shared<SyntheticTexture>(params.width, params.height, threadIndex + 100);
+		return [data] {
+			MatchHash(data->mapped.pData, data->mapped.RowPitch << 8, data->digest);
+		};
+	}));
+
+	// the padded fingerprint hashes whole pitches of 256 rows, and matches nothing on textures
+	// shorter than that; the packed one hashes only the pixels of the rows there are
+	for (const bool isPacked : { false, true }) {
+		results.push_back(RunBenchmark(isPacked ? "Fingerprint(packed)" : "Fingerprint(padded)", params, 0, [&](unsigned int threadIndex) {
+			auto data = std::make_shared<SyntheticTexture>(params.width, params.height, threadIndex + 150, params.rowPadding);
+			auto cond = isPacked ?
+				std::make_shared<FilterDataCondition>(data->packedDigest, params.width * 4, GetFingerprintRowCount(params.height)) :
+				std::make_shared<FilterDataCondition>(data->digest);
+			return [data, cond] {
+				(*cond)(data->mapped);
+			};
+		}));
+	}
+
+	results.push_back(RunBenchmark("ErasePixels", params, sizeErased, [&](unsigned int threadIndex) {
+		auto data = std::make_shared<SyntheticTexture>(params.width, params.height, threadIndex + 200);
+		return [data, eraseRect] {
+			ErasePixels(data->mapped, data->desc.Height, eraseRect, 4);
+		};
+	}));
+
+	// Putting back what a sprite covered, by a patch of the pixels it changed or by copying a
+	// whole replacement rectangle; both are decompressed when signatures are loaded. The
+	// compression_ratio is of the size of the rectangle to that stored: the patch as built, or
+	// the rectangle compressed like a bundle entry.
+	{
+		const SyntheticOverlay overlay(eraseRect, 1000);
+		auto patchData = std::make_shared<std::vector<uint8_t>>();
+		auto patch = std::make_shared<PixelPatch>();
+		if (!BuildPatch(overlay.overlay.data(), overlay.rowSize, overlay.base.data(), overlay.rowSize, overlay.width, overlay.height, 4, *patchData)
+				|| !patch->Load(patchData->data(), patchData->size()))
+			abort();
+
+		results.push_back(RunBenchmark("PixelPatch::Load", params, sizeErased, [&](unsigned int) {
+			auto loaded = std::make_shared<PixelPatch>();
+			return [patchData, loaded] {
+				if (!loaded->Load(patchData->data(), patchData->size()))
+					abort();
+			};
+		}));
+
+		results.push_back(RunBenchmark("PatchPixels", params, sizeErased, [&](unsigned int threadIndex) {
+			auto data = std::make_shared<SyntheticTexture>(params.width, params.height, threadIndex + 250);
+			return [data, eraseRect, patch] {
+				PatchPixels(data->mapped, data->desc.Height, eraseRect, *patch);
+			};
+		}));
+		results.back().compressionRatio = static_cast<double>(sizeErased) / static_cast<double>(patchData->size());
+
+		auto replacement = std::make_shared<std::vector<uint8_t>>(overlay.base);
+		results.push_back(RunBenchmark("CopyRect(full)", params, sizeErased, [&](unsigned int threadIndex) {
+			auto data = std::make_shared<SyntheticTexture>(params.width, params.height, threadIndex + 250);
+			const uint32_t rowSize = overlay.rowSize;
+			const uint32_t rowCount = overlay.height;
+			return [data, eraseRect, replacement, rowSize, rowCount] {
+				const UINT rowPitch = data->mapped.RowPitch;
+				uint8_t* dst = static_cast<uint8_t*>(data->mapped.pData) + static_cast<size_t>(eraseRect.top) * rowPitch + static_cast<size_t>(eraseRect.left) * 4;
+				for (uint32_t row = 0; row < rowCount; ++row)
+					memcpy(dst + static_cast<size_t>(row) * rowPitch, replacement->data() + static_cast<size_t>(row) * rowSize, rowSize);
+			};
+		}));
+		std::vector<uint8_t> compressed(GetLzCompressBound(replacement->size()));
+		const size_t compressedSize = LzCompress(replacement->data(), replacement->size(), compressed.data(), compressed.size());
+		results.back().compressionRatio = static_cast<double>(sizeErased) / static_cast<double>(compressedSize > 0 ? compressedSize : sizeErased);
+	}
+
+	// every thread owns a suspect list with the configured population, which keeps lock contention out of the numbers
+	auto makeSuspectList = [&]() {
+		auto list = std::make_shared<ResourceSuspectList>();
+		for (unsigned int i = 0; i < params.suspectCount; ++i)
+			list->Add(FakeResource(i), MakeSuspect(*factory, texture.desc));
+		return list;
+	};
+
+	results.push_back(RunBenchmark("ResourceSuspectList::Add+Remove", params, 0, [&](unsigned int) {
+		auto list = makeSuspectList();
+		void* resource = FakeResource(params.suspectCount);
+		const DataFilterFactory* pFactory = factory.get();
+		const D3D11_TEXTURE2D_DESC* pDesc = &texture.desc;
+		return [list, resource, pFactory, pDesc] {
+			list->Add(resource, MakeSuspect(*pFactory, *pDesc));
+			list->Remove(resource);
+		};
+	}));
+
+	results.push_back(RunBenchmark("ResourceSuspectList::SetMappedData", params, 0, [&](unsigned int) {
+		auto list = makeSuspectList();
+		const unsigned int population = params.suspectCount > 0 ? params.suspectCount : 1;
+		auto index = std::make_shared<size_t>(0);
+		const D3D11_MAPPED_SUBRESOURCE* pMapped = &texture.mapped;
+		return [list, index, population, pMapped] {
+			list->SetMappedData(FakeResource((*index)++ % population), *pMapped);
+		};
+	}));
+
+	// a miss on data: the whole fingerprint is computed but nothing is erased or removed
+	results.push_back(RunBenchmark("ResourceSuspectList::ActOn", params, sizeHashed, [&](unsigned int threadIndex) {
+		auto list = makeSuspectList();
+		auto data = std::make_shared<SyntheticTexture>(params.width, params.height, threadIndex + 300);
+		void* resource = FakeResource(params.suspectCount);
+		list->Add(resource, MakeSuspect(*factory, texture.desc));
+		list->SetMappedData(resource, data->mapped);
+		return [list, data, resource] {
+			list->ActOn(resource);
+		};
+	}));
+
+	results.push_back(RunBenchmark("ResourceSuspectList::CollectGarbage", params, 0, [&](unsigned int) {
+		auto list = makeSuspectList();
+		return [list] {
+			list->CollectGarbage();
+		};
+	}));
+
+	// CreateTexture2D() -> Map() -> Unmap() as the hooks do it, with $hitRatio of textures being
+	// censored ones; allocs_per_op should be 0, as the hooks allocate nothing in a steady state
+	results.push_back(RunBenchmark("EndToEnd", params, 0, [&](unsigned int threadIndex) {
+		auto list = makeSuspectList();
+		auto queries = std::make_shared<std::vector<D3D11_TEXTURE2D_DESC>>(MakeQueries(params, texture, threadIndex + 400));
+		auto data = std::make_shared<SyntheticTexture>(params.width, params.height, 7);  // same content as $texture
+		auto index = std::make_shared<size_t>(0);
+		const DataFilterFactory* pFactory = factory.get();
+		void* resource = FakeResource(params.suspectCount);
+		return [list, queries, data, index, pFactory, resource] {
+			ScopedHookArena hookArena;
+			SharedDataFilterList filters;
+			const D3D11_TEXTURE2D_DESC& desc = (*queries)[(*index)++ & 1023];
+			if (pFactory->Match(desc, filters)) {
+				ResourceSuspect suspect;
+				suspect.filterList = std::move(filters);
+				SetSuspectLayout(suspect, desc);
+				list->Add(resource, std::move(suspect));
+			}
+			list->SetMappedData(resource, data->mapped);
+			list->CollectGarbage();
+			if (!list->ActOn(resource))
+				list->Remove(resource);
+		};
+	}));
+
+	results.push_back(RunBenchmark("ShadowArena::Acquire+Release", params, 0, [&](unsigned int) {
+		auto arena = std::make_shared<ShadowArena>(static_cast<size_t>(256) << 20);
+		const size_t size = texture.mapped.DepthPitch;
+		return [arena, size] {
+			ShadowArena::Block block;
+			if (arena->Acquire(size, block))
+				arena->Release(block);
+		};
+	}));
+
+	results.push_back(RunBenchmark("StreamCopy", params, texture.mapped.DepthPitch, [&](unsigned int threadIndex) {
+		auto src = std::make_shared<SyntheticTexture>(params.width, params.height, threadIndex + 600);
+		auto dst = std::make_shared<WriteCombinedMapping>(src->mapped);
+		return [src, dst] {
+			StreamCopy(dst->mapped.pData, src->mapped.pData, src->mapped.DepthPitch);
+		};
+	}));
+
+	// Map() -> Unmap() of a suspect that misses, the application having written the whole texture,
+	// with the mapping in write-combined memory, directly or through a shadow buffer which first
+	// reads the mapping in
+	for (const bool isShadowed : { false, true }) {
+		results.push_back(RunBenchmark(isShadowed ? "Unmap(shadow)" : "Unmap(direct)", params, texture.mapped.DepthPitch, [&](unsigned int threadIndex) {
+			auto list = makeSuspectList();
+			auto arena = std::make_shared<ShadowArena>(static_cast<size_t>(256) << 20);
+			if (isShadowed)
+				list->SetShadowArena(arena.get());
+			auto data = std::make_shared<SyntheticTexture>(params.width, params.height, threadIndex + 700);
+			auto mapping = std::make_shared<WriteCombinedMapping>(data->mapped);
+			void* resource = FakeResource(params.suspectCount);
+			const DataFilterFactory* pFactory = factory.get();
+			const D3D11_TEXTURE2D_DESC* pDesc = &texture.desc;
+			return [list, arena, data, mapping, resource, pFactory, pDesc] {
+				list->Add(resource, MakeSuspect(*pFactory, *pDesc));
+				D3D11_MAPPED_SUBRESOURCE mapped = mapping->mapped;
+				list->SetShadowedMappedData(resource, mapped, false);
+				memcpy(mapped.pData, data->mapped.pData, mapped.DepthPitch);  // the upload by the application
+				list->ActOnUnmap(resource, nullptr);
+			};
+		}));
+	}
+
+	// A staging texture created once and reused for a trace of uploads. Each content is uploaded
+	// several times in a row and the first one is censored. Without watch mode only the first
+	// upload is checked; with it, every change of content is.
+	for (const bool isWatching : { false, true }) {
+		constexpr unsigned int c_contentCount = 4;
+		constexpr unsigned int c_repeatCount = 4;
+		auto hitCount = std::make_shared<std::atomic<uint64_t>>(0);
+		results.push_back(RunBenchmark(isWatching ? "Replay(watch=on)" : "Replay(watch=off)", params, 0, [&](unsigned int threadIndex) {
+			auto list = makeSuspectList();
+			list->SetWatchMode(isWatching);
+			void* resource = FakeResource(params.suspectCount);
+			list->Add(resource, MakeSuspect(*factory, texture.desc));
+
+			auto contents = std::make_shared<std::vector<std::unique_ptr<SyntheticTexture>>>();
+			for (unsigned int i = 0; i < c_contentCount; ++i)
+				contents->push_back(std::make_unique<SyntheticTexture>(params.width, params.height, i == 0 ? 7 : threadIndex * c_contentCount + i + 500));
+			auto index = std::make_shared<size_t>(0);
+			return [list, resource, contents, index, hitCount] {
+				const auto& content = *(*contents)[(*index)++ / c_repeatCount % c_contentCount];
+				list->SetMappedData(resource, content.mapped);
+				list->CollectGarbage();
+				if (list->ActOnUnmap(resource, nullptr))
+					hitCount->fetch_add(1, std::memory_order_relaxed);
+			};
+		}));
+		results.back().hitsPerOp = static_cast<double>(hitCount->load()) / static_cast<double>(results.back().ops);
+	}
+
+	// Draw suppression on a context which records the draws reaching it: each op binds two
+	// neighbouring views of a set where one in 16 is of a tagged overlay, then draws.
+	// hits_per_op is the fraction of draws skipped, 1/8 when nothing is missed.
+	{
+		constexpr size_t c_viewCount = 256;
+		constexpr size_t c_overlayPeriod = 16;
+		auto suppressor = std::make_shared<DrawSuppressor>();
+		for (size_t i = 0; i < c_viewCount; ++i)
+			suppressor->OnCreateView(FakeResource(c_viewCount + i), FakeResource(i));
+		for (size_t i = 0; i < c_viewCount; i += c_overlayPeriod)
+			suppressor->Tag(FakeResource(i));
+
+		auto drawnCount = std::make_shared<std::atomic<uint64_t>>(0);
+		results.push_back(RunBenchmark("DrawSuppressor(bind+draw)", params, 0, [&](unsigned int threadIndex) {
+			auto bindings = std::make_shared<DrawBindings>();
+			auto index = std::make_shared<size_t>(threadIndex);
+			return [suppressor, bindings, index, drawnCount] {
+				const size_t i = (*index)++ % c_viewCount;
+				const void* views[2] = { FakeResource(c_viewCount + i), FakeResource(c_viewCount + (i + 1) % c_viewCount) };
+				suppressor->OnSetShaderResources(*bindings, 0, 2, views);
+				if (!suppressor->OnDraw(*bindings))
+					drawnCount->fetch_add(1, std::memory_order_relaxed);
+			};
+		}));
+		results.back().hitsPerOp = 1.0 - static_cast<double>(drawnCount->load()) / static_cast<double>(results.back().ops);
+	}
+
+	// A synthetic load, not a recorded one: each op creates a staging texture, uploads to it and
+	// releases it, and one upload in c_copyPeriod gets copied to the GPU, starting with the
+	// censored one. hits_per_op should stay while lazy mode hashes 1/c_copyPeriod of the bytes,
+	// which is by construction: this checks that uncopied uploads are skipped, not what share of
+	// a game's uploads is never copied.
+	for (const bool isLazy : { false, true }) {
+		constexpr unsigned int c_copyPeriod = 4;
+		auto hitCount = std::make_shared<std::atomic<uint64_t>>(0);
+		results.push_back(RunBenchmark(isLazy ? "SyntheticLoad(lazy=on)" : "SyntheticLoad(lazy=off)", params, 0, [&](unsigned int threadIndex) {
+			auto list = makeSuspectList();
+			list->SetLazyMode(isLazy);
+			void* resource = FakeResource(params.suspectCount);
+			auto contents = std::make_shared<std::vector<std::unique_ptr<SyntheticTexture>>>();
+			for (unsigned int i = 0; i < c_copyPeriod * 2; ++i)
+				contents->push_back(std::make_unique<SyntheticTexture>(params.width, params.height, i == 0 ? 7 : threadIndex * c_copyPeriod * 2 + i + 700));
+			const DataFilterFactory* pFactory = factory.get();
+			const D3D11_TEXTURE2D_DESC* pDesc = &texture.desc;
+			auto index = std::make_shared<size_t>(0);
+			return [list, resource, contents, pFactory, pDesc, index, hitCount] {
+				const size_t upload = (*index)++;
+				const auto& content = *(*contents)[upload % contents->size()];
+				list->Add(resource, MakeSuspect(*pFactory, *pDesc));
+				list->SetMappedData(resource, content.mapped);
+				bool hasHit = list->ActOnUnmap(resource, nullptr);
+				if (upload % c_copyPeriod == 0 && list->IsPending(resource))
+					hasHit = list->ActOnRemapped(resource, content.mapped, nullptr);
+				if (hasHit)
+					hitCount->fetch_add(1, std::memory_order_relaxed);
+				list->Remove(resource);
+			};
+		}));
+		results.back().hitsPerOp = static_cast<double>(hitCount->load()) / static_cast<double>(results.back().ops);
+	}
+
+	// A texture uploaded in bands of c_bandRows rows by UpdateSubresource(), every other time
+	// with the censored content. Without resumable state the uploaded rows are kept and the
+	// fingerprint taken again after each band; the tracker hashes every row once. Compare
+	// hashed_bytes_per_op, while hits_per_op should stay at 1/2.
+	for (const bool isIncremental : { false, true }) {
+		constexpr unsigned int c_bandRows = 32;
+		auto tracker = std::make_shared<BandedUploadTracker>();
+		auto hitCount = std::make_shared<std::atomic<uint64_t>>(0);
+		results.push_back(RunBenchmark(isIncremental ? "BandedUpload(incremental)" : "BandedUpload(rehash)", params, 0, [&](unsigned int threadIndex) {
+			const SharedDataFilterList filterList = MakeSuspect(*factory, texture.desc).filterList;
+			auto contents = std::make_shared<std::vector<std::unique_ptr<SyntheticTexture>>>();
+			contents->push_back(std::make_unique<SyntheticTexture>(params.width, params.height, 7));
+			contents->push_back(std::make_unique<SyntheticTexture>(params.width, params.height, threadIndex + 900));
+			auto uploaded = std::make_shared<std::vector<uint8_t>>(texture.pixels.size());
+			void* resource = FakeResource(threadIndex);
+			const unsigned int height = params.height;
+			auto index = std::make_shared<size_t>(0);
+			return [isIncremental, tracker, hitCount, filterList, contents, uploaded, resource, height, index] {
+				const auto& content = *(*contents)[(*index)++ % contents->size()];
+				const unsigned int rowPitch = content.mapped.RowPitch;
+				ScopedHookArena hookArena;
+				BandedUploadTracker::EraseList erases;
+				bool hasHit = false;
+				for (unsigned int row = 0; row < height; row += c_bandRows) {
+					const unsigned int endRow = row + c_bandRows < height ? row + c_bandRows : height;
+					const uint8_t* rows = content.pixels.data() + static_cast<size_t>(row) * rowPitch;
+					if (isIncremental) {
+						const BandedUploadTracker::Band band { rows, rowPitch, rowPitch, height, row, endRow };
+						hasHit = tracker->OnUpload(resource, *filterList, band, erases) || hasHit;
+						continue;
+					}
+					memcpy(uploaded->data() + static_cast<size_t>(row) * rowPitch, rows, static_cast<size_t>(endRow - row) * rowPitch);
+					if (endRow < c_fingerprintRowCount || hasHit)
+						continue;
+					D3D11_MAPPED_SUBRESOURCE mapped = content.mapped;
+					mapped.pData = uploaded->data();
+					for (const auto& filter : *filterList)
+						hasHit = filter->MatchMappedData(mapped) || hasHit;
+				}
+				if (hasHit)
+					hitCount->fetch_add(1, std::memory_order_relaxed);
+			};
+		}));
+		results.back().hitsPerOp = static_cast<double>(hitCount->load()) / static_cast<double>(results.back().ops);
+		if (isIncremental)
+			results.back().hashedBytesPerOp = static_cast<double>(tracker->GetStats().hashedBytes) / static_cast<double>(results.back().ops);
+	}
+
+	// Encoders of texture dumps on a CG-sized image; the image codec with one thread and with
+	// one per core, against PNG through WIC.
+	const SyntheticArtwork artwork(params.width, params.height, 800);
+	const uint64_t sizeArtwork = artwork.pixels.size();
+	const unsigned int coreCount = std::thread::hardware_concurrency() > 0 ? std::thread::hardware_concurrency() : 1;
+	for (const unsigned int codecThreads : { 1u, coreCount }) {
+		auto encodedSize = std::make_shared<std::atomic<size_t>>(0);
+		results.push_back(RunBenchmark(codecThreads == 1 ? "EncodeImage(threads=1)" : "EncodeImage(threads=cores)", params, sizeArtwork, [&](unsigned int) {
+			auto out = std::make_shared<std::vector<uint8_t>>();
+			const SyntheticArtwork* pArtwork = &artwork;
+			return [out, pArtwork, codecThreads, encodedSize] {
+				if (EncodeImage(pArtwork->info, pArtwork->pixels.data(), pArtwork->info.rowSize, *out, codecThreads))
+					encodedSize->store(out->size());
+			};
+		}));
+		results.back().compressionRatio = static_cast<double>(sizeArtwork) / static_cast<double>(encodedSize->load() > 0 ? encodedSize->load() : 1);
+	}
+
+	{
+		auto encoded = std::make_shared<std::vector<uint8_t>>();
+		if (!EncodeImage(artwork.info, artwork.pixels.data(), artwork.info.rowSize, *encoded, coreCount))
+			abort();
+		results.push_back(RunBenchmark("DecodeImage(threads=cores)", params, sizeArtwork, [&](unsigned int) {
+			auto pixels = std::make_shared<std::vector<uint8_t>>(artwork.pixels.size());
+			const uint32_t rowSize = artwork.info.rowSize;
+			return [encoded, pixels, rowSize, coreCount] {
+				if (!DecodeImage(encoded->data(), encoded->size(), pixels->data(), rowSize, coreCount))
+					abort();
+			};
+		}));
+	}
+
+	{
+		auto encodedSize = std::make_shared<std::atomic<size_t>>(0);
+		results.push_back(RunBenchmark("PngEncode(WIC)", params, sizeArtwork, [&](unsigned int) {
+			auto encoder = std::make_shared<PngEncoder>(artwork.pixels.size() * 2);
+			const SyntheticArtwork* pArtwork = &artwork;
+			return [encoder, pArtwork, encodedSize] {
+				if (encoder->Encode(*pArtwork))
+					encodedSize->store(encoder->encodedSize);
+			};
+		}));
+		results.back().compressionRatio = static_cast<double>(sizeArtwork) / static_cast<double>(encodedSize->load() > 0 ? encodedSize->load() : 1);
+	}
+
+	// Launching: opening a bundle of 64 MiB, obfuscated as in the launcher, and extracting one
+	// entry out of the middle of it
+	{
+		constexpr unsigned int c_entryCount = 64;
+		constexpr size_t c_entrySize = 1 << 20;
+		constexpr uint8_t c_mask = 0x90;
+		auto bundle = std::make_shared<std::vector<uint8_t>>(MakeSyntheticBundle(c_entryCount, c_entrySize, 900));
+		for (auto& byte : *bundle)
+			byte ^= c_mask;
+
+		results.push_back(RunBenchmark("BundleReader::Open", params, 0, [&](unsigned int) {
+			return [bundle] {
+				BundleReader reader;
+				if (!reader.Open(bundle->data(), bundle->size(), c_mask))
+					abort();
+			};
+		}));
+
+		results.push_back(RunBenchmark("BundleReader::Extract", params, c_entrySize, [&](unsigned int) {
+			auto reader = std::make_shared<BundleReader>();
+			if (!reader->Open(bundle->data(), bundle->size(), c_mask))
+				abort();
+			auto out = std::make_shared<std::vector<uint8_t>>();
+			const BundleEntry* entry = reader->Find("entry37", BundleArch::X86);
+			return [bundle, reader, out, entry] {
+				if (!reader->Extract(*entry, *out))
+					abort();
+			};
+		}));
+		results.back().compressionRatio = static_cast<double>(c_entrySize * c_entryCount) / static_cast<double>(bundle->size());
+	}
+
+	// Logging from a hook: a record as written by CreateTexture2D, with the level enabled and
+	// the drain formatting into nowhere, with the level disabled, and formatted synchronously
+	// as DEBUG_MSG used to, minus the console. hits_per_op is the fraction of records kept.
+	{
+		Logger::Start(nullptr, LogLevel::Debug);
+		const Logger::Stats statsBefore = Logger::GetStats();
+		results.push_back(RunBenchmark("Logger::Write(enabled)", params, 0, [&](unsigned int threadIndex) {
+			return [threadIndex] {
+				LOG_DEBUG(L"CreateTexture2D w=%d h=%d fmt=%d usg=%d dat=%p tex=%p\n", 2048u, 1024u, 28, 0, &threadIndex, nullptr);
+			};
+		}));
+		const Logger::Stats statsAfter = Logger::GetStats();
+		results.back().hitsPerOp = static_cast<double>(statsAfter.written - statsBefore.written) / static_cast<double>(results.back().ops);
+
+		Logger::SetLevel(LogLevel::Info);
+		results.push_back(RunBenchmark("Logger::Write(disabled)", params, 0, [&](unsigned int threadIndex) {
+			return [threadIndex] {
+				LOG_DEBUG(L"CreateTexture2D w=%d h=%d fmt=%d usg=%d dat=%p tex=%p\n", 2048u, 1024u, 28, 0, &threadIndex, nullptr);
+			};
+		}));
+		Logger::Stop();
+
+		results.push_back(RunBenchmark("swprintf", params, 0, [&](unsigned int threadIndex) {
+			auto buffer = std::make_shared<std::vector<wchar_t>>(256);
+			return [buffer, threadIndex] {
+				swprintf(buffer->data(), buffer->size(), L"CreateTexture2D w=%d h=%d fmt=%d usg=%d dat=%p tex=%p\n", 2048u, 1024u, 28, 0, &threadIndex, nullptr);
+			};
+		}));
+	}
+}
+
+
+void PrintJson(const Params& params, const std::vector<Result>& results)
+{
+	printf("{\n");
+	printf("  \"config\": {\"signatures\": %u, \"width\": %u, \"height\": %u, \"hit_ratio\": %.4f, \"suspects\": %u, \"threads\": %u, \"iterations\": %u, \"row_padding\": %u},\n",
+		params.signatureCount, params.width, params.height, params.hitRatio, params.suspectCount, params.threadCount, params.iterations, params.rowPadding);
+	printf("  \"results\": [\n");
+	for (size_t i = 0; i < results.size(); ++i) {
+		const auto& result = results[i];
+		printf("    {\"name\": \"%s\", \"threads\": %u, \"ops\": %llu, \"ns_per_op\": %.2f, \"bytes_per_sec\": %.0f, \"allocs_per_op\": %.3f, \"hits_per_op\": %.4f, \"hashed_bytes_per_op\": %.0f, \"compression_ratio\": %.3f}%s\n",
+			result.name, result.threadCount, result.ops, result.nsPerOp, result.bytesPerSec, result.allocsPerOp, result.hitsPerOp, result.hashedBytesPerOp, result.compressionRatio, i + 1 < results.size() ? "," : "");
+	}
+	printf("  ]\n");
+	printf("}\n");
+}
+
+
+// Drives the filter engine the way the hooks do for a texture matched, mapped, unmapped and
+// collected, and fails if anything but the warm-up iterations allocates from inside a hook.
+bool CheckSteadyStateAllocations(const Params& params)
+{
+	static constexpr unsigned int c_warmUpIterations = 16;
+
+	const SyntheticTexture texture(params.width, params.height, 7);
+	const auto factory = MakeFactory(params, texture);
+	ResourceSuspectList list;
+	for (unsigned int i = 0; i < params.suspectCount; ++i)
+		list.Add(FakeResource(i), MakeSuspect(*factory, texture.desc));
+	void* resource = FakeResource(params.suspectCount);
+	SyntheticTexture data(params.width, params.height, 7);  // same content as $texture, so it hits
+	const std::vector<uint8_t> pixels(data.pixels);  // to undo the erasing of each iteration
+
+	uint64_t allocCountBefore = 0;
+	for (unsigned int n = 0; n < c_warmUpIterations + params.iterations; ++n) {
+		if (n == c_warmUpIterations)
+			allocCountBefore = GetHookAllocationCount();
+
+		ScopedHookArena hookArena;
+		SharedDataFilterList filters;
+		if (!factory->Match(texture.desc, filters)) {
+			fprintf(stderr, "steady state: the synthetic texture matches no filter\n");
+			return false;
+		}
+		ResourceSuspect suspect;
+		suspect.filterList = std::move(filters);
+		SetSuspectLayout(suspect, texture.desc);
+		list.Add(resource, std::move(suspect));
+		memcpy(data.pixels.data(), pixels.data(), pixels.size());
+		list.SetMappedData(resource, data.mapped);
+		CopiedActionList copies;
+		list.ActOnUnmap(resource, &copies);
+		list.CollectGarbage();
+	}
+
+	const uint64_t allocCount = GetHookAllocationCount() - allocCountBefore;
+	if (allocCount > 0) {
+		fprintf(stderr, "steady state: the hooks allocated %llu times in %u iterations after warming up\n", static_cast<unsigned long long>(allocCount), params.iterations);
+		return false;
+	}
+	return true;
+}
+
+
+
+}  // unnamed namespace
+
+
+
+int wmain(int argc, wchar_t** argv)
+{
+	Params params;
+	if (!ParseParams(argc, argv, params)) {
+		fwprintf(stderr, L"Usage: %s [--signatures N] [--width W] [--height H] [--hit-ratio R] [--suspects S] [--threads T] [--iterations I] [--row-padding P]\n", argv[0]);
+		return -1;
+	}
+
+	// WIC objects are created here and used on the benchmark threads, which join this MTA
+	const HRESULT hrInit = ::CoInitializeEx(nullptr, COINIT_MULTITHREADED);
+
+	std::vector<Result> results;
+	RunAll(params, results);
+	PrintJson(params, results);
+
+	if (SUCCEEDED(hrInit))
+		::CoUninitialize();
+
+	int exitCode = 0;
+	for (const auto& result : results) {
+		if (result.mustNotAllocate && result.allocsPerOp > 0.0) {
+			fprintf(stderr, "%s allocates %.3f times per op, where the hooks must not allocate\n", result.name, result.allocsPerOp);
+			exitCode = 1;
+		}
+	}
+	if (!CheckSteadyStateAllocations(params))
+		exitCode = 1;
+	return exitCode;
+}
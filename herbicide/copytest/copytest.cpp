@@ -0,0 +1,536 @@
+/*
+ *  herbicide - removing flowers and rabbits in the game Mirror
+ *  Copyright (C) 2018 Mifan Bang <https://debug.tw>.
+ *
+ *  This program is free software: you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation, either version 3 of the License, or
+ *  (at your option) any later version.
+ *
+ *  This program is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+// Tests of CopyPatcher, which takes the types of Direct3D and so builds on Windows only; see
+// unittest for what builds anywhere. Textures are fakes holding their pixels, and the copies
+// are recorded on a context which carries them out in order as the GPU would. The detours of
+// CreateTexture2D(), Unmap() and the copies are replayed around them as payload/detours/d3d11.cpp
+// does them.
+
+#include <stdio.h>
+#include <string.h>
+
+#include <memory>
+#include <vector>
+
+#include "payload/CopyPatcher.h"
+#include "payload/DxgiFormat.h"
+#include "payload/TextureFilter.h"
+#include "shared/patch.h"
+
+
+
+namespace {
+
+
+
+unsigned int s_failureCount = 0;
+
+
+void Check(bool condition, const char* expression, int line)
+{
+	if (!condition) {
+		fprintf(stderr, "copytest.cpp(%d): check failed: %s\n", line, expression);
+		++s_failureCount;
+	}
+}
+
+#define CHECK(expression) Check((expression), #expression, __LINE__)
+
+
+
+// ---------------------------------------------------------------------------
+// fakes
+// ---------------------------------------------------------------------------
+
+constexpr UINT c_width = 64;
+constexpr UINT c_height = 32;
+constexpr UINT c_pixelSize = 4;  // of the formats copied in these tests
+
+unsigned int s_liveTextureCount = 0;
+
+
+// A texture of tightly packed rows. Only what CopyPatcher and the detours replayed call does
+// anything.
+class FakeTexture final : public ID3D11Texture2D
+{
+public:
+	FakeTexture(const D3D11_TEXTURE2D_DESC& desc, const D3D11_SUBRESOURCE_DATA* pData)
+		: pixels(static_cast<size_t>(desc.Width) * c_pixelSize * desc.Height)
+		, desc(desc)
+		, hasDepthPitch(true)
+		, m_refCount(1)
+	{
+		if (pData != nullptr) {
+			for (UINT y = 0; y < desc.Height; ++y)
+				memcpy(&pixels[GetOffset(0, y)], static_cast<const uint8_t*>(pData->pSysMem) + static_cast<size_t>(y) * pData->SysMemPitch, desc.Width * c_pixelSize);
+		}
+		++s_liveTextureCount;
+	}
+
+	size_t GetOffset(UINT x, UINT y) const
+	{
+		return (static_cast<size_t>(y) * desc.Width + x) * c_pixelSize;
+	}
+
+	D3D11_MAPPED_SUBRESOURCE Map()
+	{
+		const UINT rowPitch = desc.Width * c_pixelSize;
+		return D3D11_MAPPED_SUBRESOURCE { pixels.data(), rowPitch, hasDepthPitch ? rowPitch * desc.Height : 0 };
+	}
+
+	HRESULT STDMETHODCALLTYPE QueryInterface(REFIID, void** ppObject) override
+	{
+		*ppObject = nullptr;
+		return E_NOINTERFACE;
+	}
+
+	ULONG STDMETHODCALLTYPE AddRef() override
+	{
+		return ++m_refCount;
+	}
+
+	ULONG STDMETHODCALLTYPE Release() override
+	{
+		const ULONG refCount = --m_refCount;
+		if (refCount == 0) {
+			--s_liveTextureCount;
+			delete this;
+		}
+		return refCount;
+	}
+
+	void STDMETHODCALLTYPE GetDevice(ID3D11Device** ppDevice) override						{ *ppDevice = nullptr; }
+	HRESULT STDMETHODCALLTYPE GetPrivateData(REFGUID, UINT*, void*) override				{ return E_NOTIMPL; }
+	HRESULT STDMETHODCALLTYPE SetPrivateData(REFGUID, UINT, const void*) override			{ return E_NOTIMPL; }
+	HRESULT STDMETHODCALLTYPE SetPrivateDataInterface(REFGUID, const IUnknown*) override	{ return E_NOTIMPL; }
+	void STDMETHODCALLTYPE GetType(D3D11_RESOURCE_DIMENSION* pDimension) override			{ *pDimension = D3D11_RESOURCE_DIMENSION_TEXTURE2D; }
+	void STDMETHODCALLTYPE SetEvictionPriority(UINT) override								{ }
+	UINT STDMETHODCALLTYPE GetEvictionPriority() override									{ return 0; }
+	void STDMETHODCALLTYPE GetDesc(D3D11_TEXTURE2D_DESC* pDesc) override					{ *pDesc = desc; }
+
+	std::vector<uint8_t> pixels;
+	D3D11_TEXTURE2D_DESC desc;
+	bool hasDepthPitch;  // whether Map() gives one, which a driver may not for a 2D texture
+
+
+private:
+	~FakeTexture() = default;
+
+	ULONG m_refCount;
+};
+
+
+// what reached the context, in order
+enum class CallKind
+{
+	Unmap,
+	PatchCopy,  // issued by CopyPatcher
+	AppCopy,  // made by the application
+};
+
+
+struct RecordingContext
+{
+	std::vector<CallKind> calls;
+	std::vector<uint8_t> unmapped;  // the content the CPU left in the last texture unmapped
+
+	RecordingContext();
+	~RecordingContext();
+
+	void Unmap(const FakeTexture& texture)
+	{
+		calls.push_back(CallKind::Unmap);
+		unmapped = texture.pixels;
+	}
+
+	void Copy(CallKind kind, FakeTexture& dst, UINT dstX, UINT dstY, const FakeTexture& src, const D3D11_BOX& box)
+	{
+		calls.push_back(kind);
+		for (UINT y = box.top; y < box.bottom; ++y)
+			memcpy(&dst.pixels[dst.GetOffset(dstX, dstY + y - box.top)], &src.pixels[src.GetOffset(box.left, y)], (box.right - box.left) * c_pixelSize);
+	}
+};
+
+RecordingContext* s_recording = nullptr;  // as CopyPatcher::CopyFunc takes no state
+
+
+RecordingContext::RecordingContext()
+	: calls()
+	, unmapped()
+{
+	s_recording = this;
+}
+
+
+RecordingContext::~RecordingContext()
+{
+	s_recording = nullptr;
+}
+
+
+void WINAPI RecordCopy(ID3D11DeviceContext*, ID3D11Resource* pDst, UINT dstSubresource, UINT dstX, UINT dstY, UINT dstZ, ID3D11Resource* pSrc, UINT srcSubresource, const D3D11_BOX* pSrcBox)
+{
+	CHECK(dstSubresource == 0 && dstZ == 0 && srcSubresource == 0 && pSrcBox != nullptr);
+	auto& dst = *static_cast<FakeTexture*>(pDst);
+	const auto& src = *static_cast<FakeTexture*>(pSrc);
+	CHECK(dst.desc.Usage != D3D11_USAGE_DYNAMIC && dst.desc.Format == src.desc.Format);
+	CHECK(pSrcBox->right <= src.desc.Width && pSrcBox->bottom <= src.desc.Height);
+	CHECK(dstX + pSrcBox->right - pSrcBox->left <= dst.desc.Width && dstY + pSrcBox->bottom - pSrcBox->top <= dst.desc.Height);
+	s_recording->Copy(CallKind::PatchCopy, dst, dstX, dstY, src, *pSrcBox);
+}
+
+
+unsigned int s_createdCount = 0;
+D3D11_TEXTURE2D_DESC s_lastCreatedDesc;
+
+
+bool CreateSource(const D3D11_TEXTURE2D_DESC& desc, const D3D11_SUBRESOURCE_DATA& data, ID3D11Texture2D** ppTexture)
+{
+	++s_createdCount;
+	s_lastCreatedDesc = desc;
+	*ppTexture = new FakeTexture(desc, &data);
+	return true;
+}
+
+
+
+// ---------------------------------------------------------------------------
+// filters and detours
+// ---------------------------------------------------------------------------
+
+D3D11_TEXTURE2D_DESC MakeDesc(D3D11_USAGE usage, DXGI_FORMAT format = DXGI_FORMAT_R8G8B8A8_UNORM)
+{
+	D3D11_TEXTURE2D_DESC desc { };
+	desc.Width = c_width;
+	desc.Height = c_height;
+	desc.MipLevels = 1;
+	desc.ArraySize = 1;
+	desc.Format = format;
+	desc.SampleDesc.Count = 1;
+	desc.Usage = usage;
+	desc.CPUAccessFlags = usage == D3D11_USAGE_DEFAULT ? 0 : D3D11_CPU_ACCESS_WRITE;
+	return desc;
+}
+
+
+bool MatchAlways(const D3D11_MAPPED_SUBRESOURCE&)
+{
+	return true;
+}
+
+
+std::shared_ptr<DataFilter> MakeErase(const D3D11_RECT& rect, uint8_t stride, bool isCopied)
+{
+	FilterDataAction action(rect, stride);
+	CHECK(action.SetCopied(isCopied));
+	return std::make_shared<DataFilter>(FilterDataCondition(MatchAlways), action);
+}
+
+
+// a patch of $rect, inclusive, which replaces every pixel of $content
+std::shared_ptr<DataFilter> MakePatch(const D3D11_RECT& rect, const std::vector<uint8_t>& content, bool isCopied)
+{
+	const UINT width = rect.right - rect.left + 1;
+	const UINT height = rect.bottom - rect.top + 1;
+	const size_t pitch = static_cast<size_t>(c_width) * c_pixelSize;
+	std::vector<uint8_t> patched(content);
+	for (UINT y = 0; y < height; ++y) {
+		for (UINT x = 0; x < width * c_pixelSize; ++x)
+			patched[(rect.top + y) * pitch + rect.left * c_pixelSize + x] ^= 0x5A;
+	}
+	const size_t offset = rect.top * pitch + rect.left * c_pixelSize;
+	std::vector<uint8_t> data;
+	CHECK(BuildPatch(content.data() + offset, pitch, patched.data() + offset, pitch, width, height, c_pixelSize, data));
+	auto patch = std::make_shared<PixelPatch>();
+	CHECK(patch->Load(data.data(), data.size()));
+
+	FilterDataAction action(rect, std::shared_ptr<const PixelPatch>(std::move(patch)));
+	CHECK(action.SetCopied(isCopied));
+	return std::make_shared<DataFilter>(FilterDataCondition(MatchAlways), action);
+}
+
+
+// what the application writes, and what the filters leave of it
+struct Scene
+{
+	static constexpr D3D11_RECT c_eraseRect { 4, 6, 13, 10 };
+	static constexpr D3D11_RECT c_patchRect { 20, 2, 27, 5 };
+
+	std::vector<uint8_t> content;
+	std::vector<uint8_t> expected;
+	DataFilterList filters;
+
+	Scene()
+		: content(static_cast<size_t>(c_width) * c_pixelSize * c_height)
+		, expected()
+		, filters()
+	{
+		for (size_t i = 0; i < content.size(); ++i)
+			content[i] = static_cast<uint8_t>(i * 7 + 1);  // no zero, so that erased pixels show
+		filters.push_back(MakeErase(c_eraseRect, c_pixelSize, true));
+		filters.push_back(MakePatch(c_patchRect, content, true));
+
+		expected = content;
+		const size_t pitch = static_cast<size_t>(c_width) * c_pixelSize;
+		for (LONG y = c_eraseRect.top; y <= c_eraseRect.bottom; ++y)
+			memset(&expected[y * pitch + c_eraseRect.left * c_pixelSize], 0, (c_eraseRect.right - c_eraseRect.left + 1) * c_pixelSize);
+		for (LONG y = c_patchRect.top; y <= c_patchRect.bottom; ++y) {
+			for (LONG x = c_patchRect.left * c_pixelSize; x < (c_patchRect.right + 1) * static_cast<LONG>(c_pixelSize); ++x)
+				expected[y * pitch + x] ^= 0x5A;
+		}
+	}
+};
+
+
+// as CreateTexture2D() does
+FakeTexture* CreateSuspect(ResourceSuspectList& list, CopyPatcher& patcher, const D3D11_TEXTURE2D_DESC& desc, const DataFilterList& filters)
+{
+	auto texture = new FakeTexture(desc, nullptr);
+	ResourceSuspect suspect;
+	suspect.filterList = std::make_shared<const DataFilterList>(filters);
+	if (!GetFormatLayout(desc.Format, desc.Width, desc.Height, suspect.rowSize, suspect.rowCount)) {
+		suspect.rowSize = 0;
+		suspect.rowCount = desc.Height;
+	}
+	if (patcher.Prepare(desc, filters, CreateSource))
+		suspect.copyFormat = desc.Format;
+	list.Add(texture, std::move(suspect));
+	return texture;
+}
+
+
+// the application maps $texture, writes $content and unmaps it, as Map() and Unmap() see it
+bool ReplayWrite(ResourceSuspectList& list, CopyPatcher& patcher, RecordingContext& context, FakeTexture& texture, const std::vector<uint8_t>& content)
+{
+	list.SetMappedData(&texture, texture.Map());
+	texture.pixels = content;
+
+	ScopedHookArena hookArena;
+	CopiedActionList copies;
+	const bool hasActionTaken = list.ActOnUnmap(&texture, &copies);
+	context.Unmap(texture);
+	if (!copies.empty())
+		patcher.Issue(nullptr, RecordCopy, &texture, copies);
+	return hasActionTaken;
+}
+
+
+// the application copies $src as a whole, which lazy mode checks first, as OnCopy() does
+void ReplayCopy(ResourceSuspectList& list, CopyPatcher& patcher, RecordingContext& context, FakeTexture& dst, FakeTexture& src)
+{
+	if (list.IsPending(&src)) {
+		ScopedHookArena hookArena;
+		CopiedActionList copies;
+		list.ActOnRemapped(&src, src.Map(), &copies);
+		context.Unmap(src);
+		if (!copies.empty())
+			patcher.Issue(nullptr, RecordCopy, &src, copies);
+	}
+	context.Copy(CallKind::AppCopy, dst, 0, 0, src, D3D11_BOX { 0, 0, 0, src.desc.Width, src.desc.Height, 1 });
+}
+
+
+
+// ---------------------------------------------------------------------------
+// CopyPatcher
+// ---------------------------------------------------------------------------
+
+void TestCopiesFollowUnmap()
+{
+	const Scene scene;
+	{
+		CopyPatcher patcher;
+		ResourceSuspectList list;
+		RecordingContext context;
+		auto target = CreateSuspect(list, patcher, MakeDesc(D3D11_USAGE_STAGING), scene.filters);
+		auto sampled = new FakeTexture(MakeDesc(D3D11_USAGE_DEFAULT), nullptr);
+
+		CHECK(ReplayWrite(list, patcher, context, *target, scene.content));
+		ReplayCopy(list, patcher, context, *sampled, *target);
+
+		// the CPU wrote nothing, and both copies landed between the unmap and the application's copy
+		CHECK(context.unmapped == scene.content);
+		CHECK((context.calls == std::vector<CallKind> { CallKind::Unmap, CallKind::PatchCopy, CallKind::PatchCopy, CallKind::AppCopy }));
+		CHECK(sampled->pixels == scene.expected);
+		sampled->Release();
+		target->Release();
+	}
+	CHECK(s_liveTextureCount == 0);
+}
+
+
+void TestCopiesFollowLazyCheck()
+{
+	const Scene scene;
+	{
+		CopyPatcher patcher;
+		ResourceSuspectList list;
+		list.SetLazyMode(true);
+		RecordingContext context;
+		auto target = CreateSuspect(list, patcher, MakeDesc(D3D11_USAGE_STAGING), scene.filters);
+		auto sampled = new FakeTexture(MakeDesc(D3D11_USAGE_DEFAULT), nullptr);
+
+		// nothing is checked until the content is copied
+		CHECK(!ReplayWrite(list, patcher, context, *target, scene.content));
+		CHECK(list.IsPending(target));
+		CHECK((context.calls == std::vector<CallKind> { CallKind::Unmap }));
+
+		ReplayCopy(list, patcher, context, *sampled, *target);
+		CHECK(context.unmapped == scene.content);
+		CHECK((context.calls == std::vector<CallKind> { CallKind::Unmap, CallKind::Unmap, CallKind::PatchCopy, CallKind::PatchCopy, CallKind::AppCopy }));
+		CHECK(sampled->pixels == scene.expected);
+		sampled->Release();
+		target->Release();
+	}
+	CHECK(s_liveTextureCount == 0);
+}
+
+
+void TestCpuFallback()
+{
+	const Scene scene;
+	CopyPatcher patcher;
+	const unsigned int createdCount = s_createdCount;
+
+	// the GPU can't copy to a dynamic texture: the CPU writes the actions into the mapping
+	{
+		ResourceSuspectList list;
+		RecordingContext context;
+		auto target = CreateSuspect(list, patcher, MakeDesc(D3D11_USAGE_DYNAMIC), scene.filters);
+		CHECK(ReplayWrite(list, patcher, context, *target, scene.content));
+		CHECK(context.unmapped == scene.expected);
+		CHECK((context.calls == std::vector<CallKind> { CallKind::Unmap }));
+		target->Release();
+	}
+
+	// ... as far as the rows of the texture, when the mapping doesn't tell its size
+	{
+		ResourceSuspectList list;
+		RecordingContext context;
+		auto target = CreateSuspect(list, patcher, MakeDesc(D3D11_USAGE_DYNAMIC), scene.filters);
+		target->hasDepthPitch = false;
+		CHECK(ReplayWrite(list, patcher, context, *target, scene.content));
+		CHECK(context.unmapped == scene.expected);
+		target->Release();
+	}
+
+	// boxes of block formats are in blocks
+	CHECK(!patcher.Prepare(MakeDesc(D3D11_USAGE_STAGING, DXGI_FORMAT_BC1_UNORM), scene.filters, CreateSource));
+
+	// pixels of 2 bytes, where the actions are of 4
+	CHECK(!patcher.Prepare(MakeDesc(D3D11_USAGE_STAGING, DXGI_FORMAT_B5G6R5_UNORM), scene.filters, CreateSource));
+
+	// a rectangle out of the texture
+	D3D11_TEXTURE2D_DESC narrow = MakeDesc(D3D11_USAGE_STAGING);
+	narrow.Width = 8;
+	CHECK(!patcher.Prepare(narrow, scene.filters, CreateSource));
+
+	CHECK(s_createdCount == createdCount);
+}
+
+
+void TestBlankGrowth()
+{
+	{
+		CopyPatcher patcher;
+		const D3D11_TEXTURE2D_DESC desc = MakeDesc(D3D11_USAGE_STAGING);
+		const unsigned int createdCount = s_createdCount;
+
+		CHECK(patcher.Prepare(desc, DataFilterList { MakeErase(D3D11_RECT { 0, 0, 9, 4 }, c_pixelSize, true) }, CreateSource));
+		CHECK(s_createdCount == createdCount + 1 && s_lastCreatedDesc.Width == 10 && s_lastCreatedDesc.Height == 5);
+
+		// a taller rectangle grows the blank to cover both, replacing the smaller one
+		CHECK(patcher.Prepare(desc, DataFilterList { MakeErase(D3D11_RECT { 30, 10, 33, 29 }, c_pixelSize, true) }, CreateSource));
+		CHECK(s_createdCount == createdCount + 2 && s_lastCreatedDesc.Width == 10 && s_lastCreatedDesc.Height == 20);
+		CHECK(s_liveTextureCount == 1);
+
+		// one within it creates nothing; another format has a blank of its own
+		CHECK(patcher.Prepare(desc, DataFilterList { MakeErase(D3D11_RECT { 0, 0, 7, 7 }, c_pixelSize, true) }, CreateSource));
+		CHECK(s_createdCount == createdCount + 2);
+		CHECK(patcher.Prepare(MakeDesc(D3D11_USAGE_STAGING, DXGI_FORMAT_B8G8R8A8_UNORM), DataFilterList { MakeErase(D3D11_RECT { 0, 0, 1, 1 }, c_pixelSize, true) }, CreateSource));
+		CHECK(s_createdCount == createdCount + 3 && s_lastCreatedDesc.Width == 2 && s_lastCreatedDesc.Height == 2);
+		CHECK(s_liveTextureCount == 2);
+
+		// copies of the first size take the top-left corner of the grown blank, which is all zeros
+		RecordingContext context;
+		auto target = new FakeTexture(desc, nullptr);
+		target->pixels.assign(target->pixels.size(), 0xEE);
+		CopiedActionList copies;
+		copies.push_back(CopiedAction { MakeErase(D3D11_RECT { 2, 3, 11, 7 }, c_pixelSize, true), desc.Format });
+		CHECK(patcher.Issue(nullptr, RecordCopy, target, copies) == 1);
+		for (UINT y = 0; y < c_height; ++y) {
+			for (UINT x = 0; x < c_width; ++x) {
+				const bool isErased = x >= 2 && x <= 11 && y >= 3 && y <= 7;
+				CHECK(target->pixels[target->GetOffset(x, y)] == (isErased ? 0 : 0xEE));
+			}
+		}
+		target->Release();
+	}
+	CHECK(s_liveTextureCount == 0);
+}
+
+
+void TestOrphansDropped()
+{
+	const Scene scene;
+	{
+		CopyPatcher patcher;
+		const D3D11_TEXTURE2D_DESC desc = MakeDesc(D3D11_USAGE_STAGING);
+		DataFilterList filters { MakePatch(Scene::c_patchRect, scene.content, true) };
+		CHECK(patcher.Prepare(desc, filters, CreateSource));
+		CHECK(s_liveTextureCount == 1);
+
+		// prepared again, the patch is found in the cache
+		const unsigned int createdCount = s_createdCount;
+		CHECK(patcher.Prepare(desc, filters, CreateSource));
+		CHECK(s_createdCount == createdCount && s_liveTextureCount == 1);
+
+		// a reload drops the filter; the next patch prepared drops its texture, but not the blanks
+		CHECK(patcher.Prepare(desc, DataFilterList { MakeErase(Scene::c_eraseRect, c_pixelSize, true) }, CreateSource));
+		CHECK(s_liveTextureCount == 2);
+		filters.clear();
+		CHECK(s_liveTextureCount == 2);
+		DataFilterList reloaded { MakePatch(D3D11_RECT { 0, 20, 3, 23 }, scene.content, true) };
+		CHECK(patcher.Prepare(desc, reloaded, CreateSource));
+		CHECK(s_createdCount == createdCount + 2 && s_liveTextureCount == 2);
+	}
+	CHECK(s_liveTextureCount == 0);
+}
+
+
+
+}  // unnamed namespace
+
+
+
+int main()
+{
+	TestCopiesFollowUnmap();
+	TestCopiesFollowLazyCheck();
+	TestCpuFallback();
+	TestBlankGrowth();
+	TestOrphansDropped();
+
+	if (s_failureCount != 0) {
+		fprintf(stderr, "%u check(s) failed\n", s_failureCount);
+		return 1;
+	}
+	printf("all tests passed\n");
+	return 0;
+}
@@ -0,0 +1,718 @@
+/*
+ *  herbicide - removing flowers and rabbits in the game Mirror
+ *  Copyright (C) 2018 Mifan Bang <https://debug.tw>.
+ *
+ *  This program is free software: you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation, either version 3 of the License, or
+ *  (at your option) any later version.
+ *
+ *  This program is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+// Finds the rectangles to erase from a texture by comparing dumps of it with and without the
+// overlay, and prints them as signatures with packed fingerprints of the overlay dump: lines of
+// a signature file, or with --code as entries for a scenario. With --patch, the lines carry
+// patches which put the pixels of the base back instead of erasing the rectangles, and with
+// --copy, those which the payload may carry out by copies are marked so. Dumps are the
+// .hbi files written by the payload with HERBICIDE_DUMP_PNG unset and no dump store. Given two
+// directories, every overlay dump is compared with the base dumps of the same descriptor and
+// paired with the closest one. Only standard C++ and shared/ are used, so that it also builds
+// on POSIX:
+//   c++ -std=c++17 -O2 -I. erasefind/erasefind.cpp shared/imagecodec.cpp shared/jobs.cpp shared/signature.cpp shared/patch.cpp shared/lz.cpp shared/file.cpp -pthread
+
+#include <stdio.h>
+#include <string.h>
+
+#include <algorithm>
+#include <bitset>
+#include <chrono>
+#include <memory>
+#include <string>
+#include <thread>
+#include <vector>
+
+#if defined(_M_X64) || (defined(_M_IX86_FP) && _M_IX86_FP >= 2) || defined(__SSE2__)
+	#define ERASEFIND_SSE2 1
+	#include <emmintrin.h>
+#else
+	#define ERASEFIND_SSE2 0
+#endif
+
+#ifdef _WIN32
+	#include <windows.h>
+#else
+	#include <dirent.h>
+	#include <sys/stat.h>
+#endif  // _WIN32
+
+#ifdef _MSC_VER
+	#include <intrin.h>
+#endif  // _MSC_VER
+
+#include "shared/file.h"
+#include "shared/imagecodec.h"
+#include "shared/jobs.h"
+#include "shared/patch.h"
+#include "shared/signature.h"
+
+
+
+namespace {
+
+
+
+#ifdef _WIN32
+	#define PATH_TEXT(text)	L##text
+#else
+	#define PATH_TEXT(text)	text
+#endif  // _WIN32
+
+using PathString = std::basic_string<PathChar>;
+
+constexpr uint32_t c_bytesPerPixel = 4;  // only Rgba8 and Bgra8 dumps are compared
+
+
+struct Options
+{
+	const PathChar* basePath = nullptr;
+	const PathChar* overlayPath = nullptr;
+	unsigned int threadCount = 0;
+	unsigned int threshold = 0;  // largest difference of a channel which is ignored
+	unsigned int gap = 0;  // pixels between differences which still join them into one rectangle
+	unsigned int minPixels = 1;  // smaller groups of differences are taken as noise
+	bool isCode = false;
+	bool isPatch = false;
+	bool isCopy = false;
+};
+
+
+struct Dump
+{
+	PathString path;
+	ImageInfo info;
+	std::vector<uint8_t> pixels;  // rows of info.rowSize bytes
+};
+
+
+struct Rect
+{
+	uint32_t x;
+	uint32_t y;
+	uint32_t width;
+	uint32_t height;
+};
+
+
+// the rectangles of one overlay, against the base it is paired with
+struct Finding
+{
+	const Dump* base;
+	uint64_t pixelCount;  // pixels which differ
+	uint8_t digest[StreamHasher::c_digestSize];  // packed fingerprint of the overlay
+	std::vector<Rect> rects;
+	std::vector<std::vector<uint8_t>> patches;  // of the rectangles, with --patch
+	double diffMs;
+	bool isFailed;
+};
+
+
+// horizontal run of differing pixels, or of several joined across a gap
+struct Run
+{
+	uint32_t begin;
+	uint32_t end;
+	uint32_t pixelCount;
+};
+
+
+void PrintError(const char* message, const PathChar* path)
+{
+#ifdef _WIN32
+	fwprintf(stderr, L"%hs: %s\n", message, path);
+#else
+	fprintf(stderr, "%s: %s\n", message, path);
+#endif  // _WIN32
+}
+
+
+void PrintUsage()
+{
+	fprintf(stderr,
+		"Usage: erasefind [--threads N] [--threshold N] [--gap N] [--min-pixels N] [--code | [--patch] [--copy]] <base> <overlay>\n"
+		"  where <base> and <overlay> are both .hbi dumps, or both directories of them\n");
+}
+
+
+bool ParseUInt(const PathChar* text, unsigned int& value)
+{
+	value = 0;
+	for (const PathChar* p = text; *p != '\0'; ++p) {
+		if (*p < '0' || *p > '9' || value > 9999)
+			return false;
+		value = value * 10 + static_cast<unsigned int>(*p - '0');
+	}
+	return *text != '\0';
+}
+
+
+bool ParseOptions(int argc, PathChar** argv, Options& options)
+{
+	std::vector<const PathChar*> paths;
+	for (int i = 1; i < argc; ++i) {
+		const PathString arg = argv[i];
+		const bool hasValue = i + 1 < argc;
+		if (arg == PATH_TEXT("--threads") && hasValue && ParseUInt(argv[++i], options.threadCount))
+			continue;
+		else if (arg == PATH_TEXT("--threshold") && hasValue && ParseUInt(argv[++i], options.threshold) && options.threshold <= 255)
+			continue;
+		else if (arg == PATH_TEXT("--gap") && hasValue && ParseUInt(argv[++i], options.gap))
+			continue;
+		else if (arg == PATH_TEXT("--min-pixels") && hasValue && ParseUInt(argv[++i], options.minPixels))
+			continue;
+		else if (arg == PATH_TEXT("--code"))
+			options.isCode = true;
+		else if (arg == PATH_TEXT("--patch"))
+			options.isPatch = true;
+		else if (arg == PATH_TEXT("--copy"))
+			options.isCopy = true;
+		else if (arg.size() > 2 && arg[0] == '-' && arg[1] == '-')
+			return false;
+		else
+			paths.push_back(argv[i]);
+	}
+	if (paths.size() != 2 || (options.isCode && (options.isPatch || options.isCopy)))
+		return false;
+	options.basePath = paths[0];
+	options.overlayPath = paths[1];
+	return true;
+}
+
+
+PathString GetFileName(const PathString& path)
+{
+	const size_t slash = path.find_last_of(PATH_TEXT("/\\"));
+	return slash == PathString::npos ? path : path.substr(slash + 1);
+}
+
+
+bool HasDumpExtension(const PathString& name)
+{
+	const PathString extension = PATH_TEXT(".hbi");
+	return name.size() > extension.size() && name.compare(name.size() - extension.size(), extension.size(), extension) == 0;
+}
+
+
+// $path itself if it is a file, or the dumps in it if it is a directory, sorted by name
+bool ListDumps(const PathChar* path, std::vector<PathString>& out, bool& isDirectory)
+{
+	out.clear();
+#ifdef _WIN32
+	const DWORD attributes = ::GetFileAttributesW(path);
+	if (attributes == INVALID_FILE_ATTRIBUTES)
+		return false;
+	isDirectory = (attributes & FILE_ATTRIBUTE_DIRECTORY) != 0;
+	if (isDirectory) {
+		const PathString directory = path;
+		WIN32_FIND_DATAW data;
+		const HANDLE hFind = ::FindFirstFileW((directory + L"\\*.hbi").c_str(), &data);
+		if (hFind == INVALID_HANDLE_VALUE)
+			return ::GetLastError() == ERROR_FILE_NOT_FOUND;
+		do {
+			if ((data.dwFileAttributes & FILE_ATTRIBUTE_DIRECTORY) == 0 && HasDumpExtension(data.cFileName))
+				out.push_back(directory + L"\\" + data.cFileName);
+		} while (::FindNextFileW(hFind, &data));
+		::FindClose(hFind);
+	}
+#else
+	struct stat status;
+	if (stat(path, &status) != 0)
+		return false;
+	isDirectory = S_ISDIR(status.st_mode);
+	if (isDirectory) {
+		const PathString directory = path;
+		DIR* dir = opendir(path);
+		if (dir == nullptr)
+			return false;
+		for (const dirent* entry = readdir(dir); entry != nullptr; entry = readdir(dir)) {
+			const PathString file = directory + "/" + entry->d_name;
+			struct stat fileStatus;
+			if (HasDumpExtension(entry->d_name) && stat(file.c_str(), &fileStatus) == 0 && S_ISREG(fileStatus.st_mode))
+				out.push_back(file);
+		}
+		closedir(dir);
+	}
+#endif  // _WIN32
+	if (!isDirectory)
+		out.push_back(path);
+	std::sort(out.begin(), out.end());
+	return true;
+}
+
+
+bool LoadDump(const PathString& path, unsigned int threadCount, Dump& dump)
+{
+	dump.path = path;
+
+	MappedFile file;
+	if (!file.Open(path.c_str()) || file.GetSize() > SIZE_MAX)
+		return false;
+	const size_t size = static_cast<size_t>(file.GetSize());
+	if (!ReadImageInfo(file.GetData(), size, dump.info) || (dump.info.format != ImageFormat::Rgba8 && dump.info.format != ImageFormat::Bgra8))
+		return false;
+	dump.pixels.resize(static_cast<size_t>(dump.info.rowSize) * dump.info.rowCount);
+	return DecodeImage(file.GetData(), size, dump.pixels.data(), dump.info.rowSize, threadCount);
+}
+
+
+bool IsSameDescriptor(const ImageInfo& lhs, const ImageInfo& rhs)
+{
+	return lhs.width == rhs.width && lhs.height == rhs.height && lhs.sourceFormat == rhs.sourceFormat;
+}
+
+
+// @param mask not zero
+inline uint32_t CountTrailingZeros(uint32_t mask)
+{
+#ifdef _MSC_VER
+	unsigned long index;
+	_BitScanForward(&index, mask);
+	return index;
+#else
+	return static_cast<uint32_t>(__builtin_ctz(mask));
+#endif  // _MSC_VER
+}
+
+
+// Set a bit in $bits for every pixel of a row which differs by more than $threshold in any
+// channel, and return how many do. With SSE2 the difference of 16 pixels is taken at a time
+// from saturated subtractions, which leave zero in every byte within the threshold.
+uint32_t DiffRow(const uint8_t* base, const uint8_t* overlay, uint32_t width, uint8_t threshold, uint32_t* bits)
+{
+	std::fill(bits, bits + (width + 31) / 32, 0);
+	uint32_t count = 0;
+	uint32_t x = 0;
+#if ERASEFIND_SSE2
+	const __m128i limit = _mm_set1_epi8(static_cast<char>(threshold));
+	const __m128i zero = _mm_setzero_si128();
+	for (; x + 16 <= width; x += 16) {
+		uint32_t mask = 0;
+		for (uint32_t i = 0; i < 4; ++i) {
+			const size_t offset = static_cast<size_t>(x + i * 4) * c_bytesPerPixel;
+			const __m128i lhs = _mm_loadu_si128(reinterpret_cast<const __m128i*>(base + offset));
+			const __m128i rhs = _mm_loadu_si128(reinterpret_cast<const __m128i*>(overlay + offset));
+			const __m128i diff = _mm_or_si128(_mm_subs_epu8(lhs, rhs), _mm_subs_epu8(rhs, lhs));
+			const __m128i isWithin = _mm_cmpeq_epi32(_mm_subs_epu8(diff, limit), zero);
+			mask |= static_cast<uint32_t>(~_mm_movemask_ps(_mm_castsi128_ps(isWithin)) & 0xF) << (i * 4);
+		}
+		if (mask != 0) {
+			// $x is a multiple of 16, so the mask never straddles two words
+			bits[x / 32] |= mask << (x % 32);
+			count += static_cast<uint32_t>(std::bitset<16>(mask).count());
+		}
+	}
+#endif  // ERASEFIND_SSE2
+	for (; x < width; ++x) {
+		const uint8_t* lhs = base + static_cast<size_t>(x) * c_bytesPerPixel;
+		const uint8_t* rhs = overlay + static_cast<size_t>(x) * c_bytesPerPixel;
+		for (uint32_t channel = 0; channel < c_bytesPerPixel; ++channel) {
+			const int diff = lhs[channel] > rhs[channel] ? lhs[channel] - rhs[channel] : rhs[channel] - lhs[channel];
+			if (diff > threshold) {
+				bits[x / 32] |= 1u << (x % 32);
+				++count;
+				break;
+			}
+		}
+	}
+	return count;
+}
+
+
+// number of differing pixels, counted no further than past $limit
+uint64_t CountDifferences(const Dump& base, const Dump& overlay, uint8_t threshold, uint64_t limit)
+{
+	const ImageInfo& info = overlay.info;
+	std::vector<uint32_t> bits((info.width + 31) / 32);
+	uint64_t count = 0;
+	for (uint32_t y = 0; y < info.rowCount && count <= limit; ++y) {
+		const size_t offset = static_cast<size_t>(info.rowSize) * y;
+		count += DiffRow(base.pixels.data() + offset, overlay.pixels.data() + offset, info.width, threshold, bits.data());
+	}
+	return count;
+}
+
+
+// first pixel from $from on whose bit is $value, or past the end of the row if none
+uint32_t FindBit(const uint32_t* bits, uint32_t wordCount, uint32_t from, bool value)
+{
+	const uint32_t flip = value ? 0 : ~0u;
+	uint32_t index = from / 32;
+	if (index >= wordCount)
+		return wordCount * 32;
+	uint32_t word = (bits[index] ^ flip) & (~0u << (from % 32));
+	while (word == 0) {
+		if (++index == wordCount)
+			return wordCount * 32;
+		word = bits[index] ^ flip;
+	}
+	return index * 32 + CountTrailingZeros(word);
+}
+
+
+// append the runs of set bits of a row, joining those no more than $gap pixels apart
+void AppendRuns(const uint32_t* bits, uint32_t width, uint32_t gap, std::vector<Run>& runs, size_t rowBegin)
+{
+	const uint32_t wordCount = (width + 31) / 32;
+	for (uint32_t x = FindBit(bits, wordCount, 0, true); x < width; ) {
+		const uint32_t end = std::min<uint32_t>(FindBit(bits, wordCount, x, false), width);
+		if (runs.size() > rowBegin && x - runs.back().end <= gap) {
+			runs.back().end = end;
+			runs.back().pixelCount += end - x;
+		}
+		else {
+			runs.push_back(Run { x, end, end - x });
+		}
+		x = FindBit(bits, wordCount, end, true);
+	}
+}
+
+
+uint32_t FindRoot(std::vector<uint32_t>& parents, uint32_t index)
+{
+	while (parents[index] != index) {
+		parents[index] = parents[parents[index]];  // path halving
+		index = parents[index];
+	}
+	return index;
+}
+
+
+bool IsNear(const Rect& lhs, const Rect& rhs, uint32_t gap)
+{
+	const uint64_t g = gap;
+	return lhs.x <= rhs.x + rhs.width + g && rhs.x <= lhs.x + lhs.width + g
+		&& lhs.y <= rhs.y + rhs.height + g && rhs.y <= lhs.y + lhs.height + g;
+}
+
+
+Rect Unite(const Rect& lhs, const Rect& rhs)
+{
+	const uint32_t x = std::min<uint32_t>(lhs.x, rhs.x);
+	const uint32_t y = std::min<uint32_t>(lhs.y, rhs.y);
+	const uint32_t right = std::max<uint32_t>(lhs.x + lhs.width, rhs.x + rhs.width);
+	const uint32_t bottom = std::max<uint32_t>(lhs.y + lhs.height, rhs.y + rhs.height);
+	return Rect { x, y, right - x, bottom - y };
+}
+
+
+// Group the differing pixels into 8-connected components, treating pixels up to $gap apart
+// as connected, and bound each by a rectangle. Components are found on the runs of each row,
+// which are joined with those of the rows above which they touch. Bounding rectangles which
+// still overlap or come within $gap of each other are merged, so that no pixel is erased twice.
+void FindRects(const Dump& base, const Dump& overlay, const Options& options, Finding& finding)
+{
+	const ImageInfo& info = overlay.info;
+	const uint32_t gap = options.gap;
+	std::vector<uint32_t> bits((info.width + 31) / 32);
+	std::vector<Run> runs;
+	std::vector<size_t> rowBegins(static_cast<size_t>(info.rowCount) + 1);
+	std::vector<uint32_t> parents;
+	finding.pixelCount = 0;
+
+	for (uint32_t y = 0; y < info.rowCount; ++y) {
+		const size_t offset = static_cast<size_t>(info.rowSize) * y;
+		rowBegins[y] = runs.size();
+		finding.pixelCount += DiffRow(base.pixels.data() + offset, overlay.pixels.data() + offset, info.width, static_cast<uint8_t>(options.threshold), bits.data());
+		AppendRuns(bits.data(), info.width, gap, runs, rowBegins[y]);
+		rowBegins[y + 1] = runs.size();
+
+		for (size_t i = rowBegins[y]; i < runs.size(); ++i)
+			parents.push_back(static_cast<uint32_t>(i));
+		const uint32_t firstAbove = y > gap ? y - gap - 1 : 0;
+		for (uint32_t above = firstAbove; above < y; ++above) {
+			// both rows are sorted, so the runs above which may touch a run only move right
+			size_t j = rowBegins[above];
+			for (size_t i = rowBegins[y]; i < rowBegins[y + 1]; ++i) {
+				const Run& run = runs[i];
+				while (j < rowBegins[above + 1] && static_cast<uint64_t>(runs[j].end) + gap < run.begin)
+					++j;
+				for (size_t k = j; k < rowBegins[above + 1] && runs[k].begin <= static_cast<uint64_t>(run.end) + gap; ++k) {
+					const uint32_t lhs = FindRoot(parents, static_cast<uint32_t>(i));
+					const uint32_t rhs = FindRoot(parents, static_cast<uint32_t>(k));
+					if (lhs != rhs)
+						parents[std::max<uint32_t>(lhs, rhs)] = std::min<uint32_t>(lhs, rhs);
+				}
+			}
+		}
+	}
+
+	// roots come first in their components, so every component gets its slot before it grows
+	struct Component
+	{
+		Rect rect;
+		uint64_t pixelCount;
+	};
+	std::vector<Component> components;
+	std::vector<uint32_t> slots(runs.size());
+	for (uint32_t y = 0; y < info.rowCount; ++y) {
+		for (size_t i = rowBegins[y]; i < rowBegins[y + 1]; ++i) {
+			const Run& run = runs[i];
+			const Rect rect { run.begin, y, run.end - run.begin, 1 };
+			const uint32_t root = FindRoot(parents, static_cast<uint32_t>(i));
+			if (root == i) {
+				slots[i] = static_cast<uint32_t>(components.size());
+				components.push_back(Component { rect, run.pixelCount });
+			}
+			else {
+				Component& component = components[slots[root]];
+				component.rect = Unite(component.rect, rect);
+				component.pixelCount += run.pixelCount;
+			}
+		}
+	}
+
+	std::vector<Rect>& rects = finding.rects;
+	rects.clear();
+	for (const Component& component : components) {
+		if (component.pixelCount >= options.minPixels)
+			rects.push_back(component.rect);
+	}
+	for (bool isMerged = true; isMerged; ) {
+		isMerged = false;
+		for (size_t i = 0; i < rects.size(); ++i) {
+			for (size_t j = i + 1; j < rects.size(); ) {
+				if (IsNear(rects[i], rects[j], gap)) {
+					rects[i] = Unite(rects[i], rects[j]);
+					rects.erase(rects.begin() + j);
+					isMerged = true;
+				}
+				else {
+					++j;
+				}
+			}
+		}
+	}
+	std::sort(rects.begin(), rects.end(), [](const Rect& lhs, const Rect& rhs) {
+		return lhs.y != rhs.y ? lhs.y < rhs.y : lhs.x < rhs.x;
+	});
+}
+
+
+// pair $overlay with the base of the same descriptor it differs least from, and find the rectangles
+void ProcessOverlay(const std::vector<Dump>& bases, const Dump& overlay, const Options& options, Finding& finding)
+{
+	finding.base = nullptr;
+	uint64_t best = UINT64_MAX;
+	for (const Dump& base : bases) {
+		if (!IsSameDescriptor(base.info, overlay.info))
+			continue;
+		const uint64_t count = CountDifferences(base, overlay, static_cast<uint8_t>(options.threshold), best);
+		if (count < best) {
+			best = count;
+			finding.base = &base;
+		}
+	}
+	if (finding.base == nullptr || best == 0)
+		return;
+
+	const auto start = std::chrono::steady_clock::now();
+	FindRects(*finding.base, overlay, options, finding);
+	finding.diffMs = std::chrono::duration<double, std::milli>(std::chrono::steady_clock::now() - start).count();
+
+	const ImageInfo& info = overlay.info;
+	finding.isFailed = !GetPackedFingerprint(overlay.pixels.data(), info.rowSize, info.rowSize, GetFingerprintRowCount(info.rowCount), finding.digest);
+
+	// exact, so that pixels within the threshold are put back as well
+	if (options.isPatch) {
+		finding.patches.resize(finding.rects.size());
+		for (size_t i = 0; i < finding.rects.size() && !finding.isFailed; ++i) {
+			const Rect& rect = finding.rects[i];
+			const size_t offset = static_cast<size_t>(rect.y) * info.rowSize + static_cast<size_t>(rect.x) * c_bytesPerPixel;
+			finding.isFailed = !BuildPatch(overlay.pixels.data() + offset, info.rowSize, finding.base->pixels.data() + offset, info.rowSize,
+				rect.width, rect.height, c_bytesPerPixel, finding.patches[i]);
+		}
+	}
+}
+
+
+void PrintPath(const char* prefix, const PathString& path)
+{
+#ifdef _WIN32
+	printf("%s%ls", prefix, path.c_str());
+#else
+	printf("%s%s", prefix, path.c_str());
+#endif  // _WIN32
+}
+
+
+const char* GetFormatName(uint32_t format)
+{
+	switch (format) {
+	case 28:	return "DXGI_FORMAT_R8G8B8A8_UNORM";
+	case 29:	return "DXGI_FORMAT_R8G8B8A8_UNORM_SRGB";
+	case 87:	return "DXGI_FORMAT_B8G8R8A8_UNORM";
+	case 91:	return "DXGI_FORMAT_B8G8R8A8_UNORM_SRGB";
+	default:	return nullptr;
+	}
+}
+
+
+// the signatures of one overlay, as lines of a signature file
+void PrintSignatureLines(const Dump& overlay, const Finding& finding, const Options& options)
+{
+	PrintPath("# ", GetFileName(overlay.path));
+	PrintPath(" against ", GetFileName(finding.base->path));
+	printf(": %llu pixels differ\n", static_cast<unsigned long long>(finding.pixelCount));
+
+	const ImageInfo& info = overlay.info;
+	for (size_t i = 0; i < finding.rects.size(); ++i) {
+		const Rect& rect = finding.rects[i];
+		printf("%u %u %u packed:", info.width, info.height, info.sourceFormat);
+		for (unsigned int j = 0; j < StreamHasher::c_digestSize; ++j)
+			printf("%02x", finding.digest[j]);
+		printf(" %u %u %u %u %u", rect.x, rect.y, rect.width, rect.height, c_bytesPerPixel);
+		bool isCopied = options.isCopy;
+		if (i < finding.patches.size()) {
+			printf(" patch:");
+			for (uint8_t byte : finding.patches[i])
+				printf("%02x", byte);
+			// a patch leaving pixels in place needs them, which only the CPU has
+			PixelPatch patch;
+			isCopied = isCopied && patch.Load(finding.patches[i].data(), finding.patches[i].size()) && patch.IsWhole();
+		}
+		printf(isCopied ? " copy\n" : "\n");
+	}
+}
+
+
+// the signatures of one overlay, as entries of a scenario such as payload/scenarios/Mirror.cpp
+void PrintScenarioEntries(const Dump& overlay, const Finding& finding)
+{
+	const ImageInfo& info = overlay.info;
+	const char* formatName = GetFormatName(info.sourceFormat);
+	for (const Rect& rect : finding.rects) {
+		PrintPath("\t// ", GetFileName(overlay.path));
+		printf("\n\tfactory.Register({\n");
+		if (formatName != nullptr)
+			printf("\t\tMAKE_DESC_FILTER(%u, %u, %s),\n", info.width, info.height, formatName);
+		else
+			printf("\t\tMAKE_DESC_FILTER(%u, %u, static_cast<DXGI_FORMAT>(%u)),\n", info.width, info.height, info.sourceFormat);
+		printf("\t\tMAKE_PACKED_FILTER(%u, %u", info.rowSize, GetFingerprintRowCount(info.rowCount));
+		for (unsigned int i = 0; i < StreamHasher::c_digestSize; ++i)
+			printf(i == 0 ? ", 0x%02X" : ",0x%02X", finding.digest[i]);
+		printf("),\n");
+		printf("\t\tMAKE_DATA_ERASER(%u, %u, %u, %u, %u)\n", rect.x, rect.y, rect.width, rect.height, c_bytesPerPixel);
+		printf("\t});\n");
+	}
+}
+
+
+int RunEraseFind(int argc, PathChar** argv)
+{
+	Options options;
+	if (!ParseOptions(argc, argv, options)) {
+		PrintUsage();
+		return -1;
+	}
+
+	std::vector<PathString> basePaths;
+	std::vector<PathString> overlayPaths;
+	bool isBaseDirectory;
+	bool isOverlayDirectory;
+	if (!ListDumps(options.basePath, basePaths, isBaseDirectory)) {
+		PrintError("Failed to list", options.basePath);
+		return -1;
+	}
+	if (!ListDumps(options.overlayPath, overlayPaths, isOverlayDirectory)) {
+		PrintError("Failed to list", options.overlayPath);
+		return -1;
+	}
+	if (isBaseDirectory != isOverlayDirectory) {
+		PrintUsage();
+		return -1;
+	}
+
+	// pairs are spread over the workers, so that each dump is decoded on a single thread
+	const unsigned int threadCount = options.threadCount > 0 ? options.threadCount : std::thread::hardware_concurrency();
+	JobSystem jobs;
+	if (!jobs.Start(std::min<unsigned int>(threadCount > 1 ? threadCount - 1 : 0, JobSystem::c_maxWorkers), false)) {
+		fprintf(stderr, "Failed to start the workers\n");
+		return -1;
+	}
+
+	const auto start = std::chrono::steady_clock::now();
+	std::vector<Dump> bases(basePaths.size());
+	std::unique_ptr<bool[]> isBaseLoaded(new bool[bases.size()]);
+	jobs.ParallelFor(bases.size(), 1, [&](size_t i) {
+		isBaseLoaded[i] = LoadDump(basePaths[i], 1, bases[i]);
+	});
+	for (size_t i = 0; i < bases.size(); ++i) {
+		if (!isBaseLoaded[i])
+			PrintError("Not a 32-bit RGBA or BGRA dump", basePaths[i].c_str());
+	}
+	bases.erase(std::remove_if(bases.begin(), bases.end(), [](const Dump& dump) { return dump.pixels.empty(); }), bases.end());
+
+	// overlays are decoded in their jobs and released once compared
+	std::vector<Dump> overlays(overlayPaths.size());
+	std::vector<Finding> findings(overlayPaths.size());
+	jobs.ParallelFor(overlays.size(), 1, [&](size_t i) {
+		Finding& finding = findings[i];
+		finding.base = nullptr;
+		finding.isFailed = !LoadDump(overlayPaths[i], 1, overlays[i]);
+		if (!finding.isFailed)
+			ProcessOverlay(bases, overlays[i], options, finding);
+		overlays[i].pixels = std::vector<uint8_t>();
+	});
+	const double totalMs = std::chrono::duration<double, std::milli>(std::chrono::steady_clock::now() - start).count();
+
+	unsigned int pairCount = 0;
+	unsigned int rectCount = 0;
+	double diffMs = 0.0;
+	double maxDiffMs = 0.0;
+	for (size_t i = 0; i < overlays.size(); ++i) {
+		const Finding& finding = findings[i];
+		if (finding.isFailed) {
+			PrintError("Failed to read as a 32-bit RGBA or BGRA dump", overlayPaths[i].c_str());
+			continue;
+		}
+		if (finding.base == nullptr || finding.rects.empty())
+			continue;
+
+		++pairCount;
+		rectCount += static_cast<unsigned int>(finding.rects.size());
+		diffMs += finding.diffMs;
+		maxDiffMs = std::max<double>(maxDiffMs, finding.diffMs);
+		if (options.isCode)
+			PrintScenarioEntries(overlays[i], finding);
+		else
+			PrintSignatureLines(overlays[i], finding, options);
+	}
+
+	fprintf(stderr, "%u of %u overlays differ from a base, in %u rectangles; %.1f ms in all",
+		pairCount, static_cast<unsigned int>(overlays.size()), rectCount, totalMs);
+	if (pairCount > 0)
+		fprintf(stderr, ", differencing %.2f ms per pair on average and %.2f ms at most", diffMs / pairCount, maxDiffMs);
+	fprintf(stderr, "\n");
+	return 0;
+}
+
+
+
+}  // unnamed namespace
+
+
+
+#ifdef _WIN32
+int wmain(int argc, wchar_t** argv)
+#else
+int main(int argc, char** argv)
+#endif  // _WIN32
+{
+	return RunEraseFind(argc, argv);
+}
@@ -0,0 +1,254 @@
+/*
+ *  herbicide - removing flowers and rabbits in the game Mirror
+ *  Copyright (C) 2018 Mifan Bang <https://debug.tw>.
+ *
+ *  This program is free software: you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation, either version 3 of the License, or
+ *  (at your option) any later version.
+ *
+ *  This program is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+// Measures the file layer of shared/file against reading a whole file into memory first, the
+// way ReadFileToBuffer() used to feed the hashing, and the check the launcher makes of the
+// unpacked payload with and without a file stamp. Only standard C++ and shared/ are used, so
+// that it also builds on POSIX:
+//   c++ -std=c++17 -O2 -I. filebench/filebench.cpp shared/file.cpp
+
+#include <stdio.h>
+
+#ifndef _WIN32
+	#include <fcntl.h>
+	#include <unistd.h>
+#endif  // _WIN32
+
+#include <chrono>
+#include <cstring>
+#include <random>
+#include <vector>
+
+#include "shared/file.h"
+
+
+
+namespace {
+
+
+
+#ifdef _WIN32
+	#define PATH_TEXT(text)	L##text
+#else
+	#define PATH_TEXT(text)	text
+#endif  // _WIN32
+
+const PathChar* const c_tempPath = PATH_TEXT("filebench.tmp");
+const PathChar* const c_tempStampPath = PATH_TEXT("filebench.tmp.stamp");
+const wchar_t* const c_stampKey = L"filebench";
+constexpr size_t c_fileSize = 64 << 20;  // large enough for the read-ahead and the page cache to matter
+constexpr unsigned int c_repeatCount = 4;
+
+using HashDigest = uint8_t[StreamHasher::c_digestSize];
+
+
+double GetSeconds(std::chrono::steady_clock::time_point start)
+{
+	return std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+}
+
+
+bool WriteTempFile(size_t size)
+{
+	FILE* fp = nullptr;
+#ifdef _WIN32
+	if (_wfopen_s(&fp, c_tempPath, L"wb") != 0)
+		fp = nullptr;
+#else
+	fp = fopen(c_tempPath, "wb");
+#endif  // _WIN32
+	if (fp == nullptr)
+		return false;
+
+	std::vector<uint8_t> chunk(1 << 20);
+	std::mt19937 rng(1);
+	bool isWritten = true;
+	for (size_t sizeLeft = size; isWritten && sizeLeft > 0; sizeLeft -= chunk.size() < sizeLeft ? chunk.size() : sizeLeft) {
+		for (auto& byte : chunk)
+			byte = static_cast<uint8_t>(rng());
+		const size_t sizeThisRound = chunk.size() < sizeLeft ? chunk.size() : sizeLeft;
+		isWritten = fwrite(chunk.data(), 1, sizeThisRound, fp) == sizeThisRound;
+	}
+	return fclose(fp) == 0 && isWritten;
+}
+
+
+void RemoveTempFile(const PathChar* path)
+{
+#ifdef _WIN32
+	_wremove(path);
+#else
+	remove(path);
+#endif  // _WIN32
+}
+
+
+// Drop the file from the page cache, as after a reboot. Win32 offers no such call short of
+// unbuffered handles, so cold runs are only measured on POSIX.
+bool EvictTempFile()
+{
+#ifdef _WIN32
+	return false;
+#else
+	const int fd = ::open(c_tempPath, O_RDONLY | O_CLOEXEC);
+	if (fd < 0)
+		return false;
+	const bool isEvicted = ::fdatasync(fd) == 0 && ::posix_fadvise(fd, 0, 0, POSIX_FADV_DONTNEED) == 0;
+	::close(fd);
+	return isEvicted;
+#endif  // _WIN32
+}
+
+
+// the whole file in memory, then hashed at once
+bool HashReadAll(HashDigest& digest, size_t& peakBuffer)
+{
+	std::vector<uint8_t> content;
+	FileErrorCode errCode;
+	StreamHasher hasher;
+	const bool isHashed = ReadWholeFile(c_tempPath, [&content](uint64_t size) {
+		content.resize(static_cast<size_t>(size));
+		return content.data();
+	}, errCode) && hasher.Update(content.data(), content.size()) && hasher.Finish(digest);
+	peakBuffer = content.size();
+	return isHashed;
+}
+
+
+bool HashMapped(HashDigest& digest, size_t& peakBuffer)
+{
+	MappedFile file;
+	StreamHasher hasher;
+	peakBuffer = 0;
+	return file.Open(c_tempPath) && hasher.Update(file.GetData(), file.GetSize()) && hasher.Finish(digest);
+}
+
+
+bool HashStreamed(HashDigest& digest, size_t& peakBuffer)
+{
+	FileErrorCode errCode;
+	peakBuffer = 2 * FileReader::c_defaultChunkSize;
+	return HashFile(c_tempPath, digest, errCode);
+}
+
+
+struct Method
+{
+	const char* name;
+	bool (*hash)(HashDigest& digest, size_t& peakBuffer);
+};
+
+
+// @return MiB/s, or a negative value if the file couldn't be hashed or evicted
+double MeasureMethod(const Method& method, bool isCold, size_t& peakBuffer)
+{
+	double seconds = 0.0;
+	for (unsigned int n = 0; n < c_repeatCount; ++n) {
+		if (isCold && !EvictTempFile())
+			return -1.0;
+		HashDigest digest;
+		const auto start = std::chrono::steady_clock::now();
+		if (!method.hash(digest, peakBuffer))
+			return -1.0;
+		seconds += GetSeconds(start);
+	}
+	return static_cast<double>(c_fileSize) * c_repeatCount / seconds / (1 << 20);
+}
+
+
+// The check of the unpacked payload at each launch: a full rehash, or a look at the stamp
+// next to the file, after which the launcher would only rehash if the stamp disagreed.
+// @return milliseconds per launch, or a negative value if the check failed
+double MeasureLaunchCheck(const HashDigest& expected, bool isStamped, bool isCold)
+{
+	double seconds = 0.0;
+	for (unsigned int n = 0; n < c_repeatCount; ++n) {
+		if (isCold && !EvictTempFile())
+			return -1.0;
+		const auto start = std::chrono::steady_clock::now();
+		HashDigest digest;
+		FileErrorCode errCode;
+		const bool isValid = isStamped ?
+			CheckFileStamp(c_tempPath, expected, c_stampKey) :
+			HashFile(c_tempPath, digest, errCode) && memcmp(digest, expected, sizeof(digest)) == 0;
+		seconds += GetSeconds(start);
+		if (!isValid)
+			return -1.0;
+	}
+	return seconds * 1e3 / c_repeatCount;
+}
+
+
+int RunFileBench()
+{
+	if (!WriteTempFile(c_fileSize)) {
+		fprintf(stderr, "Failed to write the test file\n");
+		return -1;
+	}
+
+	const Method methods[] = {
+		{ "read-all", HashReadAll },
+		{ "mapped", HashMapped },
+		{ "streamed", HashStreamed },
+	};
+	printf("%zu MiB file, hashed with SHA-256\n", c_fileSize >> 20);
+	printf("method    cache  MiB/s  buffer MiB\n");
+	for (const bool isCold : { false, true }) {
+		for (const auto& method : methods) {
+			size_t peakBuffer = 0;
+			const double rate = MeasureMethod(method, isCold, peakBuffer);
+			if (rate < 0.0)
+				printf("%-8s  %-5s  %5s  %10s\n", method.name, isCold ? "cold" : "warm", "n/a", "n/a");
+			else
+				printf("%-8s  %-5s  %5.0f  %10.1f\n", method.name, isCold ? "cold" : "warm", rate, static_cast<double>(peakBuffer) / (1 << 20));
+		}
+	}
+
+	HashDigest expected;
+	FileErrorCode errCode;
+	if (!HashFile(c_tempPath, expected, errCode) || !WriteFileStamp(c_tempPath, expected, c_stampKey)) {
+		fprintf(stderr, "Failed to stamp the test file\n");
+		RemoveTempFile(c_tempPath);
+		return -1;
+	}
+	printf("\nlaunch check  cache  ms/launch\n");
+	for (const bool isCold : { false, true }) {
+		for (const bool isStamped : { false, true }) {
+			const double ms = MeasureLaunchCheck(expected, isStamped, isCold);
+			if (ms < 0.0)
+				printf("%-12s  %-5s  %9s\n", isStamped ? "stamp" : "rehash", isCold ? "cold" : "warm", "n/a");
+			else
+				printf("%-12s  %-5s  %9.3f\n", isStamped ? "stamp" : "rehash", isCold ? "cold" : "warm", ms);
+		}
+	}
+
+	RemoveTempFile(c_tempStampPath);
+	RemoveTempFile(c_tempPath);
+	return 0;
+}
+
+
+
+}  // unnamed namespace
+
+
+
+int main()
+{
+	return RunFileBench();
+}
@@ -0,0 +1,112 @@
+/*
+ *  herbicide - removing flowers and rabbits in the game Mirror
+ *  Copyright (C) 2018 Mifan Bang <https://debug.tw>.
+ *
+ *  This program is free software: you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation, either version 3 of the License, or
+ *  (at your option) any later version.
+ *
+ *  This program is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+// Reports on frame traces written by the payload with HERBICIDE_FRAME_PROFILE=2, comparing the
+// frames with the detours active against those with the detours bypassed. Only standard C++
+// and shared/ are used, so that it also builds on POSIX:
+//   c++ -std=c++17 -O2 -I. frameprof/frameprof.cpp shared/frameprofile.cpp shared/file.cpp
+
+#include <stdio.h>
+
+#include <vector>
+
+#include "shared/file.h"
+#include "shared/frameprofile.h"
+
+
+
+namespace {
+
+
+
+void PrintError(const char* message, const PathChar* path)
+{
+#ifdef _WIN32
+	fwprintf(stderr, L"%hs: %s\n", message, path);
+#else
+	fprintf(stderr, "%s: %s\n", message, path);
+#endif  // _WIN32
+}
+
+
+void PrintDistribution(const char* name, const FrameDistribution& distribution)
+{
+	printf("  %-10s mean %10.1f  p50 %10.1f  p90 %10.1f  p99 %10.1f  max %10.1f\n",
+		name, distribution.mean, distribution.p50, distribution.p90, distribution.p99, distribution.max);
+}
+
+
+void PrintReport(const char* label, const FrameReport& report)
+{
+	printf("%s: %llu frames, detours take %.3f%% of frame time in %.1f calls per frame\n",
+		label, static_cast<unsigned long long>(report.frameCount), report.detourShare * 100.0, report.callsPerFrame);
+	PrintDistribution("frame us", report.frameUs);
+	PrintDistribution("detour us", report.detourUs);
+}
+
+
+int RunFrameProf(int argc, PathChar** argv)
+{
+	if (argc < 2) {
+		fprintf(stderr, "Usage: frameprof <trace>...\n");
+		return -1;
+	}
+
+	// several traces of the same scene are reported as one
+	std::vector<FrameRecord> records;
+	for (int i = 1; i < argc; ++i) {
+		MappedFile file;
+		std::vector<FrameRecord> trace;
+		if (!file.Open(argv[i]) || file.GetSize() > SIZE_MAX || !ReadFrameTrace(file.GetData(), static_cast<size_t>(file.GetSize()), trace)) {
+			PrintError("Not a frame trace", argv[i]);
+			return -1;
+		}
+		records.insert(records.end(), trace.begin(), trace.end());
+	}
+
+	FrameReport active;
+	FrameReport bypassed;
+	const bool hasActive = BuildFrameReport(records.data(), records.size(), false, active);
+	const bool hasBypassed = BuildFrameReport(records.data(), records.size(), true, bypassed);
+	if (hasActive)
+		PrintReport("active", active);
+	if (hasBypassed)
+		PrintReport("bypassed", bypassed);
+	if (hasActive && hasBypassed) {
+		printf("active - bypassed: mean %+.1f us, p50 %+.1f us, p99 %+.1f us\n",
+			active.frameUs.mean - bypassed.frameUs.mean, active.frameUs.p50 - bypassed.frameUs.p50, active.frameUs.p99 - bypassed.frameUs.p99);
+	}
+	if (!hasActive && !hasBypassed)
+		printf("no frames\n");
+	return 0;
+}
+
+
+
+}  // unnamed namespace
+
+
+
+#ifdef _WIN32
+int wmain(int argc, wchar_t** argv)
+#else
+int main(int argc, char** argv)
+#endif  // _WIN32
+{
+	return RunFrameProf(argc, argv);
+}
@@ -6,9 +6,14 @@ set PATH_PACKER=%OUT_DIR%\packer.exe
 set PATH_PAYLOAD=%OUT_DIR%\payload.dll
 set PATH_HEADER_TARGET=%PROJ_DIR%\launcher\payload.h
 set PATH_HEADER_TEMP=%PATH_HEADER_TARGET%.tmp
+set PATH_SIGNATURES=%PROJ_DIR%\signatures.sig
 
 
-%PATH_PACKER% %PATH_PAYLOAD% %PATH_HEADER_TEMP%
+rem the bundle has the payload and, if there are any, the signatures to ship with it
+set BUNDLE_ENTRIES=payload.dll@x86=%PATH_PAYLOAD%
+if exist %PATH_SIGNATURES% set BUNDLE_ENTRIES=%BUNDLE_ENTRIES% signatures.sig=%PATH_SIGNATURES%
+
+%PATH_PACKER% --header %PATH_HEADER_TEMP% %BUNDLE_ENTRIES% || goto _end
 
 fc %PATH_HEADER_TEMP% %PATH_HEADER_TARGET% >NUL 2>NUL && goto _no_change || goto _gen_header
 
@@ -0,0 +1,140 @@
+/*
+ *  herbicide - removing flowers and rabbits in the game Mirror
+ *  Copyright (C) 2018 Mifan Bang <https://debug.tw>.
+ *
+ *  This program is free software: you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation, either version 3 of the License, or
+ *  (at your option) any later version.
+ *
+ *  This program is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+// Measures the overhead and the scaling of the job system of shared/jobs with the kernels the
+// payload runs on it. Only standard C++ and shared/ are used, so that it also builds on POSIX:
+//   c++ -std=c++17 -O2 -I. jobbench/jobbench.cpp shared/jobs.cpp shared/file.cpp -lpthread
+
+#include <stdio.h>
+
+#include <chrono>
+#include <random>
+#include <thread>
+#include <vector>
+
+#include "shared/file.h"
+#include "shared/jobs.h"
+
+
+
+namespace {
+
+
+
+constexpr unsigned int c_emptyJobCount = 100000;
+constexpr unsigned int c_chunkCount = 64;  // a 2048x2048 RGBA texture in chunks of 64 rows
+constexpr size_t c_chunkSize = 2048 * 4 * 64;
+constexpr unsigned int c_repeatCount = 8;
+
+
+double GetSeconds(std::chrono::steady_clock::time_point start)
+{
+	return std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+}
+
+
+// submit jobs which do nothing from outside the workers and wait for them
+double MeasureSubmitWait(JobSystem& jobs)
+{
+	const auto start = std::chrono::steady_clock::now();
+	JobCounter counter;
+	for (unsigned int i = 0; i < c_emptyJobCount; ++i)
+		jobs.Submit([]() { }, &counter);
+	jobs.Wait(counter);
+	return GetSeconds(start) * 1e9 / c_emptyJobCount;
+}
+
+
+// fork/join of a recursion, so that the workers find jobs by stealing
+unsigned int Fork(JobSystem& jobs, unsigned int depth)
+{
+	if (depth == 0)
+		return 1;
+	unsigned int left = 0;
+	unsigned int right = 0;
+	jobs.Invoke([&]() { left = Fork(jobs, depth - 1); }, [&]() { right = Fork(jobs, depth - 1); });
+	return left + right;
+}
+
+
+double MeasureFork(JobSystem& jobs)
+{
+	constexpr unsigned int c_depth = 14;
+	const auto start = std::chrono::steady_clock::now();
+	if (Fork(jobs, c_depth) != 1u << c_depth)
+		return -1.0;
+	return GetSeconds(start) * 1e9 / ((1u << c_depth) - 1);
+}
+
+
+// the chunk keys of a dump, as DumpStore::Put() computes them
+double MeasureHashChunks(JobSystem& jobs, const std::vector<uint8_t>& data)
+{
+	uint8_t keys[c_chunkCount][StreamHasher::c_digestSize];
+	const auto start = std::chrono::steady_clock::now();
+	for (unsigned int n = 0; n < c_repeatCount; ++n) {
+		jobs.ParallelFor(c_chunkCount, 1, [&](size_t chunk) {
+			StreamHasher hasher;
+			hasher.Update(data.data() + chunk * c_chunkSize, c_chunkSize);
+			hasher.Finish(keys[chunk]);
+		});
+	}
+	const double seconds = GetSeconds(start);
+	return static_cast<double>(data.size()) * c_repeatCount / seconds / (1 << 20);
+}
+
+
+int RunJobBench()
+{
+	std::vector<uint8_t> data(c_chunkCount * c_chunkSize);
+	std::mt19937 rng(1);
+	for (auto& byte : data)
+		byte = static_cast<uint8_t>(rng());
+
+	const unsigned int coreCount = std::thread::hardware_concurrency();
+	printf("%u cores\n", coreCount);
+	printf("workers  submit+wait ns/job  fork ns/job  hash MiB/s  speedup  steals\n");
+	double baseRate = 0.0;
+	for (unsigned int workerCount = 0; workerCount <= JobSystem::c_maxWorkers; workerCount = workerCount == 0 ? 1 : workerCount * 2) {
+		JobSystem jobs;
+		if (!jobs.Start(workerCount, false)) {
+			fprintf(stderr, "Failed to start %u workers\n", workerCount);
+			return -1;
+		}
+		const double submitNs = MeasureSubmitWait(jobs);
+		const double forkNs = MeasureFork(jobs);
+		const double hashRate = MeasureHashChunks(jobs, data);
+		if (workerCount == 0)
+			baseRate = hashRate;
+		const auto stats = jobs.GetStats();
+		printf("%7u  %19.1f  %11.1f  %10.1f  %7.2f  %6llu\n",
+			workerCount, submitNs, forkNs, hashRate, hashRate / baseRate, static_cast<unsigned long long>(stats.stealCount));
+	}
+	return 0;
+}
+
+
+
+}  // unnamed namespace
+
+
+
+int main()
+{
+	return RunJobBench();
+}
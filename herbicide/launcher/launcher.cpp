@@ -17,7 +17,11 @@
  */
 
 #include <algorithm>
+#include <cstdio>
+#include <cwchar>
+#include <cwctype>
 #include <string>
+#include <vector>
 
 #include <windows.h>
 #include <shlwapi.h>
@@ -25,7 +29,10 @@
 #include <Buffer.h>
 #include <Handle.h>
 
+#include "shared/bundle.h"
+#include "shared/handoff.h"
 #include "shared/herbicide.h"
+#include "shared/signature.h"
 #include "shared/util.h"
 #include "payload.h"
 
@@ -35,6 +42,10 @@ namespace {
 
 
 
+// game.exe is a 32-bit program
+constexpr BundleArch c_payloadArch = BundleArch::X86;
+
+
 // output localized error message if $dwErrCode is non-zero
 void ShowErrorMessageBox(LPCWSTR lpszMsg, DWORD dwErrCode)
 {
@@ -70,64 +81,175 @@ void ShowErrorMessageBox(LPCWSTR lpszMsg, DWORD dwErrCode)
 }
 
 
+bool WriteWholeFile(LPCWSTR lpszPath, const std::vector<uint8_t>& data)
+{
+	gan::AutoWinHandle hFile = ::CreateFile(lpszPath, GENERIC_WRITE, FILE_SHARE_WRITE, 0, CREATE_ALWAYS, FILE_ATTRIBUTE_NORMAL, nullptr);
+	DWORD dwWritten;
+	return hFile != INVALID_HANDLE_VALUE
+		&& ::WriteFile(hFile, data.data(), static_cast<DWORD>(data.size()), &dwWritten, nullptr) == TRUE
+		&& dwWritten == data.size();
+}
+
+
 // return true on success; return false otherwise
-bool UnpackPayloadTo(const std::wstring& path)
+bool UnpackPayloadTo(const BundleReader& bundle, const std::wstring& path)
 {
 	auto lpszPath = path.c_str();
 	bool bShouldUnpack = true;
 	bool bSucceeded = false;
 
+	const BundleEntry* entry = bundle.Find("payload.dll", c_payloadArch);
+	if (entry == nullptr)
+		return false;
+	gan::Hash<256> payloadHash;
+	static_assert(sizeof(payloadHash.data) == sizeof(entry->digest), "both must be SHA-256");
+	CopyMemory(payloadHash.data, entry->digest, sizeof(payloadHash.data));
+
 	// check for path
 	bShouldUnpack = bShouldUnpack && !PathFileExists(lpszPath);
 
+	// fast path: the stamp tells the pre-existing file is the very one we have verified before
+	const bool bIsStampValid = !bShouldUnpack && CheckFileStamp(lpszPath, payloadHash);
+
 	// match the hash of payload with that of an pre-existing file
-	bShouldUnpack = bShouldUnpack || !CheckFileHash(lpszPath, s_payloadHash);
+	bShouldUnpack = bShouldUnpack || (!bIsStampValid && !CheckFileHash(lpszPath, payloadHash));
 
 	if (bShouldUnpack) {
-		DWORD dwPayloadSize = sizeof(s_payloadData);
-		auto payloadData = gan::Buffer::Allocate(dwPayloadSize);
-		if (payloadData == nullptr)
-			return false;
-		CopyMemory(*payloadData, s_payloadData, dwPayloadSize);
-
-		// de-obfuscate our code
-		for (DWORD i = 0; i < dwPayloadSize; i++)
-			(*payloadData)[i] ^= c_byteObfuscator;
-
-		// write to a temp path
-		gan::AutoWinHandle hFile = ::CreateFile(lpszPath, GENERIC_WRITE, FILE_SHARE_WRITE, 0, CREATE_ALWAYS, FILE_ATTRIBUTE_NORMAL, nullptr);
-		DWORD dwWritten;
-		if (hFile != INVALID_HANDLE_VALUE)
-		{
-			::WriteFile(hFile, *payloadData, dwPayloadSize, &dwWritten, nullptr);
-			bSucceeded = true;
-		}
+		// only this entry is de-obfuscated and decompressed
+		std::vector<uint8_t> payloadData;
+		bSucceeded = bundle.Extract(*entry, payloadData) && WriteWholeFile(lpszPath, payloadData);
 	}
 	else
 		bSucceeded = true;  // file already exists
 
+	// (re-)stamp the file whenever it has just been verified the slow way
+	if (bSucceeded && !bIsStampValid)
+		WriteFileStamp(lpszPath, payloadHash);
+
 	return bSucceeded;
 }
 
 
+// Signatures shipped with the launcher are written where the payload looks for them, unless
+// there's a file there already, which may well have been edited by the user.
+bool UnpackSignaturesTo(const BundleReader& bundle, const std::wstring& path)
+{
+	const BundleEntry* entry = bundle.Find("signatures.sig", c_payloadArch);
+	if (entry == nullptr || PathFileExists(path.c_str()))
+		return true;
+
+	std::vector<uint8_t> data;
+	return bundle.Extract(*entry, data) && WriteWholeFile(path.c_str(), data);
+}
+
+
+// The signature file is parsed, validated and sorted here, while the game has yet to start, and
+// laid out in a section which the payload maps as it is. A malformed file is left to the
+// payload, which reports the line as it does on reloads.
+bool PrepareHandoff(HandoffSection& section)
+{
+	const std::wstring path = GetSignaturePath();
+	const uint64_t writeTime = GetLastWriteTime(path.c_str());
+	SignatureRecordList records;
+	std::vector<uint8_t> patchData;
+	unsigned int errorLine = 0;
+	if (writeTime != 0 && !LoadSignatureFile(path.c_str(), records, patchData, errorLine)) {
+		LOG_WARNING(L"Malformed signature file at line %u\n", errorLine);
+		return false;
+	}
+	SortSignatureRecords(records);
+
+	const size_t size = GetHandoffSize(records.size(), patchData.size());
+	if (size > UINT32_MAX || !section.Create(GetHandoffName().c_str(), size))
+		return false;
+	HandoffHeader* header = WriteHandoff(section.GetData(), records, patchData, writeTime);
+
+	// the game inherits the environment, so the toggles start where the payload does
+	uint32_t bypass = 0;
+	GetEnvironmentUInt(L"HERBICIDE_BYPASS", bypass);
+	uint32_t logLevel = static_cast<uint32_t>(LogLevel::Off);
+	GetEnvironmentUInt(L"HERBICIDE_LOG_LEVEL", logLevel);
+	header->toggles.isBypassed.store(bypass);
+	header->toggles.logLevel.store(logLevel);
+	LOG_INFO(L"Handing %u signatures over\n", header->recordCount);
+	return true;
+}
+
+
+// "--toggle <bypass|log-level> <value>" changes a toggle of the game running with a handoff
+// @return false if $lpszCmdLine is no such command; one which is malformed is reported, and
+//   still taken for a toggle command so that the game isn't launched instead
+bool RunToggleCommand(LPCWSTR lpszCmdLine)
+{
+	static constexpr wchar_t c_command[] = L"--toggle";
+	while (iswspace(*lpszCmdLine))
+		++lpszCmdLine;
+	if (wcsncmp(lpszCmdLine, c_command, _countof(c_command) - 1) != 0)
+		return false;
+
+	wchar_t name[16];
+	wchar_t valueText[16];
+	wchar_t extra[2];
+	if (swscanf_s(lpszCmdLine + _countof(c_command) - 1, L"%15ls %15ls %1ls", name, static_cast<unsigned int>(_countof(name)), valueText, static_cast<unsigned int>(_countof(valueText)), extra, static_cast<unsigned int>(_countof(extra))) != 2) {
+		ShowErrorMessageBox(L"Usage: --toggle <bypass|log-level> <value>", NO_ERROR);
+		return true;
+	}
+
+	const bool isBypass = wcscmp(name, L"bypass") == 0;
+	if (!isBypass && wcscmp(name, L"log-level") != 0) {
+		ShowErrorMessageBox(L"Unknown toggle", NO_ERROR);
+		return true;
+	}
+	const uint32_t maxValue = isBypass ? 1 : static_cast<uint32_t>(LogLevel::Off);
+	wchar_t* valueEnd = nullptr;
+	const unsigned long value = wcstoul(valueText, &valueEnd, 10);
+	if (!iswdigit(valueText[0]) || *valueEnd != L'\0' || value > maxValue) {
+		ShowErrorMessageBox(isBypass ? L"The bypass toggle takes 0 or 1" : L"The log-level toggle takes a level from 0 (debug) to 4 (off)", NO_ERROR);
+		return true;
+	}
+
+	HandoffSection section;
+	HandoffHeader* header = section.Open(GetHandoffName().c_str(), true) ? GetHandoffHeader(section.GetData(), section.GetSize()) : nullptr;
+	if (header == nullptr)
+		ShowErrorMessageBox(L"The game is not running with this version", NO_ERROR);
+	else if (isBypass)
+		header->toggles.isBypassed.store(static_cast<uint32_t>(value));
+	else
+		header->toggles.logLevel.store(static_cast<uint32_t>(value));
+	return true;
+}
+
+
 
 }  // unnames namespace
 
 
 
-int WINAPI wWinMain(_In_ HINSTANCE, _In_opt_ HINSTANCE, _In_ LPWSTR, _In_ int)
+int WINAPI wWinMain(_In_ HINSTANCE, _In_opt_ HINSTANCE, _In_ LPWSTR lpCmdLine, _In_ int)
 {
 #ifdef _DEBUG
 	DebugConsole dbgConsole;
 #endif  // _DEBUG
 
+	if (RunToggleCommand(lpCmdLine))
+		return 0;
+
+	// only the table of contents is read here
+	BundleReader bundle;
+	if (!bundle.Open(s_bundleData, sizeof(s_bundleData), c_byteObfuscator)) {
+		ShowErrorMessageBox(L"The bundled payload is corrupted", NO_ERROR);
+		return 0;
+	}
+
 	// generate DLL path in user's Temp directory
 	auto pathPayload = GetPayloadPath();
-	DEBUG_MSG(L"Payload path: %s\n", pathPayload.c_str());
-	if (!UnpackPayloadTo(pathPayload)) {
+	LOG_INFO(L"Payload path: %s\n", pathPayload.c_str());
+	if (!UnpackPayloadTo(bundle, pathPayload)) {
 		ShowErrorMessageBox(L"UnpackPayloadTo()", GetLastError());
 		return 0;
 	}
+	if (!UnpackSignaturesTo(bundle, GetSignaturePath()))
+		LOG_WARNING(L"Failed to unpack the bundled signatures\n");
 
 	// get executable paths
 	auto pathDir = GetMirrorDir();
@@ -136,9 +258,14 @@ int WINAPI wWinMain(_In_ HINSTANCE, _In_opt_ HINSTANCE, _In_ LPWSTR, _In_ int)
 		return 0;  // according to MSDN, we should return zero before entering the message loop
 	}
 
+	// kept until the game has loaded the payload, which maps it for good
+	HandoffSection handoff;
+	if (!PrepareHandoff(handoff))
+		LOG_WARNING(L"No handoff; the payload loads the signatures itself\n");
+
 	// create and purify
 	auto pathExe = pathDir + L"/game.exe";
-	DEBUG_MSG(L"EXE path: %s\n", pathExe.c_str());
+	LOG_INFO(L"EXE path: %s\n", pathExe.c_str());
 	auto createdPid = CreatePurifiedProcess(pathExe.c_str(), pathDir.c_str(), pathPayload.c_str());
 	if (createdPid == 0) {
 		auto errCode = GetLastError();
@@ -0,0 +1,181 @@
+/*
+ *  herbicide - removing flowers and rabbits in the game Mirror
+ *  Copyright (C) 2018 Mifan Bang <https://debug.tw>.
+ *
+ *  This program is free software: you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation, either version 3 of the License, or
+ *  (at your option) any later version.
+ *
+ *  This program is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+// Measures the per-call cost of logging from a hook through shared/logger: a record as written
+// by CreateTexture2D() with its level enabled, the drain formatting it into nowhere, both in
+// bursts the drain keeps up with and in a flood which overflows the rings; the same record with
+// its level disabled; and the record formatted synchronously by swprintf() as DEBUG_MSG used
+// to, minus the console. Only standard C++ and shared/logger are used, so that it also builds
+// on POSIX:
+//   c++ -std=c++17 -O2 -I. logbench/logbench.cpp shared/logger.cpp -lpthread
+
+#include <stdio.h>
+#include <wchar.h>
+
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <thread>
+#include <vector>
+
+#include "shared/logger.h"
+
+
+
+namespace {
+
+
+
+constexpr unsigned int c_callsPerThread = 1000000;
+
+// bursts small enough for the ring of a thread, with time for the drain in between
+constexpr unsigned int c_callsPerBurst = 1000;
+constexpr unsigned int c_burstCount = 100;
+
+
+double GetSeconds(std::chrono::steady_clock::time_point start)
+{
+	return std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+}
+
+
+void LogCreateTexture(const void* texture)
+{
+	LOG_DEBUG(L"CreateTexture2D w=%d h=%d fmt=%d usg=%d dat=%p tex=%p\n", 2048u, 1024u, 28, 0, texture, nullptr);
+}
+
+
+// a string argument is copied into the record
+void LogLoaded(const wchar_t* path)
+{
+	LOG_DEBUG(L"Loaded signatures from %s\n", path);
+}
+
+
+void FormatCreateTexture(const void* texture)
+{
+	wchar_t buffer[256];
+	swprintf(buffer, sizeof(buffer) / sizeof(buffer[0]), L"CreateTexture2D w=%d h=%d fmt=%d usg=%d dat=%p tex=%p\n", 2048u, 1024u, 28, 0, texture, nullptr);
+
+	// keeps the formatting from being optimized away
+	static std::atomic<wchar_t> s_sink(0);
+	s_sink.store(buffer[16], std::memory_order_relaxed);
+}
+
+
+struct Method
+{
+	const char* name;
+	void (*call)(unsigned int threadIndex);
+};
+
+
+// @return ns per call, each thread making $c_callsPerThread of them back to back
+double MeasureCalls(const Method& method, unsigned int threadCount)
+{
+	std::vector<std::thread> threads;
+	const auto start = std::chrono::steady_clock::now();
+	for (unsigned int t = 0; t < threadCount; ++t) {
+		threads.emplace_back([&method, t]() {
+			for (unsigned int n = 0; n < c_callsPerThread; ++n)
+				method.call(t);
+		});
+	}
+	for (auto& thread : threads)
+		thread.join();
+	return GetSeconds(start) * 1e9 / c_callsPerThread;
+}
+
+
+// Like MeasureCalls(), but in bursts the drain keeps up with, as hooks log in a game; a flood
+// mostly measures how records are dropped. The pauses aren't measured.
+double MeasurePacedCalls(const Method& method, unsigned int threadCount)
+{
+	std::vector<std::thread> threads;
+	std::vector<double> seconds(threadCount, 0.0);
+	for (unsigned int t = 0; t < threadCount; ++t) {
+		threads.emplace_back([&method, &seconds, t]() {
+			for (unsigned int burst = 0; burst < c_burstCount; ++burst) {
+				const auto start = std::chrono::steady_clock::now();
+				for (unsigned int n = 0; n < c_callsPerBurst; ++n)
+					method.call(t);
+				seconds[t] += GetSeconds(start);
+				std::this_thread::sleep_for(std::chrono::milliseconds(Logger::c_drainIntervalMs * 2));
+			}
+		});
+	}
+	for (auto& thread : threads)
+		thread.join();
+	double totalSeconds = 0.0;
+	for (const double threadSeconds : seconds)
+		totalSeconds += threadSeconds;
+	return totalSeconds / threadCount * 1e9 / (c_callsPerBurst * c_burstCount);
+}
+
+
+int RunLogBench()
+{
+	const Method enabledMethods[] = {
+		{ "write", [](unsigned int t) { LogCreateTexture(&t); } },
+		{ "write(string)", [](unsigned int) { LogLoaded(L"C:\\Users\\player\\AppData\\Local\\Temp\\herbicide\\signatures.txt"); } },
+	};
+	const Method disabledMethod = { "write(disabled)", [](unsigned int t) { LogCreateTexture(&t); } };
+	const Method formatMethod = { "swprintf", [](unsigned int t) { FormatCreateTexture(&t); } };
+
+	// formatted by the drain and thrown away; a full ring drops records rather than waiting
+	if (!Logger::Start(nullptr, LogLevel::Debug)) {
+		fprintf(stderr, "Failed to start the logger\n");
+		return -1;
+	}
+	const unsigned int coreCount = std::max(std::thread::hardware_concurrency(), 1u);
+	printf("method           calls   threads  ns/call  kept\n");
+	for (const bool isPaced : { true, false }) {
+		for (unsigned int threadCount = 1; threadCount <= coreCount; threadCount *= 2) {
+			for (const auto& method : enabledMethods) {
+				const Logger::Stats statsBefore = Logger::GetStats();
+				const double ns = isPaced ? MeasurePacedCalls(method, threadCount) : MeasureCalls(method, threadCount);
+
+				// the counts of a ring are retired when its thread exits
+				const Logger::Stats statsAfter = Logger::GetStats();
+				const uint64_t written = statsAfter.written - statsBefore.written;
+				const uint64_t dropped = statsAfter.dropped - statsBefore.dropped;
+				printf("%-15s  %-6s  %7u  %7.1f  %3.0f%%\n", method.name, isPaced ? "paced" : "flood", threadCount, ns, written + dropped > 0 ? 100.0 * written / (written + dropped) : 0.0);
+			}
+		}
+	}
+
+	Logger::SetLevel(LogLevel::Info);
+	for (unsigned int threadCount = 1; threadCount <= coreCount; threadCount *= 2)
+		printf("%-15s  %-6s  %7u  %7.1f\n", disabledMethod.name, "flood", threadCount, MeasureCalls(disabledMethod, threadCount));
+	Logger::Stop();
+
+	for (unsigned int threadCount = 1; threadCount <= coreCount; threadCount *= 2)
+		printf("%-15s  %-6s  %7u  %7.1f\n", formatMethod.name, "flood", threadCount, MeasureCalls(formatMethod, threadCount));
+	return 0;
+}
+
+
+
+}  // unnamed namespace
+
+
+
+int main()
+{
+	return RunLogBench();
+}
@@ -16,73 +16,222 @@
  *  along with this program.  If not, see <http://www.gnu.org/licenses/>.
  */
 
-#include <windows.h>
+// Packs files into a bundle and emits it as a header for the launcher, or as a plain file.
+// Only standard C++ and shared/ are used, so that it also builds on POSIX:
+//   c++ -std=c++17 -O2 -I. packer/packer.cpp shared/bundle.cpp shared/file.cpp shared/lz.cpp -pthread
+
 #include <stdio.h>
 #include <stdlib.h>
-#include <wchar.h>
+#include <string.h>
+
+#include <memory>
+#include <string>
+#include <thread>
+#include <vector>
 
+#include "shared/bundle.h"
+#include "shared/file.h"
 #include "shared/herbicide.h"
-#include "shared/util.h"
 
 
 
-int wmain(int argc, wchar_t** argv)
+namespace {
+
+
+
+#ifdef _WIN32
+	#define PATH_TEXT(text)	L##text
+#else
+	#define PATH_TEXT(text)	text
+#endif  // _WIN32
+
+
+struct Options
 {
-	if (argc < 3) {
-		printf("Too few parameters.\n\n");
-		system("pause");
-		return -1;
+	const PathChar* headerPath = nullptr;
+	const PathChar* bundlePath = nullptr;
+	unsigned int threadCount = 0;
+	std::vector<const PathChar*> entrySpecs;
+};
+
+
+void PrintError(const char* message, const PathChar* path)
+{
+#ifdef _WIN32
+	fwprintf(stderr, L"%hs: %s\n", message, path);
+#else
+	fprintf(stderr, "%s: %s\n", message, path);
+#endif  // _WIN32
+}
+
+
+void PrintUsage()
+{
+	fprintf(stderr,
+		"Usage: packer [--header <header path>] [--bundle <bundle path>] [--threads N] <entry>...\n"
+		"  where an entry is <name>[@any|@x86|@x64]=<file path>, e.g. payload.dll@x86=Release/payload.dll\n");
+}
+
+
+FILE* OpenForWriting(const PathChar* path)
+{
+	FILE* fp = nullptr;
+#ifdef _WIN32
+	if (_wfopen_s(&fp, path, L"wb") != 0)
+		fp = nullptr;
+#else
+	fp = fopen(path, "wb");
+#endif  // _WIN32
+	return fp;
+}
+
+
+bool ParseUInt(const PathChar* text, unsigned int& value)
+{
+	value = 0;
+	for (const PathChar* p = text; *p != '\0'; ++p) {
+		if (*p < '0' || *p > '9' || value > 9999)
+			return false;
+		value = value * 10 + static_cast<unsigned int>(*p - '0');
+	}
+	return *text != '\0';
+}
+
+
+bool ParseOptions(int argc, PathChar** argv, Options& options)
+{
+	for (int i = 1; i < argc; ++i) {
+		const std::basic_string<PathChar> arg = argv[i];
+		const bool hasValue = i + 1 < argc;
+		if (arg == PATH_TEXT("--header") && hasValue)
+			options.headerPath = argv[++i];
+		else if (arg == PATH_TEXT("--bundle") && hasValue)
+			options.bundlePath = argv[++i];
+		else if (arg == PATH_TEXT("--threads") && hasValue && ParseUInt(argv[++i], options.threadCount))
+			continue;
+		else if (arg.size() > 2 && arg[0] == '-' && arg[1] == '-')
+			return false;
+		else
+			options.entrySpecs.push_back(argv[i]);
 	}
+	return !options.entrySpecs.empty() && (options.headerPath != nullptr || options.bundlePath != nullptr);
+}
 
-	WinErrorCode errCode;
-	const wchar_t* lpPayloadPath = argv[1];
-	const wchar_t* lpHeaderPath = argv[2];
 
-	// read payload
-	auto payloadData = ReadFileToBuffer(lpPayloadPath, errCode);
-	if (payloadData == nullptr) {
-		wprintf(L"Failed to open %s for reading: %d\n\n", lpPayloadPath, errCode);
+// split "<name>[@<arch>]=<path>"; names and architectures are plain ASCII
+bool ParseEntrySpec(const PathChar* spec, std::string& name, BundleArch& arch, const PathChar*& path)
+{
+	const PathChar* p = spec;
+	std::string key;
+	for (; *p != '\0' && *p != '='; ++p) {
+		if (*p < 0x20 || *p > 0x7E)
+			return false;
+		key.push_back(static_cast<char>(*p));
+	}
+	if (*p != '=' || p[1] == '\0')
+		return false;
+	path = p + 1;
+
+	arch = BundleArch::Any;
+	const size_t at = key.find('@');
+	if (at != std::string::npos && !ParseBundleArch(key.c_str() + at + 1, arch))
+		return false;
+	name = key.substr(0, at);
+	return !name.empty();
+}
+
+
+// .rdata section will be merged into .text via linker option /MERGE, hence the obfuscation
+bool WriteHeader(const PathChar* path, const std::vector<uint8_t>& bundle)
+{
+	FILE* fp = OpenForWriting(path);
+	if (fp == nullptr)
+		return false;
+
+	fprintf(fp, "#pragma once\n\n");
+	fprintf(fp, "// bundle of shared/bundle.h with every byte XOR-ed with c_byteObfuscator\n");
+	fprintf(fp, "const unsigned char s_bundleData[] = {");
+	for (size_t i = 0; i < bundle.size(); i++) {
+		fprintf(fp, "%d,", bundle[i] ^ c_byteObfuscator);
+		if ((i & 0xFF) == 0xFF && i != bundle.size() - 1)
+			fprintf(fp, "\n\t");
+	}
+	fprintf(fp, "};\n");
+	return fclose(fp) == 0;
+}
+
+
+bool WriteBundle(const PathChar* path, const std::vector<uint8_t>& bundle)
+{
+	FILE* fp = OpenForWriting(path);
+	if (fp == nullptr)
+		return false;
+	const bool isWritten = fwrite(bundle.data(), 1, bundle.size(), fp) == bundle.size();
+	return fclose(fp) == 0 && isWritten;
+}
+
+
+int RunPacker(int argc, PathChar** argv)
+{
+	Options options;
+	if (!ParseOptions(argc, argv, options)) {
+		PrintUsage();
 		return -1;
 	}
 
-	// generate hash of payload
-	gan::Hash<256> hash;
-	if ((errCode = gan::Hasher::GetSHA(*payloadData, payloadData->GetSize(), hash)) != NO_ERROR) {
-		wprintf(L"Failed to create hash for payload: %d\n\n", errCode);
+	// inputs are mapped; no copy of them is made
+	std::vector<std::unique_ptr<MappedFile>> files;
+	std::vector<BundleInput> inputs;
+	for (const PathChar* spec : options.entrySpecs) {
+		BundleInput input;
+		const PathChar* path;
+		if (!ParseEntrySpec(spec, input.name, input.arch, path) || input.name.size() > BundleEntry::c_maxNameLength) {
+			PrintError("Malformed entry", spec);
+			return -1;
+		}
+
+		auto file = std::make_unique<MappedFile>();
+		if (!file->Open(path) || file->GetSize() > SIZE_MAX) {
+			PrintError("Failed to open for reading", path);
+			return -1;
+		}
+		input.data = file->GetData();
+		input.size = static_cast<size_t>(file->GetSize());
+		inputs.push_back(input);
+		files.push_back(std::move(file));
+	}
+
+	const unsigned int threadCount = options.threadCount > 0 ? options.threadCount : std::thread::hardware_concurrency();
+	std::vector<uint8_t> bundle;
+	if (!BuildBundle(inputs, threadCount, bundle)) {
+		fprintf(stderr, "Failed to build the bundle; are there duplicate entries?\n");
 		return -1;
 	}
 
-	// output to intermediate header file
-	FILE* fp = nullptr;
-	if (_wfopen_s(&fp, lpHeaderPath, L"w") != 0 || fp == nullptr) {
-		wprintf(L"Failed to open header file to write.\n\n");
+	if (options.headerPath != nullptr && !WriteHeader(options.headerPath, bundle)) {
+		PrintError("Failed to write", options.headerPath);
+		return -1;
+	}
+	if (options.bundlePath != nullptr && !WriteBundle(options.bundlePath, bundle)) {
+		PrintError("Failed to write", options.bundlePath);
 		return -1;
 	}
 
-	// pre-defined directives
-	fprintf(fp, "#pragma once\n");
-	fprintf(fp, "#include \"shared/util.h\"\n\n");
+	printf("Packed %u entries into %u bytes.\n", static_cast<unsigned int>(inputs.size()), static_cast<unsigned int>(bundle.size()));
+	return 0;
+}
 
-	// payload data
-	fprintf(fp, "// .rdata section will be merged into .text via linker option /MERGE \n");
-	fprintf(fp, "const unsigned char s_payloadData[] = {");
-	for (DWORD i = 0, dwSizePayload = payloadData->GetSize(); i < dwSizePayload; i++) {
-		fprintf(fp, "%d,", (*payloadData)[i] ^ c_byteObfuscator);
-		if ((i & 0xFF) == 0xFF && i != (dwSizePayload - 1))
-			fprintf(fp, "\n\t");
-	}
-	fprintf(fp, "};\n\n");
 
-	// hash of payload
-	fprintf(fp, "// SHA256 digest of non-obfuscated payload data\n");
-	fprintf(fp, "const gan::Hash<256> s_payloadHash = {{");
-	for (DWORD i = 0; i < sizeof(hash.data); i++)
-		fprintf(fp, "%d%s", hash.data[i], i < sizeof(hash.data) - 1 ? "," : "");
-	fprintf(fp, "}};\n");
 
-	fclose(fp);
+}  // unnamed namespace
 
-	wprintf(L"Packing completed successfully.\nThe output is: %s\n\n", lpHeaderPath);
 
-	return 0;
+
+#ifdef _WIN32
+int wmain(int argc, wchar_t** argv)
+#else
+int main(int argc, char** argv)
+#endif  // _WIN32
+{
+	return RunPacker(argc, argv);
 }
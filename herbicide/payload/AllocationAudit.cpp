@@ -0,0 +1,52 @@
+/*
+ *  herbicide - removing flowers and rabbits in the game Mirror
+ *  Copyright (C) 2018 Mifan Bang <https://debug.tw>.
+ *
+ *  This program is free software: you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation, either version 3 of the License, or
+ *  (at your option) any later version.
+ *
+ *  This program is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+// Audit builds replace the global operator new of the payload to count the heap allocations
+// made by detours. The arrays and the nothrow forms of the library end up here as well.
+
+#include "HookArena.h"
+
+#if HERBICIDE_AUDIT_ALLOCATIONS
+
+#include <cstdlib>
+#include <new>
+
+
+
+void* operator new(size_t size)
+{
+	NoteHeapAllocation();
+	void* ptr = malloc(size > 0 ? size : 1);
+	if (ptr == nullptr)
+		std::_Xbad_alloc();  // throws std::bad_alloc, or terminates in builds without exceptions
+	return ptr;
+}
+
+
+void operator delete(void* ptr) noexcept
+{
+	free(ptr);
+}
+
+
+void operator delete(void* ptr, size_t) noexcept
+{
+	free(ptr);
+}
+
+#endif  // HERBICIDE_AUDIT_ALLOCATIONS
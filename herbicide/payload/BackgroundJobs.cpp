@@ -0,0 +1,61 @@
+/*
+ *  herbicide - removing flowers and rabbits in the game Mirror
+ *  Copyright (C) 2018 Mifan Bang <https://debug.tw>.
+ *
+ *  This program is free software: you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation, either version 3 of the License, or
+ *  (at your option) any later version.
+ *
+ *  This program is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include "BackgroundJobs.h"
+
+#include <thread>
+
+#include "shared/util.h"
+
+
+
+namespace {
+
+
+
+constexpr unsigned int c_coresLeftToGame = 2;
+
+
+JobSystem* StartBackgroundJobs()
+{
+	const unsigned int coreCount = std::thread::hardware_concurrency();
+	uint32_t workerCount = coreCount > c_coresLeftToGame ? coreCount - c_coresLeftToGame : 1;
+	if (workerCount > c_defaultMaxJobWorkers)
+		workerCount = c_defaultMaxJobWorkers;
+	GetEnvironmentUInt(L"HERBICIDE_JOB_WORKERS", workerCount);
+	if (workerCount > JobSystem::c_maxWorkers)
+		workerCount = JobSystem::c_maxWorkers;
+
+	// leaked on purpose, see GetBackgroundJobs()
+	auto jobs = new JobSystem();
+	if (jobs->Start(workerCount, true))
+		LOG_INFO(L"Background jobs started with %u workers\n", workerCount);
+	return jobs;
+}
+
+
+
+}  // unnamed namespace
+
+
+
+JobSystem& GetBackgroundJobs()
+{
+	static JobSystem* s_jobs = StartBackgroundJobs();
+	return *s_jobs;
+}
@@ -0,0 +1,33 @@
+/*
+ *  herbicide - removing flowers and rabbits in the game Mirror
+ *  Copyright (C) 2018 Mifan Bang <https://debug.tw>.
+ *
+ *  This program is free software: you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation, either version 3 of the License, or
+ *  (at your option) any later version.
+ *
+ *  This program is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#pragma once
+
+#include "shared/jobs.h"
+
+
+
+// The job system of the payload, started on first use with low-priority workers. Their number
+// is HERBICIDE_JOB_WORKERS if set; otherwise all cores but the two left to the render and
+// streaming threads of the game, at most c_defaultMaxJobWorkers and at least one.
+//
+// Never call it under the loader lock, as the workers couldn't start until it's released. The
+// job system is never stopped: by the time the payload is unloaded its workers may be gone.
+constexpr unsigned int c_defaultMaxJobWorkers = 4;
+
+JobSystem& GetBackgroundJobs();
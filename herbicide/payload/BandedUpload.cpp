@@ -0,0 +1,236 @@
+/*
+ *  herbicide - removing flowers and rabbits in the game Mirror
+ *  Copyright (C) 2018 Mifan Bang <https://debug.tw>.
+ *
+ *  This program is free software: you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation, either version 3 of the License, or
+ *  (at your option) any later version.
+ *
+ *  This program is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include "BandedUpload.h"
+
+#include <algorithm>
+#include <climits>
+#include <cstring>
+
+
+
+namespace {
+
+
+
+// the part of $rect within rows [firstRow, endRow) and the first $width pixels of a row
+// @return false if nothing is left
+bool ClipRect(const D3D11_RECT& rect, LONG width, LONG firstRow, LONG endRow, D3D11_RECT& out)
+{
+	out.left = std::max<LONG>(rect.left, 0);
+	out.right = std::min<LONG>(rect.right, width - 1);
+	out.top = std::max<LONG>(rect.top, firstRow);
+	out.bottom = std::min<LONG>(rect.bottom, endRow - 1);
+	return out.left <= out.right && out.top <= out.bottom;
+}
+
+
+
+}  // unnamed namespace
+
+
+
+BandedUploadTracker::BandedUploadTracker()
+	: m_lock()
+	, m_states()
+	, m_useCount(0)
+	, m_stats()
+{
+}
+
+
+bool BandedUploadTracker::OnUpload(void* resource, const DataFilterList& filters, const Band& band, EraseList& erases)
+{
+	if (band.firstRow >= band.endRow || band.rowSize == 0)
+		return false;
+
+	std::lock_guard<std::mutex> lock(m_lock);
+
+	auto itr = m_states.find(resource);
+	if (itr == m_states.end()) {
+		itr = m_states.emplace(resource, State()).first;
+		Reset(itr->second, band);
+	}
+	else {
+		// the top row uploaded again is new content, unless it fills the gap before held bands
+		const State& state = itr->second;
+		const bool isNewContent = band.firstRow == 0 && (state.nextRow > 0 || state.phase != Phase::Hashing);
+		if (isNewContent || band.rowSize != state.rowSize || GetFingerprintRowCount(band.rowCount) != state.fingerprintRows)
+			Reset(itr->second, band);
+	}
+	State& state = itr->second;
+	state.lastUse = ++m_useCount;
+
+	bool isHit = false;
+	if (state.phase == Phase::Hashing) {
+		const unsigned int endRow = std::min(band.endRow, state.fingerprintRows);
+		if (band.firstRow <= state.nextRow) {
+			// rows above $nextRow which the band uploads again are taken as unchanged
+			if (endRow > state.nextRow)
+				Hash(state, band.data + static_cast<size_t>(state.nextRow - band.firstRow) * band.rowPitch, band.rowPitch, state.nextRow, endRow);
+		}
+		else if (band.firstRow < endRow)
+			Hold(state, band, endRow);
+
+		// the band may have filled the gap before those held
+		while (!state.heldBands.empty() && state.heldBands.begin()->first <= state.nextRow) {
+			const auto held = state.heldBands.begin();
+			const unsigned int heldEnd = held->first + static_cast<unsigned int>(held->second.size() / state.rowSize);
+			if (heldEnd > state.nextRow)
+				Hash(state, held->second.data() + static_cast<size_t>(state.nextRow - held->first) * state.rowSize, state.rowSize, state.nextRow, heldEnd);
+			m_stats.heldBytes -= held->second.size();
+			state.heldBands.erase(held);
+		}
+
+		if (state.nextRow >= state.fingerprintRows) {
+			isHit = Evaluate(state, filters);
+			if (isHit)
+				erases.assign(state.erases.cbegin(), state.erases.cend());
+		}
+	}
+	else if (state.phase == Phase::Identified) {
+		for (const Erase& erase : state.erases) {
+			Erase part;
+			part.stride = erase.stride;
+			if (ClipRect(erase.rect, static_cast<LONG>(band.rowSize / erase.stride), static_cast<LONG>(band.firstRow), static_cast<LONG>(band.endRow), part.rect))
+				erases.push_back(part);
+		}
+	}
+
+	Evict();
+	return isHit;
+}
+
+
+void BandedUploadTracker::Forget(void* resource)
+{
+	std::lock_guard<std::mutex> lock(m_lock);
+	auto itr = m_states.find(resource);
+	if (itr != m_states.end()) {
+		Release(itr->second);
+		m_states.erase(itr);
+	}
+}
+
+
+BandedUploadTracker::Stats BandedUploadTracker::GetStats() const
+{
+	std::lock_guard<std::mutex> lock(m_lock);
+	return m_stats;
+}
+
+
+void BandedUploadTracker::Reset(State& state, const Band& band)
+{
+	Release(state);
+	state.phase = Phase::Hashing;
+	state.hasher.reset(new StreamHasher());
+	state.rowSize = band.rowSize;
+	state.fingerprintRows = GetFingerprintRowCount(band.rowCount);
+	state.nextRow = 0;
+	state.erases.clear();
+}
+
+
+void BandedUploadTracker::Hash(State& state, const uint8_t* data, unsigned int rowPitch, unsigned int firstRow, unsigned int endRow)
+{
+	const unsigned int rowCount = endRow - firstRow;
+	if (rowPitch == state.rowSize)
+		state.hasher->Update(data, static_cast<uint64_t>(state.rowSize) * rowCount);
+	else {
+		for (unsigned int i = 0; i < rowCount; ++i)
+			state.hasher->Update(data + static_cast<size_t>(i) * rowPitch, state.rowSize);
+	}
+	state.nextRow = endRow;
+	m_stats.hashedBytes += static_cast<uint64_t>(state.rowSize) * rowCount;
+}
+
+
+void BandedUploadTracker::Hold(State& state, const Band& band, unsigned int endRow)
+{
+	std::vector<uint8_t>& rows = state.heldBands[band.firstRow];
+	m_stats.heldBytes -= rows.size();
+	rows.resize(static_cast<size_t>(state.rowSize) * (endRow - band.firstRow));
+	for (unsigned int row = band.firstRow; row < endRow; ++row)
+		memcpy(rows.data() + static_cast<size_t>(row - band.firstRow) * state.rowSize, band.data + static_cast<size_t>(row - band.firstRow) * band.rowPitch, state.rowSize);
+	m_stats.heldBytes += rows.size();
+}
+
+
+bool BandedUploadTracker::Evaluate(State& state, const DataFilterList& filters)
+{
+	uint8_t digest[StreamHasher::c_digestSize];
+	const bool isFinished = state.hasher->Finish(digest);
+	Release(state);
+	state.phase = Phase::Rejected;
+	if (!isFinished)
+		return false;
+
+	bool isHit = false;
+	for (const auto& filter : filters) {
+		const FilterDataCondition& cond = filter->GetCondition();
+		if (!cond.HasFingerprint() || !IsSameLayout(cond, state) || memcmp(cond.GetFingerprint().data, digest, sizeof(digest)) != 0)
+			continue;
+		isHit = true;
+		const FilterDataAction& action = filter->GetAction();
+		if (action.IsErase()) {
+			Erase erase;
+			erase.stride = action.GetStride();
+			if (ClipRect(action.GetEraseRect(), static_cast<LONG>(state.rowSize / erase.stride), 0, LONG_MAX, erase.rect))
+				state.erases.push_back(erase);
+		}
+	}
+	if (isHit) {
+		state.phase = Phase::Identified;
+		++m_stats.hitCount;
+	}
+	return isHit;
+}
+
+
+// whether the rows fingerprinted by $cond are those hashed into $state
+bool BandedUploadTracker::IsSameLayout(const FilterDataCondition& cond, const State& state)
+{
+	if (cond.GetFingerprintKind() == FingerprintKind::Packed)
+		return cond.GetRowSize() == state.rowSize && cond.GetRowCount() == state.fingerprintRows;
+	return state.fingerprintRows == c_fingerprintRowCount;
+}
+
+
+void BandedUploadTracker::Release(State& state)
+{
+	state.hasher.reset();
+	for (const auto& held : state.heldBands)
+		m_stats.heldBytes -= held.second.size();
+	state.heldBands.clear();
+}
+
+
+void BandedUploadTracker::Evict()
+{
+	while (m_states.size() > c_maxStates || m_stats.heldBytes > c_maxHeldBytes) {
+		auto oldest = m_states.begin();
+		for (auto itr = m_states.begin(); itr != m_states.end(); ++itr) {
+			if (itr->second.lastUse < oldest->second.lastUse)
+				oldest = itr;
+		}
+		Release(oldest->second);
+		m_states.erase(oldest);
+		++m_stats.evictCount;
+	}
+}
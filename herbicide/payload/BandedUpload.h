@@ -0,0 +1,131 @@
+/*
+ *  herbicide - removing flowers and rabbits in the game Mirror
+ *  Copyright (C) 2018 Mifan Bang <https://debug.tw>.
+ *
+ *  This program is free software: you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation, either version 3 of the License, or
+ *  (at your option) any later version.
+ *
+ *  This program is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#pragma once
+
+#include <cstdint>
+#include <map>
+#include <memory>
+#include <mutex>
+#include <unordered_map>
+#include <vector>
+
+#include "shared/file.h"
+#include "TextureFilter.h"
+
+
+
+// Fingerprints of textures which are never mapped but uploaded in row bands, as by several
+// UpdateSubresource() calls. Each band feeds only the rows it adds to a SHA-256 resumed from
+// the previous bands. Bands arriving ahead of the rows fingerprinted so far are held until the
+// gap is filled. Once the rows of a fingerprint are in, as many as GetFingerprintRowCount()
+// gives, the signatures are evaluated against the digest.
+//
+// Rows are hashed without padding, which is a packed fingerprint. It also matches a padded one
+// taken from a mapping whose row pitch has no padding either, of a texture of enough rows.
+//
+// Only erasing is carried out on the uploads; the pixels a patch would leave in place are gone
+// once uploaded, so signatures with patches only identify textures here.
+class BandedUploadTracker
+{
+public:
+	static constexpr size_t c_maxStates = 64;  // textures being fingerprinted or acted on
+	static constexpr size_t c_maxHeldBytes = 32 << 20;  // of rows held ahead, in total
+
+	// full rows [firstRow, endRow) of an upload
+	struct Band
+	{
+		const uint8_t* data;  // row $firstRow
+		unsigned int rowPitch;
+		unsigned int rowSize;  // pixels of a row, without padding
+		unsigned int rowCount;  // of the whole texture
+		unsigned int firstRow;
+		unsigned int endRow;
+	};
+
+	// a rectangle to write zeros over, in pixels, inclusive like ErasePixels()
+	struct Erase
+	{
+		D3D11_RECT rect;
+		uint8_t stride;
+	};
+
+	// filled within the UpdateSubresource() detour, so it takes the memory of the hook arena
+	using EraseList = ArenaVector<Erase>;
+
+	struct Stats
+	{
+		uint64_t hashedBytes;
+		uint64_t heldBytes;  // currently
+		uint64_t hitCount;  // textures identified
+		uint64_t evictCount;  // states dropped to stay in bounds
+	};
+
+
+	BandedUploadTracker();
+
+	BandedUploadTracker(const BandedUploadTracker&) = delete;
+	BandedUploadTracker& operator=(const BandedUploadTracker&) = delete;
+
+	// Feed a band uploaded to $resource, whose signatures are $filters. A band starting at the
+	// top row is new content and starts over, unless it fills the gap before bands held ahead.
+	// @param erases receives what to erase once the band has been uploaded: when the band
+	//   completes a fingerprint which hits, the whole rectangles of the signatures; later on,
+	//   the parts overlapping the band
+	// @return whether the band completed a fingerprint which hit
+	bool OnUpload(void* resource, const DataFilterList& filters, const Band& band, EraseList& erases);
+
+	// the resource was released, or its content replaced otherwise
+	void Forget(void* resource);
+
+	Stats GetStats() const;
+
+
+private:
+	enum class Phase
+	{
+		Hashing,
+		Identified,
+		Rejected,
+	};
+
+	struct State
+	{
+		Phase phase;
+		std::unique_ptr<StreamHasher> hasher;
+		unsigned int rowSize;
+		unsigned int fingerprintRows;
+		unsigned int nextRow;  // rows above are in the hasher
+		std::map<unsigned int, std::vector<uint8_t>> heldBands;  // unpadded rows, by first row
+		std::vector<Erase> erases;  // once identified
+		uint64_t lastUse;
+	};
+
+	void Reset(State& state, const Band& band);
+	void Hash(State& state, const uint8_t* data, unsigned int rowPitch, unsigned int firstRow, unsigned int endRow);
+	void Hold(State& state, const Band& band, unsigned int endRow);
+	bool Evaluate(State& state, const DataFilterList& filters);
+	static bool IsSameLayout(const FilterDataCondition& cond, const State& state);
+	void Release(State& state);
+	void Evict();
+
+	mutable std::mutex m_lock;
+	std::unordered_map<void*, State> m_states;
+	uint64_t m_useCount;
+	Stats m_stats;
+};
@@ -0,0 +1,109 @@
+/*
+ *  herbicide - removing flowers and rabbits in the game Mirror
+ *  Copyright (C) 2018 Mifan Bang <https://debug.tw>.
+ *
+ *  This program is free software: you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation, either version 3 of the License, or
+ *  (at your option) any later version.
+ *
+ *  This program is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#pragma once
+
+#include <atomic>
+#include <cstddef>
+#include <cstdint>
+
+
+
+// Bounded multi-producer multi-consumer queue which never blocks nor allocates.
+//
+// Every cell carries a sequence number telling whether it's ready to be written (equal to the
+// position of the producer) or read (one past the position of the consumer). A producer claims
+// a position by advancing the enqueue counter, which only succeeds while the cell is free.
+template <typename T, size_t Capacity>
+class BoundedQueue
+{
+	static_assert(Capacity >= 2 && (Capacity & (Capacity - 1)) == 0, "capacity must be a power of 2");
+
+public:
+	BoundedQueue()
+		: m_cells()
+		, m_enqueuePos(0)
+		, m_dequeuePos(0)
+	{
+		for (size_t i = 0; i < Capacity; ++i)
+			m_cells[i].sequence.store(i, std::memory_order_relaxed);
+	}
+
+	BoundedQueue(const BoundedQueue&) = delete;
+	BoundedQueue& operator=(const BoundedQueue&) = delete;
+
+	// @return false if the queue is full
+	bool TryPush(const T& value)
+	{
+		size_t pos = m_enqueuePos.load(std::memory_order_relaxed);
+		for (;;) {
+			Cell& cell = m_cells[pos & (Capacity - 1)];
+			const size_t sequence = cell.sequence.load(std::memory_order_acquire);
+			const intptr_t diff = static_cast<intptr_t>(sequence) - static_cast<intptr_t>(pos);
+			if (diff == 0) {
+				if (m_enqueuePos.compare_exchange_weak(pos, pos + 1, std::memory_order_relaxed)) {
+					cell.value = value;
+					cell.sequence.store(pos + 1, std::memory_order_release);
+					return true;
+				}
+			}
+			else if (diff < 0)
+				return false;
+			else
+				pos = m_enqueuePos.load(std::memory_order_relaxed);
+		}
+	}
+
+	// @return false if the queue is empty
+	bool TryPop(T& out)
+	{
+		size_t pos = m_dequeuePos.load(std::memory_order_relaxed);
+		for (;;) {
+			Cell& cell = m_cells[pos & (Capacity - 1)];
+			const size_t sequence = cell.sequence.load(std::memory_order_acquire);
+			const intptr_t diff = static_cast<intptr_t>(sequence) - static_cast<intptr_t>(pos + 1);
+			if (diff == 0) {
+				if (m_dequeuePos.compare_exchange_weak(pos, pos + 1, std::memory_order_relaxed)) {
+					out = cell.value;
+					cell.sequence.store(pos + Capacity, std::memory_order_release);
+					return true;
+				}
+			}
+			else if (diff < 0)
+				return false;
+			else
+				pos = m_dequeuePos.load(std::memory_order_relaxed);
+		}
+	}
+
+
+private:
+	struct Cell
+	{
+		std::atomic<size_t> sequence;
+		T value;
+	};
+
+	static constexpr size_t c_cacheLineSize = 64;
+
+	Cell m_cells[Capacity];
+	uint8_t m_padding0[c_cacheLineSize];
+	std::atomic<size_t> m_enqueuePos;
+	uint8_t m_padding1[c_cacheLineSize];  // producers and consumers don't share a line
+	std::atomic<size_t> m_dequeuePos;
+};
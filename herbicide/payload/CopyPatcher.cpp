@@ -0,0 +1,177 @@
+/*
+ *  herbicide - removing flowers and rabbits in the game Mirror
+ *  Copyright (C) 2018 Mifan Bang <https://debug.tw>.
+ *
+ *  This program is free software: you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation, either version 3 of the License, or
+ *  (at your option) any later version.
+ *
+ *  This program is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include "CopyPatcher.h"
+
+#include <algorithm>
+
+#include "shared/util.h"
+#include "DxgiFormat.h"
+
+
+
+namespace {
+
+
+
+// a texture of $width x $height pixels holding $pixels, which the GPU only copies from
+bool CreateSource(DXGI_FORMAT format, UINT width, UINT height, const std::vector<uint8_t>& pixels, UINT pitch, const CopyPatcher::CreateFunc& create, Microsoft::WRL::ComPtr<ID3D11Texture2D>& out)
+{
+	D3D11_TEXTURE2D_DESC desc { };
+	desc.Width = width;
+	desc.Height = height;
+	desc.MipLevels = 1;
+	desc.ArraySize = 1;
+	desc.Format = format;
+	desc.SampleDesc.Count = 1;
+	desc.Usage = D3D11_USAGE_DEFAULT;
+	const D3D11_SUBRESOURCE_DATA data { pixels.data(), pitch, 0 };
+
+	Microsoft::WRL::ComPtr<ID3D11Texture2D> texture;
+	if (!create(desc, data, texture.GetAddressOf()) || texture == nullptr) {
+		LOG_WARNING(L"Failed to create a %ux%u texture of format %d to copy from\n", width, height, format);
+		return false;
+	}
+	out = std::move(texture);
+	return true;
+}
+
+
+
+}  // unnamed namespace
+
+
+
+CopyPatcher::CopyPatcher()
+	: m_lock()
+	, m_sources()
+{
+}
+
+
+bool CopyPatcher::Prepare(const D3D11_TEXTURE2D_DESC& desc, const DataFilterList& filters, const CreateFunc& create)
+{
+	// the GPU can't copy to dynamic textures, and the boxes of block formats are in blocks
+	if (desc.Usage == D3D11_USAGE_DYNAMIC || desc.Usage == D3D11_USAGE_IMMUTABLE || desc.SampleDesc.Count != 1 || IsBlockCompressed(desc.Format))
+		return false;
+	UINT pixelSize, rowCount;
+	if (!GetFormatLayout(desc.Format, 1, 1, pixelSize, rowCount))
+		return false;
+
+	std::lock_guard<std::mutex> lock(m_lock);
+	bool hasCopied = false;
+	for (const auto& filter : filters) {
+		const FilterDataAction& action = filter->GetAction();
+		if (!action.IsCopied())
+			continue;
+		const D3D11_RECT& rect = action.GetEraseRect();
+		CopyRegion region;
+		if (!GetCopyRegion(rect.left, rect.top, rect.right, rect.bottom, region) || !IsCopyRegionWithin(region, desc.Width, desc.Height))
+			return false;
+		const bool isReady = action.IsErase()
+			? action.GetStride() == pixelSize && PrepareBlank(desc.Format, region, pixelSize, create)
+			: action.GetPatch()->GetInfo().stride == pixelSize && PreparePatch(desc.Format, filter, create);
+		if (!isReady)
+			return false;
+		hasCopied = true;
+	}
+	return hasCopied;
+}
+
+
+size_t CopyPatcher::Issue(ID3D11DeviceContext* pContext, CopyFunc copy, ID3D11Resource* target, const CopiedActionList& actions)
+{
+	std::lock_guard<std::mutex> lock(m_lock);
+	size_t count = 0;
+	for (const auto& copied : actions) {
+		const FilterDataAction& action = copied.filter->GetAction();
+		const Source* source = Find(copied.format, action.GetPatch());
+		const D3D11_RECT& rect = action.GetEraseRect();
+		CopyRegion region;
+		if (source == nullptr || !GetCopyRegion(rect.left, rect.top, rect.right, rect.bottom, region))
+			continue;
+		const D3D11_BOX box { 0, 0, 0, region.width, region.height, 1 };
+		copy(pContext, target, 0, region.dstX, region.dstY, 0, source->texture.Get(), 0, &box);
+		++count;
+	}
+	return count;
+}
+
+
+CopyPatcher::Source* CopyPatcher::Find(DXGI_FORMAT format, const PixelPatch* patch)
+{
+	for (auto& source : m_sources) {
+		if (source.format == format && source.patch == patch)
+			return &source;
+	}
+	return nullptr;
+}
+
+
+// Copies of a blank take the top-left corner they need, so that a format has a single one. The
+// texture replaced by a larger one lives on as long as copies queued from it.
+bool CopyPatcher::PrepareBlank(DXGI_FORMAT format, const CopyRegion& region, UINT stride, const CreateFunc& create)
+{
+	Source* blank = Find(format, nullptr);
+	uint32_t width = blank != nullptr ? blank->width : 0;
+	uint32_t height = blank != nullptr ? blank->height : 0;
+	if (!GrowBlankSize(width, height, region))
+		return true;
+
+	const std::vector<uint8_t> zeros(static_cast<size_t>(width) * stride * height);
+	Microsoft::WRL::ComPtr<ID3D11Texture2D> texture;
+	if (!CreateSource(format, width, height, zeros, width * stride, create, texture))
+		return false;
+	if (blank == nullptr)
+		m_sources.push_back(Source { format, nullptr, nullptr, width, height, std::move(texture) });
+	else {
+		blank->width = width;
+		blank->height = height;
+		blank->texture = std::move(texture);
+	}
+	return true;
+}
+
+
+bool CopyPatcher::PreparePatch(DXGI_FORMAT format, const std::shared_ptr<DataFilter>& filter, const CreateFunc& create)
+{
+	const PixelPatch* patch = filter->GetAction().GetPatch();
+	if (Find(format, patch) != nullptr)
+		return true;
+	DropOrphans();
+
+	// the patch replaces every pixel, so it is applied over anything
+	const PatchInfo& info = patch->GetInfo();
+	const UINT pitch = info.width * info.stride;
+	std::vector<uint8_t> pixels(static_cast<size_t>(pitch) * info.height);
+	patch->Apply(pixels.data(), pitch);
+	Microsoft::WRL::ComPtr<ID3D11Texture2D> texture;
+	if (!CreateSource(format, info.width, info.height, pixels, pitch, create, texture))
+		return false;
+	m_sources.push_back(Source { format, patch, filter, info.width, info.height, std::move(texture) });
+	return true;
+}
+
+
+// the sources of patches whose filters were all dropped by reloads
+void CopyPatcher::DropOrphans()
+{
+	m_sources.erase(std::remove_if(m_sources.begin(), m_sources.end(), [](const Source& source) {
+		return source.owner != nullptr && source.owner.use_count() == 1;
+	}), m_sources.end());
+}
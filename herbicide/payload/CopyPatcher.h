@@ -0,0 +1,93 @@
+/*
+ *  herbicide - removing flowers and rabbits in the game Mirror
+ *  Copyright (C) 2018 Mifan Bang <https://debug.tw>.
+ *
+ *  This program is free software: you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation, either version 3 of the License, or
+ *  (at your option) any later version.
+ *
+ *  This program is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#pragma once
+
+#include <functional>
+#include <memory>
+#include <mutex>
+#include <vector>
+
+#pragma warning(push)
+#pragma warning(disable: 4005)  // macro redefinition
+#include <d3d11.h>
+#pragma warning(pop)
+#include <wrl/client.h>
+
+#include "CopyRegion.h"
+#include "TextureFilter.h"
+
+
+
+// Carries out the copied actions of ActionExecution::Copy. Their pixels are put into a texture
+// once, when a suspect they may apply to is created, and the GPU copies them over the rectangle
+// by CopySubresourceRegion() once the suspect has been unmapped; the CPU doesn't write a pixel
+// into the mapping. The copies are queued on the context which unmapped the suspect, after
+// the content written through the mapping and before any copy the application makes of it.
+//
+// Erasing needs zeros only, so the rectangles of one format share a blank texture, grown to the
+// largest of them. Patches each have a texture of their own, dropped once their filters are
+// gone. Textures the GPU can't copy to, and formats of blocks or whose pixels aren't of the size
+// of the action, are left to the CPU.
+class CopyPatcher
+{
+public:
+	// creates a source texture without it being taken for a suspect
+	using CreateFunc = std::function<bool (const D3D11_TEXTURE2D_DESC&, const D3D11_SUBRESOURCE_DATA&, ID3D11Texture2D**)>;
+
+	// the original CopySubresourceRegion()
+	using CopyFunc = void (WINAPI*)(ID3D11DeviceContext*, ID3D11Resource*, UINT, UINT, UINT, UINT, ID3D11Resource*, UINT, const D3D11_BOX*);
+
+
+	CopyPatcher();
+
+	CopyPatcher(const CopyPatcher&) = delete;
+	CopyPatcher& operator=(const CopyPatcher&) = delete;
+
+	// Have the sources of the copied actions of $filters ready for a texture described by
+	// $desc, creating those not cached yet through $create.
+	// @return whether the texture can take copies and every source is ready, for the suspect
+	//   to get $desc.Format as its copy format; the CPU writes its actions otherwise
+	bool Prepare(const D3D11_TEXTURE2D_DESC& desc, const DataFilterList& filters, const CreateFunc& create);
+
+	// Queue the copies of $actions onto the top level of $target, which has just been unmapped
+	// on $pContext, through $copy.
+	// @return number of copies queued
+	size_t Issue(ID3D11DeviceContext* pContext, CopyFunc copy, ID3D11Resource* target, const CopiedActionList& actions);
+
+
+private:
+	struct Source
+	{
+		DXGI_FORMAT format;
+		const PixelPatch* patch;  // nullptr for the blank of the format
+		std::shared_ptr<const DataFilter> owner;  // keeps $patch alive; none for a blank
+		UINT width;
+		UINT height;
+		Microsoft::WRL::ComPtr<ID3D11Texture2D> texture;
+	};
+
+	// with m_lock held
+	Source* Find(DXGI_FORMAT format, const PixelPatch* patch);
+	bool PrepareBlank(DXGI_FORMAT format, const CopyRegion& region, UINT stride, const CreateFunc& create);
+	bool PreparePatch(DXGI_FORMAT format, const std::shared_ptr<DataFilter>& filter, const CreateFunc& create);
+	void DropOrphans();
+
+	std::mutex m_lock;  // the device may create textures on any thread
+	std::vector<Source> m_sources;
+};
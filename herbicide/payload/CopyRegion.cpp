@@ -0,0 +1,51 @@
+/*
+ *  herbicide - removing flowers and rabbits in the game Mirror
+ *  Copyright (C) 2018 Mifan Bang <https://debug.tw>.
+ *
+ *  This program is free software: you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation, either version 3 of the License, or
+ *  (at your option) any later version.
+ *
+ *  This program is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include "CopyRegion.h"
+
+
+
+bool GetCopyRegion(int32_t left, int32_t top, int32_t right, int32_t bottom, CopyRegion& out)
+{
+	if (left < 0 || top < 0 || right < left || bottom < top)
+		return false;
+	out.dstX = static_cast<uint32_t>(left);
+	out.dstY = static_cast<uint32_t>(top);
+	out.width = static_cast<uint32_t>(right - left) + 1;
+	out.height = static_cast<uint32_t>(bottom - top) + 1;
+	return true;
+}
+
+
+bool IsCopyRegionWithin(const CopyRegion& region, uint32_t width, uint32_t height)
+{
+	return static_cast<uint64_t>(region.dstX) + region.width <= width
+		&& static_cast<uint64_t>(region.dstY) + region.height <= height;
+}
+
+
+bool GrowBlankSize(uint32_t& width, uint32_t& height, const CopyRegion& region)
+{
+	if (width >= region.width && height >= region.height)
+		return false;
+	if (width < region.width)
+		width = region.width;
+	if (height < region.height)
+		height = region.height;
+	return true;
+}
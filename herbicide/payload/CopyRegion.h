@@ -0,0 +1,47 @@
+/*
+ *  herbicide - removing flowers and rabbits in the game Mirror
+ *  Copyright (C) 2018 Mifan Bang <https://debug.tw>.
+ *
+ *  This program is free software: you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation, either version 3 of the License, or
+ *  (at your option) any later version.
+ *
+ *  This program is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#pragma once
+
+#include <cstdint>
+
+
+
+// Where a copied action lands and what it copies, in the terms of CopySubresourceRegion(). It is
+// kept apart from Direct3D so that the geometry can be tested on any platform.
+struct CopyRegion
+{
+	uint32_t dstX;  // top-left corner in the target
+	uint32_t dstY;
+	uint32_t width;  // of the box, which starts at the top-left corner of the source
+	uint32_t height;
+};
+
+
+
+// the region of an action on the inclusive rectangle from ($left, $top) to ($right, $bottom)
+// @return false for a rectangle which is empty or starts at negative coordinates
+bool GetCopyRegion(int32_t left, int32_t top, int32_t right, int32_t bottom, CopyRegion& out);
+
+// whether $region lies within a texture of $width x $height
+bool IsCopyRegionWithin(const CopyRegion& region, uint32_t width, uint32_t height);
+
+// Grow the size of a blank, $width x $height or 0 x 0 if there is none yet, so that copies of
+// $region can take its top-left corner.
+// @return whether the blank had to grow
+bool GrowBlankSize(uint32_t& width, uint32_t& height, const CopyRegion& region);
@@ -0,0 +1,132 @@
+/*
+ *  herbicide - removing flowers and rabbits in the game Mirror
+ *  Copyright (C) 2018 Mifan Bang <https://debug.tw>.
+ *
+ *  This program is free software: you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation, either version 3 of the License, or
+ *  (at your option) any later version.
+ *
+ *  This program is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include "DeferredContext.h"
+
+#include <utility>
+
+
+
+DeferredContextState::DeferredContextState()
+	: m_work()
+	, m_drawBindings()
+{
+}
+
+
+void DeferredContextState::OnPendingCopy(const PendingCopy& copy)
+{
+	m_work.pendingCopies.push_back(copy);
+}
+
+
+CommandListWork DeferredContextState::TakeWork()
+{
+	CommandListWork result;
+	std::swap(result, m_work);
+	return result;
+}
+
+
+void DeferredContextState::Inherit(const CommandListWork& work)
+{
+	m_work.pendingCopies.insert(m_work.pendingCopies.end(), work.pendingCopies.cbegin(), work.pendingCopies.cend());
+}
+
+
+
+DeferredContextRegistry::DeferredContextRegistry()
+	: m_contextLock()
+	, m_contexts()
+	, m_commandListLock()
+	, m_commandLists()
+{
+}
+
+
+DeferredContextState* DeferredContextRegistry::Register(void* context)
+{
+	std::unique_lock<std::shared_mutex> lock(m_contextLock);
+	auto& state = m_contexts[context];
+	state = std::make_unique<DeferredContextState>();
+	return state.get();
+}
+
+
+DeferredContextState* DeferredContextRegistry::Find(void* context) const
+{
+	std::shared_lock<std::shared_mutex> lock(m_contextLock);
+	auto itr = m_contexts.find(context);
+	return itr != m_contexts.cend() ? itr->second.get() : nullptr;
+}
+
+
+void DeferredContextRegistry::Unregister(void* context, const DeferredContextState* state)
+{
+	std::unique_lock<std::shared_mutex> lock(m_contextLock);
+	auto itr = m_contexts.find(context);
+	if (itr != m_contexts.end() && itr->second.get() == state)
+		m_contexts.erase(itr);
+}
+
+
+// a command list is never recorded into again, so its work is shared by every execution as is
+void DeferredContextRegistry::AttachToCommandList(void* commandList, CommandListWork&& work)
+{
+	std::shared_ptr<const CommandListWork> record;
+	if (!work.IsEmpty())
+		record = std::make_shared<const CommandListWork>(std::move(work));
+
+	// the address of a list released unnoticed may come back, with work of its own or none
+	std::lock_guard<std::mutex> lock(m_commandListLock);
+	if (record != nullptr)
+		m_commandLists[commandList] = std::move(record);
+	else
+		m_commandLists.erase(commandList);
+}
+
+
+std::shared_ptr<const CommandListWork> DeferredContextRegistry::FindCommandListWork(void* commandList) const
+{
+	std::lock_guard<std::mutex> lock(m_commandListLock);
+	auto itr = m_commandLists.find(commandList);
+	return itr != m_commandLists.cend() ? itr->second : nullptr;
+}
+
+
+void DeferredContextRegistry::ForgetCommandList(void* commandList, const CommandListWork* work)
+{
+	std::lock_guard<std::mutex> lock(m_commandListLock);
+	auto itr = m_commandLists.find(commandList);
+	if (itr != m_commandLists.end() && itr->second.get() == work)
+		m_commandLists.erase(itr);
+}
+
+
+size_t DeferredContextRegistry::GetContextCount() const
+{
+	std::shared_lock<std::shared_mutex> lock(m_contextLock);
+	return m_contexts.size();
+}
+
+
+size_t DeferredContextRegistry::GetCommandListCount() const
+{
+	std::lock_guard<std::mutex> lock(m_commandListLock);
+	return m_commandLists.size();
+}
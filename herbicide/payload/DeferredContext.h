@@ -0,0 +1,133 @@
+/*
+ *  herbicide - removing flowers and rabbits in the game Mirror
+ *  Copyright (C) 2018 Mifan Bang <https://debug.tw>.
+ *
+ *  This program is free software: you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation, either version 3 of the License, or
+ *  (at your option) any later version.
+ *
+ *  This program is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#pragma once
+
+#include <cstdint>
+#include <memory>
+#include <mutex>
+#include <shared_mutex>
+#include <unordered_map>
+#include <vector>
+
+#include "DrawSuppressor.h"
+
+
+
+// a copy from a suspect whose content was left unchecked by lazy mode
+struct PendingCopy
+{
+	void* src;
+	void* dst;
+	bool isWhole;
+};
+
+
+// what a command list leaves to be settled on the context which executes it
+struct CommandListWork
+{
+	std::vector<PendingCopy> pendingCopies;
+
+	bool IsEmpty() const	{ return pendingCopies.empty(); }
+};
+
+
+
+// What is recorded on one deferred context. Only the thread recording on that context
+// touches it, so nothing here is locked. Suspects are never mapped there: a deferred
+// context can only map dynamic resources.
+class DeferredContextState
+{
+public:
+	DeferredContextState();
+
+	// a deferred context can't map a staging texture, so the check waits for the execution
+	void OnPendingCopy(const PendingCopy& copy);
+
+	// hand the work since the last command list over to the next one
+	CommandListWork TakeWork();
+
+	// a command list executed on this context carries its work over into the next one
+	void Inherit(const CommandListWork& work);
+
+	DrawBindings& GetDrawBindings()		{ return m_drawBindings; }
+
+
+private:
+	CommandListWork m_work;
+	DrawBindings m_drawBindings;
+};
+
+
+
+// Keeps the state of every deferred context and the work recorded into command lists, which
+// is settled on the immediate context by ExecuteCommandList().
+//
+// Both live until the final Release() of their object. Once released, the address may be
+// taken by a new object at once, so the one to forget is the one looked up beforehand.
+class DeferredContextRegistry
+{
+public:
+	DeferredContextRegistry();
+
+	// a new context may reuse the address of a released one, so its state starts over
+	DeferredContextState* Register(void* context);
+	DeferredContextState* Find(void* context) const;
+
+	// Release() a context through $release, and forget it if that was the final one.
+	template <typename ReleaseFunc>
+	unsigned long ReleaseContext(void* context, ReleaseFunc release)
+	{
+		auto state = Find(context);
+		const unsigned long count = release();
+		if (count == 0 && state != nullptr)
+			Unregister(context, state);
+		return count;
+	}
+
+	void AttachToCommandList(void* commandList, CommandListWork&& work);
+
+	// A command list may be executed any number of times, and each execution settles the
+	// same work again.
+	std::shared_ptr<const CommandListWork> FindCommandListWork(void* commandList) const;
+
+	// Release() a command list through $release, and forget its work if that was the final one.
+	template <typename ReleaseFunc>
+	unsigned long ReleaseCommandList(void* commandList, ReleaseFunc release)
+	{
+		auto work = FindCommandListWork(commandList);
+		const unsigned long count = release();
+		if (count == 0 && work != nullptr)
+			ForgetCommandList(commandList, work.get());
+		return count;
+	}
+
+	size_t GetContextCount() const;
+	size_t GetCommandListCount() const;
+
+
+private:
+	void Unregister(void* context, const DeferredContextState* state);  // if its state is still $state
+	void ForgetCommandList(void* commandList, const CommandListWork* work);  // if its work is still $work
+
+	mutable std::shared_mutex m_contextLock;
+	std::unordered_map<void*, std::unique_ptr<DeferredContextState>> m_contexts;
+
+	mutable std::mutex m_commandListLock;
+	std::unordered_map<void*, std::shared_ptr<const CommandListWork>> m_commandLists;
+};
@@ -0,0 +1,168 @@
+/*
+ *  herbicide - removing flowers and rabbits in the game Mirror
+ *  Copyright (C) 2018 Mifan Bang <https://debug.tw>.
+ *
+ *  This program is free software: you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation, either version 3 of the License, or
+ *  (at your option) any later version.
+ *
+ *  This program is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include "DrawSuppressor.h"
+
+#include <algorithm>
+#include <mutex>
+
+
+
+DrawBindings::DrawBindings()
+	: m_views()
+	, m_boundCount(0)
+{
+}
+
+
+void DrawBindings::Clear()
+{
+	std::fill(std::begin(m_views), std::end(m_views), nullptr);
+	m_boundCount = 0;
+}
+
+
+
+DrawSuppressor::DrawSuppressor()
+	: m_lock()
+	, m_taggedResources()
+	, m_viewResources()
+	, m_taggedCount(0)
+	, m_skipCount(0)
+{
+}
+
+
+void DrawSuppressor::Tag(const void* resource)
+{
+	std::unique_lock<std::shared_mutex> lock(m_lock);
+	m_taggedResources.insert(resource);
+	m_taggedCount.store(m_taggedResources.size(), std::memory_order_relaxed);
+}
+
+
+void DrawSuppressor::Untag(const void* resource)
+{
+	if (m_taggedCount.load(std::memory_order_relaxed) == 0)
+		return;
+
+	std::unique_lock<std::shared_mutex> lock(m_lock);
+	m_taggedResources.erase(resource);
+	m_taggedCount.store(m_taggedResources.size(), std::memory_order_relaxed);
+}
+
+
+bool DrawSuppressor::IsTagged(const void* resource) const
+{
+	if (m_taggedCount.load(std::memory_order_relaxed) == 0)
+		return false;
+
+	std::shared_lock<std::shared_mutex> lock(m_lock);
+	return m_taggedResources.count(resource) > 0;
+}
+
+
+void DrawSuppressor::OnCopy(const void* dst, const void* src, bool isWhole)
+{
+	if (m_taggedCount.load(std::memory_order_relaxed) == 0)
+		return;
+
+	std::unique_lock<std::shared_mutex> lock(m_lock);
+	if (m_taggedResources.count(src) > 0)
+		m_taggedResources.insert(dst);
+	else if (isWhole)
+		m_taggedResources.erase(dst);
+	m_taggedCount.store(m_taggedResources.size(), std::memory_order_relaxed);
+}
+
+
+void DrawSuppressor::OnCreateResource(const void* resource)
+{
+	Untag(resource);
+}
+
+
+void DrawSuppressor::OnCreateView(const void* view, const void* resource)
+{
+	std::unique_lock<std::shared_mutex> lock(m_lock);
+	m_viewResources[view] = resource;
+}
+
+
+void DrawSuppressor::OnSetShaderResources(DrawBindings& bindings, unsigned int startSlot, unsigned int count, const void* const* views) const
+{
+	if (startSlot >= DrawBindings::c_slotCount)
+		return;
+	count = std::min(count, DrawBindings::c_slotCount - startSlot);
+
+	// views bound while nothing is tagged are never resolved
+	const bool hasTags = m_taggedCount.load(std::memory_order_relaxed) != 0;
+	std::shared_lock<std::shared_mutex> lock(m_lock, std::defer_lock);
+	if (hasTags)
+		lock.lock();
+
+	for (unsigned int i = 0; i < count; ++i) {
+		const void* view = views != nullptr ? views[i] : nullptr;
+		const void* tagged = hasTags && view != nullptr && IsViewTagged(view) ? view : nullptr;
+		const void*& slot = bindings.m_views[startSlot + i];
+		if (slot != nullptr)
+			--bindings.m_boundCount;
+		if (tagged != nullptr)
+			++bindings.m_boundCount;
+		slot = tagged;
+	}
+}
+
+
+bool DrawSuppressor::OnDraw(DrawBindings& bindings)
+{
+	if (bindings.m_boundCount == 0)
+		return false;
+
+	// the resource may have been given other content since the view was bound
+	std::shared_lock<std::shared_mutex> lock(m_lock);
+	for (auto& view : bindings.m_views) {
+		if (view == nullptr)
+			continue;
+		if (IsViewTagged(view)) {
+			m_skipCount.fetch_add(1, std::memory_order_relaxed);
+			return true;
+		}
+		view = nullptr;
+		--bindings.m_boundCount;
+	}
+	return false;
+}
+
+
+DrawSuppressor::Stats DrawSuppressor::GetStats() const
+{
+	std::shared_lock<std::shared_mutex> lock(m_lock);
+	Stats stats;
+	stats.taggedCount = m_taggedResources.size();
+	stats.viewCount = m_viewResources.size();
+	stats.skipCount = m_skipCount.load(std::memory_order_relaxed);
+	return stats;
+}
+
+
+bool DrawSuppressor::IsViewTagged(const void* view) const
+{
+	auto itr = m_viewResources.find(view);
+	return itr != m_viewResources.cend() && m_taggedResources.count(itr->second) > 0;
+}
@@ -0,0 +1,107 @@
+/*
+ *  herbicide - removing flowers and rabbits in the game Mirror
+ *  Copyright (C) 2018 Mifan Bang <https://debug.tw>.
+ *
+ *  This program is free software: you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation, either version 3 of the License, or
+ *  (at your option) any later version.
+ *
+ *  This program is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#pragma once
+
+#include <atomic>
+#include <cstdint>
+#include <shared_mutex>
+#include <unordered_map>
+#include <unordered_set>
+
+
+
+// The pixel shader slots of one context which hold views of tagged resources, as of the last
+// PSSetShaderResources(). Only the thread using that context touches it.
+class DrawBindings
+{
+public:
+	static constexpr unsigned int c_slotCount = 128;  // D3D11_COMMONSHADER_INPUT_RESOURCE_SLOT_COUNT
+
+	DrawBindings();
+
+	// the context state was reset
+	void Clear();
+
+
+private:
+	friend class DrawSuppressor;
+
+	const void* m_views[c_slotCount];  // nullptr unless the view was tagged when bound
+	unsigned int m_boundCount;
+};
+
+
+
+// Skips the draws which sample the overlay, as the alternative to erasing it from the pixels.
+//
+// A resource gets tagged once its content has been identified, and the tag follows copies of
+// that content into other resources. Views are resolved to their resources when bound, and a
+// draw is skipped while a view of a tagged resource is bound to the pixel shader. None of this
+// reads pixel data. Objects are only known by address; a new object at the address of a
+// released one always goes through a creation which resets what was known about the address.
+class DrawSuppressor
+{
+public:
+	struct Stats
+	{
+		uint64_t taggedCount;  // resources currently tagged
+		uint64_t viewCount;  // views known
+		uint64_t skipCount;  // draws skipped
+	};
+
+
+	DrawSuppressor();
+
+	DrawSuppressor(const DrawSuppressor&) = delete;
+	DrawSuppressor& operator=(const DrawSuppressor&) = delete;
+
+	// identification
+	void Tag(const void* resource);
+	void Untag(const void* resource);  // its content is about to be replaced
+	bool IsTagged(const void* resource) const;
+	bool IsAnyTagged() const		{ return m_taggedCount.load(std::memory_order_relaxed) != 0; }
+
+	// a whole copy carries the tag of $src over to $dst either way; a partial one can only add it
+	void OnCopy(const void* dst, const void* src, bool isWhole);
+
+	void OnCreateResource(const void* resource);
+	void OnCreateView(const void* view, const void* resource);
+
+	// $views may be nullptr to unbind $count slots
+	void OnSetShaderResources(DrawBindings& bindings, unsigned int startSlot, unsigned int count, const void* const* views) const;
+
+	// @return whether the draw must be skipped
+	bool OnDraw(DrawBindings& bindings);
+
+	Stats GetStats() const;
+
+
+private:
+	bool IsViewTagged(const void* view) const;  // with m_lock held
+
+	mutable std::shared_mutex m_lock;
+	std::unordered_set<const void*> m_taggedResources;
+
+	// Every view created while enabled, as a view may be created long before its resource gets
+	// tagged. Entries of released views stay until the address is reused by another view.
+	std::unordered_map<const void*, const void*> m_viewResources;
+
+	std::atomic<size_t> m_taggedCount;  // lets the hooks skip the lock while nothing is tagged
+	std::atomic<uint64_t> m_skipCount;
+};
@@ -0,0 +1,499 @@
+/*
+ *  herbicide - removing flowers and rabbits in the game Mirror
+ *  Copyright (C) 2018 Mifan Bang <https://debug.tw>.
+ *
+ *  This program is free software: you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation, either version 3 of the License, or
+ *  (at your option) any later version.
+ *
+ *  This program is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include "DumpStore.h"
+
+#include <atomic>
+#include <cstddef>
+#include <cstring>
+
+#include "shared/file.h"
+#include "shared/imagecodec.h"
+#include "shared/jobs.h"
+#include "DxgiFormat.h"
+
+
+
+namespace {
+
+
+
+constexpr uint32_t c_packMagic = 0x4B504248;  // "HBPK"
+constexpr uint32_t c_indexMagic = 0x58494248;  // "HBIX"
+constexpr uint32_t c_indexVersion = 1;
+constexpr uint32_t c_initialCapacity = 1 << 14;
+constexpr size_t c_logFlushSize = 64 << 10;
+
+
+HANDLE OpenStoreFile(const std::wstring& directory, const wchar_t* name, DWORD access)
+{
+	const std::wstring path = directory + L"\\" + name;
+	HANDLE hFile = ::CreateFileW(path.c_str(), access, FILE_SHARE_READ, nullptr, OPEN_ALWAYS, FILE_ATTRIBUTE_NORMAL, nullptr);
+	return hFile != INVALID_HANDLE_VALUE ? hFile : nullptr;
+}
+
+
+bool ReadAt(HANDLE hFile, uint64_t offset, void* buffer, DWORD size)
+{
+	OVERLAPPED overlapped { };
+	overlapped.Offset = static_cast<DWORD>(offset);
+	overlapped.OffsetHigh = static_cast<DWORD>(offset >> 32);
+	DWORD read;
+	return ::ReadFile(hFile, buffer, size, &read, &overlapped) != FALSE && read == size;
+}
+
+
+bool WriteAt(HANDLE hFile, uint64_t offset, const void* buffer, DWORD size)
+{
+	OVERLAPPED overlapped { };
+	overlapped.Offset = static_cast<DWORD>(offset);
+	overlapped.OffsetHigh = static_cast<DWORD>(offset >> 32);
+	DWORD written;
+	return ::WriteFile(hFile, buffer, size, &written, &overlapped) != FALSE && written == size;
+}
+
+
+bool Truncate(HANDLE hFile, uint64_t size)
+{
+	LARGE_INTEGER position;
+	position.QuadPart = static_cast<LONGLONG>(size);
+	return ::SetFilePointerEx(hFile, position, nullptr, FILE_BEGIN) != FALSE && ::SetEndOfFile(hFile) != FALSE;
+}
+
+
+ImageFormat GetImageFormat(DXGI_FORMAT format)
+{
+	switch (format) {
+	case DXGI_FORMAT_R8G8B8A8_UNORM:
+	case DXGI_FORMAT_R8G8B8A8_UNORM_SRGB:
+		return ImageFormat::Rgba8;
+	case DXGI_FORMAT_B8G8R8A8_UNORM:
+	case DXGI_FORMAT_B8G8R8A8_UNORM_SRGB:
+		return ImageFormat::Bgra8;
+	default:
+		return ImageFormat::Raw;
+	}
+}
+
+
+bool HashChunk(const DumpStore::Descriptor& desc, const uint8_t* rows, uint32_t rowCount, uint8_t (&key)[DumpStore::c_keySize])
+{
+	StreamHasher hasher;
+	const uint32_t layout[] = { desc.rowSize, rowCount };
+	hasher.Update(layout, sizeof(layout));
+	for (uint32_t row = 0; row < rowCount; ++row, rows += desc.rowPitch)
+		hasher.Update(rows, desc.rowSize);
+	return hasher.Finish(key);
+}
+
+
+// slots are picked by the leading bytes of the key, which is already a hash
+uint32_t GetHomeSlot(const uint8_t (&key)[DumpStore::c_keySize])
+{
+	uint32_t value;
+	memcpy(&value, key, sizeof(value));
+	return value;
+}
+
+
+
+}  // unnamed namespace
+
+
+
+// the header of store.idx, followed by $capacity entries
+struct DumpStore::IndexHeader
+{
+	uint32_t magic;
+	uint32_t version;
+	uint32_t capacity;  // a power of two
+	uint32_t count;
+	uint64_t packSize;  // length of the pack covered by the index; zero while it's being rebuilt
+	uint32_t reserved[10];
+};
+
+
+struct DumpStore::IndexEntry
+{
+	uint8_t key[c_keySize];
+	uint64_t offset;  // of the record header in the pack
+	uint32_t size;  // of the payload
+	RecordKind kind;  // RecordKindNone for a free slot
+	uint32_t reserved[4];
+};
+
+static_assert(sizeof(DumpStore::PackRecordHeader) == 48, "the pack format must not change");
+
+
+
+DumpStore::DumpStore()
+	: m_hPack(nullptr)
+	, m_hIndex(nullptr)
+	, m_hIndexMapping(nullptr)
+	, m_hLog(nullptr)
+	, m_index(nullptr)
+	, m_packSize(0)
+	, m_manifest()
+	, m_encoded()
+	, m_logBuffer()
+	, m_stats()
+	, m_jobs(nullptr)
+{
+}
+
+
+DumpStore::~DumpStore()
+{
+	Close();
+}
+
+
+bool DumpStore::Open(const std::wstring& directory)
+{
+	Close();
+	::CreateDirectoryW(directory.c_str(), nullptr);
+	m_hPack = OpenStoreFile(directory, L"store.pack", GENERIC_READ | GENERIC_WRITE);
+	m_hIndex = OpenStoreFile(directory, L"store.idx", GENERIC_READ | GENERIC_WRITE);
+	m_hLog = OpenStoreFile(directory, L"store.log", FILE_APPEND_DATA);
+	LARGE_INTEGER packSize;
+	LARGE_INTEGER indexSize;
+	if (m_hPack == nullptr || m_hIndex == nullptr || m_hLog == nullptr
+		|| ::GetFileSizeEx(m_hPack, &packSize) == FALSE || ::GetFileSizeEx(m_hIndex, &indexSize) == FALSE) {
+		Close();
+		return false;
+	}
+	m_packSize = static_cast<uint64_t>(packSize.QuadPart);
+
+	IndexHeader header;
+	const bool isIndexValid = static_cast<uint64_t>(indexSize.QuadPart) >= sizeof(header)
+		&& ReadAt(m_hIndex, 0, &header, sizeof(header))
+		&& header.magic == c_indexMagic
+		&& header.version == c_indexVersion
+		&& header.capacity >= c_initialCapacity
+		&& (header.capacity & (header.capacity - 1)) == 0
+		&& static_cast<uint64_t>(header.count) * 4 <= static_cast<uint64_t>(header.capacity) * 3
+		&& static_cast<uint64_t>(indexSize.QuadPart) == sizeof(IndexHeader) + static_cast<uint64_t>(header.capacity) * sizeof(IndexEntry)
+		&& header.packSize == m_packSize
+		&& MapIndex(header.capacity);
+	if (!isIndexValid && !RebuildIndex()) {
+		Close();
+		return false;
+	}
+	return true;
+}
+
+
+void DumpStore::Close()
+{
+	if (m_hLog != nullptr) {
+		FlushLog();
+		::CloseHandle(m_hLog);
+		m_hLog = nullptr;
+	}
+	m_logBuffer.clear();
+	UnmapIndex();
+	if (m_hIndex != nullptr) {
+		::CloseHandle(m_hIndex);
+		m_hIndex = nullptr;
+	}
+	if (m_hPack != nullptr) {
+		::CloseHandle(m_hPack);
+		m_hPack = nullptr;
+	}
+	m_packSize = 0;
+}
+
+
+bool DumpStore::Put(const Descriptor& desc, const uint8_t* data, const uint8_t (&signatureDigest)[c_keySize], uint32_t uploadId)
+{
+	if (!IsOpen() || data == nullptr || desc.rowCount == 0 || desc.rowSize == 0 || desc.rowSize > desc.rowPitch)
+		return false;
+
+	// hash the chunks first, so that nothing but the index is touched for known content
+	const uint32_t chunkCount = (desc.rowCount + c_chunkRows - 1) / c_chunkRows;
+	m_manifest.resize(sizeof(ObjectManifest) + static_cast<size_t>(chunkCount) * c_keySize);
+	ObjectManifest manifest;
+	manifest.width = desc.width;
+	manifest.height = desc.height;
+	manifest.format = static_cast<uint32_t>(desc.format);
+	manifest.rowPitch = desc.rowPitch;
+	manifest.rowSize = desc.rowSize;
+	manifest.rowCount = desc.rowCount;
+	manifest.chunkRows = c_chunkRows;
+	manifest.chunkCount = chunkCount;
+	memcpy(manifest.signatureDigest, signatureDigest, c_keySize);
+	memcpy(m_manifest.data(), &manifest, sizeof(manifest));
+
+	uint8_t (*chunkKeys)[c_keySize] = reinterpret_cast<uint8_t (*)[c_keySize]>(m_manifest.data() + sizeof(ObjectManifest));
+	std::atomic<bool> isHashed(true);
+	auto hashChunk = [&](size_t chunk) {
+		const uint32_t firstRow = static_cast<uint32_t>(chunk) * c_chunkRows;
+		const uint32_t rowCount = desc.rowCount - firstRow < c_chunkRows ? desc.rowCount - firstRow : c_chunkRows;
+		if (!HashChunk(desc, data + static_cast<size_t>(desc.rowPitch) * firstRow, rowCount, chunkKeys[chunk]))
+			isHashed.store(false, std::memory_order_relaxed);
+	};
+	if (m_jobs != nullptr)
+		m_jobs->ParallelFor(chunkCount, 1, hashChunk);
+	else {
+		for (uint32_t chunk = 0; chunk < chunkCount; ++chunk)
+			hashChunk(chunk);
+	}
+	if (!isHashed.load())
+		return false;
+
+	// everything but the signature digest, which follows from the rest
+	uint8_t objectKey[c_keySize];
+	StreamHasher hasher;
+	hasher.Update(&manifest, offsetof(ObjectManifest, signatureDigest));
+	hasher.Update(chunkKeys, static_cast<uint64_t>(chunkCount) * c_keySize);
+	if (!hasher.Finish(objectKey))
+		return false;
+
+	if (Find(objectKey) == nullptr) {
+		for (uint32_t chunk = 0; chunk < chunkCount; ++chunk) {
+			const uint32_t firstRow = chunk * c_chunkRows;
+			const uint32_t rowCount = desc.rowCount - firstRow < c_chunkRows ? desc.rowCount - firstRow : c_chunkRows;
+			if (!StoreChunk(desc, data + static_cast<size_t>(desc.rowPitch) * firstRow, rowCount, chunkKeys[chunk]))
+				return false;
+		}
+
+		uint64_t offset;
+		const uint32_t size = static_cast<uint32_t>(m_manifest.size());
+		if (!Append(RecordKindObject, objectKey, m_manifest.data(), size, offset) || Insert(objectKey, RecordKindObject, offset, size) == nullptr)
+			return false;
+		m_index->packSize = m_packSize;
+		++m_stats.newObjectCount;
+	}
+
+	UploadRecord record { };
+	FILETIME now;
+	::GetSystemTimeAsFileTime(&now);
+	record.time = (static_cast<uint64_t>(now.dwHighDateTime) << 32) | now.dwLowDateTime;
+	record.uploadId = uploadId;
+	memcpy(record.objectKey, objectKey, c_keySize);
+	const auto bytes = reinterpret_cast<const uint8_t*>(&record);
+	m_logBuffer.insert(m_logBuffer.end(), bytes, bytes + sizeof(record));
+	++m_stats.uploadCount;
+	return m_logBuffer.size() < c_logFlushSize || FlushLog();
+}
+
+
+bool DumpStore::FlushLog()
+{
+	if (m_hLog == nullptr || m_logBuffer.empty())
+		return m_hLog != nullptr;
+
+	DWORD written;
+	const bool isOk = ::WriteFile(m_hLog, m_logBuffer.data(), static_cast<DWORD>(m_logBuffer.size()), &written, nullptr) != FALSE
+		&& written == m_logBuffer.size();
+	m_logBuffer.clear();
+	return isOk;
+}
+
+
+DumpStore::IndexEntry* DumpStore::GetEntries()
+{
+	return reinterpret_cast<IndexEntry*>(m_index + 1);
+}
+
+
+DumpStore::IndexEntry* DumpStore::Find(const uint8_t (&key)[c_keySize])
+{
+	IndexEntry* const entries = GetEntries();
+	const uint32_t mask = m_index->capacity - 1;
+	uint32_t slot = GetHomeSlot(key) & mask;
+	for (uint32_t probe = 0; probe <= mask; ++probe, slot = (slot + 1) & mask) {
+		IndexEntry& entry = entries[slot];
+		if (entry.kind == RecordKindNone)
+			return nullptr;
+		if (memcmp(entry.key, key, c_keySize) == 0)
+			return &entry;
+	}
+	return nullptr;
+}
+
+
+DumpStore::IndexEntry* DumpStore::Insert(const uint8_t (&key)[c_keySize], RecordKind kind, uint64_t offset, uint32_t size)
+{
+	// keep the load factor at 3/4 at most
+	if ((static_cast<uint64_t>(m_index->count) + 1) * 4 > static_cast<uint64_t>(m_index->capacity) * 3 && !GrowIndex())
+		return nullptr;
+
+	IndexEntry* const entries = GetEntries();
+	const uint32_t mask = m_index->capacity - 1;
+	uint32_t slot = GetHomeSlot(key) & mask;
+	while (entries[slot].kind != RecordKindNone)
+		slot = (slot + 1) & mask;
+
+	// the kind goes last as it marks the slot as taken
+	IndexEntry& entry = entries[slot];
+	memcpy(entry.key, key, c_keySize);
+	entry.offset = offset;
+	entry.size = size;
+	entry.kind = kind;
+	++m_index->count;
+	return &entry;
+}
+
+
+bool DumpStore::MapIndex(uint32_t capacity)
+{
+	const uint64_t size = sizeof(IndexHeader) + static_cast<uint64_t>(capacity) * sizeof(IndexEntry);
+	if (size > SIZE_MAX)
+		return false;
+
+	// the file grows to the size of the mapping
+	m_hIndexMapping = ::CreateFileMappingW(m_hIndex, nullptr, PAGE_READWRITE, static_cast<DWORD>(size >> 32), static_cast<DWORD>(size), nullptr);
+	if (m_hIndexMapping == nullptr)
+		return false;
+	m_index = reinterpret_cast<IndexHeader*>(::MapViewOfFile(m_hIndexMapping, FILE_MAP_WRITE, 0, 0, static_cast<SIZE_T>(size)));
+	if (m_index == nullptr) {
+		::CloseHandle(m_hIndexMapping);
+		m_hIndexMapping = nullptr;
+		return false;
+	}
+	return true;
+}
+
+
+void DumpStore::InitIndex(uint32_t capacity)
+{
+	memset(m_index, 0, sizeof(IndexHeader) + static_cast<size_t>(capacity) * sizeof(IndexEntry));
+	m_index->magic = c_indexMagic;
+	m_index->version = c_indexVersion;
+	m_index->capacity = capacity;
+}
+
+
+void DumpStore::UnmapIndex()
+{
+	if (m_index != nullptr) {
+		::UnmapViewOfFile(m_index);
+		m_index = nullptr;
+	}
+	if (m_hIndexMapping != nullptr) {
+		::CloseHandle(m_hIndexMapping);
+		m_hIndexMapping = nullptr;
+	}
+}
+
+
+bool DumpStore::GrowIndex()
+{
+	const uint32_t capacity = m_index->capacity;
+	if (capacity > UINT32_MAX / 2)
+		return false;
+
+	std::vector<IndexEntry> entries;
+	entries.reserve(m_index->count);
+	const IndexEntry* const oldEntries = GetEntries();
+	for (uint32_t slot = 0; slot < capacity; ++slot) {
+		if (oldEntries[slot].kind != RecordKindNone)
+			entries.push_back(oldEntries[slot]);
+	}
+
+	// the pack size stays zero until every entry is back, so a crash in between forces a rebuild
+	const uint64_t packSize = m_index->packSize;
+	UnmapIndex();
+	if (!MapIndex(capacity * 2))
+		return false;
+	InitIndex(capacity * 2);
+	for (const auto& entry : entries)
+		Insert(entry.key, entry.kind, entry.offset, entry.size);
+	m_index->packSize = packSize;
+	return true;
+}
+
+
+bool DumpStore::RebuildIndex()
+{
+	UnmapIndex();
+	if (!Truncate(m_hIndex, 0) || !MapIndex(c_initialCapacity))
+		return false;
+	InitIndex(c_initialCapacity);
+
+	// a record cut short by a crash is dropped along with anything after it
+	uint64_t offset = 0;
+	PackRecordHeader header;
+	while (m_packSize - offset >= sizeof(header)) {
+		if (!ReadAt(m_hPack, offset, &header, sizeof(header)))
+			return false;
+		if (header.magic != c_packMagic
+			|| (header.kind != RecordKindChunk && header.kind != RecordKindObject)
+			|| m_packSize - offset - sizeof(header) < header.size)
+			break;
+		if (Find(header.key) == nullptr && Insert(header.key, header.kind, offset, header.size) == nullptr)
+			return false;
+		offset += sizeof(header) + header.size;
+	}
+	if (offset < m_packSize) {
+		if (!Truncate(m_hPack, offset))
+			return false;
+		m_packSize = offset;
+	}
+
+	m_index->packSize = m_packSize;
+	return true;
+}
+
+
+bool DumpStore::Append(RecordKind kind, const uint8_t (&key)[c_keySize], const void* payload, uint32_t size, uint64_t& offset)
+{
+	PackRecordHeader header { };
+	header.magic = c_packMagic;
+	header.kind = kind;
+	header.size = size;
+	memcpy(header.key, key, c_keySize);
+
+	// on failure the next record overwrites whatever got written
+	offset = m_packSize;
+	if (!WriteAt(m_hPack, offset, &header, sizeof(header)) || !WriteAt(m_hPack, offset + sizeof(header), payload, size))
+		return false;
+	m_packSize += sizeof(header) + size;
+	return true;
+}
+
+
+bool DumpStore::StoreChunk(const Descriptor& desc, const uint8_t* rows, uint32_t rowCount, const uint8_t (&key)[c_keySize])
+{
+	if (Find(key) != nullptr) {
+		++m_stats.sharedChunkCount;
+		return true;
+	}
+
+	// a self-contained image of the rows; for a block-compressed format a row is 4 pixels high
+	ImageInfo info;
+	info.width = desc.width;
+	info.height = IsBlockCompressed(desc.format) ? rowCount * 4 : rowCount;
+	info.format = GetImageFormat(desc.format);
+	info.sourceFormat = static_cast<uint32_t>(desc.format);
+	info.rowSize = desc.rowSize;
+	info.rowCount = rowCount;
+	if (info.format != ImageFormat::Raw && info.rowSize != info.width * 4)
+		info.format = ImageFormat::Raw;
+	if (!EncodeImage(info, rows, desc.rowPitch, m_encoded, 1))
+		return false;
+
+	uint64_t offset;
+	const uint32_t size = static_cast<uint32_t>(m_encoded.size());
+	if (!Append(RecordKindChunk, key, m_encoded.data(), size, offset) || Insert(key, RecordKindChunk, offset, size) == nullptr)
+		return false;
+	m_index->packSize = m_packSize;
+	++m_stats.newChunkCount;
+	return true;
+}
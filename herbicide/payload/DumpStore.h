@@ -0,0 +1,159 @@
+/*
+ *  herbicide - removing flowers and rabbits in the game Mirror
+ *  Copyright (C) 2018 Mifan Bang <https://debug.tw>.
+ *
+ *  This program is free software: you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation, either version 3 of the License, or
+ *  (at your option) any later version.
+ *
+ *  This program is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#pragma once
+
+#include <cstdint>
+#include <string>
+#include <vector>
+
+#pragma warning(push)
+#pragma warning(disable: 4005)  // macro redefinition
+#include <d3d11.h>
+#pragma warning(pop)
+#include <windows.h>
+
+class JobSystem;
+
+
+
+// Content-addressed store of dumped textures, deduplicated by chunks of rows.
+//
+// A directory holds three files:
+//   store.pack  append-only records, each a PackRecordHeader followed by its payload:
+//               a chunk is an image of up to c_chunkRows rows encoded with the image codec,
+//               and an object is an ObjectManifest followed by the keys of its chunks
+//   store.idx   memory-mapped open-addressing table from key to pack record
+//   store.log   append-only UploadRecord per upload, referring to an object
+// The key of a chunk is the SHA-256 of its layout and rows; the key of an object is the
+// SHA-256 of its descriptor and chunk keys. The pack and the log are the source of truth, and
+// the index is rebuilt from the pack when it doesn't cover the whole pack, e.g. after a crash.
+//
+// An upload whose content is already stored costs one index probe and a record appended to
+// an in-memory log buffer. Not thread-safe; the dump writer thread owns it.
+class DumpStore
+{
+public:
+	static constexpr uint32_t c_chunkRows = 64;
+	static constexpr unsigned int c_keySize = 32;
+
+	struct Descriptor
+	{
+		UINT width;
+		UINT height;
+		DXGI_FORMAT format;
+		UINT rowPitch;
+		UINT rowSize;  // bytes of pixels in a row, as given by GetFormatLayout()
+		UINT rowCount;
+	};
+
+	struct Stats
+	{
+		uint32_t uploadCount;
+		uint32_t newObjectCount;
+		uint32_t newChunkCount;
+		uint32_t sharedChunkCount;  // chunks of new objects which were already stored
+	};
+
+	enum RecordKind : uint32_t
+	{
+		RecordKindNone = 0,
+		RecordKindChunk = 1,
+		RecordKindObject = 2,
+	};
+
+	struct PackRecordHeader
+	{
+		uint32_t magic;  // "HBPK"
+		RecordKind kind;
+		uint32_t size;  // of the payload
+		uint32_t reserved;
+		uint8_t key[c_keySize];
+	};
+
+	struct ObjectManifest
+	{
+		uint32_t width;
+		uint32_t height;
+		uint32_t format;  // value of DXGI_FORMAT
+		uint32_t rowPitch;
+		uint32_t rowSize;
+		uint32_t rowCount;
+		uint32_t chunkRows;
+		uint32_t chunkCount;
+		uint8_t signatureDigest[c_keySize];  // as in signatures: packed, or padded if the layout is unknown
+	};
+
+	struct UploadRecord
+	{
+		uint64_t time;  // FILETIME
+		uint32_t uploadId;
+		uint32_t reserved;
+		uint8_t objectKey[c_keySize];
+	};
+
+
+	DumpStore();
+	~DumpStore();
+
+	DumpStore(const DumpStore&) = delete;
+	DumpStore& operator=(const DumpStore&) = delete;
+
+	bool Open(const std::wstring& directory);
+	void Close();  // flushes the log
+	bool IsOpen() const	{ return m_index != nullptr; }
+
+	// chunks are hashed on $jobs if set, which must outlive the store
+	void SetJobSystem(JobSystem* jobs)	{ m_jobs = jobs; }
+
+	// store the rows at $data unless stored before, and record the upload either way
+	bool Put(const Descriptor& desc, const uint8_t* data, const uint8_t (&signatureDigest)[c_keySize], uint32_t uploadId);
+
+	// write out the buffered upload records
+	bool FlushLog();
+
+	Stats GetStats() const	{ return m_stats; }
+
+
+private:
+	struct IndexHeader;
+	struct IndexEntry;
+
+	IndexEntry* GetEntries();
+	IndexEntry* Find(const uint8_t (&key)[c_keySize]);
+	IndexEntry* Insert(const uint8_t (&key)[c_keySize], RecordKind kind, uint64_t offset, uint32_t size);
+	bool MapIndex(uint32_t capacity);
+	void InitIndex(uint32_t capacity);
+	void UnmapIndex();
+	bool GrowIndex();
+	bool RebuildIndex();
+	bool Append(RecordKind kind, const uint8_t (&key)[c_keySize], const void* payload, uint32_t size, uint64_t& offset);
+	bool StoreChunk(const Descriptor& desc, const uint8_t* rows, uint32_t rowCount, const uint8_t (&key)[c_keySize]);
+
+	HANDLE m_hPack;
+	HANDLE m_hIndex;
+	HANDLE m_hIndexMapping;
+	HANDLE m_hLog;
+	IndexHeader* m_index;
+	uint64_t m_packSize;
+	std::vector<uint8_t> m_manifest;
+	std::vector<uint8_t> m_encoded;
+	std::vector<uint8_t> m_logBuffer;
+	Stats m_stats;
+	JobSystem* m_jobs;
+};
@@ -0,0 +1,33 @@
+/*
+ *  herbicide - removing flowers and rabbits in the game Mirror
+ *  Copyright (C) 2018 Mifan Bang <https://debug.tw>.
+ *
+ *  This program is free software: you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation, either version 3 of the License, or
+ *  (at your option) any later version.
+ *
+ *  This program is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#pragma once
+
+#pragma warning(push)
+#pragma warning(disable: 4005)  // macro redefinition
+#include <d3d11.h>
+#pragma warning(pop)
+
+
+
+bool IsBlockCompressed(DXGI_FORMAT format);
+
+// Size of the pixels of one row, without padding, and number of rows of a $width x $height
+// surface. A row of a block-compressed format is a row of 4x4 blocks.
+// @return false if the format isn't known
+bool GetFormatLayout(DXGI_FORMAT format, UINT width, UINT height, UINT& rowSize, UINT& rowCount);
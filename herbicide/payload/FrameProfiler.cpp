@@ -0,0 +1,163 @@
+/*
+ *  herbicide - removing flowers and rabbits in the game Mirror
+ *  Copyright (C) 2018 Mifan Bang <https://debug.tw>.
+ *
+ *  This program is free software: you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation, either version 3 of the License, or
+ *  (at your option) any later version.
+ *
+ *  This program is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include "FrameProfiler.h"
+
+#include <algorithm>
+
+#include "shared/util.h"
+#include "BackgroundJobs.h"
+
+
+
+namespace {
+
+
+
+void LogReport(const wchar_t* label, const FrameReport& report)
+{
+	LOG_INFO(L"Frames %s: %llu, frame us mean=%.0f p50=%.0f p90=%.0f p99=%.0f max=%.0f\n",
+		label, report.frameCount, report.frameUs.mean, report.frameUs.p50, report.frameUs.p90, report.frameUs.p99, report.frameUs.max);
+	LOG_INFO(L"Frames %s: detour us mean=%.1f p50=%.1f p99=%.1f max=%.1f, share=%.3f%%, calls=%.1f\n",
+		label, report.detourUs.mean, report.detourUs.p50, report.detourUs.p99, report.detourUs.max, report.detourShare * 100.0, report.callsPerFrame);
+}
+
+
+
+}  // unnamed namespace
+
+
+
+FrameProfiler::FrameProfiler()
+	: m_isEnabled(false)
+	, m_ticksPerSecond(1)
+	, m_startTicks(0)
+	, m_lastPresentTicks(0)
+	, m_detourTicks(0)
+	, m_detourCalls(0)
+	, m_records()
+	, m_trace(nullptr)
+	, m_unwritten()
+	, m_writing()
+	, m_traceWrite()
+	, m_isTraceFailed(false)
+{
+}
+
+
+FrameProfiler::~FrameProfiler()
+{
+	// at exit the worker of an unfinished write may be gone, so it isn't waited for
+	if (m_trace != nullptr && m_traceWrite.IsDone())
+		fclose(m_trace);
+}
+
+
+void FrameProfiler::Start(const wchar_t* tracePath)
+{
+	if (m_isEnabled.load())
+		return;
+
+	LARGE_INTEGER value;
+	::QueryPerformanceFrequency(&value);
+	m_ticksPerSecond = value.QuadPart;
+	::QueryPerformanceCounter(&value);
+	m_startTicks = value.QuadPart;
+	m_records.reserve(c_reportInterval);
+
+	if (tracePath != nullptr && _wfopen_s(&m_trace, tracePath, L"wb") == 0 && !WriteFrameTraceHeader(m_trace)) {
+		fclose(m_trace);
+		m_trace = nullptr;
+	}
+	m_isEnabled.store(true);
+}
+
+
+void FrameProfiler::OnPresent(bool isBypassed)
+{
+	if (!m_isEnabled.load(std::memory_order_relaxed))
+		return;
+
+	LARGE_INTEGER now;
+	::QueryPerformanceCounter(&now);
+	const int64_t detourTicks = m_detourTicks.exchange(0, std::memory_order_relaxed);
+	const uint32_t detourCalls = m_detourCalls.exchange(0, std::memory_order_relaxed);
+
+	// the time before the first Present() isn't a frame
+	if (m_lastPresentTicks != 0) {
+		FrameRecord record;
+		record.startNs = TicksToNs(m_lastPresentTicks - m_startTicks);
+		record.frameNs = static_cast<uint32_t>(std::min<uint64_t>(TicksToNs(now.QuadPart - m_lastPresentTicks), UINT32_MAX));
+		record.detourNs = static_cast<uint32_t>(std::min<uint64_t>(TicksToNs(detourTicks), UINT32_MAX));
+		record.detourCalls = detourCalls;
+		record.flags = isBypassed ? FrameRecord::c_bypassed : 0;
+		m_records.push_back(record);
+		if (m_records.size() >= c_reportInterval)
+			Report();
+	}
+	m_lastPresentTicks = now.QuadPart;
+}
+
+
+void FrameProfiler::Report()
+{
+	FrameReport report;
+	if (BuildFrameReport(m_records.data(), m_records.size(), false, report))
+		LogReport(L"active", report);
+	if (BuildFrameReport(m_records.data(), m_records.size(), true, report))
+		LogReport(L"bypassed", report);
+
+	if (m_trace != nullptr)
+		WriteTrace();
+	m_records.clear();
+}
+
+
+// Writing to the file is left to a background job so that the presenting thread never waits
+// for the disk. Records reported while the previous write is still running wait for the next
+// report.
+void FrameProfiler::WriteTrace()
+{
+	m_unwritten.insert(m_unwritten.end(), m_records.begin(), m_records.end());
+	if (!m_traceWrite.IsDone())
+		return;
+	if (m_isTraceFailed.load()) {
+		fclose(m_trace);
+		m_trace = nullptr;
+		m_unwritten.clear();
+		LOG_WARNING(L"Failed to write the frame trace\n");
+		return;
+	}
+
+	m_writing.swap(m_unwritten);
+	m_unwritten.clear();
+	GetBackgroundJobs().Submit([this]() {
+		if (!AppendFrameTrace(m_trace, m_writing.data(), m_writing.size()) || fflush(m_trace) != 0)
+			m_isTraceFailed.store(true);
+	}, &m_traceWrite);
+}
+
+
+uint64_t FrameProfiler::TicksToNs(int64_t ticks) const
+{
+	if (ticks <= 0)
+		return 0;
+	const uint64_t value = static_cast<uint64_t>(ticks);
+	const uint64_t frequency = static_cast<uint64_t>(m_ticksPerSecond);
+	return value / frequency * 1000000000 + value % frequency * 1000000000 / frequency;
+}
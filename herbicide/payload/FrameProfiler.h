@@ -0,0 +1,111 @@
+/*
+ *  herbicide - removing flowers and rabbits in the game Mirror
+ *  Copyright (C) 2018 Mifan Bang <https://debug.tw>.
+ *
+ *  This program is free software: you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation, either version 3 of the License, or
+ *  (at your option) any later version.
+ *
+ *  This program is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#pragma once
+
+#include <atomic>
+#include <cstdint>
+#include <cstdio>
+#include <vector>
+
+#include <windows.h>
+
+#include "shared/frameprofile.h"
+#include "shared/jobs.h"
+
+
+
+// Measures every frame from one Present() to the next, along with the time the detours spend
+// in it. Every c_reportInterval frames a summary goes to the log and the records are appended
+// to the trace file, if any, by a background job.
+class FrameProfiler
+{
+public:
+	static constexpr size_t c_reportInterval = 600;
+
+	FrameProfiler();
+	~FrameProfiler();
+
+	FrameProfiler(const FrameProfiler&) = delete;
+	FrameProfiler& operator=(const FrameProfiler&) = delete;
+
+	// call once, before any detour runs; $tracePath may be nullptr for no trace
+	void Start(const wchar_t* tracePath);
+	bool IsEnabled() const		{ return m_isEnabled.load(std::memory_order_relaxed); }
+
+	void AddDetourTime(int64_t ticks)
+	{
+		m_detourTicks.fetch_add(ticks, std::memory_order_relaxed);
+		m_detourCalls.fetch_add(1, std::memory_order_relaxed);
+	}
+
+	// call from the presenting thread, before the original Present()
+	void OnPresent(bool isBypassed);
+
+
+private:
+	void Report();
+	void WriteTrace();
+	uint64_t TicksToNs(int64_t ticks) const;
+
+	std::atomic<bool> m_isEnabled;
+	int64_t m_ticksPerSecond;
+	int64_t m_startTicks;
+	int64_t m_lastPresentTicks;
+	std::atomic<int64_t> m_detourTicks;  // of the current frame
+	std::atomic<uint32_t> m_detourCalls;
+	std::vector<FrameRecord> m_records;  // since the last report
+	FILE* m_trace;
+	std::vector<FrameRecord> m_unwritten;  // reported, waiting for the trace write to finish
+	std::vector<FrameRecord> m_writing;  // owned by the trace write while it runs
+	JobCounter m_traceWrite;
+	std::atomic<bool> m_isTraceFailed;
+};
+
+
+
+// measures the scope it lives in as time spent by a detour
+class ScopedDetourTime
+{
+public:
+	explicit ScopedDetourTime(FrameProfiler& profiler)
+		: m_profiler(profiler)
+		, m_start()
+	{
+		m_start.QuadPart = 0;
+		if (m_profiler.IsEnabled())
+			::QueryPerformanceCounter(&m_start);
+	}
+
+	~ScopedDetourTime()
+	{
+		if (m_start.QuadPart != 0) {
+			LARGE_INTEGER end;
+			::QueryPerformanceCounter(&end);
+			m_profiler.AddDetourTime(end.QuadPart - m_start.QuadPart);
+		}
+	}
+
+	ScopedDetourTime(const ScopedDetourTime&) = delete;
+	ScopedDetourTime& operator=(const ScopedDetourTime&) = delete;
+
+
+private:
+	FrameProfiler& m_profiler;
+	LARGE_INTEGER m_start;
+};
@@ -0,0 +1,62 @@
+/*
+ *  herbicide - removing flowers and rabbits in the game Mirror
+ *  Copyright (C) 2018 Mifan Bang <https://debug.tw>.
+ *
+ *  This program is free software: you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation, either version 3 of the License, or
+ *  (at your option) any later version.
+ *
+ *  This program is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include "Handoff.h"
+
+#include "shared/util.h"
+
+
+
+namespace {
+
+
+
+const HandoffHeader* s_handoff = nullptr;
+
+
+
+}  // unnamed namespace
+
+
+
+bool OpenHandoff()
+{
+	if (s_handoff != nullptr)
+		return true;
+
+	// leaked on purpose: detours read the toggles until the very end
+	auto section = new HandoffSection();
+	if (!section->Open(GetHandoffName().c_str(), false)) {
+		delete section;
+		return false;
+	}
+	s_handoff = GetHandoffHeader(section->GetData(), section->GetSize());
+	if (s_handoff == nullptr) {
+		LOG_WARNING(L"Ignoring a handoff of another build\n");
+		delete section;
+		return false;
+	}
+	LOG_INFO(L"Handoff from the launcher with %u signatures\n", s_handoff->recordCount);
+	return true;
+}
+
+
+const HandoffHeader* GetHandoff()
+{
+	return s_handoff;
+}
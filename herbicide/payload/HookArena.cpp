@@ -0,0 +1,145 @@
+/*
+ *  herbicide - removing flowers and rabbits in the game Mirror
+ *  Copyright (C) 2018 Mifan Bang <https://debug.tw>.
+ *
+ *  This program is free software: you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation, either version 3 of the License, or
+ *  (at your option) any later version.
+ *
+ *  This program is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include "HookArena.h"
+
+#include <atomic>
+#include <cstdlib>
+
+
+
+namespace {
+
+
+
+std::atomic<uint64_t> s_hookAllocationCount(0);
+
+
+
+}  // unnamed namespace
+
+
+
+HookArena& HookArena::Get()
+{
+	thread_local HookArena t_arena;
+	return t_arena;
+}
+
+
+HookArena::HookArena()
+	: m_base(nullptr)
+	, m_used(0)
+	, m_hookDepth(0)
+{
+}
+
+
+HookArena::~HookArena()
+{
+	free(m_base);
+}
+
+
+void* HookArena::Allocate(size_t size, size_t alignment)
+{
+	// malloc() keeps the one allocation per thread out of the audit
+	if (m_base == nullptr) {
+		m_base = static_cast<uint8_t*>(malloc(c_capacity));
+		if (m_base == nullptr)
+			return nullptr;
+	}
+
+	const size_t offset = (m_used + alignment - 1) & ~(alignment - 1);
+	if (offset > c_capacity || size > c_capacity - offset)
+		return nullptr;
+	m_used = offset + size;
+	return m_base + offset;
+}
+
+
+void HookArena::Free(void* ptr, size_t size)
+{
+	auto data = static_cast<uint8_t*>(ptr);
+	if (data + size == m_base + m_used)
+		m_used = data - m_base;
+}
+
+
+
+NodePool::NodePool()
+	: m_freeLists()
+{
+}
+
+
+NodePool::~NodePool()
+{
+	for (auto& freeList : m_freeLists) {
+		while (freeList.second != nullptr) {
+			FreeNode* node = freeList.second;
+			freeList.second = node->next;
+			::operator delete(node);
+		}
+	}
+}
+
+
+void* NodePool::Allocate(size_t size)
+{
+	auto& freeList = GetFreeList(size);
+	if (freeList == nullptr)
+		return ::operator new(size < sizeof(FreeNode) ? sizeof(FreeNode) : size);
+	FreeNode* node = freeList;
+	freeList = node->next;
+	return node;
+}
+
+
+void NodePool::Free(void* ptr, size_t size)
+{
+	auto& freeList = GetFreeList(size);
+	auto node = static_cast<FreeNode*>(ptr);
+	node->next = freeList;
+	freeList = node;
+}
+
+
+NodePool::FreeNode*& NodePool::GetFreeList(size_t size)
+{
+	for (auto& freeList : m_freeLists) {
+		if (freeList.first == size)
+			return freeList.second;
+	}
+	m_freeLists.emplace_back(size, nullptr);
+	return m_freeLists.back().second;
+}
+
+
+
+uint64_t GetHookAllocationCount()
+{
+	return s_hookAllocationCount.load(std::memory_order_relaxed);
+}
+
+
+void NoteHeapAllocation()
+{
+	if (HookArena::Get().IsInHook())
+		s_hookAllocationCount.fetch_add(1, std::memory_order_relaxed);
+}
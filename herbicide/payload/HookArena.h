@@ -0,0 +1,234 @@
+/*
+ *  herbicide - removing flowers and rabbits in the game Mirror
+ *  Copyright (C) 2018 Mifan Bang <https://debug.tw>.
+ *
+ *  This program is free software: you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation, either version 3 of the License, or
+ *  (at your option) any later version.
+ *
+ *  This program is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#pragma once
+
+#include <cstddef>
+#include <cstdint>
+#include <memory>
+#include <new>
+#include <utility>
+#include <vector>
+
+
+// Debug builds count the heap allocations made while a detour runs, see GetHookAllocationCount().
+#ifndef HERBICIDE_AUDIT_ALLOCATIONS
+#ifdef _DEBUG
+#define HERBICIDE_AUDIT_ALLOCATIONS 1
+#else
+#define HERBICIDE_AUDIT_ALLOCATIONS 0
+#endif  // _DEBUG
+#endif  // HERBICIDE_AUDIT_ALLOCATIONS
+
+
+
+// Bump allocator for the memory a detour needs only until it returns. Every thread has its own,
+// which a ScopedHookArena rewinds at the end of its scope, so nothing is ever freed one by one.
+// What doesn't fit comes from the heap instead.
+class HookArena
+{
+public:
+	static constexpr size_t c_capacity = 64 << 10;
+
+	// of the calling thread
+	static HookArena& Get();
+
+	HookArena();
+	~HookArena();
+
+	HookArena(const HookArena&) = delete;
+	HookArena& operator=(const HookArena&) = delete;
+
+	// @return nullptr if the arena is full
+	void* Allocate(size_t size, size_t alignment);
+
+	// only the latest allocation is taken back at once; the others wait for the rewind
+	void Free(void* ptr, size_t size);
+
+	bool Owns(const void* ptr) const
+	{
+		return m_base != nullptr && ptr >= m_base && ptr < m_base + c_capacity;
+	}
+
+	size_t GetMark() const			{ return m_used; }
+	void Rewind(size_t mark)		{ m_used = mark; }
+
+	bool IsInHook() const			{ return m_hookDepth > 0; }
+	void EnterHook()				{ ++m_hookDepth; }
+	void LeaveHook()				{ --m_hookDepth; }
+
+
+private:
+	uint8_t* m_base;  // allocated on first use, outside of the allocation audit
+	size_t m_used;
+	unsigned int m_hookDepth;
+};
+
+
+
+// Makes the scope it lives in a hook call: the arena memory taken in it is given back at its end.
+// Scopes nest, as a detour may call functions which open their own.
+class ScopedHookArena
+{
+public:
+	ScopedHookArena()
+		: m_arena(HookArena::Get())
+		, m_mark(m_arena.GetMark())
+	{
+		m_arena.EnterHook();
+	}
+
+	~ScopedHookArena()
+	{
+		m_arena.LeaveHook();
+		m_arena.Rewind(m_mark);
+	}
+
+	ScopedHookArena(const ScopedHookArena&) = delete;
+	ScopedHookArena& operator=(const ScopedHookArena&) = delete;
+
+
+private:
+	HookArena& m_arena;
+	size_t m_mark;
+};
+
+
+
+// Allocator of containers local to a ScopedHookArena, which must not outlive it.
+template <typename T>
+class ArenaAllocator
+{
+public:
+	using value_type = T;
+
+	ArenaAllocator() noexcept
+	{
+	}
+
+	template <typename U>
+	ArenaAllocator(const ArenaAllocator<U>&) noexcept
+	{
+	}
+
+	T* allocate(size_t count)
+	{
+		void* ptr = HookArena::Get().Allocate(count * sizeof(T), alignof(T));
+		return static_cast<T*>(ptr != nullptr ? ptr : ::operator new(count * sizeof(T)));
+	}
+
+	void deallocate(T* ptr, size_t count) noexcept
+	{
+		auto& arena = HookArena::Get();
+		if (arena.Owns(ptr))
+			arena.Free(ptr, count * sizeof(T));
+		else
+			::operator delete(ptr);
+	}
+};
+
+template <typename T, typename U>
+bool operator==(const ArenaAllocator<T>&, const ArenaAllocator<U>&)	{ return true; }
+template <typename T, typename U>
+bool operator!=(const ArenaAllocator<T>&, const ArenaAllocator<U>&)	{ return false; }
+
+template <typename T>
+using ArenaVector = std::vector<T, ArenaAllocator<T>>;
+
+
+
+// Keeps the nodes freed by a node-based container for the next ones of the same size, so that
+// a container whose size holds steady stops allocating. Arrays, like the buckets of a hash map,
+// come from the heap as usual. It is as thread-safe as the container using it.
+class NodePool
+{
+public:
+	NodePool();
+	~NodePool();
+
+	NodePool(const NodePool&) = delete;
+	NodePool& operator=(const NodePool&) = delete;
+
+	void* Allocate(size_t size);
+	void Free(void* ptr, size_t size);
+
+
+private:
+	struct FreeNode
+	{
+		FreeNode* next;
+	};
+
+	FreeNode*& GetFreeList(size_t size);
+
+	std::vector<std::pair<size_t, FreeNode*>> m_freeLists;  // by node size, there are few
+};
+
+
+template <typename T>
+class NodePoolAllocator
+{
+public:
+	using value_type = T;
+
+	explicit NodePoolAllocator(std::shared_ptr<NodePool> pool) noexcept
+		: m_pool(std::move(pool))
+	{
+	}
+
+	template <typename U>
+	NodePoolAllocator(const NodePoolAllocator<U>& other) noexcept
+		: m_pool(other.GetPool())
+	{
+	}
+
+	T* allocate(size_t count)
+	{
+		if (count == 1)
+			return static_cast<T*>(m_pool->Allocate(sizeof(T)));
+		return static_cast<T*>(::operator new(count * sizeof(T)));
+	}
+
+	void deallocate(T* ptr, size_t count) noexcept
+	{
+		if (count == 1)
+			m_pool->Free(ptr, sizeof(T));
+		else
+			::operator delete(ptr);
+	}
+
+	const std::shared_ptr<NodePool>& GetPool() const	{ return m_pool; }
+
+
+private:
+	std::shared_ptr<NodePool> m_pool;
+};
+
+template <typename T, typename U>
+bool operator==(const NodePoolAllocator<T>& lhs, const NodePoolAllocator<U>& rhs)	{ return lhs.GetPool() == rhs.GetPool(); }
+template <typename T, typename U>
+bool operator!=(const NodePoolAllocator<T>& lhs, const NodePoolAllocator<U>& rhs)	{ return lhs.GetPool() != rhs.GetPool(); }
+
+
+
+// Heap allocations made inside a ScopedHookArena since startup, counted in audit builds only;
+// once the game runs in a steady state it should stay put.
+uint64_t GetHookAllocationCount();
+
+// called by the replaced operator new of audit builds
+void NoteHeapAllocation();
@@ -0,0 +1,195 @@
+/*
+ *  herbicide - removing flowers and rabbits in the game Mirror
+ *  Copyright (C) 2018 Mifan Bang <https://debug.tw>.
+ *
+ *  This program is free software: you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation, either version 3 of the License, or
+ *  (at your option) any later version.
+ *
+ *  This program is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include "HookGovernor.h"
+
+#include "shared/util.h"
+
+
+
+namespace {
+
+
+
+constexpr HookGovernorConfig c_defaultConfig {
+	5000,   // idleWindowMs
+	0,      // frameBudgetUs
+	16667,  // framePeriodUs
+};
+
+
+int64_t MicrosecondsToTicks(uint32_t us)
+{
+	LARGE_INTEGER freq;
+	::QueryPerformanceFrequency(&freq);
+	return static_cast<int64_t>(us) * freq.QuadPart / 1000000;
+}
+
+
+
+}  // unnamed namespace
+
+
+
+HookGovernorConfig GetHookGovernorConfig()
+{
+	HookGovernorConfig config = c_defaultConfig;
+	GetEnvironmentUInt(L"HERBICIDE_IDLE_WINDOW_MS", config.idleWindowMs);
+	GetEnvironmentUInt(L"HERBICIDE_FRAME_BUDGET_US", config.frameBudgetUs);
+	GetEnvironmentUInt(L"HERBICIDE_FRAME_PERIOD_US", config.framePeriodUs);
+	if (config.framePeriodUs == 0)
+		config.framePeriodUs = c_defaultConfig.framePeriodUs;
+	return config;
+}
+
+
+
+HookGovernor::HookGovernor()
+	: m_config(c_defaultConfig)
+	, m_onBudgetExceeded(nullptr)
+	, m_hooks()
+	, m_hookCount(0)
+	, m_lock()
+	, m_lastMatchTime(GetTickCount64())
+	, m_isArmPending(false)
+	, m_budgetTicks(0)
+	, m_frameTicks(0)
+	, m_frameStart(0)
+	, m_frameOverhead(0)
+	, m_budgetDisarmFrame(0)
+{
+}
+
+
+// call before any governed hook is armed
+void HookGovernor::Configure(const HookGovernorConfig& config, void (*onBudgetExceeded)())
+{
+	std::lock_guard<std::mutex> lock(m_lock);
+	m_config = config;
+	m_onBudgetExceeded = onBudgetExceeded;
+	m_budgetTicks = MicrosecondsToTicks(config.frameBudgetUs);
+	m_frameTicks = MicrosecondsToTicks(config.framePeriodUs);
+}
+
+
+bool HookGovernor::Govern(VtableHook& hook)
+{
+	std::lock_guard<std::mutex> lock(m_lock);
+	const unsigned int hookCount = m_hookCount.load(std::memory_order_relaxed);
+	for (unsigned int i = 0; i < hookCount; ++i) {
+		if (m_hooks[i] == &hook)
+			return true;
+	}
+	if (hookCount >= c_maxHooks)
+		return false;
+	m_hooks[hookCount] = &hook;
+	m_hookCount.store(hookCount + 1, std::memory_order_release);
+	return true;
+}
+
+
+void HookGovernor::OnMatch()
+{
+	m_lastMatchTime.store(GetTickCount64(), std::memory_order_relaxed);
+	if (AreAllArmed())
+		return;
+
+	// arming at once would undo a disarm forced by the budget within the same frame
+	if (IsHeldByBudget()) {
+		m_isArmPending.store(true, std::memory_order_relaxed);
+		return;
+	}
+	std::lock_guard<std::mutex> lock(m_lock);
+	ArmAll();
+}
+
+
+void HookGovernor::OnFrame()
+{
+	if (!m_isArmPending.load(std::memory_order_relaxed) || IsHeldByBudget() || !m_isArmPending.exchange(false))
+		return;
+	std::lock_guard<std::mutex> lock(m_lock);
+	ArmAll();
+}
+
+
+void HookGovernor::AddOverhead(int64_t ticks)
+{
+	LARGE_INTEGER now;
+	::QueryPerformanceCounter(&now);
+
+	// a new frame starts once the period has elapsed; only one thread gets to reset the sum
+	int64_t frameStart = m_frameStart.load(std::memory_order_relaxed);
+	if (now.QuadPart - frameStart >= m_frameTicks && m_frameStart.compare_exchange_strong(frameStart, now.QuadPart))
+		m_frameOverhead.store(0, std::memory_order_relaxed);
+
+	if (m_frameOverhead.fetch_add(ticks, std::memory_order_relaxed) + ticks > m_budgetTicks) {
+		std::lock_guard<std::mutex> lock(m_lock);
+		if (DisarmAll()) {
+			m_budgetDisarmFrame.store(m_frameStart.load(std::memory_order_relaxed), std::memory_order_relaxed);
+			if (m_onBudgetExceeded != nullptr)
+				m_onBudgetExceeded();
+		}
+	}
+}
+
+
+bool HookGovernor::AreAllArmed() const
+{
+	const unsigned int hookCount = m_hookCount.load(std::memory_order_acquire);
+	for (unsigned int i = 0; i < hookCount; ++i) {
+		if (!m_hooks[i]->IsArmed())
+			return false;
+	}
+	return true;
+}
+
+
+bool HookGovernor::IsHeldByBudget() const
+{
+	const int64_t disarmFrame = m_budgetDisarmFrame.load(std::memory_order_relaxed);
+	if (disarmFrame == 0)
+		return false;
+	LARGE_INTEGER now;
+	::QueryPerformanceCounter(&now);
+	return now.QuadPart - disarmFrame < m_frameTicks;
+}
+
+
+void HookGovernor::ArmAll()
+{
+	const unsigned int hookCount = m_hookCount.load(std::memory_order_relaxed);
+	for (unsigned int i = 0; i < hookCount; ++i) {
+		if (!m_hooks[i]->IsArmed() && m_hooks[i]->Arm())
+			LOG_DEBUG(L"Hook %u armed\n", i);
+	}
+}
+
+
+bool HookGovernor::DisarmAll()
+{
+	bool hasDisarmed = false;
+	const unsigned int hookCount = m_hookCount.load(std::memory_order_relaxed);
+	for (unsigned int i = 0; i < hookCount; ++i) {
+		if (m_hooks[i]->IsArmed() && m_hooks[i]->Disarm()) {
+			LOG_DEBUG(L"Hook %u disarmed\n", i);
+			hasDisarmed = true;
+		}
+	}
+	return hasDisarmed;
+}
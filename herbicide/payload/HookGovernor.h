@@ -0,0 +1,140 @@
+/*
+ *  herbicide - removing flowers and rabbits in the game Mirror
+ *  Copyright (C) 2018 Mifan Bang <https://debug.tw>.
+ *
+ *  This program is free software: you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation, either version 3 of the License, or
+ *  (at your option) any later version.
+ *
+ *  This program is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#pragma once
+
+#include <atomic>
+#include <cstdint>
+#include <mutex>
+
+#include <windows.h>
+
+#include "detours/VtableHook.h"
+
+
+
+struct HookGovernorConfig
+{
+	uint32_t idleWindowMs;  // disarm once no descriptor matched for this long; 0 to never disarm
+	uint32_t frameBudgetUs;  // time per frame the governed detours may spend; 0 for no budget
+	uint32_t framePeriodUs;  // length of a frame as seen by the budget
+};
+
+// defaults, overridden by HERBICIDE_IDLE_WINDOW_MS, HERBICIDE_FRAME_BUDGET_US and HERBICIDE_FRAME_PERIOD_US
+HookGovernorConfig GetHookGovernorConfig();
+
+
+
+// Turns a set of hooks off while they have nothing to do and back on when they might.
+//
+// The governed hooks only matter while some texture is suspected. Once the suspects are gone
+// and no descriptor has matched for a while, the hooks are disarmed and calls go straight to
+// the original functions. A match arms them again before the matching texture can be mapped.
+class HookGovernor
+{
+public:
+	static constexpr unsigned int c_maxHooks = 6;  // Map(), Unmap() and UpdateSubresource() of two context vtables
+
+	HookGovernor();
+
+	HookGovernor(const HookGovernor&) = delete;
+	HookGovernor& operator=(const HookGovernor&) = delete;
+
+	// $onBudgetExceeded is called with the governor locked after the budget forced a disarm
+	void Configure(const HookGovernorConfig& config, void (*onBudgetExceeded)());
+	bool Govern(VtableHook& hook);  // the hook must be attached
+
+	// Call when a descriptor matched, after the suspect has been recorded. Hooks disarmed by the
+	// budget stay so for the rest of that frame; the match then arms them at OnFrame().
+	void OnMatch();
+
+	// call once per frame, e.g. from Present()
+	void OnFrame();
+
+	// call from a governed detour; $hasSuspects is called with the governor locked and must
+	// tell whether any suspect is outstanding
+	template <typename Pred>
+	void OnIdle(Pred hasSuspects)
+	{
+		const uint32_t window = m_config.idleWindowMs;
+		if (window == 0 || GetTickCount64() - m_lastMatchTime.load(std::memory_order_relaxed) < window)
+			return;
+
+		std::lock_guard<std::mutex> lock(m_lock);
+		if (GetTickCount64() - m_lastMatchTime.load(std::memory_order_relaxed) >= window && !hasSuspects())
+			DisarmAll();
+	}
+
+	// account time spent by a governed detour, excluding the original function
+	void AddOverhead(int64_t ticks);
+	bool HasBudget() const { return m_config.frameBudgetUs != 0; }
+
+
+private:
+	bool AreAllArmed() const;  // without locking
+	bool IsHeldByBudget() const;  // whether the frame of the last budget disarm is still running
+	void ArmAll();
+	bool DisarmAll();  // whether any hook was disarmed
+
+	HookGovernorConfig m_config;
+	void (*m_onBudgetExceeded)();
+	VtableHook* m_hooks[c_maxHooks];
+	std::atomic<unsigned int> m_hookCount;  // written under $m_lock, after the hook it counts
+	std::mutex m_lock;
+	std::atomic<uint64_t> m_lastMatchTime;
+	std::atomic<bool> m_isArmPending;  // a match was held back by the budget
+
+	int64_t m_budgetTicks;
+	int64_t m_frameTicks;
+	std::atomic<int64_t> m_frameStart;
+	std::atomic<int64_t> m_frameOverhead;
+	std::atomic<int64_t> m_budgetDisarmFrame;  // start of the frame the budget last disarmed in
+};
+
+
+
+// measures the scope it lives in as overhead of a governed detour
+class ScopedOverhead
+{
+public:
+	explicit ScopedOverhead(HookGovernor& governor)
+		: m_governor(governor)
+		, m_start()
+	{
+		m_start.QuadPart = 0;
+		if (m_governor.HasBudget())
+			::QueryPerformanceCounter(&m_start);
+	}
+
+	~ScopedOverhead()
+	{
+		if (m_start.QuadPart != 0) {
+			LARGE_INTEGER end;
+			::QueryPerformanceCounter(&end);
+			m_governor.AddOverhead(end.QuadPart - m_start.QuadPart);
+		}
+	}
+
+	ScopedOverhead(const ScopedOverhead&) = delete;
+	ScopedOverhead& operator=(const ScopedOverhead&) = delete;
+
+
+private:
+	HookGovernor& m_governor;
+	LARGE_INTEGER m_start;
+};
@@ -0,0 +1,72 @@
+/*
+ *  herbicide - removing flowers and rabbits in the game Mirror
+ *  Copyright (C) 2018 Mifan Bang <https://debug.tw>.
+ *
+ *  This program is free software: you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation, either version 3 of the License, or
+ *  (at your option) any later version.
+ *
+ *  This program is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include "LogFile.h"
+
+#include <stdio.h>
+
+#include "shared/util.h"
+
+
+
+namespace {
+
+
+
+FILE* s_logFile = nullptr;
+
+
+
+}  // unnamed namespace
+
+
+
+void StartLogging(bool hasConsole)
+{
+	uint32_t level = static_cast<uint32_t>(hasConsole ? LogLevel::Debug : LogLevel::Off);
+	GetEnvironmentUInt(L"HERBICIDE_LOG_LEVEL", level);
+	const LogLevel minLevel = level < static_cast<uint32_t>(LogLevel::Off) ? static_cast<LogLevel>(level) : LogLevel::Off;
+	if (hasConsole || minLevel == LogLevel::Off)
+		Logger::SetLevel(minLevel);
+	else
+		SetLoggingLevel(minLevel);
+}
+
+
+void StopLogging()
+{
+	Logger::Stop();
+	if (s_logFile != nullptr) {
+		fclose(s_logFile);
+		s_logFile = nullptr;
+	}
+}
+
+
+bool SetLoggingLevel(LogLevel level)
+{
+	if (level == LogLevel::Off || Logger::IsStarted()) {
+		Logger::SetLevel(level);
+		return true;
+	}
+	if (s_logFile == nullptr && _wfopen_s(&s_logFile, GetLogPath().c_str(), L"at, ccs=UTF-8") != 0) {
+		s_logFile = nullptr;
+		return false;
+	}
+	return Logger::Start(s_logFile, level);
+}
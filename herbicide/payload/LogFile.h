@@ -0,0 +1,33 @@
+/*
+ *  herbicide - removing flowers and rabbits in the game Mirror
+ *  Copyright (C) 2018 Mifan Bang <https://debug.tw>.
+ *
+ *  This program is free software: you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation, either version 3 of the License, or
+ *  (at your option) any later version.
+ *
+ *  This program is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#pragma once
+
+#include "shared/logger.h"
+
+
+
+// HERBICIDE_LOG_LEVEL picks the lowest LogLevel recorded. Records go to the debug console if
+// there is one; release builds write them into a file, opened once a level is enabled, by the
+// variable at startup or by the log-level toggle later on.
+void StartLogging(bool hasConsole);
+void StopLogging();
+
+// change the lowest LogLevel recorded, opening the log file if nothing records yet
+// @return false if that file can't be opened, in which case the level is left as it was
+bool SetLoggingLevel(LogLevel level);
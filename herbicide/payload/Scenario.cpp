@@ -0,0 +1,95 @@
+/*
+ *  herbicide - removing flowers and rabbits in the game Mirror
+ *  Copyright (C) 2018 Mifan Bang <https://debug.tw>.
+ *
+ *  This program is free software: you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation, either version 3 of the License, or
+ *  (at your option) any later version.
+ *
+ *  This program is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include "Scenario.h"
+
+#include <memory>
+#include <string>
+
+#include <windows.h>
+
+#include "shared/util.h"
+#include "Handoff.h"
+#include "SignatureWatcher.h"
+#include "scenarios/Mirror.h"
+
+
+
+namespace {
+
+
+
+ScenarioPackLoader s_loader;
+
+
+DWORD WINAPI LoadScenarioPack(LPVOID param)
+{
+	std::unique_ptr<std::wstring> imagePath(reinterpret_cast<std::wstring*>(param));
+	s_loader.Run(imagePath->c_str(), [](const ScenarioPack& pack, bool isVerified) {
+		const HandoffHeader* handoff = GetHandoff();
+		if (isVerified && handoff != nullptr)
+			InitDataFilters(pack.setupFilters, GetHandoffRecords(*handoff), handoff->recordCount, GetHandoffPatchData(*handoff), handoff->patchSize);
+		else if (isVerified)
+			InitDataFilters(pack.setupFilters, nullptr, 0, nullptr, 0);
+		LOG_INFO(L"Scenario pack '%s' %s\n", pack.name, isVerified ? L"loaded" : L"rejected: unknown build");
+		if (!isVerified)
+			LOG_WARNING(L"Running without built-in signatures\n");
+
+		// reloads are built on top of the built-in signatures, so those must be in place first.
+		// The file the launcher handed over is published with the pack already.
+		StartSignatureWatcher(isVerified && handoff != nullptr ? handoff->sourceWriteTime : 0);
+	});
+	return 0;
+}
+
+
+
+}  // unnamed namespace
+
+
+
+const ScenarioPackList& GetScenarioPacks()
+{
+	static const ScenarioPackList packs = {
+		&c_scenarioPackMirror,
+	};
+	return packs;
+}
+
+
+bool StartLoadingScenarioPack(const ScenarioPack& pack, const wchar_t* imagePath)
+{
+	if (!s_loader.Begin(pack))
+		return false;  // only one pack per process
+
+	auto param = new std::wstring(imagePath);
+	HANDLE hThread = ::CreateThread(nullptr, 0, LoadScenarioPack, param, 0, nullptr);
+	if (hThread == nullptr) {
+		delete param;
+		s_loader.Cancel();
+		return false;
+	}
+	::CloseHandle(hThread);
+	return true;
+}
+
+
+ScenarioPackState GetScenarioPackState()
+{
+	return s_loader.GetState();
+}
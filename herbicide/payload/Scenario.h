@@ -0,0 +1,69 @@
+/*
+ *  herbicide - removing flowers and rabbits in the game Mirror
+ *  Copyright (C) 2018 Mifan Bang <https://debug.tw>.
+ *
+ *  This program is free software: you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation, either version 3 of the License, or
+ *  (at your option) any later version.
+ *
+ *  This program is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#pragma once
+
+#include <cstdint>
+#include <vector>
+
+#include <Hook.h>
+
+#include "ScenarioPack.h"
+#include "TextureFilter.h"
+
+
+
+// set of hooks for a certain title
+class Scenario
+{
+public:
+	Scenario()
+		: m_hookList()
+	{ }
+
+	virtual ~Scenario()
+	{ }
+
+	void Start()
+	{
+		for (auto& hook : m_hookList)
+			hook.Install();
+	}
+
+	void Stop()
+	{
+		for (auto& hook : m_hookList)
+			hook.Uninstall();
+	}
+
+protected:
+	std::vector<gan::Hook> m_hookList;
+};
+
+
+
+// all packs built into the payload
+const ScenarioPackList& GetScenarioPacks();
+
+
+// Verify the image digest and publish the signatures of a pack from a new thread, then start
+// watching the signature file. This is meant to be called from DllMain(): the thread only runs
+// once the loader lock is released. Nothing waits for it.
+bool StartLoadingScenarioPack(const ScenarioPack& pack, const wchar_t* imagePath);
+
+ScenarioPackState GetScenarioPackState();
@@ -0,0 +1,120 @@
+/*
+ *  herbicide - removing flowers and rabbits in the game Mirror
+ *  Copyright (C) 2018 Mifan Bang <https://debug.tw>.
+ *
+ *  This program is free software: you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation, either version 3 of the License, or
+ *  (at your option) any later version.
+ *
+ *  This program is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include "ScenarioPack.h"
+
+#include <cstring>
+#include <cwctype>
+#include <type_traits>
+
+
+
+namespace {
+
+
+
+const PathChar* GetFileName(const PathChar* path)
+{
+	const PathChar* name = path;
+	for (const PathChar* ptr = path; *ptr != 0; ++ptr) {
+		if (*ptr == '\\' || *ptr == '/')
+			name = ptr + 1;
+	}
+	return name;
+}
+
+
+std::wint_t FoldCase(PathChar c)
+{
+	return std::towlower(static_cast<std::wint_t>(static_cast<std::make_unsigned_t<PathChar>>(c)));
+}
+
+
+bool EqualsIgnoreCase(const PathChar* lhs, const PathChar* rhs)
+{
+	for (; *lhs != 0 && *rhs != 0; ++lhs, ++rhs) {
+		if (FoldCase(*lhs) != FoldCase(*rhs))
+			return false;
+	}
+	return *lhs == *rhs;
+}
+
+
+
+}  // unnamed namespace
+
+
+
+const ScenarioPack* SelectScenarioPack(const PathChar* imagePath, const ScenarioPackList& packs)
+{
+	const PathChar* imageName = GetFileName(imagePath);
+	for (auto pack : packs) {
+		if (EqualsIgnoreCase(imageName, pack->imageName))
+			return pack;
+	}
+	return nullptr;
+}
+
+
+bool IsScenarioPackImage(const ScenarioPack& pack, const PathChar* imagePath)
+{
+	if (pack.imageDigest == nullptr)
+		return true;
+	uint8_t digest[StreamHasher::c_digestSize];
+	FileErrorCode errCode;
+	return HashFile(imagePath, digest, errCode) && memcmp(digest, pack.imageDigest, sizeof(digest)) == 0;
+}
+
+
+
+ScenarioPackLoader::ScenarioPackLoader()
+	: m_state(ScenarioPackState::None)
+	, m_pack(nullptr)
+{
+}
+
+
+bool ScenarioPackLoader::Begin(const ScenarioPack& pack)
+{
+	ScenarioPackState expected = ScenarioPackState::None;
+	if (!m_state.compare_exchange_strong(expected, ScenarioPackState::Loading))
+		return false;  // only one pack per process
+	m_pack = &pack;
+	return true;
+}
+
+
+ScenarioPackState ScenarioPackLoader::Run(const PathChar* imagePath, const PublishFunc& publish)
+{
+	if (m_state.load(std::memory_order_acquire) != ScenarioPackState::Loading || m_pack == nullptr)
+		return GetState();
+
+	// an unknown build keeps its hooks but gets no signatures at all
+	const bool isVerified = IsScenarioPackImage(*m_pack, imagePath);
+	publish(*m_pack, isVerified);
+	const ScenarioPackState state = isVerified ? ScenarioPackState::Loaded : ScenarioPackState::Rejected;
+	m_state.store(state, std::memory_order_release);
+	return state;
+}
+
+
+void ScenarioPackLoader::Cancel()
+{
+	m_pack = nullptr;
+	m_state.store(ScenarioPackState::None, std::memory_order_release);
+}
@@ -0,0 +1,96 @@
+/*
+ *  herbicide - removing flowers and rabbits in the game Mirror
+ *  Copyright (C) 2018 Mifan Bang <https://debug.tw>.
+ *
+ *  This program is free software: you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation, either version 3 of the License, or
+ *  (at your option) any later version.
+ *
+ *  This program is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#pragma once
+
+#include <atomic>
+#include <cstdint>
+#include <functional>
+#include <vector>
+
+#include "shared/file.h"
+
+
+class DataFilterFactory;
+class Scenario;
+
+
+
+// Everything specific to one title. Packs are chosen by the file name of the process image and,
+// optionally, by its SHA-256 digest so that signatures are never applied to an unknown build.
+struct ScenarioPack
+{
+	const wchar_t* name;
+	const PathChar* imageName;  // case-insensitive
+	const uint8_t* imageDigest;  // 32 bytes; nullptr to accept any build
+	Scenario* (*createScenario)();
+	void (*setupFilters)(DataFilterFactory&);  // see FilterSetupFunc
+};
+
+using ScenarioPackList = std::vector<const ScenarioPack*>;
+
+
+// pick the pack for a process by the file name in $imagePath; does no I/O
+// @return nullptr if no pack applies
+const ScenarioPack* SelectScenarioPack(const PathChar* imagePath, const ScenarioPackList& packs);
+
+// whether the image at $imagePath is the build $pack was made for; it's read as a whole if the
+// pack pins a digest
+bool IsScenarioPackImage(const ScenarioPack& pack, const PathChar* imagePath);
+
+
+
+enum class ScenarioPackState : uint32_t
+{
+	None,  // no pack is being loaded
+	Loading,
+	Loaded,
+	Rejected,  // the image isn't the build of the pack
+};
+
+
+// Loads one pack, once. Hooks never wait for it: until the pack is published, the filter set is
+// empty and nothing gets filtered.
+class ScenarioPackLoader
+{
+public:
+	// publishes the signatures of the pack, or none if the image is another build
+	using PublishFunc = std::function<void(const ScenarioPack& pack, bool isVerified)>;
+
+	ScenarioPackLoader();
+
+	ScenarioPackLoader(const ScenarioPackLoader&) = delete;
+	ScenarioPackLoader& operator=(const ScenarioPackLoader&) = delete;
+
+	// claim the loader for $pack; only the first call succeeds
+	bool Begin(const ScenarioPack& pack);
+
+	// verify the image and publish; meant for a thread of its own, as it may read the whole image
+	// @remark does nothing unless Begin() succeeded
+	ScenarioPackState Run(const PathChar* imagePath, const PublishFunc& publish);
+
+	// abandon a load whose thread couldn't be started
+	void Cancel();
+
+	ScenarioPackState GetState() const	{ return m_state.load(std::memory_order_acquire); }
+
+
+private:
+	std::atomic<ScenarioPackState> m_state;
+	const ScenarioPack* m_pack;
+};
@@ -0,0 +1,195 @@
+/*
+ *  herbicide - removing flowers and rabbits in the game Mirror
+ *  Copyright (C) 2018 Mifan Bang <https://debug.tw>.
+ *
+ *  This program is free software: you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation, either version 3 of the License, or
+ *  (at your option) any later version.
+ *
+ *  This program is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include "ShadowArena.h"
+
+#include <cstring>
+
+#ifdef _WIN32
+#include <windows.h>
+#else
+#include <sys/mman.h>
+#endif  // _WIN32
+
+#if defined(_M_IX86) || defined(_M_X64) || defined(__SSE2__)
+#define HAS_STREAMING_STORES	1
+#include <emmintrin.h>
+#else
+#define HAS_STREAMING_STORES	0
+#endif
+
+
+
+namespace {
+
+
+
+unsigned int GetSizeClass(size_t size, unsigned int minShift)
+{
+	unsigned int sizeClass = 0;
+	while ((static_cast<size_t>(1) << (minShift + sizeClass)) < size)
+		++sizeClass;
+	return sizeClass;
+}
+
+
+// cached, page-aligned memory
+#ifdef _WIN32
+
+uint8_t* AllocatePages(size_t size)
+{
+	return reinterpret_cast<uint8_t*>(::VirtualAlloc(nullptr, size, MEM_COMMIT | MEM_RESERVE, PAGE_READWRITE));
+}
+
+
+void FreePages(uint8_t* data, size_t)
+{
+	::VirtualFree(data, 0, MEM_RELEASE);
+}
+
+#else
+
+uint8_t* AllocatePages(size_t size)
+{
+	void* data = mmap(nullptr, size, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+	return data != MAP_FAILED ? static_cast<uint8_t*>(data) : nullptr;
+}
+
+
+void FreePages(uint8_t* data, size_t size)
+{
+	munmap(data, size);
+}
+
+#endif  // _WIN32
+
+
+
+}  // unnamed namespace
+
+
+
+ShadowArena::ShadowArena(size_t retainLimit)
+	: m_lock()
+	, m_pool()
+	, m_retainLimit(retainLimit)
+	, m_stats()
+{
+}
+
+
+ShadowArena::~ShadowArena()
+{
+	for (unsigned int sizeClass = 0; sizeClass < c_classCount; ++sizeClass) {
+		for (auto data : m_pool[sizeClass])
+			FreePages(data, static_cast<size_t>(1) << (c_minClassShift + sizeClass));
+	}
+}
+
+
+bool ShadowArena::Acquire(size_t size, Block& out)
+{
+	const unsigned int sizeClass = GetSizeClass(size, c_minClassShift);
+	if (sizeClass >= c_classCount)
+		return false;
+	const size_t classSize = static_cast<size_t>(1) << (c_minClassShift + sizeClass);
+
+	{
+		std::lock_guard<std::mutex> lock(m_lock);
+		++m_stats.acquireCount;
+		auto& pool = m_pool[sizeClass];
+		if (!pool.empty()) {
+			out.data = pool.back();
+			out.size = classSize;
+			pool.pop_back();
+			++m_stats.reuseCount;
+			m_stats.retainedBytes -= classSize;
+			return true;
+		}
+	}
+
+	out.data = AllocatePages(classSize);
+	out.size = classSize;
+	return out.data != nullptr;
+}
+
+
+void ShadowArena::Release(Block& block)
+{
+	if (block.data == nullptr)
+		return;
+
+	const unsigned int sizeClass = GetSizeClass(block.size, c_minClassShift);
+	{
+		std::lock_guard<std::mutex> lock(m_lock);
+		if (m_stats.retainedBytes + block.size <= m_retainLimit) {
+			m_pool[sizeClass].push_back(block.data);
+			m_stats.retainedBytes += block.size;
+			block.data = nullptr;
+			return;
+		}
+	}
+
+	FreePages(block.data, block.size);
+	block.data = nullptr;
+}
+
+
+ShadowArena::Stats ShadowArena::GetStats() const
+{
+	std::lock_guard<std::mutex> lock(m_lock);
+	return m_stats;
+}
+
+
+
+void StreamCopy(void* dst, const void* src, size_t size)
+{
+#if HAS_STREAMING_STORES
+	auto pDst = reinterpret_cast<uint8_t*>(dst);
+	auto pSrc = reinterpret_cast<const uint8_t*>(src);
+
+	// bring the destination to a 16-byte boundary; non-temporal stores require it
+	const size_t head = (16 - (reinterpret_cast<uintptr_t>(pDst) & 15)) & 15;
+	if (size <= head + 64) {
+		memcpy(pDst, pSrc, size);
+		return;
+	}
+	memcpy(pDst, pSrc, head);
+	pDst += head;
+	pSrc += head;
+	size -= head;
+
+	// whole 64-byte lines, so that each write-combining buffer is flushed complete
+	for (; size >= 64; size -= 64, pDst += 64, pSrc += 64) {
+		const __m128i v0 = _mm_loadu_si128(reinterpret_cast<const __m128i*>(pSrc));
+		const __m128i v1 = _mm_loadu_si128(reinterpret_cast<const __m128i*>(pSrc + 16));
+		const __m128i v2 = _mm_loadu_si128(reinterpret_cast<const __m128i*>(pSrc + 32));
+		const __m128i v3 = _mm_loadu_si128(reinterpret_cast<const __m128i*>(pSrc + 48));
+		_mm_stream_si128(reinterpret_cast<__m128i*>(pDst), v0);
+		_mm_stream_si128(reinterpret_cast<__m128i*>(pDst + 16), v1);
+		_mm_stream_si128(reinterpret_cast<__m128i*>(pDst + 32), v2);
+		_mm_stream_si128(reinterpret_cast<__m128i*>(pDst + 48), v3);
+	}
+	_mm_sfence();
+
+	memcpy(pDst, pSrc, size);
+#else
+	memcpy(dst, src, size);
+#endif  // HAS_STREAMING_STORES
+}
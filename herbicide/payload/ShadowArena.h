@@ -0,0 +1,73 @@
+/*
+ *  herbicide - removing flowers and rabbits in the game Mirror
+ *  Copyright (C) 2018 Mifan Bang <https://debug.tw>.
+ *
+ *  This program is free software: you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation, either version 3 of the License, or
+ *  (at your option) any later version.
+ *
+ *  This program is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#pragma once
+
+#include <cstddef>
+#include <cstdint>
+#include <mutex>
+#include <vector>
+
+
+
+// Pool of page-aligned buffers in ordinary cached memory, handed out in power-of-two size
+// classes so that the buffer of a texture uploaded every frame is reused instead of reallocated.
+class ShadowArena
+{
+public:
+	struct Block
+	{
+		uint8_t* data;
+		size_t size;  // of the size class, at least the size requested
+	};
+
+	struct Stats
+	{
+		uint64_t acquireCount;
+		uint64_t reuseCount;  // acquisitions served from the pool
+		size_t retainedBytes;  // in the pool, not handed out
+	};
+
+
+	// up to $retainLimit bytes of released blocks are kept for reuse
+	explicit ShadowArena(size_t retainLimit);
+	~ShadowArena();
+
+	ShadowArena(const ShadowArena&) = delete;
+	ShadowArena& operator=(const ShadowArena&) = delete;
+
+	bool Acquire(size_t size, Block& out);
+	void Release(Block& block);
+	Stats GetStats() const;
+
+
+private:
+	static constexpr unsigned int c_minClassShift = 16;  // 64 KiB
+	static constexpr unsigned int c_classCount = 12;  // up to 128 MiB
+
+	mutable std::mutex m_lock;
+	std::vector<uint8_t*> m_pool[c_classCount];
+	size_t m_retainLimit;
+	Stats m_stats;
+};
+
+
+
+// Copy $size bytes with non-temporal stores, which suits a destination in write-combined
+// memory that is never read back by the CPU. Without SSE2 this is a plain memcpy().
+void StreamCopy(void* dst, const void* src, size_t size);
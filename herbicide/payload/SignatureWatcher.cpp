@@ -0,0 +1,144 @@
+/*
+ *  herbicide - removing flowers and rabbits in the game Mirror
+ *  Copyright (C) 2018 Mifan Bang <https://debug.tw>.
+ *
+ *  This program is free software: you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation, either version 3 of the License, or
+ *  (at your option) any later version.
+ *
+ *  This program is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include "SignatureWatcher.h"
+
+#include <memory>
+
+#include "shared/util.h"
+#include "TextureFilter.h"
+
+
+
+namespace {
+
+
+
+// editors tend to save a file in several writes; wait for them to settle
+constexpr DWORD c_settleTimeMs = 200;
+
+// used when the directory cannot be watched for change notifications
+constexpr DWORD c_pollIntervalMs = 1000;
+
+
+std::unique_ptr<SignatureWatcher> s_watcher;
+
+
+
+}  // unnamed namespace
+
+
+
+SignatureWatcher::SignatureWatcher(const std::wstring& path, uint64_t loadedWriteTime)
+	: m_path(path)
+	, m_lastWriteTime(loadedWriteTime)
+	, m_hStopEvent(::CreateEventW(nullptr, TRUE, FALSE, nullptr))
+	, m_hThread(nullptr)
+{
+}
+
+
+SignatureWatcher::~SignatureWatcher()
+{
+	Stop();
+	if (m_hThread != nullptr)
+		::CloseHandle(m_hThread);
+	if (m_hStopEvent != nullptr)
+		::CloseHandle(m_hStopEvent);
+}
+
+
+bool SignatureWatcher::Start()
+{
+	if (m_hStopEvent == nullptr || m_hThread != nullptr)
+		return false;
+
+	m_hThread = ::CreateThread(nullptr, 0, ThreadProc, this, 0, nullptr);
+	if (m_hThread != nullptr)
+		::SetThreadPriority(m_hThread, THREAD_PRIORITY_BELOW_NORMAL);
+	return m_hThread != nullptr;
+}
+
+
+void SignatureWatcher::Stop()
+{
+	if (m_hStopEvent != nullptr)
+		::SetEvent(m_hStopEvent);
+}
+
+
+DWORD WINAPI SignatureWatcher::ThreadProc(LPVOID param)
+{
+	reinterpret_cast<SignatureWatcher*>(param)->Run();
+	return 0;
+}
+
+
+void SignatureWatcher::Run()
+{
+	ReloadIfChanged();
+
+	const std::wstring dir = m_path.substr(0, m_path.find_last_of(L"\\/") + 1);
+	HANDLE hChange = ::FindFirstChangeNotificationW(dir.c_str(), FALSE, FILE_NOTIFY_CHANGE_FILE_NAME | FILE_NOTIFY_CHANGE_LAST_WRITE | FILE_NOTIFY_CHANGE_SIZE);
+	if (hChange == INVALID_HANDLE_VALUE) {
+		LOG_WARNING(L"Cannot watch %s; polling instead\n", dir.c_str());
+		while (::WaitForSingleObject(m_hStopEvent, c_pollIntervalMs) == WAIT_TIMEOUT)
+			ReloadIfChanged();
+		return;
+	}
+
+	HANDLE handles[] = { m_hStopEvent, hChange };
+	while (::WaitForMultipleObjects(_countof(handles), handles, FALSE, INFINITE) == WAIT_OBJECT_0 + 1) {
+		if (::WaitForSingleObject(m_hStopEvent, c_settleTimeMs) != WAIT_TIMEOUT)
+			break;
+		ReloadIfChanged();
+		if (::FindNextChangeNotification(hChange) == FALSE)
+			break;
+	}
+	::FindCloseChangeNotification(hChange);
+}
+
+
+bool SignatureWatcher::ReloadIfChanged()
+{
+	const uint64_t lastWriteTime = GetLastWriteTime(m_path.c_str());
+	if (lastWriteTime == 0 || lastWriteTime == m_lastWriteTime)
+		return false;
+
+	m_lastWriteTime = lastWriteTime;
+	return ReloadDataFilters(m_path.c_str());
+}
+
+
+
+void StartSignatureWatcher(uint64_t loadedWriteTime)
+{
+	if (s_watcher != nullptr)
+		return;
+
+	s_watcher = std::make_unique<SignatureWatcher>(GetSignaturePath(), loadedWriteTime);
+	s_watcher->Start();
+}
+
+
+void StopSignatureWatcher()
+{
+	// the object is leaked on purpose: its thread may still be running
+	if (s_watcher != nullptr)
+		s_watcher.release()->Stop();
+}
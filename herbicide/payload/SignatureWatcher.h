@@ -0,0 +1,63 @@
+/*
+ *  herbicide - removing flowers and rabbits in the game Mirror
+ *  Copyright (C) 2018 Mifan Bang <https://debug.tw>.
+ *
+ *  This program is free software: you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation, either version 3 of the License, or
+ *  (at your option) any later version.
+ *
+ *  This program is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#pragma once
+
+#include <cstdint>
+#include <string>
+
+#include <windows.h>
+
+
+
+// Watches a signature file from a background thread and republishes the filter set
+// whenever the file changes, so that new signatures apply without restarting the game.
+class SignatureWatcher
+{
+public:
+	// the file is loaded at start unless it was last written at $loadedWriteTime, as that content
+	// is published already
+	SignatureWatcher(const std::wstring& path, uint64_t loadedWriteTime);
+	~SignatureWatcher();
+
+	SignatureWatcher(const SignatureWatcher&) = delete;
+	SignatureWatcher& operator=(const SignatureWatcher&) = delete;
+
+	bool Start();
+
+	// only signals the thread to quit as it's likely called with the loader lock held
+	void Stop();
+
+
+private:
+	static DWORD WINAPI ThreadProc(LPVOID param);
+	void Run();
+	bool ReloadIfChanged();
+
+	std::wstring m_path;
+	uint64_t m_lastWriteTime;
+	HANDLE m_hStopEvent;
+	HANDLE m_hThread;
+};
+
+
+
+// start watching the file of GetSignaturePath(); subsequent calls do nothing
+// @param loadedWriteTime see SignatureWatcher::SignatureWatcher()
+void StartSignatureWatcher(uint64_t loadedWriteTime);
+void StopSignatureWatcher();
@@ -0,0 +1,116 @@
+/*
+ *  herbicide - removing flowers and rabbits in the game Mirror
+ *  Copyright (C) 2018 Mifan Bang <https://debug.tw>.
+ *
+ *  This program is free software: you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation, either version 3 of the License, or
+ *  (at your option) any later version.
+ *
+ *  This program is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#pragma once
+
+#include <atomic>
+#include <cstdint>
+#include <memory>
+#include <mutex>
+#include <thread>
+
+
+
+// Publishes immutable snapshots of T to readers which never lock or wait.
+//
+// This is a two-counter epoch scheme in the spirit of sleepable RCU. A reader registers
+// itself under the current epoch's counter before loading the snapshot pointer. After
+// swapping in a new snapshot, the publisher flips the epoch twice and waits each time for
+// the counter of the previous epoch to drain. Any reader still holding the old snapshot
+// must have registered before the swap, so the old snapshot is unused after both drains.
+template <typename T>
+class SnapshotPublisher
+{
+public:
+	class ReadGuard
+	{
+	public:
+		ReadGuard(const ReadGuard&) = delete;
+		ReadGuard& operator=(const ReadGuard&) = delete;
+
+		~ReadGuard()
+		{
+			m_counter.fetch_sub(1, std::memory_order_release);
+		}
+
+		const T* operator->() const	{ return m_snapshot; }
+		const T& operator*() const	{ return *m_snapshot; }
+		const T* Get() const		{ return m_snapshot; }
+
+
+	private:
+		friend class SnapshotPublisher;
+
+		explicit ReadGuard(std::atomic<uint32_t>& counter, const std::atomic<T*>& current)
+			: m_counter(counter)
+			, m_snapshot(nullptr)
+		{
+			m_counter.fetch_add(1, std::memory_order_seq_cst);
+			m_snapshot = current.load(std::memory_order_seq_cst);
+		}
+
+		std::atomic<uint32_t>& m_counter;
+		const T* m_snapshot;
+	};
+
+
+	explicit SnapshotPublisher(std::unique_ptr<T> initial)
+		: m_current(initial.release())
+		, m_epoch(0)
+		, m_readers()
+		, m_publishLock()
+	{
+	}
+
+	~SnapshotPublisher()
+	{
+		delete m_current.load();
+	}
+
+	SnapshotPublisher(const SnapshotPublisher&) = delete;
+	SnapshotPublisher& operator=(const SnapshotPublisher&) = delete;
+
+	// wait-free; the snapshot stays valid for as long as the guard lives
+	ReadGuard Read() const
+	{
+		const uint32_t epoch = m_epoch.load(std::memory_order_seq_cst);
+		return ReadGuard(m_readers[epoch & 1], m_current);
+	}
+
+	// Blocks the calling thread, never the readers, until the replaced snapshot can be freed.
+	// Call it from a background thread.
+	void Publish(std::unique_ptr<T> next)
+	{
+		std::lock_guard<std::mutex> lock(m_publishLock);
+
+		T* old = m_current.exchange(next.release(), std::memory_order_seq_cst);
+		for (int phase = 0; phase < 2; ++phase) {
+			const uint32_t prevEpoch = m_epoch.fetch_add(1, std::memory_order_seq_cst);
+			while (m_readers[prevEpoch & 1].load(std::memory_order_acquire) != 0)
+				std::this_thread::yield();
+		}
+		delete old;
+	}
+
+
+private:
+	std::atomic<T*> m_current;
+	std::atomic<uint32_t> m_epoch;
+	mutable std::atomic<uint32_t> m_readers[2];
+	std::mutex m_publishLock;
+};
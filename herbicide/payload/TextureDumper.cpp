@@ -0,0 +1,438 @@
+/*
+ *  herbicide - removing flowers and rabbits in the game Mirror
+ *  Copyright (C) 2018 Mifan Bang <https://debug.tw>.
+ *
+ *  This program is free software: you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation, either version 3 of the License, or
+ *  (at your option) any later version.
+ *
+ *  This program is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include "TextureDumper.h"
+
+#include <cstring>
+
+#include <wincodec.h>
+#include <wrl/client.h>
+
+#include <Handle.h>
+#include <Hash.h>
+
+#include "shared/imagecodec.h"
+#include "shared/signature.h"
+#include "shared/util.h"
+#include "BackgroundJobs.h"
+#include "DxgiFormat.h"
+
+#pragma comment(lib, "windowscodecs.lib")
+
+
+
+namespace {
+
+
+
+constexpr size_t c_defaultMemoryBudget = static_cast<size_t>(512) << 20;
+
+constexpr DWORD c_logFlushIntervalMs = 1000;
+
+std::atomic<TextureDumper*> s_dumper(nullptr);
+
+
+// ref: DDS_HEADER and DDS_HEADER_DXT10 in the DirectX SDK
+struct DdsPixelFormat
+{
+	uint32_t size;
+	uint32_t flags;
+	uint32_t fourCC;
+	uint32_t rgbBitCount;
+	uint32_t bitMask[4];
+};
+
+struct DdsHeader
+{
+	uint32_t magic;
+	uint32_t size;
+	uint32_t flags;
+	uint32_t height;
+	uint32_t width;
+	uint32_t pitchOrLinearSize;
+	uint32_t depth;
+	uint32_t mipMapCount;
+	uint32_t reserved1[11];
+	DdsPixelFormat pixelFormat;
+	uint32_t caps[4];
+	uint32_t reserved2;
+
+	// DX10 extension
+	uint32_t dxgiFormat;
+	uint32_t resourceDimension;
+	uint32_t miscFlag;
+	uint32_t arraySize;
+	uint32_t miscFlags2;
+};
+
+
+// any format, block-compressed ones included, as the texture is stored as is
+bool WriteDds(const std::wstring& path, const uint8_t* data, UINT rowPitch, UINT rowSize, UINT rowCount, UINT width, UINT height, DXGI_FORMAT format)
+{
+	DdsHeader header { };
+	header.magic = 0x20534444;  // "DDS "
+	header.size = 124;
+	header.flags = 0x1 | 0x2 | 0x4 | 0x1000 | (IsBlockCompressed(format) ? 0x80000 : 0x8);
+	header.height = height;
+	header.width = width;
+	header.pitchOrLinearSize = IsBlockCompressed(format) ? rowSize * rowCount : rowSize;
+	header.depth = 1;
+	header.mipMapCount = 1;
+	header.pixelFormat.size = 32;
+	header.pixelFormat.flags = 0x4;  // DDPF_FOURCC
+	header.pixelFormat.fourCC = 0x30315844;  // "DX10"
+	header.caps[0] = 0x1000;  // DDSCAPS_TEXTURE
+	header.dxgiFormat = static_cast<uint32_t>(format);
+	header.resourceDimension = 3;  // D3D10_RESOURCE_DIMENSION_TEXTURE2D
+	header.arraySize = 1;
+
+	gan::AutoWinHandle hFile = ::CreateFileW(path.c_str(), GENERIC_WRITE, 0, nullptr, CREATE_ALWAYS, FILE_ATTRIBUTE_NORMAL, nullptr);
+	if (hFile == INVALID_HANDLE_VALUE)
+		return false;
+
+	DWORD written;
+	if (::WriteFile(hFile, &header, sizeof(header), &written, nullptr) == FALSE || written != sizeof(header))
+		return false;
+	for (UINT row = 0; row < rowCount; ++row, data += rowPitch) {
+		if (::WriteFile(hFile, data, rowSize, &written, nullptr) == FALSE || written != rowSize)
+			return false;
+	}
+	return true;
+}
+
+
+bool WriteBlob(const std::wstring& path, const std::vector<uint8_t>& blob)
+{
+	gan::AutoWinHandle hFile = ::CreateFileW(path.c_str(), GENERIC_WRITE, 0, nullptr, CREATE_ALWAYS, FILE_ATTRIBUTE_NORMAL, nullptr);
+	if (hFile == INVALID_HANDLE_VALUE)
+		return false;
+
+	DWORD written;
+	return ::WriteFile(hFile, blob.data(), static_cast<DWORD>(blob.size()), &written, nullptr) != FALSE && written == blob.size();
+}
+
+
+// 32-bit RGBA and BGRA only, which covers what the game uploads
+bool WritePng(IWICImagingFactory* factory, const std::wstring& path, const uint8_t* data, UINT rowPitch, UINT width, UINT height)
+{
+	using Microsoft::WRL::ComPtr;
+
+	ComPtr<IWICStream> stream;
+	ComPtr<IWICBitmapEncoder> encoder;
+	ComPtr<IWICBitmapFrameEncode> frame;
+	WICPixelFormatGUID pixelFormat = GUID_WICPixelFormat32bppBGRA;
+	return SUCCEEDED(factory->CreateStream(&stream))
+		&& SUCCEEDED(stream->InitializeFromFilename(path.c_str(), GENERIC_WRITE))
+		&& SUCCEEDED(factory->CreateEncoder(GUID_ContainerFormatPng, nullptr, &encoder))
+		&& SUCCEEDED(encoder->Initialize(stream.Get(), WICBitmapEncoderNoCache))
+		&& SUCCEEDED(encoder->CreateNewFrame(&frame, nullptr))
+		&& SUCCEEDED(frame->Initialize(nullptr))
+		&& SUCCEEDED(frame->SetSize(width, height))
+		&& SUCCEEDED(frame->SetPixelFormat(&pixelFormat))
+		&& pixelFormat == GUID_WICPixelFormat32bppBGRA
+		&& SUCCEEDED(frame->WritePixels(height, rowPitch, rowPitch * height, const_cast<BYTE*>(data)))
+		&& SUCCEEDED(frame->Commit())
+		&& SUCCEEDED(encoder->Commit());
+}
+
+
+void SwapRedAndBlue(uint8_t* data, UINT rowPitch, UINT width, UINT height)
+{
+	for (UINT row = 0; row < height; ++row, data += rowPitch) {
+		for (UINT col = 0; col < width; ++col) {
+			uint8_t* pixel = data + col * 4;
+			const uint8_t red = pixel[0];
+			pixel[0] = pixel[2];
+			pixel[2] = red;
+		}
+	}
+}
+
+
+
+}  // unnamed namespace
+
+
+
+TextureDumper::TextureDumper(const std::wstring& directory, size_t memoryBudget, bool usePng)
+	: m_directory(directory)
+	, m_usePng(usePng)
+	, m_store()
+	, m_encoded()
+	, m_arena(memoryBudget)
+	, m_queue()
+	, m_memoryBudget(memoryBudget)
+	, m_bytesInFlight(0)
+	, m_nextId(0)
+	, m_written(0)
+	, m_dropped(0)
+	, m_failed(0)
+	, m_deduplicated(0)
+	, m_startFlag()
+	, m_isStarted(false)
+	, m_hWakeEvent(::CreateEventW(nullptr, FALSE, FALSE, nullptr))
+	, m_hStopEvent(::CreateEventW(nullptr, TRUE, FALSE, nullptr))
+{
+}
+
+
+TextureDumper::~TextureDumper()
+{
+	if (m_hWakeEvent != nullptr)
+		::CloseHandle(m_hWakeEvent);
+	if (m_hStopEvent != nullptr)
+		::CloseHandle(m_hStopEvent);
+}
+
+
+bool TextureDumper::Submit(const D3D11_TEXTURE2D_DESC& desc, const void* data, UINT rowPitch)
+{
+	UINT rowSize;
+	UINT rowCount;
+	if (!GetFormatLayout(desc.Format, desc.Width, desc.Height, rowSize, rowCount)) {
+		rowSize = rowPitch;
+		rowCount = desc.Height;
+	}
+	if (data == nullptr || rowSize > rowPitch || rowCount == 0)
+		return false;
+
+	// keep the pitch of the source, as signatures are computed over it
+	const size_t size = static_cast<size_t>(rowPitch) * rowCount;
+	if (m_bytesInFlight.fetch_add(size) + size > m_memoryBudget) {
+		m_bytesInFlight.fetch_sub(size);
+		m_dropped.fetch_add(1, std::memory_order_relaxed);
+		return false;
+	}
+
+	Job job;
+	if (!StartThread() || !m_arena.Acquire(size, job.block)) {
+		m_bytesInFlight.fetch_sub(size);
+		m_dropped.fetch_add(1, std::memory_order_relaxed);
+		return false;
+	}
+	// the last row of the source may end early
+	memcpy(job.block.data, data, size - (rowPitch - rowSize));
+	memset(job.block.data + size - (rowPitch - rowSize), 0, rowPitch - rowSize);
+	job.width = desc.Width;
+	job.height = desc.Height;
+	job.rowPitch = rowPitch;
+	job.rowCount = rowCount;
+	job.format = desc.Format;
+	job.id = m_nextId.fetch_add(1, std::memory_order_relaxed);
+
+	if (!m_queue.TryPush(job)) {
+		m_arena.Release(job.block);
+		m_bytesInFlight.fetch_sub(size);
+		m_dropped.fetch_add(1, std::memory_order_relaxed);
+		return false;
+	}
+	::SetEvent(m_hWakeEvent);
+	return true;
+}
+
+
+void TextureDumper::Stop()
+{
+	if (m_hStopEvent != nullptr)
+		::SetEvent(m_hStopEvent);
+}
+
+
+TextureDumper::Stats TextureDumper::GetStats() const
+{
+	Stats stats;
+	stats.submitted = m_nextId.load();
+	stats.written = m_written.load();
+	stats.dropped = m_dropped.load();
+	stats.failed = m_failed.load();
+	stats.deduplicated = m_deduplicated.load();
+	return stats;
+}
+
+
+bool TextureDumper::StartThread()
+{
+	std::call_once(m_startFlag, [this]() {
+		if (m_hWakeEvent == nullptr || m_hStopEvent == nullptr)
+			return;
+		HANDLE hThread = ::CreateThread(nullptr, 0, ThreadProc, this, 0, nullptr);
+		if (hThread == nullptr)
+			return;
+		::SetThreadPriority(hThread, THREAD_PRIORITY_BELOW_NORMAL);
+		::CloseHandle(hThread);
+		m_isStarted = true;
+	});
+	return m_isStarted;
+}
+
+
+DWORD WINAPI TextureDumper::ThreadProc(LPVOID param)
+{
+	reinterpret_cast<TextureDumper*>(param)->Run();
+	return 0;
+}
+
+
+void TextureDumper::Run()
+{
+	const HRESULT hrInit = ::CoInitializeEx(nullptr, COINIT_MULTITHREADED);
+	Microsoft::WRL::ComPtr<IWICImagingFactory> factory;
+	if (FAILED(::CoCreateInstance(CLSID_WICImagingFactory, nullptr, CLSCTX_INPROC_SERVER, IID_PPV_ARGS(&factory))))
+		factory = nullptr;  // no PNG
+	::CreateDirectoryW(m_directory.c_str(), nullptr);
+	m_store.SetJobSystem(&GetBackgroundJobs());
+	if (!m_usePng && !m_store.Open(m_directory))
+		LOG_WARNING(L"Failed to open the dump store; writing loose files\n");
+
+	const HANDLE handles[] = { m_hStopEvent, m_hWakeEvent };
+	for (;;) {
+		Job job;
+		while (m_queue.TryPop(job)) {
+			if (Write(job, factory.Get()))
+				m_written.fetch_add(1, std::memory_order_relaxed);
+			else
+				m_failed.fetch_add(1, std::memory_order_relaxed);
+			Finish(job);
+		}
+
+		// upload records are written once things calm down, not per upload
+		const DWORD waitResult = ::WaitForMultipleObjects(2, handles, FALSE, c_logFlushIntervalMs);
+		if (waitResult == WAIT_TIMEOUT)
+			m_store.FlushLog();
+		else if (waitResult != WAIT_OBJECT_0 + 1)
+			break;
+	}
+	m_store.Close();
+
+	factory = nullptr;
+	if (SUCCEEDED(hrInit))
+		::CoUninitialize();
+}
+
+
+bool TextureDumper::Write(Job& job, IWICImagingFactory* factory)
+{
+	UINT rowSize;
+	UINT rowCount;
+	const bool isLayoutKnown = GetFormatLayout(job.format, job.width, job.height, rowSize, rowCount);
+
+	// the same digest as a signature would have, so that dumps can be turned into signatures:
+	// a packed fingerprint, or a padded one for formats of unknown layout
+	gan::Hash<256> hash { };
+	if (isLayoutKnown)
+		GetPackedFingerprint(job.block.data, job.rowPitch, rowSize, GetFingerprintRowCount(rowCount), hash.data);
+	else {
+		const UINT hashedRows = job.rowCount < c_fingerprintRowCount ? job.rowCount : c_fingerprintRowCount;
+		gan::Hasher::GetSHA(job.block.data, job.rowPitch * hashedRows, hash);
+	}
+	if (m_store.IsOpen()) {
+		DumpStore::Descriptor desc;
+		desc.width = job.width;
+		desc.height = job.height;
+		desc.format = job.format;
+		desc.rowPitch = job.rowPitch;
+		desc.rowSize = isLayoutKnown ? rowSize : job.rowPitch;
+		desc.rowCount = isLayoutKnown ? rowCount : job.rowCount;
+		const uint32_t newObjectCount = m_store.GetStats().newObjectCount;
+		if (!m_store.Put(desc, job.block.data, hash.data, job.id))
+			return false;
+		if (m_store.GetStats().newObjectCount == newObjectCount)
+			m_deduplicated.fetch_add(1, std::memory_order_relaxed);
+		return true;
+	}
+
+	std::wstring path;
+	path.reserve(MAX_PATH);
+	path.append(m_directory);
+	path.append(L"\\tx_");
+	for (int i = 0; i < 32; ++i) {
+		wchar_t buf[4];
+		wsprintfW(buf, L"%02X", hash.data[i]);
+		path.append(buf);
+	}
+	path.push_back(L'_');
+	path.append(std::to_wstring(job.format));
+	path.push_back(L'_');
+	path.append(std::to_wstring(job.id));
+
+	const bool isRgba = job.format == DXGI_FORMAT_R8G8B8A8_UNORM || job.format == DXGI_FORMAT_R8G8B8A8_UNORM_SRGB;
+	const bool isBgra = job.format == DXGI_FORMAT_B8G8R8A8_UNORM || job.format == DXGI_FORMAT_B8G8R8A8_UNORM_SRGB;
+	if (m_usePng && factory != nullptr && (isRgba || isBgra)) {
+		if (isRgba)
+			SwapRedAndBlue(job.block.data, job.rowPitch, job.width, job.height);
+		if (WritePng(factory, path + L".png", job.block.data, job.rowPitch, job.width, job.height))
+			return true;
+		::DeleteFileW((path + L".png").c_str());
+		if (isRgba)
+			SwapRedAndBlue(job.block.data, job.rowPitch, job.width, job.height);
+	}
+
+	if (!isLayoutKnown) {
+		// without knowing the layout, DDS at least keeps the format for later inspection
+		return WriteDds(path + L".dds", job.block.data, job.rowPitch, job.rowPitch, job.rowCount, job.width, job.height, job.format);
+	}
+
+	ImageInfo info;
+	info.width = job.width;
+	info.height = job.height;
+	info.format = isRgba ? ImageFormat::Rgba8 : (isBgra ? ImageFormat::Bgra8 : ImageFormat::Raw);
+	info.sourceFormat = static_cast<uint32_t>(job.format);
+	info.rowSize = rowSize;
+	info.rowCount = rowCount;
+	if (EncodeImage(info, job.block.data, job.rowPitch, m_encoded, GetBackgroundJobs()) && WriteBlob(path + L".hbi", m_encoded))
+		return true;
+	::DeleteFileW((path + L".hbi").c_str());
+	return WriteDds(path + L".dds", job.block.data, job.rowPitch, rowSize, rowCount, job.width, job.height, job.format);
+}
+
+
+void TextureDumper::Finish(Job& job)
+{
+	const size_t size = static_cast<size_t>(job.rowPitch) * job.rowCount;
+	m_arena.Release(job.block);
+	m_bytesInFlight.fetch_sub(size);
+}
+
+
+
+TextureDumper& GetTextureDumper()
+{
+	TextureDumper* dumper = s_dumper.load();
+	if (dumper != nullptr)
+		return *dumper;
+
+	uint32_t budgetMb = static_cast<uint32_t>(c_defaultMemoryBudget >> 20);
+	GetEnvironmentUInt(L"HERBICIDE_DUMP_BUDGET_MB", budgetMb);
+	uint32_t usePng = 0;
+	GetEnvironmentUInt(L"HERBICIDE_DUMP_PNG", usePng);
+	auto created = new TextureDumper(L"tx", static_cast<size_t>(budgetMb) << 20, usePng != 0);
+	if (!s_dumper.compare_exchange_strong(dumper, created))
+		delete created;  // another thread won; $dumper now holds its instance
+	else
+		dumper = created;
+	return *dumper;
+}
+
+
+// the dumper is leaked on purpose, as its thread may still be running
+void StopTextureDumper()
+{
+	TextureDumper* dumper = s_dumper.load();
+	if (dumper != nullptr)
+		dumper->Stop();
+}
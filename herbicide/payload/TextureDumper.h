@@ -0,0 +1,120 @@
+/*
+ *  herbicide - removing flowers and rabbits in the game Mirror
+ *  Copyright (C) 2018 Mifan Bang <https://debug.tw>.
+ *
+ *  This program is free software: you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation, either version 3 of the License, or
+ *  (at your option) any later version.
+ *
+ *  This program is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#pragma once
+
+#include <atomic>
+#include <cstdint>
+#include <mutex>
+#include <string>
+#include <vector>
+
+#pragma warning(push)
+#pragma warning(disable: 4005)  // macro redefinition
+#include <d3d11.h>
+#pragma warning(pop)
+#include <windows.h>
+
+#include "BoundedQueue.h"
+#include "DumpStore.h"
+#include "ShadowArena.h"
+
+
+struct IWICImagingFactory;
+
+
+// Writes textures to disk from a background thread.
+//
+// The game thread only copies the rows into a pooled buffer and queues it; hashing, encoding
+// and writing happen on the writer thread. Textures go into a deduplicating DumpStore, or are
+// written as loose PNG files if asked to, which is several times slower. A dump is dropped
+// rather than waited for when the queue is full or the buffers in flight would exceed the
+// memory budget.
+class TextureDumper
+{
+public:
+	struct Stats
+	{
+		uint32_t submitted;
+		uint32_t written;
+		uint32_t dropped;  // queue full or out of budget
+		uint32_t failed;  // encoding or writing failed
+		uint32_t deduplicated;  // written as a reference to content already stored
+	};
+
+
+	TextureDumper(const std::wstring& directory, size_t memoryBudget, bool usePng);
+	~TextureDumper();  // must not be called while the thread is running
+
+	TextureDumper(const TextureDumper&) = delete;
+	TextureDumper& operator=(const TextureDumper&) = delete;
+
+	// copy the top-level surface in $data, whose rows are $rowPitch bytes apart
+	bool Submit(const D3D11_TEXTURE2D_DESC& desc, const void* data, UINT rowPitch);
+
+	// only signals the thread to quit as it's likely called with the loader lock held
+	void Stop();
+
+	Stats GetStats() const;
+
+
+private:
+	struct Job
+	{
+		ShadowArena::Block block;
+		UINT width;
+		UINT height;
+		UINT rowPitch;
+		UINT rowCount;
+		DXGI_FORMAT format;
+		uint32_t id;
+	};
+
+	static constexpr size_t c_queueCapacity = 256;
+
+	bool StartThread();
+	static DWORD WINAPI ThreadProc(LPVOID param);
+	void Run();
+	bool Write(Job& job, IWICImagingFactory* factory);
+	void Finish(Job& job);
+
+	std::wstring m_directory;
+	bool m_usePng;
+	DumpStore m_store;  // used by the writer thread only
+	std::vector<uint8_t> m_encoded;  // used by the writer thread only, kept to reuse its capacity
+	ShadowArena m_arena;
+	BoundedQueue<Job, c_queueCapacity> m_queue;
+	size_t m_memoryBudget;
+	std::atomic<size_t> m_bytesInFlight;
+	std::atomic<uint32_t> m_nextId;
+	std::atomic<uint32_t> m_written;
+	std::atomic<uint32_t> m_dropped;
+	std::atomic<uint32_t> m_failed;
+	std::atomic<uint32_t> m_deduplicated;
+	std::once_flag m_startFlag;
+	bool m_isStarted;
+	HANDLE m_hWakeEvent;
+	HANDLE m_hStopEvent;
+};
+
+
+
+// the dumper writing into "tx" under the working directory, created on first use;
+// it writes loose PNG files instead of into the store if HERBICIDE_DUMP_PNG is 1
+TextureDumper& GetTextureDumper();
+void StopTextureDumper();
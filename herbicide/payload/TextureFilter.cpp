@@ -18,16 +18,47 @@
 
 #include "TextureFilter.h"
 
+#include <algorithm>
+#include <atomic>
+#include <cstring>
+
 #include <Hash.h>
 
+#include "shared/util.h"
+#include "DxgiFormat.h"
+
 
 
 namespace {
 
 
 
+std::atomic<uint64_t> s_hashedByteCount(0);
+
+
+// Whether the pixels of $rect, inclusive and of $stride bytes, lie within the mapping: within
+// RowPitch on every row, and within the $rowCount rows of the texture, and of DepthPitch if it's
+// given. A mapping of unknown size fits nothing.
+bool IsRectInMapping(const D3D11_MAPPED_SUBRESOURCE& data, const D3D11_RECT& rect, uint32_t stride, UINT rowCount)
+{
+	if (data.pData == nullptr || data.RowPitch == 0 || rect.left < 0 || rect.top < 0 || rect.right < rect.left || rect.bottom < rect.top)
+		return false;
+	const uint64_t rowEnd = (static_cast<uint64_t>(rect.right) + 1) * stride;
+	uint64_t rowLimit = rowCount;
+	if (data.DepthPitch != 0 && data.DepthPitch / data.RowPitch < rowLimit)
+		rowLimit = data.DepthPitch / data.RowPitch;
+	return rowEnd <= data.RowPitch && static_cast<uint64_t>(rect.bottom) < rowLimit;
+}
+
+
+
+}  // unnamed namespace
+
+
+
 bool MatchHash(const void* data, unsigned int size, const gan::Hash<256>& hash)
 {
+	s_hashedByteCount.fetch_add(size, std::memory_order_relaxed);
 	gan::Hash<256> hashOther;
 	if (gan::Hasher::GetSHA(data, size, hashOther) != NO_ERROR)
 		return false;
@@ -35,8 +66,33 @@ bool MatchHash(const void* data, unsigned int size, const gan::Hash<256>& hash)
 }
 
 
-void ErasePixels(const D3D11_MAPPED_SUBRESOURCE& data, const D3D11_RECT& rect, uint8_t stride)
+uint64_t GetHashedByteCount()
 {
+	return s_hashedByteCount.load(std::memory_order_relaxed);
+}
+
+
+// Staging textures are mapped with CPU write access; default ones may be uploaded in bands
+// by UpdateSubresource(). Render targets, depth buffers and UAVs of the same size are
+// default textures too, and so common that they alone would keep the hooks armed.
+bool IsSignatureDesc(const D3D11_TEXTURE2D_DESC& desc)
+{
+	switch (desc.Usage) {
+	case D3D11_USAGE_STAGING:
+		return (desc.CPUAccessFlags & D3D11_CPU_ACCESS_WRITE) != 0;
+	case D3D11_USAGE_DEFAULT:
+		return desc.BindFlags == D3D11_BIND_SHADER_RESOURCE && desc.CPUAccessFlags == 0;
+	default:
+		return false;
+	}
+}
+
+
+bool ErasePixels(const D3D11_MAPPED_SUBRESOURCE& data, UINT rowCount, const D3D11_RECT& rect, uint8_t stride)
+{
+	if (stride == 0 || !IsRectInMapping(data, rect, stride, rowCount))
+		return false;
+
 	const unsigned int offsetOfCol = rect.top * data.RowPitch;
 	const unsigned int offsetInRow = rect.left * stride;
 	const unsigned int numErasedBytesPerRow = (rect.right - rect.left + 1) * stride;
@@ -45,186 +101,282 @@ void ErasePixels(const D3D11_MAPPED_SUBRESOURCE& data, const D3D11_RECT& rect, u
 	auto dataPtr = reinterpret_cast<uint8_t*>(data.pData) + offsetOfCol + offsetInRow;
 	for (; i <= rect.bottom; ++i, dataPtr += data.RowPitch)
 		memset(dataPtr, 0x00, numErasedBytesPerRow);
+	return true;
+}
+
+
+bool PatchPixels(const D3D11_MAPPED_SUBRESOURCE& data, UINT rowCount, const D3D11_RECT& rect, const PixelPatch& patch)
+{
+	const PatchInfo& info = patch.GetInfo();
+	if (info.width == 0 || info.height == 0
+			|| static_cast<uint64_t>(rect.right) - rect.left + 1 != info.width || static_cast<uint64_t>(rect.bottom) - rect.top + 1 != info.height
+			|| !IsRectInMapping(data, rect, info.stride, rowCount))
+		return false;
+
+	auto dataPtr = reinterpret_cast<uint8_t*>(data.pData) + static_cast<size_t>(rect.top) * data.RowPitch + static_cast<size_t>(rect.left) * patch.GetInfo().stride;
+	patch.Apply(dataPtr, data.RowPitch);
+	return true;
+}
+
+
+FilterDataCondition::FilterDataCondition(const gan::Hash<256>& fingerprint)
+	: m_func()
+	, m_fingerprint(fingerprint)
+	, m_hasFingerprint(true)
+	, m_kind(FingerprintKind::Padded)
+	, m_rowSize(0)
+	, m_rowCount(0)
+{
+}
+
+
+FilterDataCondition::FilterDataCondition(const gan::Hash<256>& fingerprint, UINT rowSize, UINT rowCount)
+	: m_func()
+	, m_fingerprint(fingerprint)
+	, m_hasFingerprint(true)
+	, m_kind(FingerprintKind::Packed)
+	, m_rowSize(rowSize)
+	, m_rowCount(rowCount)
+{
+}
+
+
+bool FilterDataCondition::operator()(const D3D11_MAPPED_SUBRESOURCE& data) const
+{
+	if (m_hasFingerprint)
+		return m_kind == FingerprintKind::Packed ? MatchPacked(data) : MatchPadded(data);
+	return m_func(data);
+}
+
+
+bool FilterDataAction::SetCopied(bool isCopied)
+{
+	if (isCopied && !IsErase() && !(IsPatch() && m_patch->IsWhole()))
+		return false;
+	m_isCopied = isCopied;
+	return true;
+}
+
+
+// A mapping known to be shorter than the rows hashed can't hold the content the signature was
+// taken from, and reading on would run past it.
+bool FilterDataCondition::MatchPadded(const D3D11_MAPPED_SUBRESOURCE& data) const
+{
+	const UINT size = data.RowPitch * c_fingerprintRowCount;
+	if (data.DepthPitch != 0 && data.DepthPitch < size)
+		return false;
+	return MatchHash(data.pData, size, m_fingerprint);
+}
+
+
+bool FilterDataCondition::MatchPacked(const D3D11_MAPPED_SUBRESOURCE& data) const
+{
+	if (m_rowSize == 0 || m_rowCount == 0 || data.RowPitch < m_rowSize)
+		return false;
+	const uint64_t extent = static_cast<uint64_t>(data.RowPitch) * (m_rowCount - 1) + m_rowSize;
+	if (data.DepthPitch != 0 && data.DepthPitch < extent)
+		return false;
+	if (data.RowPitch == m_rowSize)
+		return MatchHash(data.pData, m_rowSize * m_rowCount, m_fingerprint);
+
+	s_hashedByteCount.fetch_add(static_cast<uint64_t>(m_rowSize) * m_rowCount, std::memory_order_relaxed);
+	uint8_t digest[StreamHasher::c_digestSize];
+	static_assert(sizeof(digest) == sizeof(m_fingerprint.data), "digest size mismatch");
+	return GetPackedFingerprint(static_cast<const uint8_t*>(data.pData), data.RowPitch, m_rowSize, m_rowCount, digest)
+		&& memcmp(digest, m_fingerprint.data, sizeof(digest)) == 0;
+}
+
+
+
+FilterDataAction::FilterDataAction(const D3D11_RECT& eraseRect, uint8_t stride)
+	: m_func()
+	, m_eraseRect(eraseRect)
+	, m_stride(stride)
+	, m_patch()
+	, m_isCopied(false)
+{
 }
 
 
-void SetupDataFilterFactory(DataFilterFactory& factory)
-{
-#define MAKE_DESC_FILTER(w, h, format) \
-	( [](const D3D11_TEXTURE2D_DESC& desc) -> bool { \
-		return desc.Width == w && desc.Height == h && desc.Format == format && desc.Usage == D3D11_USAGE_STAGING; \
-	} )
-
-// function checks first 256 rows
-#define MAKE_DATA_FILTER(h0,h1,h2,h3,h4,h5,h6,h7,h8,h9,h10,h11,h12,h13,h14,h15,h16,h17,h18,h19,h20,h21,h22,h23,h24,h25,h26,h27,h28,h29,h30,h31) \
-	( [](const D3D11_MAPPED_SUBRESOURCE& data) -> bool { \
-		return MatchHash( \
-			data.pData, \
-			data.RowPitch << 8, \
-			{ h0,h1,h2,h3,h4,h5,h6,h7,h8,h9,h10,h11,h12,h13,h14,h15,h16,h17,h18,h19,h20,h21,h22,h23,h24,h25,h26,h27,h28,h29,h30,h31 } \
-		); \
-	 } )
-
-#define MAKE_DATA_ERASER(x, y, w, h, stride) \
-	( [](const D3D11_MAPPED_SUBRESOURCE& data) -> bool { \
-		ErasePixels(data, {x, y, x+w-1, y+h-1}, stride); \
-		return true; \
-	} )
-
-
-	// Dark Elf: battle (flower)
-	factory.Register({
-		MAKE_DESC_FILTER(2048, 2048, DXGI_FORMAT_R8G8B8A8_UNORM),
-		MAKE_DATA_FILTER(0x04,0xF1,0xB2,0x4E,0x5D,0x9A,0xB0,0x1C,0xA3,0xC6,0x87,0x95,0x17,0x8E,0x98,0x63,0xD6,0x26,0x8D,0xBA,0x6E,0xEA,0xE5,0xB1,0xA6,0xDE,0x2E,0xA6,0x90,0xCA,0x51,0xD1),
-		MAKE_DATA_ERASER(1733, 1721, 56, 56, 4)
-	});
-	// Dark Elf: ecchi scene (flower)
-	factory.Register({
-		MAKE_DESC_FILTER(2048, 2048, DXGI_FORMAT_R8G8B8A8_UNORM),
-		MAKE_DATA_FILTER(0x92,0x7D,0x61,0xC6,0xD5,0x1A,0xE6,0x37,0x9A,0x76,0xA9,0x93,0x55,0x62,0xEA,0x0D,0x31,0x53,0xB7,0x3E,0xC1,0x1B,0xD6,0xFA,0x25,0x6A,0x58,0xF7,0xC5,0x79,0x8A,0x0B),
-		MAKE_DATA_ERASER(1687, 1992, 56, 56, 4)
-	});
-	// Dark Elf: ecchi scene (rabbit)
-	factory.Register({
-		MAKE_DESC_FILTER(2048, 256, DXGI_FORMAT_R8G8B8A8_UNORM),
-		MAKE_DATA_FILTER(0x59,0x77,0x24,0x9A,0x4F,0x07,0xFA,0x5B,0x4A,0x41,0x3A,0x3F,0x92,0x9C,0x2A,0xCC,0x8A,0xEC,0xE7,0xD4,0x65,0x2F,0xB7,0x8A,0xDD,0x22,0x12,0x7E,0x44,0x00,0x5E,0x78),
-		MAKE_DATA_ERASER(577, 0, 183, 256, 4)
-	});
-
-
-	// Witch Girl: battle (flower)
-	factory.Register({
-		MAKE_DESC_FILTER(2048, 2048, DXGI_FORMAT_R8G8B8A8_UNORM),
-		MAKE_DATA_FILTER(0x66,0xFD,0x9D,0x8D,0x37,0x33,0xA9,0xA7,0x63,0xFC,0xF7,0x96,0x0B,0xFF,0x58,0x06,0x11,0x7E,0x7A,0x6B,0xB6,0xE1,0x40,0xE7,0x4B,0x8C,0x47,0xFF,0x9F,0xD0,0x2F,0x33),
-		MAKE_DATA_ERASER(135, 955, 56, 56, 4)
-	});
-	// Witch Girl: ecchi scene (flower)
-	factory.Register({
-		MAKE_DESC_FILTER(2048, 2048, DXGI_FORMAT_R8G8B8A8_UNORM),
-		MAKE_DATA_FILTER(0x2A,0x0B,0xA7,0xE5,0x90,0x42,0x99,0x94,0xB0,0xFF,0x6E,0xF3,0x08,0x4F,0xF5,0xDE,0xD2,0xFC,0xB4,0x7E,0x80,0xA1,0x3B,0x9F,0x75,0x78,0x06,0x1C,0x3A,0x77,0xA2,0x32),
-		MAKE_DATA_ERASER(1211, 680, 56, 56, 4)
-	});
-	// Witch Girl: ecchi scene (rabbit)
-	factory.Register({
-		MAKE_DESC_FILTER(2048, 2048, DXGI_FORMAT_R8G8B8A8_UNORM),
-		MAKE_DATA_FILTER(0x2A,0x0B,0xA7,0xE5,0x90,0x42,0x99,0x94,0xB0,0xFF,0x6E,0xF3,0x08,0x4F,0xF5,0xDE,0xD2,0xFC,0xB4,0x7E,0x80,0xA1,0x3B,0x9F,0x75,0x78,0x06,0x1C,0x3A,0x77,0xA2,0x32),
-		MAKE_DATA_ERASER(1560, 440, 155, 184, 4)
-	});
-
-
-	// Zombie Girl: battle (flower)
-	factory.Register({
-		MAKE_DESC_FILTER(2048, 2048, DXGI_FORMAT_R8G8B8A8_UNORM),
-		MAKE_DATA_FILTER(0x7C,0xD2,0xB0,0x58,0x9B,0x2C,0xAF,0x59,0x44,0x27,0x9B,0xDD,0xB3,0xED,0xCC,0x71,0x7D,0x9B,0x4D,0xBB,0xB1,0x20,0x3E,0xD1,0x02,0x49,0xFE,0x86,0x7E,0x19,0x1B,0x09),
-		MAKE_DATA_ERASER(963, 1054, 56, 56, 4)
-	});
-	// Zombie Girl does not have an uncensorable flower in the ecchi scene
-	// Zombie Girl: ecchi scene (rabbit)
-	factory.Register({
-		MAKE_DESC_FILTER(2048, 2048, DXGI_FORMAT_R8G8B8A8_UNORM),
-		MAKE_DATA_FILTER(0xB5,0xF7,0xC3,0x4A,0xB5,0x6F,0x0C,0x1A,0x54,0x09,0x63,0xB7,0x6F,0x49,0x7A,0x2F,0xB0,0xD5,0x53,0x86,0x64,0x96,0x36,0xCF,0xB1,0xF7,0x33,0xF3,0xDA,0x3E,0x52,0x13),
-		MAKE_DATA_ERASER(1517, 1220, 184, 154, 4)
-	});
-
-
-	// Dragon Maiden: battle (flower)
-	factory.Register({
-		MAKE_DESC_FILTER(2048, 2048, DXGI_FORMAT_R8G8B8A8_UNORM),
-		MAKE_DATA_FILTER(0xAE,0x15,0xDE,0x83,0xAA,0x71,0x9C,0x37,0xBA,0x69,0x38,0x55,0x95,0x1E,0x2F,0x9C,0xE3,0x4E,0xE8,0x75,0x22,0x06,0xAF,0xCF,0x3A,0x66,0x61,0xC1,0x4C,0x90,0xA6,0x23),
-		MAKE_DATA_ERASER(0, 1995, 54, 53, 4)
-	});
-	// Dragon Maiden does not have a flower in the ecchi scene
-	// Dragon Maiden: ecchi scene (rabbit)
-	factory.Register({
-		MAKE_DESC_FILTER(2048, 2048, DXGI_FORMAT_R8G8B8A8_UNORM),
-		MAKE_DATA_FILTER(0x56,0xF7,0xE6,0x07,0xDA,0xE2,0xEB,0x1C,0x4D,0xBE,0x0A,0xF5,0xDF,0x36,0x58,0x2D,0x34,0x54,0x99,0x51,0x85,0x0C,0x0C,0x60,0xF7,0x27,0xC9,0x56,0x4C,0x49,0x7B,0x24),
-		MAKE_DATA_ERASER(1628, 309, 184, 155, 4)
-	});
-
-
-	// Beast Girl: battle (flower)
-	factory.Register({
-		MAKE_DESC_FILTER(2048, 2048, DXGI_FORMAT_R8G8B8A8_UNORM),
-		MAKE_DATA_FILTER(0x42,0xE1,0xAB,0xED,0xC5,0xF7,0x30,0xB9,0xE9,0xB1,0xB6,0x57,0xAA,0x07,0x86,0x20,0x67,0xD5,0xB4,0xEC,0x0B,0xC1,0x6B,0x58,0xF3,0xE5,0x4E,0xD4,0xDC,0xE8,0x0E,0x65),
-		MAKE_DATA_ERASER(1296, 1988, 55, 54, 4)
-	});
-	// Beast Girl: ecchi scene (flower)
-	factory.Register({
-		MAKE_DESC_FILTER(2048, 2048, DXGI_FORMAT_R8G8B8A8_UNORM),
-		MAKE_DATA_FILTER(0x69,0xDB,0xA2,0x6D,0x4A,0x2B,0x21,0x6A,0x9A,0xF2,0xB0,0xDF,0x5A,0x4D,0xE5,0xBD,0x81,0x8F,0x89,0x9C,0x62,0x7B,0xB7,0xFB,0xED,0xEE,0x41,0x63,0xB6,0x39,0xF3,0xE0),
-		MAKE_DATA_ERASER(1992, 830, 54, 55, 4)
-	});
-	// Beast Girl: ecchi scene (rabbit)
-	factory.Register({
-		MAKE_DESC_FILTER(2048, 2048, DXGI_FORMAT_R8G8B8A8_UNORM),
-		MAKE_DATA_FILTER(0x69,0xDB,0xA2,0x6D,0x4A,0x2B,0x21,0x6A,0x9A,0xF2,0xB0,0xDF,0x5A,0x4D,0xE5,0xBD,0x81,0x8F,0x89,0x9C,0x62,0x7B,0xB7,0xFB,0xED,0xEE,0x41,0x63,0xB6,0x39,0xF3,0xE0),
-		MAKE_DATA_ERASER(1602, 1880, 184, 155, 4)
-	});
-
-
-	// Pharaoh: battle (flower)
-	factory.Register({
-		MAKE_DESC_FILTER(2048, 2048, DXGI_FORMAT_R8G8B8A8_UNORM),
-		MAKE_DATA_FILTER(0xC1,0x9D,0xA0,0x00,0x27,0x7C,0x42,0x5B,0x15,0x70,0x94,0x9D,0x24,0x80,0x16,0xDC,0xA4,0x4D,0x0F,0x0D,0xFE,0xB0,0x9C,0x6D,0x90,0x51,0x9C,0xB2,0x26,0x9F,0x21,0xC1),
-		MAKE_DATA_ERASER(1990, 977, 55, 53, 4)
-	});
-	// Pharaoh: ecchi scene (flower)
-	factory.Register({
-		MAKE_DESC_FILTER(2048, 2048, DXGI_FORMAT_R8G8B8A8_UNORM),
-		MAKE_DATA_FILTER(0x15,0xEE,0xB4,0x6F,0xDA,0x63,0x50,0xF9,0x96,0x84,0x1E,0xC1,0x5A,0x18,0x62,0xD0,0x67,0x02,0x73,0x85,0xF3,0x91,0xAD,0x44,0x8B,0x12,0xD1,0x69,0xDE,0x11,0x79,0xF4),
-		MAKE_DATA_ERASER(1155, 715, 54, 55, 4)
-	});
-	// Pharaoh: ecchi scene (rabbit)
-	factory.Register({
-		MAKE_DESC_FILTER(2048, 2048, DXGI_FORMAT_R8G8B8A8_UNORM),
-		MAKE_DATA_FILTER(0x95,0xF8,0xD9,0xC7,0x55,0x31,0x07,0x84,0x28,0xCE,0xA6,0xA1,0xE2,0xF9,0x93,0x25,0x97,0xCA,0x46,0x6E,0x17,0x24,0xEE,0x1E,0x70,0x79,0xC0,0xD4,0xBF,0x71,0x15,0x9E),
-		MAKE_DATA_ERASER(944, 1637, 155, 185, 4)
-	});
-
-
-	// Warrior Girl: battle (flower)
-	factory.Register({
-		MAKE_DESC_FILTER(2048, 2048, DXGI_FORMAT_R8G8B8A8_UNORM),
-		MAKE_DATA_FILTER(0x8D,0x12,0xBC,0x04,0x5C,0x92,0xC0,0x40,0xBA,0x48,0xE9,0x63,0xD6,0xDD,0xAC,0x43,0x67,0x65,0x5B,0x39,0x4C,0x5C,0x68,0xAB,0xE5,0x17,0x16,0x45,0xCB,0x3C,0x54,0xE9),
-		MAKE_DATA_ERASER(1978, 256, 55, 54, 4)
-	});
-	// Warrior Girl: ecchi scene (flower)
-	factory.Register({
-		MAKE_DESC_FILTER(2048, 2048, DXGI_FORMAT_R8G8B8A8_UNORM),
-		MAKE_DATA_FILTER(0x2C,0x04,0xC8,0x4B,0x46,0x7F,0x6E,0x3C,0x80,0x77,0x39,0x47,0x85,0x60,0x5F,0x5A,0xD2,0x99,0x74,0x2E,0xAF,0xB9,0xAE,0x18,0x4E,0x23,0xC1,0x47,0xE0,0x6A,0xC3,0xE5),
-		MAKE_DATA_ERASER(1989, 15, 55, 54, 4)
-	});
-	// Warrior Girl: ecchi scene (rabbit)
-	factory.Register({
-		MAKE_DESC_FILTER(2048, 2048, DXGI_FORMAT_R8G8B8A8_UNORM),
-		MAKE_DATA_FILTER(0x5A,0x5B,0x66,0x3F,0x76,0x43,0x0A,0x9A,0xE7,0x7B,0xA4,0xDD,0x2B,0x1D,0x08,0x5B,0xCA,0xB0,0x78,0xCA,0xA1,0xC9,0xCF,0x1E,0xDD,0x78,0xC7,0xEF,0x33,0x62,0x61,0xBB),
-		MAKE_DATA_ERASER(1853, 1438, 155, 183, 4)
-	});
-
-
-	// Preist: battle (flower)
-	factory.Register({
-		MAKE_DESC_FILTER(2048, 2048, DXGI_FORMAT_R8G8B8A8_UNORM),
-		MAKE_DATA_FILTER(0x5D,0x26,0x38,0x93,0xAF,0xCB,0x1C,0xD3,0x27,0x47,0xCD,0x18,0x41,0xE3,0x14,0xD6,0x89,0x0A,0xE0,0x87,0x2A,0x76,0x71,0x65,0x37,0xEE,0xB1,0x2A,0x5B,0xE2,0x6D,0x0A),
-		MAKE_DATA_ERASER(748, 1706, 54, 55, 4)
-	});
-	// Preist: ecchi scene (flower)
-	factory.Register({
-		MAKE_DESC_FILTER(2048, 2048, DXGI_FORMAT_R8G8B8A8_UNORM),
-		MAKE_DATA_FILTER(0xD3,0xAC,0x08,0x3F,0x28,0xF0,0x96,0x02,0xC0,0xD4,0x97,0xE7,0x56,0x8D,0xE0,0x56,0x75,0x19,0xFA,0x7C,0x41,0x2A,0xD4,0x22,0x7F,0x04,0x2E,0x5E,0x5A,0xC3,0x37,0xBF),
-		MAKE_DATA_ERASER(1845, 1226, 54, 55, 4)
-	});
-	// Preist: ecchi scene (rabbit)
-	factory.Register({
-		MAKE_DESC_FILTER(2048, 2048, DXGI_FORMAT_R8G8B8A8_UNORM),
-		MAKE_DATA_FILTER(0xD3,0xAC,0x08,0x3F,0x28,0xF0,0x96,0x02,0xC0,0xD4,0x97,0xE7,0x56,0x8D,0xE0,0x56,0x75,0x19,0xFA,0x7C,0x41,0x2A,0xD4,0x22,0x7F,0x04,0x2E,0x5E,0x5A,0xC3,0x37,0xBF),
-		MAKE_DATA_ERASER(1691, 1097, 155, 184, 4)
-	});
-
-
-#undef MAKE_DESC_FILTER
-#undef MAKE_DATA_FILTER
-#undef MAKE_DATA_ERASER
+FilterDataAction::FilterDataAction(const D3D11_RECT& rect, std::shared_ptr<const PixelPatch> patch)
+	: m_func()
+	, m_eraseRect(rect)
+	, m_stride(0)
+	, m_patch(std::move(patch))
+	, m_isCopied(false)
+{
+}
+
+
+bool FilterDataAction::operator()(const D3D11_MAPPED_SUBRESOURCE& data, UINT rowCount) const
+{
+	if (m_stride != 0)
+		return ErasePixels(data, rowCount, m_eraseRect, m_stride);
+	if (m_patch != nullptr)
+		return PatchPixels(data, rowCount, m_eraseRect, *m_patch);
+	return m_func(data);
+}
+
+
+
+// Reads one cache line from each of 8 bands of the first 256 rows, at columns that move from band
+// to band, so that an upload of different content is unlikely to leave all of them untouched.
+uint64_t SampleMappedData(const D3D11_MAPPED_SUBRESOURCE& data)
+{
+	constexpr unsigned int c_sampleCount = 8;
+	constexpr unsigned int c_lineSize = 64;
+
+	if (data.pData == nullptr || data.RowPitch == 0)
+		return 0;
+	unsigned int rowCount = data.DepthPitch / data.RowPitch;
+	if (rowCount == 0)
+		rowCount = 1;
+	else if (rowCount > 256)
+		rowCount = 256;
+	const unsigned int lineCount = data.RowPitch >= c_lineSize ? data.RowPitch / c_lineSize : 1;
+	const unsigned int lineSize = data.RowPitch >= c_lineSize ? c_lineSize : data.RowPitch;
+
+	uint64_t sample = 0xCBF29CE484222325;  // FNV-1a offset basis
+	for (unsigned int i = 0; i < c_sampleCount; ++i) {
+		const unsigned int row = (i * rowCount + rowCount / 2) / c_sampleCount;
+		const unsigned int line = (i * 0x9E3779B1u) % lineCount;
+		auto ptr = reinterpret_cast<const uint8_t*>(data.pData) + static_cast<size_t>(row) * data.RowPitch + line * lineSize;
+		for (unsigned int offset = 0; offset + 8 <= lineSize; offset += 8) {
+			uint64_t word;
+			memcpy(&word, ptr + offset, sizeof(word));
+			sample = (sample ^ word) * 0x100000001B3;
+		}
+		for (unsigned int offset = lineSize & ~7u; offset < lineSize; ++offset)
+			sample = (sample ^ ptr[offset]) * 0x100000001B3;
+	}
+	return sample;
+}
+
+
+
+namespace {
+
+
+
+// set up by the scenario pack of the running title
+std::atomic<FilterSetupFunc> s_builtInSetup(nullptr);
+
+
+FilterDataCondition MakeSignatureCondition(const SignatureRecord& record)
+{
+	gan::Hash<256> hash;
+	static_assert(sizeof(hash.data) == sizeof(record.digest), "digest size mismatch");
+	memcpy(hash.data, record.digest, sizeof(hash.data));
+	if (record.fingerprintKind != FingerprintKind::Packed)
+		return FilterDataCondition(hash);
+
+	UINT rowSize;
+	UINT rowCount;
+	if (!GetFormatLayout(static_cast<DXGI_FORMAT>(record.format), record.width, record.height, rowSize, rowCount))
+		return FilterDataCondition(hash, 0, 0);
+	return FilterDataCondition(hash, rowSize, GetFingerprintRowCount(rowCount));
+}
+
+
+// hex digits of a digest, or the list of its bytes as a scenario writes them
+void FormatDigest(const uint8_t* digest, bool isByteList, wchar_t* out, size_t size)
+{
+	size_t length = 0;
+	for (unsigned int i = 0; i < StreamHasher::c_digestSize; ++i) {
+		const wchar_t* format = isByteList ? (i == 0 ? L"0x%02X" : L",0x%02X") : L"%02x";
+		length += static_cast<size_t>(swprintf_s(out + length, size - length, format, digest[i]));
+	}
+}
+
+
+// Padded fingerprints are converted as they hit: the packed fingerprint of the same content is
+// logged, once per signature, in the forms of a signature file and of a scenario.
+void LogPackedConversion(DataFilter& filter, const ResourceSuspect& suspect)
+{
+	const FilterDataCondition& cond = filter.GetCondition();
+	const D3D11_MAPPED_SUBRESOURCE& data = suspect.mappedData;
+	if (!cond.HasFingerprint() || cond.GetFingerprintKind() != FingerprintKind::Padded || suspect.rowSize == 0 || data.RowPitch < suspect.rowSize)
+		return;
+	if (!filter.ShouldLogConversion())
+		return;
+
+	const UINT rowCount = GetFingerprintRowCount(suspect.rowCount);
+	uint8_t digest[StreamHasher::c_digestSize];
+	if (!GetPackedFingerprint(static_cast<const uint8_t*>(data.pData), data.RowPitch, suspect.rowSize, rowCount, digest))
+		return;
+	wchar_t padded[StreamHasher::c_digestSize * 2 + 1];
+	wchar_t packed[StreamHasher::c_digestSize * 2 + 1];
+	wchar_t byteList[StreamHasher::c_digestSize * 5 + 1];
+	FormatDigest(cond.GetFingerprint().data, false, padded, _countof(padded));
+	FormatDigest(digest, false, packed, _countof(packed));
+	FormatDigest(digest, true, byteList, _countof(byteList));
+	LOG_INFO(L"Padded fingerprint %s hit; its packed one is packed:%s\n", padded, packed);
+	LOG_INFO(L"  MAKE_PACKED_FILTER(%u, %u, %s)\n", suspect.rowSize, rowCount, byteList);
+}
+
+
+// A patch which can't be loaded acts on nothing, rather than falling back to erasing a
+// rectangle that was meant to be patched. So does a signature whose bytes per pixel aren't
+// those of its format, as its rectangle would be written in bytes it doesn't cover.
+FilterDataAction MakeSignatureAction(const SignatureRecord& record, const uint8_t* patchData, size_t patchDataSize)
+{
+	const DXGI_FORMAT format = static_cast<DXGI_FORMAT>(record.format);
+	UINT pixelSize = 0;
+	UINT rowCount;
+	if (IsBlockCompressed(format) || !GetFormatLayout(format, 1, 1, pixelSize, rowCount) || record.stride != pixelSize) {
+		LOG_WARNING(L"Ignoring a %ux%u signature of %u bytes per pixel, which format %u doesn't have\n", record.width, record.height, record.stride, record.format);
+		return FilterDataAction([](const D3D11_MAPPED_SUBRESOURCE&) { return false; });
+	}
+
+	const D3D11_RECT rect {
+		static_cast<LONG>(record.eraseX),
+		static_cast<LONG>(record.eraseY),
+		static_cast<LONG>(record.eraseX + record.eraseWidth - 1),
+		static_cast<LONG>(record.eraseY + record.eraseHeight - 1)
+	};
+	const bool isCopied = record.execution == ActionExecution::Copy;
+	if (record.patchSize == 0) {
+		FilterDataAction action(rect, static_cast<uint8_t>(record.stride));
+		action.SetCopied(isCopied);
+		return action;
+	}
+
+	auto patch = std::make_shared<PixelPatch>();
+	const bool isInData = record.patchOffset <= patchDataSize && record.patchSize <= patchDataSize - record.patchOffset;
+	if (!isInData || !patch->Load(patchData + record.patchOffset, record.patchSize)
+			|| patch->GetInfo().width != record.eraseWidth || patch->GetInfo().height != record.eraseHeight || patch->GetInfo().stride != record.stride) {
+		LOG_WARNING(L"Ignoring a malformed patch of a %ux%u signature\n", record.width, record.height);
+		return FilterDataAction([](const D3D11_MAPPED_SUBRESOURCE&) { return false; });
+	}
+	FilterDataAction action(rect, std::move(patch));
+	if (!action.SetCopied(isCopied))
+		LOG_WARNING(L"The patch of a %ux%u signature leaves pixels in place, so it is written instead of copied\n", record.width, record.height);
+	return action;
+}
+
+
+// whether $list holds the filters of $sources one after another
+bool IsConcatenation(const DataFilterList& list, const ArenaVector<const DataFilterList*>& sources)
+{
+	size_t index = 0;
+	for (auto source : sources) {
+		for (const auto& filter : *source) {
+			if (index >= list.size() || list[index] != filter)
+				return false;
+			++index;
+		}
+	}
+	return index == list.size();
+}
+
+
+std::unique_ptr<DataFilterFactory> MakeBuiltInDataFilterFactory()
+{
+	auto factory = std::make_unique<DataFilterFactory>();
+	const auto setup = s_builtInSetup.load();
+	if (setup != nullptr)
+		setup(*factory);
+	return std::move(factory);
 }
 
 
@@ -236,116 +388,514 @@ void SetupDataFilterFactory(DataFilterFactory& factory)
 DataFilter::DataFilter(const FilterDataCondition& condition, const FilterDataAction& action)
 	: m_condition(condition)
 	, m_action(action)
+	, m_isConversionLogged(false)
 {
 }
 
 
-bool DataFilter::ActUponMappedData(const D3D11_MAPPED_SUBRESOURCE& data)
+bool DataFilter::ActUponMappedData(const D3D11_MAPPED_SUBRESOURCE& data, UINT rowCount)
 {
 	if (!m_condition(data))
 		return false;
-	return m_action(data);
+	return m_action(data, rowCount);
+}
+
+
+bool DataFilter::MatchMappedData(const D3D11_MAPPED_SUBRESOURCE& data) const
+{
+	return m_condition(data);
+}
+
+
+bool DataFilter::ShouldLogConversion()
+{
+	return !m_isConversionLogged.exchange(true, std::memory_order_relaxed);
 }
 
 
 
 DataFilterFactory::DataFilterFactory()
 	: m_registry()
+	, m_ownedTable()
+	, m_table(nullptr)
+	, m_tableSize(0)
+	, m_tableFilters()
+	, m_combinedLock()
+	, m_combined(std::make_unique<CombinedLists>())
 {
 }
 
 
+DataFilterFactory::Entry DataFilterFactory::MakeEntry(const SignatureRecord& record, const uint8_t* patchData, size_t patchDataSize)
+{
+	auto descCond = [width = record.width, height = record.height, format = record.format](const D3D11_TEXTURE2D_DESC& desc) -> bool {
+		return desc.Width == width && desc.Height == height && desc.Format == static_cast<DXGI_FORMAT>(format) && IsSignatureDesc(desc);
+	};
+	return Entry { descCond, MakeSignatureCondition(record), MakeSignatureAction(record, patchData, patchDataSize) };
+}
+
+
 void DataFilterFactory::Register(const Entry& entry)
 {
-	m_registry.emplace_back(entry.descCond, std::make_shared<DataFilter>(entry.dataCond, entry.action));
+	auto filters = std::make_shared<DataFilterList>();
+	filters->push_back(std::make_shared<DataFilter>(entry.dataCond, entry.action));
+	m_registry.push_back(RegistryItem { entry.descCond, std::move(filters) });
+}
+
+
+void DataFilterFactory::SetSignatureTable(const SignatureRecord* records, size_t count, const uint8_t* patchData, size_t patchDataSize)
+{
+	m_table = records;
+	m_tableSize = count;
+	m_tableFilters.assign(count, nullptr);
+	std::shared_ptr<DataFilterList> filters;
+	for (size_t i = 0; i < count; ++i) {
+		if (i == 0 || IsSignatureKeyLess(records[i - 1], records[i]))
+			filters = std::make_shared<DataFilterList>();
+		filters->push_back(std::make_shared<DataFilter>(MakeSignatureCondition(records[i]), MakeSignatureAction(records[i], patchData, patchDataSize)));
+		m_tableFilters[i] = filters;
+	}
+}
+
+
+void DataFilterFactory::SetSignatureTable(SignatureRecordList&& records, std::vector<uint8_t>&& patchData)
+{
+	m_ownedTable = std::move(records);
+	m_ownedPatchData = std::move(patchData);
+	SetSignatureTable(m_ownedTable.data(), m_ownedTable.size(), m_ownedPatchData.data(), m_ownedPatchData.size());
+}
+
+
+const SharedDataFilterList* DataFilterFactory::FindInTable(const D3D11_TEXTURE2D_DESC& desc) const
+{
+	if (m_tableSize == 0 || !IsSignatureDesc(desc))
+		return nullptr;
+	SignatureRecord key;
+	key.width = desc.Width;
+	key.height = desc.Height;
+	key.format = static_cast<uint32_t>(desc.Format);
+	const SignatureRecord* end = m_table + m_tableSize;
+	const SignatureRecord* found = std::lower_bound(m_table, end, key, IsSignatureKeyLess);
+	if (found == end || IsSignatureKeyLess(key, *found))
+		return nullptr;
+	return &m_tableFilters[found - m_table];
 }
 
 
-bool DataFilterFactory::Match(const D3D11_TEXTURE2D_DESC& desc, DataFilterList& out)
+bool DataFilterFactory::Match(const D3D11_TEXTURE2D_DESC& desc, SharedDataFilterList& out) const
 {
-	DataFilterList result;
+	ScopedHookArena arena;
+	ArenaVector<const DataFilterList*> sources;
+	const SharedDataFilterList* firstMatch = nullptr;
 	for (const auto& item : m_registry) {
-		if (item.first(desc))
-			result.push_back(item.second);
+		if (!item.descCond(desc))
+			continue;
+		if (firstMatch == nullptr)
+			firstMatch = &item.filters;
+		sources.push_back(item.filters.get());
 	}
-	std::swap(out, result);
-	return out.size() > 0;
+	const SharedDataFilterList* tableMatch = FindInTable(desc);
+	if (tableMatch != nullptr) {
+		if (firstMatch == nullptr)
+			firstMatch = tableMatch;
+		sources.push_back(tableMatch->get());
+	}
+	if (sources.size() <= 1) {
+		out = firstMatch != nullptr ? *firstMatch : nullptr;
+		return firstMatch != nullptr;
+	}
+
+	auto findCombined = [&sources, &out](const CombinedLists& lists) -> bool {
+		for (const auto& combined : lists) {
+			if (IsConcatenation(*combined, sources)) {
+				out = combined;
+				return true;
+			}
+		}
+		return false;
+	};
+	{
+		auto snapshot = m_combined.Read();
+		if (findCombined(*snapshot))
+			return true;
+	}
+
+	// A new combination is rare: textures come in a handful of descriptions. Publishing waits
+	// for the readers of the previous snapshot, none of which holds it for long.
+	std::lock_guard<std::mutex> lock(m_combinedLock);
+	std::unique_ptr<CombinedLists> next;
+	{
+		auto snapshot = m_combined.Read();
+		if (findCombined(*snapshot))
+			return true;
+		next = std::make_unique<CombinedLists>(*snapshot);
+	}
+	auto filters = std::make_shared<DataFilterList>();
+	for (auto source : sources)
+		filters->insert(filters->end(), source->cbegin(), source->cend());
+	next->push_back(filters);
+	m_combined.Publish(std::move(next));
+	out = std::move(filters);
+	return true;
 }
 
 
 size_t DataFilterFactory::GetEntryCount() const
 {
-	return m_registry.size();
+	return m_registry.size() + m_tableSize;
 }
 
 
 
 ResourceSuspectList::ResourceSuspectList()
-	: super()
+	: super(0, std::hash<void*>(), std::equal_to<void*>(), super::allocator_type(std::make_shared<NodePool>()))
+	, m_lock()
+	, m_count(0)
+	, m_collectCountdown(c_collectInterval)
+	, m_isWatching(false)
+	, m_isMatchOnly(false)
+	, m_isLazy(false)
+	, m_shadowArena(nullptr)
+	, m_stats()
 {
+	for (auto& count : m_presence)
+		count.store(0, std::memory_order_relaxed);
+}
+
+
+unsigned int ResourceSuspectList::GetPresenceSlot(const void* ptr)
+{
+	// COM objects are at least 8-byte aligned
+	const uint32_t key = static_cast<uint32_t>(reinterpret_cast<uintptr_t>(ptr) >> 3);
+	return (key * 2654435761u) >> 22;  // the top 10 bits, for 1024 slots
+}
+
+
+bool ResourceSuspectList::MayHold(const void* ptr) const
+{
+	return m_presence[GetPresenceSlot(ptr)].load(std::memory_order_acquire) != 0;
+}
+
+
+ResourceSuspectList::super::iterator ResourceSuspectList::Erase(super::iterator itr)
+{
+	m_presence[GetPresenceSlot(itr->first)].fetch_sub(1, std::memory_order_release);
+	m_count.fetch_sub(1, std::memory_order_release);
+	return super::erase(itr);
+}
+
+
+void ResourceSuspectList::SetWatchMode(bool isWatching)
+{
+	m_isWatching.store(isWatching);
+}
+
+
+void ResourceSuspectList::SetMatchOnly(bool isMatchOnly)
+{
+	m_isMatchOnly.store(isMatchOnly);
+}
+
+
+void ResourceSuspectList::SetLazyMode(bool isLazy)
+{
+	m_isLazy.store(isLazy);
 }
 
 
 void ResourceSuspectList::Add(void* ptr, ResourceSuspect&& suspect)
 {
-	super::emplace(ptr, suspect);
+	std::lock_guard<std::mutex> lock(m_lock);
+	if (super::emplace(ptr, suspect).second) {
+		m_presence[GetPresenceSlot(ptr)].fetch_add(1, std::memory_order_release);
+		m_count.fetch_add(1, std::memory_order_release);
+	}
 }
 
 
 void ResourceSuspectList::Remove(void* ptr)
 {
-	super::erase(ptr);
+	if (!MayHold(ptr))
+		return;
+	std::lock_guard<std::mutex> lock(m_lock);
+	auto itr = super::find(ptr);
+	if (itr != super::cend() && !itr->second.HasShadow())
+		Erase(itr);
 }
 
 
 void ResourceSuspectList::SetMappedData(void* ptr, const D3D11_MAPPED_SUBRESOURCE& data)
 {
+	if (!MayHold(ptr))
+		return;
+	std::lock_guard<std::mutex> lock(m_lock);
 	auto itr = super::find(ptr);
-	if (itr != super::cend()) {
+	if (itr != super::cend() && !itr->second.HasShadow()) {
 		itr->second.mappedData = data;
 		itr->second.RenewTimeStamp();
 	}
 }
 
 
+void ResourceSuspectList::SetShadowArena(ShadowArena* arena)
+{
+	std::lock_guard<std::mutex> lock(m_lock);
+	m_shadowArena = arena;
+}
+
+
+bool ResourceSuspectList::SetShadowedMappedData(void* ptr, D3D11_MAPPED_SUBRESOURCE& data, bool isDiscarded)
+{
+	if (!MayHold(ptr))
+		return false;
+	std::lock_guard<std::mutex> lock(m_lock);
+	auto itr = super::find(ptr);
+	if (itr == super::cend() || itr->second.HasShadow())
+		return false;  // a second subresource mapped at once isn't tracked
+
+	auto& suspect = itr->second;
+	suspect.mappedData = data;
+	suspect.RenewTimeStamp();
+	if (m_shadowArena == nullptr || data.DepthPitch == 0 || !m_shadowArena->Acquire(data.DepthPitch, suspect.shadow))
+		return false;
+
+	// same pitch as the mapping, so the shadow is copied back in one go; what the application
+	// leaves unwritten must then be what the mapping held
+	if (!isDiscarded)
+		memcpy(suspect.shadow.data, data.pData, data.DepthPitch);
+	suspect.realData = data.pData;
+	suspect.mappedData.pData = suspect.shadow.data;
+	data.pData = suspect.shadow.data;
+	return true;
+}
+
+
 // does not check timestamp
 bool ResourceSuspectList::ActOn(void* ptr)
 {
+	if (!MayHold(ptr))
+		return false;
+	std::lock_guard<std::mutex> lock(m_lock);
 	bool hasActionTaken = false;
 	auto itr = super::find(ptr);
 	if (itr != super::cend() && itr->second.IsDataReady()) {
-		const auto& mappedData = itr->second.mappedData;
-		for (auto& filter : itr->second.filterList)
-			hasActionTaken = filter->ActUponMappedData(mappedData) || hasActionTaken;
-		if (hasActionTaken)
-			super::erase(itr);
+		hasActionTaken = ActUpon(itr->second, nullptr);
+		if (hasActionTaken) {
+			FlushShadow(itr->second);
+			Erase(itr);
+		}
+	}
+	return hasActionTaken;
+}
+
+
+bool ResourceSuspectList::ActOnUnmap(void* ptr, CopiedActionList* copies)
+{
+	if (!MayHold(ptr))
+		return false;
+	std::lock_guard<std::mutex> lock(m_lock);
+	auto itr = super::find(ptr);
+	if (itr == super::cend())
+		return false;
+	auto& suspect = itr->second;
+	if (!suspect.IsDataReady()) {
+		if (!m_isWatching.load(std::memory_order_relaxed) && !suspect.isPending)
+			Erase(itr);
+		return false;
 	}
+
+	++m_stats.unmapCount;
+	if (m_isLazy.load(std::memory_order_relaxed)) {
+		FlushShadow(suspect);
+		suspect.mappedData.pData = nullptr;
+		suspect.isPending = true;
+		suspect.RenewTimeStamp();
+		return false;
+	}
+	return ActOnData(itr, copies);
+}
+
+
+bool ResourceSuspectList::IsPending(void* ptr) const
+{
+	if (!MayHold(ptr))
+		return false;
+	std::lock_guard<std::mutex> lock(m_lock);
+	auto itr = super::find(ptr);
+	return itr != super::cend() && itr->second.isPending;
+}
+
+
+bool ResourceSuspectList::ActOnRemapped(void* ptr, const D3D11_MAPPED_SUBRESOURCE& data, CopiedActionList* copies)
+{
+	if (!MayHold(ptr))
+		return false;
+	std::lock_guard<std::mutex> lock(m_lock);
+	auto itr = super::find(ptr);
+	if (itr == super::cend() || !itr->second.isPending)
+		return false;
+	itr->second.isPending = false;
+	itr->second.mappedData = data;
+	return ActOnData(itr, copies);
+}
+
+
+bool ResourceSuspectList::ActOnData(super::iterator itr, CopiedActionList* copies)
+{
+	auto& suspect = itr->second;
+	if (!m_isWatching.load(std::memory_order_relaxed)) {
+		++m_stats.fullCheckCount;
+		const bool hasActionTaken = ActUpon(suspect, copies);
+		m_stats.hitCount += hasActionTaken ? 1 : 0;
+		FlushShadow(suspect);
+		Erase(itr);
+		return hasActionTaken;
+	}
+
+	// Content seen before needs no new check if it missed. If it hit, it has just been written
+	// again and needs the action again.
+	const uint64_t sample = SampleMappedData(suspect.mappedData);
+	bool hasActionTaken = false;
+	if (suspect.hasSample && suspect.sample == sample && !suspect.hasHit)
+		++m_stats.skipCount;
+	else {
+		++m_stats.fullCheckCount;
+		hasActionTaken = ActUpon(suspect, copies);
+		m_stats.hitCount += hasActionTaken ? 1 : 0;
+		suspect.sample = sample;
+		suspect.hasSample = true;
+		suspect.hasHit = hasActionTaken;
+	}
+	FlushShadow(suspect);
+	suspect.mappedData.pData = nullptr;
 	return hasActionTaken;
 }
 
 
+ResourceSuspectList::WatchStats ResourceSuspectList::GetWatchStats() const
+{
+	std::lock_guard<std::mutex> lock(m_lock);
+	return m_stats;
+}
+
+
+bool ResourceSuspectList::GetFilterList(void* ptr, SharedDataFilterList& out) const
+{
+	if (!MayHold(ptr))
+		return false;
+	std::lock_guard<std::mutex> lock(m_lock);
+	auto itr = super::find(ptr);
+	if (itr == super::cend())
+		return false;
+	out = itr->second.filterList;
+	return true;
+}
+
+
 void ResourceSuspectList::CollectGarbage()
 {
-	std::vector<void*> eraseList;
-	for (auto& suspect : *this) {
-		if (suspect.second.IsTimedOut())
-			eraseList.emplace_back(suspect.first);
+	// timeouts are counted in seconds, so there is no hurry
+	if (m_collectCountdown.fetch_sub(1, std::memory_order_relaxed) != 1)
+		return;
+	m_collectCountdown.store(c_collectInterval, std::memory_order_relaxed);
+	if (IsEmpty())
+		return;
+
+	std::lock_guard<std::mutex> lock(m_lock);
+	for (auto itr = super::begin(); itr != super::end();) {
+		if (itr->second.IsTimedOut() && !itr->second.HasShadow())
+			itr = Erase(itr);
+		else
+			++itr;
+	}
+}
+
+
+bool ResourceSuspectList::ActUpon(ResourceSuspect& suspect, CopiedActionList* copies)
+{
+	if (suspect.filterList == nullptr)
+		return false;
+	const bool isMatchOnly = m_isMatchOnly.load(std::memory_order_relaxed);
+	const bool canCopy = copies != nullptr && suspect.copyFormat != DXGI_FORMAT_UNKNOWN;
+	bool hasActionTaken = false;
+	for (auto& filter : *suspect.filterList) {
+		if (!filter->MatchMappedData(suspect.mappedData))
+			continue;
+		// before the action changes the content
+		LogPackedConversion(*filter, suspect);
+		if (!isMatchOnly && canCopy && filter->GetAction().IsCopied()) {
+			copies->push_back(CopiedAction { filter, suspect.copyFormat });
+			hasActionTaken = true;
+			continue;
+		}
+		hasActionTaken = (isMatchOnly || filter->GetAction()(suspect.mappedData, suspect.rowCount)) || hasActionTaken;
+	}
+	return hasActionTaken;
+}
+
+
+void ResourceSuspectList::FlushShadow(ResourceSuspect& suspect)
+{
+	if (!suspect.HasShadow())
+		return;
+	StreamCopy(suspect.realData, suspect.shadow.data, suspect.mappedData.DepthPitch);
+	m_shadowArena->Release(suspect.shadow);
+	suspect.realData = nullptr;
+}
+
+
+void ResourceSuspectList::Clear()
+{
+	std::lock_guard<std::mutex> lock(m_lock);
+	for (auto itr = super::begin(); itr != super::end(); ) {
+		if (itr->second.HasShadow())
+			++itr;
+		else
+			itr = Erase(itr);
 	}
-	for (auto item : eraseList)
-		super::erase(item);
+}
+
+
+bool ResourceSuspectList::IsEmpty() const
+{
+	return m_count.load(std::memory_order_acquire) == 0;
 }
 
 
 
-DataFilterFactory& GetDataFilterFactory()
+DataFilterSnapshot& GetDataFilterSnapshot()
 {
-	static DataFilterFactory factory;
-	if (factory.GetEntryCount() == 0)
-		SetupDataFilterFactory(factory);
-	return factory;
+	static DataFilterSnapshot snapshot(MakeBuiltInDataFilterFactory());
+	return snapshot;
 }
 
 
-ResourceSuspectList s_suspectList;
+void InitDataFilters(FilterSetupFunc setup, const SignatureRecord* table, size_t tableSize, const uint8_t* patchData, size_t patchDataSize)
+{
+	s_builtInSetup.store(setup);
+	auto factory = MakeBuiltInDataFilterFactory();
+	factory->SetSignatureTable(table, tableSize, patchData, patchDataSize);
+	GetDataFilterSnapshot().Publish(std::move(factory));
+}
+
+
+bool ReloadDataFilters(const wchar_t* signaturePath)
+{
+	SignatureRecordList records;
+	std::vector<uint8_t> patchData;
+	unsigned int errorLine;
+	if (!LoadSignatureFile(signaturePath, records, patchData, errorLine)) {
+		LOG_ERROR(L"Failed to load signatures from %s (line %u)\n", signaturePath, errorLine);
+		return false;
+	}
 
+	// the index is built here, off the hooks, and only published once complete
+	const size_t recordCount = records.size();
+	SortSignatureRecords(records);
+	auto factory = MakeBuiltInDataFilterFactory();
+	factory->SetSignatureTable(std::move(records), std::move(patchData));
+	LOG_INFO(L"Loaded %u signatures from %s\n", static_cast<unsigned int>(recordCount), signaturePath);
 
+	GetDataFilterSnapshot().Publish(std::move(factory));
+	return true;
+}
@@ -18,9 +18,12 @@
 
 #pragma once
 
+#include <atomic>
 #include <cstdint>
 #include <functional>
 #include <memory>
+#include <mutex>
+#include <type_traits>
 #include <unordered_map>
 #include <vector>
 
@@ -30,11 +33,128 @@
 #pragma warning(pop)
 #include <windows.h>
 
+#include <Hash.h>
+
+#include "shared/patch.h"
+#include "shared/signature.h"
+#include "HookArena.h"
+#include "ShadowArena.h"
+#include "Snapshot.h"
+
 
 
 using FilterDescCondition = std::function<bool (const D3D11_TEXTURE2D_DESC&)>;
-using FilterDataCondition = std::function<bool (const D3D11_MAPPED_SUBRESOURCE&)>;
-using FilterDataAction = std::function<bool (const D3D11_MAPPED_SUBRESOURCE&)>;
+
+
+
+// building blocks of the built-in filters
+bool MatchHash(const void* data, unsigned int size, const gan::Hash<256>& hash);
+uint64_t GetHashedByteCount();  // by MatchHash() since startup
+bool IsSignatureDesc(const D3D11_TEXTURE2D_DESC& desc);  // a texture whose content may be a signature
+// $rowCount is the rows of the mapped texture, as given by GetFormatLayout().
+// @return false, with nothing written, if the rectangle doesn't lie within the mapping
+bool ErasePixels(const D3D11_MAPPED_SUBRESOURCE& data, UINT rowCount, const D3D11_RECT& rect, uint8_t stride);
+bool PatchPixels(const D3D11_MAPPED_SUBRESOURCE& data, UINT rowCount, const D3D11_RECT& rect, const PixelPatch& patch);
+
+
+
+// Condition on mapped data. A fingerprint, the SHA-256 digest of the first rows as defined by
+// FingerprintKind, can also be evaluated on content which is never mapped whole.
+class FilterDataCondition
+{
+public:
+	using Func = std::function<bool (const D3D11_MAPPED_SUBRESOURCE&)>;
+
+	// padded fingerprint
+	FilterDataCondition(const gan::Hash<256>& fingerprint);
+
+	// Packed fingerprint of $rowCount rows of $rowSize bytes, as given by GetFormatLayout() and
+	// GetFingerprintRowCount(). A row size of zero, for a format of unknown layout, never matches.
+	FilterDataCondition(const gan::Hash<256>& fingerprint, UINT rowSize, UINT rowCount);
+
+	template <typename F, typename = std::enable_if_t<std::is_invocable_r_v<bool, F&, const D3D11_MAPPED_SUBRESOURCE&>>>
+	FilterDataCondition(F func)
+		: m_func(std::move(func))
+		, m_fingerprint()
+		, m_hasFingerprint(false)
+		, m_kind(FingerprintKind::Padded)
+		, m_rowSize(0)
+		, m_rowCount(0)
+	{
+	}
+
+	bool operator()(const D3D11_MAPPED_SUBRESOURCE& data) const;
+
+	bool HasFingerprint() const						{ return m_hasFingerprint; }
+	const gan::Hash<256>& GetFingerprint() const	{ return m_fingerprint; }
+	FingerprintKind GetFingerprintKind() const		{ return m_kind; }
+	UINT GetRowSize() const							{ return m_rowSize; }  // of a packed fingerprint
+	UINT GetRowCount() const						{ return m_rowCount; }  // ditto
+
+
+private:
+	bool MatchPadded(const D3D11_MAPPED_SUBRESOURCE& data) const;
+	bool MatchPacked(const D3D11_MAPPED_SUBRESOURCE& data) const;
+
+	Func m_func;
+	gan::Hash<256> m_fingerprint;
+	bool m_hasFingerprint;
+	FingerprintKind m_kind;
+	UINT m_rowSize;
+	UINT m_rowCount;
+};
+
+
+
+// Action on mapped data. Erasing a rectangle can also be done on content which is never
+// mapped, by writing zeros over it. Patching one needs the content it leaves in place, so it
+// is only done on mapped data. Either may be marked to be carried out by a copy instead, see
+// CopyPatcher; the call operator always writes through the CPU.
+class FilterDataAction
+{
+public:
+	using Func = std::function<bool (const D3D11_MAPPED_SUBRESOURCE&)>;
+
+	FilterDataAction(const D3D11_RECT& eraseRect, uint8_t stride);
+
+	// $rect is inclusive and of the size of $patch
+	FilterDataAction(const D3D11_RECT& rect, std::shared_ptr<const PixelPatch> patch);
+
+	template <typename F, typename = std::enable_if_t<std::is_invocable_r_v<bool, F&, const D3D11_MAPPED_SUBRESOURCE&>>>
+	FilterDataAction(F func)
+		: m_func(std::move(func))
+		, m_eraseRect()
+		, m_stride(0)
+		, m_patch()
+		, m_isCopied(false)
+	{
+	}
+
+	bool operator()(const D3D11_MAPPED_SUBRESOURCE& data, UINT rowCount) const;  // like ErasePixels()
+
+	// only for erasing, or a patch which replaces its whole rectangle
+	// @return whether the action may be copied
+	bool SetCopied(bool isCopied);
+
+	bool IsErase() const					{ return m_stride != 0; }
+	bool IsPatch() const					{ return m_patch != nullptr; }
+	const D3D11_RECT& GetEraseRect() const	{ return m_eraseRect; }  // inclusive, like ErasePixels(); patched, for a patch
+	uint8_t GetStride() const				{ return m_stride; }
+	const PixelPatch* GetPatch() const		{ return m_patch.get(); }
+	bool IsCopied() const					{ return m_isCopied; }
+
+
+private:
+	Func m_func;
+	D3D11_RECT m_eraseRect;
+	uint8_t m_stride;
+	std::shared_ptr<const PixelPatch> m_patch;  // shared by the copies of the action
+	bool m_isCopied;
+};
+
+// cheap digest of a few cache lines spread over the rows covered by fingerprints; equal samples
+// mean the content is very likely unchanged
+uint64_t SampleMappedData(const D3D11_MAPPED_SUBRESOURCE& data);
 
 
 
@@ -42,16 +162,39 @@ class DataFilter
 {
 public:
 	DataFilter(const FilterDataCondition& condition, const FilterDataAction& action);
-	bool ActUponMappedData(const D3D11_MAPPED_SUBRESOURCE& data);
+	bool ActUponMappedData(const D3D11_MAPPED_SUBRESOURCE& data, UINT rowCount);
+	bool MatchMappedData(const D3D11_MAPPED_SUBRESOURCE& data) const;  // the condition only
+
+	const FilterDataCondition& GetCondition() const	{ return m_condition; }
+	const FilterDataAction& GetAction() const		{ return m_action; }
+
+	// true the first time only, for the conversion of a padded fingerprint to be logged once
+	bool ShouldLogConversion();
 
 
 private:
 	FilterDataCondition m_condition;
 	FilterDataAction m_action;
+	std::atomic<bool> m_isConversionLogged;
 };
 
 using DataFilterList = std::vector<std::shared_ptr<DataFilter>>;
 
+// Lists are never changed once built, so that suspects and hooks share them instead of copying.
+using SharedDataFilterList = std::shared_ptr<const DataFilterList>;
+
+
+// An action which hit, left by ResourceSuspectList to be carried out by a copy once the suspect
+// has been unmapped. The filter is held so that the action outlives a reload.
+struct CopiedAction
+{
+	std::shared_ptr<const DataFilter> filter;
+	DXGI_FORMAT format;  // of the suspect
+};
+
+// filled within the Unmap() detour, so it takes the memory of the hook arena
+using CopiedActionList = ArenaVector<CopiedAction>;
+
 
 
 class DataFilterFactory
@@ -67,13 +210,44 @@ public:
 
 	DataFilterFactory();
 
+	// build an entry from a signature loaded at run time, with the patch data it came with
+	static Entry MakeEntry(const SignatureRecord& record, const uint8_t* patchData, size_t patchDataSize);
+
 	void Register(const Entry& entry);
-	bool Match(const D3D11_TEXTURE2D_DESC& desc, DataFilterList& out);
+
+	// Take the signatures loaded at run time as a table sorted by SortSignatureRecords(), in
+	// which Match() looks descriptors up by binary search instead of trying them one by one.
+	// The records are used where they are and must outlive the factory, like those of the
+	// handoff from the launcher. Their patches are decompressed here, once.
+	void SetSignatureTable(const SignatureRecord* records, size_t count, const uint8_t* patchData, size_t patchDataSize);
+	void SetSignatureTable(SignatureRecordList&& records, std::vector<uint8_t>&& patchData);  // kept by the factory
+
+	// The list of a description matched by one entry, or by signatures of one descriptor, is
+	// built beforehand; the one of several is built the first time they match together, then
+	// handed out again from a snapshot, without locking or allocating.
+	bool Match(const D3D11_TEXTURE2D_DESC& desc, SharedDataFilterList& out) const;
 	size_t GetEntryCount() const;
 
 
 private:
-	std::vector<std::pair<FilterDescCondition, std::shared_ptr<DataFilter>>> m_registry;
+	struct RegistryItem
+	{
+		FilterDescCondition descCond;
+		SharedDataFilterList filters;  // of this entry alone
+	};
+
+	using CombinedLists = std::vector<SharedDataFilterList>;
+
+	const SharedDataFilterList* FindInTable(const D3D11_TEXTURE2D_DESC& desc) const;
+
+	std::vector<RegistryItem> m_registry;
+	SignatureRecordList m_ownedTable;
+	std::vector<uint8_t> m_ownedPatchData;
+	const SignatureRecord* m_table;
+	size_t m_tableSize;
+	std::vector<SharedDataFilterList> m_tableFilters;  // by record, shared by those of a descriptor
+	mutable std::mutex m_combinedLock;  // serializes the publishers of new combinations
+	mutable SnapshotPublisher<CombinedLists> m_combined;
 };
 
 
@@ -82,22 +256,45 @@ private:
 template <unsigned int TimeOutSec>
 struct TimedResourceSuspect
 {
+	// unchecked content may be copied long after it was written
+	static constexpr unsigned int c_pendingTimeOutSec = TimeOutSec * 10;
+
 	uint64_t timestamp;
 	D3D11_MAPPED_SUBRESOURCE mappedData;
-	DataFilterList filterList;
+	SharedDataFilterList filterList;
+	uint64_t sample;  // of the content last checked, in watch mode
+	bool hasSample;
+	bool hasHit;  // whether that content was acted upon
+	bool isPending;  // unmapped content not checked yet, in lazy mode
+	void* realData;  // the actual mapping while $mappedData points to a shadow buffer
+	ShadowArena::Block shadow;
+	UINT rowSize;  // layout of the texture as given by GetFormatLayout(), or zero if unknown, for
+	UINT rowCount;  // padded fingerprints which hit to be converted; the height if unknown
+	DXGI_FORMAT copyFormat;  // the texture's if its copied actions may be copied, else DXGI_FORMAT_UNKNOWN
 
 
 	TimedResourceSuspect()
 		: timestamp(GetTickCount64())
 		, mappedData()
 		, filterList()
+		, sample(0)
+		, hasSample(false)
+		, hasHit(false)
+		, isPending(false)
+		, realData(nullptr)
+		, shadow()
+		, rowSize(0)
+		, rowCount(0)
+		, copyFormat(DXGI_FORMAT_UNKNOWN)
 	{
 		mappedData.pData = nullptr;
+		shadow.data = nullptr;
 	}
 
 	bool IsTimedOut() const
 	{
-		return (GetTickCount64() - timestamp) >= static_cast<uint64_t>(TimeOutSec * 1000);
+		const unsigned int timeOutSec = isPending ? c_pendingTimeOutSec : TimeOutSec;
+		return (GetTickCount64() - timestamp) >= static_cast<uint64_t>(timeOutSec * 1000);
 	}
 
 	void RenewTimeStamp()
@@ -109,6 +306,12 @@ struct TimedResourceSuspect
 	{
 		return mappedData.pData != nullptr;
 	}
+
+	// the application still writes into the shadow buffer, so the suspect must stay until Unmap()
+	bool HasShadow() const
+	{
+		return shadow.data != nullptr;
+	}
 };
 
 
@@ -116,21 +319,120 @@ constexpr unsigned int cSuspectTimeOutSec = 3;
 using ResourceSuspect = TimedResourceSuspect<cSuspectTimeOutSec>;
 
 
-class ResourceSuspectList : private std::unordered_map<void*, ResourceSuspect>
+// suspects come and go with textures, so their nodes are recycled
+using ResourceSuspectMap = std::unordered_map<void*, ResourceSuspect, std::hash<void*>, std::equal_to<void*>,
+	NodePoolAllocator<std::pair<void* const, ResourceSuspect>>>;
+
+
+class ResourceSuspectList : private ResourceSuspectMap
 {
-	using super = std::unordered_map<void*, ResourceSuspect>;
+	using super = ResourceSuspectMap;
 
 public:
+	struct WatchStats
+	{
+		uint64_t unmapCount;  // Unmap() of a suspect with mapped data
+		uint64_t fullCheckCount;  // ... of which the data conditions were evaluated
+		uint64_t skipCount;  // ... of which the sample showed unchanged content
+		uint64_t hitCount;  // ... of which some action was taken
+	};
+
+
 	ResourceSuspectList();
 
+	// Keep suspects after their data has been checked, so that a staging texture reused for
+	// many uploads is checked again whenever its sampled content changes.
+	void SetWatchMode(bool isWatching);
+
+	// Only check the data conditions and take no action, for when the content found is dealt
+	// with elsewhere. A hit is then reported as if an action had been taken.
+	void SetMatchOnly(bool isMatchOnly);
+
+	// Leave the content unchecked at Unmap() and check it when the suspect is first copied
+	// from, through ActOnRemapped(). Content which is never copied is never checked.
+	void SetLazyMode(bool isLazy);
+
+	// Hand out shadow buffers from $arena in place of the mappings of suspects; call it before
+	// anything is mapped.
+	void SetShadowArena(ShadowArena* arena);
+
+	// Like SetMappedData(), but the mapping in $data is replaced with a shadow buffer in cached
+	// memory if $ptr is a suspect, which makes fingerprinting and patching much cheaper than on
+	// write-combined memory. The shadow is copied over the whole mapping at Unmap(), so it starts
+	// with the content of the mapping unless $isDiscarded says that content is undefined anyway.
+	// @return whether $data has been replaced
+	bool SetShadowedMappedData(void* ptr, D3D11_MAPPED_SUBRESOURCE& data, bool isDiscarded);
+
+	// Act on the data of a suspect about to be unmapped, then write its shadow buffer back if any.
+	// As the data will be invalid afterwards, the suspect is forgotten unless watch mode keeps it.
+	// Copied actions which hit go to $copies, if given, for the caller to copy once unmapped;
+	// without it, or if the suspect has no copy format, they are written like the others.
+	bool ActOnUnmap(void* ptr, CopiedActionList* copies);
+	WatchStats GetWatchStats() const;
+
+	// whether the suspect has content left unchecked by lazy mode
+	bool IsPending(void* ptr) const;
+
+	// Act on the pending content of a suspect mapped again for that, like ActOnUnmap() would
+	// have done; the caller unmaps it afterwards.
+	bool ActOnRemapped(void* ptr, const D3D11_MAPPED_SUBRESOURCE& data, CopiedActionList* copies);
+
 	void Add(void* ptr, ResourceSuspect&& suspect);
 	void Remove(void* ptr);
 	void SetMappedData(void* ptr, const D3D11_MAPPED_SUBRESOURCE& data);
 	bool ActOn(void* ptr);  // does not check timestamp
+	bool GetFilterList(void* ptr, SharedDataFilterList& out) const;
+
+	// forget suspects timed out; only one call in c_collectInterval does the sweep
 	void CollectGarbage();
+	void Clear();
+	bool IsEmpty() const;  // without locking
+
+
+private:
+	static constexpr unsigned int c_presenceSlotCount = 1024;  // power of two
+	static constexpr unsigned int c_collectInterval = 64;
+
+	static unsigned int GetPresenceSlot(const void* ptr);
+
+	// Whether $ptr may be a suspect, without locking. Map() and Unmap() see every resource
+	// of the application, so the lock is only taken for those which might be ours.
+	bool MayHold(const void* ptr) const;
+
+	super::iterator Erase(super::iterator itr);
+	bool ActOnData(super::iterator itr, CopiedActionList* copies);  // the mapped data is invalid afterwards
+	bool ActUpon(ResourceSuspect& suspect, CopiedActionList* copies);
+	void FlushShadow(ResourceSuspect& suspect);
+
+	mutable std::mutex m_lock;  // the device may create textures on any thread
+	std::atomic<uint32_t> m_presence[c_presenceSlotCount];  // suspects per slot, written under $m_lock
+	std::atomic<size_t> m_count;  // ditto, of all suspects
+	std::atomic<unsigned int> m_collectCountdown;
+	std::atomic<bool> m_isWatching;
+	std::atomic<bool> m_isMatchOnly;
+	std::atomic<bool> m_isLazy;
+	ShadowArena* m_shadowArena;
+	WatchStats m_stats;
 };
 
 
 
-DataFilterFactory& GetDataFilterFactory();
+// adds the built-in signatures of a title to a factory
+using FilterSetupFunc = void (*)(DataFilterFactory&);
+
+
+// The set of registered filters is swapped as a whole whenever signatures are reloaded.
+// Hooks read the current one through a guard, with no locking.
+using DataFilterSnapshot = SnapshotPublisher<DataFilterFactory>;
+
+DataFilterSnapshot& GetDataFilterSnapshot();
+
+// publish the built-in signatures of the running title, on top of which reloads are built,
+// along with a table of signatures loaded beforehand, if any; see SetSignatureTable()
+// @remark the filter set is empty until this is called
+void InitDataFilters(FilterSetupFunc setup, const SignatureRecord* table, size_t tableSize, const uint8_t* patchData, size_t patchDataSize);
+
+// rebuild the filter set from built-in signatures plus those in a signature file, then publish it
+// @remark blocks until no hook uses the previous set anymore; don't call it from a hook
+bool ReloadDataFilters(const wchar_t* signaturePath);
 
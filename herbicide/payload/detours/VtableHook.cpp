@@ -0,0 +1,108 @@
+/*
+ *  herbicide - removing flowers and rabbits in the game Mirror
+ *  Copyright (C) 2018 Mifan Bang <https://debug.tw>.
+ *
+ *  This program is free software: you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation, either version 3 of the License, or
+ *  (at your option) any later version.
+ *
+ *  This program is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include "VtableHook.h"
+
+#include <mutex>
+
+
+
+namespace {
+
+
+
+// Several entries share a vtable page and one page's protection is a single setting, so
+// two unsynchronized writers could restore read-only under each other's store. Every
+// hook writes through this lock, whichever of the governor or the hooking code asked.
+std::mutex s_writeLock;
+
+
+
+}  // unnamed namespace
+
+
+
+VtableHook::VtableHook()
+	: m_entry(nullptr)
+	, m_original(nullptr)
+	, m_detour(nullptr)
+	, m_isArmed(false)
+{
+}
+
+
+bool VtableHook::Attach(void** vtable, unsigned int index, void* detour)
+{
+	void** entry = vtable + index;
+	if (entry == m_entry)
+		return true;
+	if (m_entry != nullptr || *entry == detour)
+		return false;
+
+	m_original = *entry;
+	m_detour = detour;
+	m_entry = entry;
+	return true;
+}
+
+
+bool VtableHook::Arm()
+{
+	if (m_entry == nullptr)
+		return false;
+	if (m_isArmed.exchange(true))
+		return true;
+	if (!WriteEntry(m_detour)) {
+		m_isArmed.store(false);
+		return false;
+	}
+	return true;
+}
+
+
+bool VtableHook::Disarm()
+{
+	if (m_entry == nullptr)
+		return false;
+	if (!m_isArmed.exchange(false))
+		return true;
+	if (!WriteEntry(m_original)) {
+		m_isArmed.store(true);
+		return false;
+	}
+	return true;
+}
+
+
+bool VtableHook::IsArmed() const
+{
+	return m_isArmed.load(std::memory_order_relaxed);
+}
+
+
+// vtables live in read-only sections, hence the change of protection around the store
+bool VtableHook::WriteEntry(void* value)
+{
+	std::lock_guard<std::mutex> lock(s_writeLock);
+	DWORD oldProtect;
+	if (::VirtualProtect(m_entry, sizeof(void*), PAGE_READWRITE, &oldProtect) == FALSE)
+		return false;
+	::InterlockedExchangePointer(m_entry, value);
+	::VirtualProtect(m_entry, sizeof(void*), oldProtect, &oldProtect);
+	return true;
+}
@@ -0,0 +1,61 @@
+/*
+ *  herbicide - removing flowers and rabbits in the game Mirror
+ *  Copyright (C) 2018 Mifan Bang <https://debug.tw>.
+ *
+ *  This program is free software: you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation, either version 3 of the License, or
+ *  (at your option) any later version.
+ *
+ *  This program is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#pragma once
+
+#include <atomic>
+
+#include <windows.h>
+
+
+
+// Hook made by replacing one entry of a vtable. Unlike an inline hook it can be turned on
+// and off at any time: the entry is a single aligned pointer, so a concurrent caller sees
+// either the original function or the detour, never a half-written one.
+class VtableHook
+{
+public:
+	VtableHook();
+
+	VtableHook(const VtableHook&) = delete;
+	VtableHook& operator=(const VtableHook&) = delete;
+
+	// remember the original entry; attaching the same entry again does nothing
+	bool Attach(void** vtable, unsigned int index, void* detour);
+
+	// arming and disarming one hook from several threads at once must be serialized by the caller
+	bool Arm();
+	bool Disarm();
+	bool IsArmed() const;
+
+	// the original function, valid whether armed or not
+	template <typename Func>
+	Func* GetOriginal() const
+	{
+		return reinterpret_cast<Func*>(m_original);
+	}
+
+
+private:
+	bool WriteEntry(void* value);
+
+	void** m_entry;
+	void* m_original;
+	void* m_detour;
+	std::atomic<bool> m_isArmed;
+};
@@ -19,101 +19,169 @@
 #pragma warning(disable: 4731)  // frame pointer register 'ebp' modified by inline assembly code
 #pragma warning(disable: 4740)  // flow in or out of inline asm code suppresses global optimization
 
-#define TEXTURE_DUMPING_MODE	0
-#define TEXTURE_DUMPING_LIB		1  // 0 for using legacy D3D11 SDK; 1 for using DirectXTK.
+#define TEXTURE_DUMPING_MODE	0  // textures are written to "tx" by a background thread
 
 #include "d3d11.h"
 
-#if TEXTURE_DUMPING_MODE
-	#if TEXTURE_DUMPING_LIB == 0
-		#include <D3DX11tex.h>
-		#pragma comment(lib, "d3dx11.lib")
-	#elif TEXTURE_DUMPING_LIB == 1
-		#include <DXGItype.h>
-		#include <wincodec.h>
-		#include <../../DirectXTK/Inc/ScreenGrab.h>
-		#pragma comment(lib, "../../DirectXTK/Bin/Desktop_2019_Win10/Win32/Release/DirectXTK.lib")
-	#else
-		#error "Invalid TEXTURE_DUMPING_LIB value"
-	#endif  // TEXTURE_DUMPING_LIB
-#endif  // TEXTURE_DUMPING_MODE
+#include <atomic>
+#include <mutex>
+#include <type_traits>
+#include <vector>
+
+#include <dxgi1_2.h>
+#include <wrl/client.h>
 
 #include <Hook.h>
 
 #include "shared/util.h"
+#include "../BandedUpload.h"
+#include "../CopyPatcher.h"
+#include "../DeferredContext.h"
+#include "../DrawSuppressor.h"
+#include "../DxgiFormat.h"
+#include "../FrameProfiler.h"
+#include "../Handoff.h"
+#include "../HookArena.h"
+#include "../HookGovernor.h"
+#include "../LogFile.h"
+#include "../TextureDumper.h"
 #include "../TextureFilter.h"
+#include "VtableHook.h"
 
 
 namespace {
 
 
-ID3D11DeviceContext* s_deviceContext = nullptr;
+// hooks on the vtable of a kind of context; immediate and deferred contexts may share one
+struct ContextHooks
+{
+	void** vtable;
+	VtableHook map;
+	VtableHook unmap;
+	VtableHook executeCommandList;
+	VtableHook finishCommandList;
+	VtableHook updateSubresource;
+	VtableHook release;
+
+	// with draw suppression or lazy verification
+	VtableHook copySubresourceRegion;
+	VtableHook copyResource;
+
+	// with draw suppression only
+	VtableHook psSetShaderResources;
+	VtableHook drawIndexed;
+	VtableHook draw;
+	VtableHook drawIndexedInstanced;
+	VtableHook drawInstanced;
+	VtableHook drawAuto;
+	VtableHook drawIndexedInstancedIndirect;
+	VtableHook drawInstancedIndirect;
+	VtableHook clearState;
+};
+
+
+ID3D11DeviceContext* s_deviceContext = nullptr;  // the immediate context
 void* s_addrCreateTexture2D = nullptr;
-void* s_addrUnmap = nullptr;
-void* s_addrMap = nullptr;
+VtableHook s_hookCreateShaderResourceView;
+VtableHook s_hookCreateDeferredContext;
+ContextHooks s_contextHooks[2];  // immediate, then deferred if their vtables differ
+VtableHook s_hookCommandListRelease;
+VtableHook s_hookCreateSwapChain;
+VtableHook s_hookCreateSwapChainForHwnd;
+VtableHook s_hookPresent;
+std::mutex s_hookLock;
+std::once_flag s_deviceSetupFlag;
+
+constexpr size_t c_shadowRetainLimit = 256 << 20;
 
+ShadowArena s_shadowArena(c_shadowRetainLimit);
 ResourceSuspectList s_suspectList;
+DeferredContextRegistry s_deferredContexts;
+BandedUploadTracker s_bandedUploads;  // suspects which are uploaded rather than mapped
+CopyPatcher s_copyPatcher;  // actions of signatures carried out by copies
+HookGovernor s_governor;
+FrameProfiler s_frameProfiler;
 
-#if TEXTURE_DUMPING_MODE
-std::unordered_map<ID3D11Resource*, D3D11_MAPPED_SUBRESOURCE> s_mappedRes;
+// With draw suppression, identified content is left as it is and the draws sampling it are
+// skipped instead. It's chosen once, before any hook is in place.
+bool s_isDrawSuppressing = false;
+DrawSuppressor s_drawSuppressor;
+DrawBindings s_immediateBindings;
+
+// with lazy verification, the content of a suspect is only checked once it gets copied from
+bool s_isLazyVerifying = false;
 
-bool DumpTexture(ID3D11DeviceContext* pContext, ID3D11Resource* pResource, bool checkMappedResource)
+// When set, the detours go straight to the original functions, so that the same scene can be
+// compared with and without the filter engine. It only changes at a Present().
+std::atomic<bool> s_isBypassed(false);
+
+// the textures CopyPatcher copies from are created through the hooked CreateTexture2D()
+thread_local bool t_isCreatingCopySource = false;
+
+
+bool IsBypassed()
 {
-	static bool callFlag = false;  // prevent texture saving function from recursively calling itself
-	static uint32_t uniqueId = 0;
+	return s_isBypassed.load(std::memory_order_relaxed);
+}
 
-	D3D11_RESOURCE_DIMENSION type;
-	pResource->GetType(&type);
-	if (!callFlag && type == ::D3D11_RESOURCE_DIMENSION_TEXTURE2D) {
-		D3D11_TEXTURE2D_DESC desc;
-		reinterpret_cast<::ID3D11Texture2D*>(pResource)->GetDesc(&desc);
-
-		gan::Hash<256> hash { };
-		if (checkMappedResource) {
-			auto itr = s_mappedRes.find(pResource);
-			if (itr == s_mappedRes.cend())
-				return false;
-			auto mapped = itr->second;
-			s_mappedRes.erase(pResource);
-
-			if (desc.Height >= 32)
-				gan::Hasher::GetSHA(mapped.pData, mapped.RowPitch << 5, hash);
-			else
-				return false;
-		}
 
-		std::wstring path;
-		{
-			path.reserve(MAX_PATH);
-			path.append(L"tx\\tx_");
-			for (int i = 0; i < 32; ++i) {
-				wchar_t buf[32];
-				wsprintf(buf, L"%02X", hash.data[i]);
-				path.append(buf);
-			}
-			path.push_back('_');
-			path.append(std::to_wstring(desc.Format));
-			path.push_back('_');
-			path.append(std::to_wstring(uniqueId++));
-			path.append(L".png");
-		}
+ContextHooks& GetContextHooks(ID3D11DeviceContext* pContext)
+{
+	void** vtable = *reinterpret_cast<void***>(pContext);
+	return s_contextHooks[1].vtable == vtable ? s_contextHooks[1] : s_contextHooks[0];
+}
 
-		callFlag = true;
-		LRESULT result = S_OK;
-#if TEXTURE_DUMPING_LIB == 0
-		result = ::D3DX11SaveTextureToFileW(pContext, pResource, ::D3DX11_IFF_PNG, path.c_str());
 
-#elif TEXTURE_DUMPING_LIB == 1
-		result = DirectX::SaveWICTextureToFile(pContext, pResource, GUID_ContainerFormatPng, path.c_str(), nullptr, nullptr, true);
-		if (result != S_OK)
-			result = DirectX::SaveDDSTextureToFile(pContext, pResource, path.c_str());
-#endif  // TEXTURE_DUMPING_LIB
-		callFlag = false;
+DrawBindings* GetDrawBindings(ID3D11DeviceContext* pContext)
+{
+	if (pContext->GetType() != D3D11_DEVICE_CONTEXT_DEFERRED)
+		return &s_immediateBindings;
+	auto state = s_deferredContexts.Find(pContext);
+	return state != nullptr ? &state->GetDrawBindings() : nullptr;
+}
 
-		return result == S_OK;
-	}
 
-	return false;
+// CopySubresourceRegion() is only hooked with draw suppression or lazy verification
+CopyPatcher::CopyFunc GetOriginalCopy(const ContextHooks& hooks)
+{
+	auto original = hooks.copySubresourceRegion.GetOriginal<std::remove_pointer_t<CopyPatcher::CopyFunc>>();
+	return original != nullptr ? original : reinterpret_cast<CopyPatcher::CopyFunc>(hooks.vtable[46]);
+}
+
+#if TEXTURE_DUMPING_MODE
+constexpr size_t c_maxMappedRes = 1024;
+
+std::unordered_map<ID3D11Resource*, D3D11_MAPPED_SUBRESOURCE> s_mappedRes;  // top-level surfaces mapped on the immediate context
+
+
+void RememberMapping(ID3D11Resource* pResource, UINT subresource, const D3D11_MAPPED_SUBRESOURCE& mapped)
+{
+	if (subresource != 0)
+		return;
+
+	// resources mapped while the hooks were disarmed are never seen unmapped
+	if (s_mappedRes.size() >= c_maxMappedRes)
+		s_mappedRes.clear();
+	s_mappedRes[pResource] = mapped;
+}
+
+
+// queue the content of a texture about to be unmapped; the game thread only pays for a copy
+void DumpMappedTexture(ID3D11Resource* pResource)
+{
+	auto itr = s_mappedRes.find(pResource);
+	if (itr == s_mappedRes.end())
+		return;
+	const auto mapped = itr->second;
+	s_mappedRes.erase(itr);
+
+	D3D11_RESOURCE_DIMENSION type;
+	pResource->GetType(&type);
+	if (type != D3D11_RESOURCE_DIMENSION_TEXTURE2D)
+		return;
+	D3D11_TEXTURE2D_DESC desc;
+	static_cast<ID3D11Texture2D*>(pResource)->GetDesc(&desc);
+	GetTextureDumper().Submit(desc, mapped.pData, mapped.RowPitch);
 }
 #endif  // TEXTURE_DUMPING_MODE
 
@@ -148,7 +216,15 @@ ResultAvailable:
 	if (result != S_OK)
 		return result;
 
-	DEBUG_MSG(
+	// the texture may take the address of a released one which was tagged
+	if (s_isDrawSuppressing)
+		s_drawSuppressor.OnCreateResource(*ppTexture2D);
+	if (IsBypassed() || t_isCreatingCopySource)
+		return result;
+
+	ScopedDetourTime detourTime(s_frameProfiler);
+	ScopedHookArena hookArena;
+	LOG_DEBUG(
 		L"CreateTexture2D w=%d h=%d fmt=%d usg=%d dat=%p tex=%p\n",
 		pDesc->Width,
 		pDesc->Height,
@@ -157,67 +233,81 @@ ResultAvailable:
 		pInitialData,
 		ppTexture2D ? *ppTexture2D : nullptr);
 
-	if (pInitialData != nullptr && s_deviceContext != nullptr)
+	if (pInitialData != nullptr)
 	{
-		DEBUG_MSG(L"  pInitialData: pSysMem=%p SysMemPitch=%d SysMemSlicePitch=%d\n", pInitialData->pSysMem, pInitialData->SysMemPitch, pInitialData->SysMemSlicePitch);
+		LOG_DEBUG(L"  pInitialData: pSysMem=%p SysMemPitch=%d SysMemSlicePitch=%d\n", pInitialData->pSysMem, pInitialData->SysMemPitch, pInitialData->SysMemSlicePitch);
 #if TEXTURE_DUMPING_MODE
-		DumpTexture(s_deviceContext, *ppTexture2D, false);
+		GetTextureDumper().Submit(*pDesc, pInitialData->pSysMem, pInitialData->SysMemPitch);
 #endif
 	}
 
-	DataFilterList dataFilters;
-	if (GetDataFilterFactory().Match(*pDesc, dataFilters)) {
+	SharedDataFilterList dataFilters;
+	if (GetDataFilterSnapshot().Read()->Match(*pDesc, dataFilters)) {
 		ResourceSuspect suspect;
 		suspect.filterList = std::move(dataFilters);
+		if (!GetFormatLayout(pDesc->Format, pDesc->Width, pDesc->Height, suspect.rowSize, suspect.rowCount)) {
+			suspect.rowSize = 0;
+			suspect.rowCount = pDesc->Height;
+		}
+		// draw suppression leaves the content as it is
+		const auto createSource = [pDevice](const D3D11_TEXTURE2D_DESC& desc, const D3D11_SUBRESOURCE_DATA& data, ID3D11Texture2D** ppTexture) {
+			t_isCreatingCopySource = true;
+			const HRESULT result = pDevice->CreateTexture2D(&desc, &data, ppTexture);
+			t_isCreatingCopySource = false;
+			return result == S_OK;
+		};
+		if (!s_isDrawSuppressing && s_copyPatcher.Prepare(*pDesc, *suspect.filterList, createSource))
+			suspect.copyFormat = pDesc->Format;
 		s_suspectList.Add(*ppTexture2D, std::move(suspect));
+		s_bandedUploads.Forget(*ppTexture2D);
+		s_governor.OnMatch();
 	}
 	return S_OK;
 }
 
 
-HRESULT WINAPI Map(
-	[[maybe_unused]] ID3D11DeviceContext* pContext,
-	[[maybe_unused]] ID3D11Resource* pResource,
-	[[maybe_unused]] UINT Subresource,
-	[[maybe_unused]] D3D11_MAP MapType,
-	[[maybe_unused]] UINT MapFlags,
-	[[maybe_unused]] D3D11_MAPPED_SUBRESOURCE* pMappedResource
-)
+void TagResource(ID3D11Resource* pResource)
 {
-	if (s_deviceContext == nullptr)
-		s_deviceContext = pContext;
+	if (!s_drawSuppressor.IsTagged(pResource))
+		LOG_DEBUG(L"Resource %p tagged for draw suppression\n", pResource);
+	s_drawSuppressor.Tag(pResource);
+}
 
-	HRESULT result;
-	__asm {
-		lea eax, pContext
-		push dword ptr[eax + 14h]
-		push dword ptr[eax + 10h]
-		push dword ptr[eax + 0Ch]
-		push dword ptr[eax + 8h]
-		push dword ptr[eax + 4h]
-		push dword ptr[eax]
-		call Trampoline
-		mov result, eax
-		jmp ResultAvailable
 
-Trampoline:
-		push ebp
-		mov ebp, esp
-		mov eax, s_addrMap
-		add eax, 5
-		jmp eax
+HRESULT WINAPI Map(
+	ID3D11DeviceContext* pContext,
+	ID3D11Resource* pResource,
+	UINT Subresource,
+	D3D11_MAP MapType,
+	UINT MapFlags,
+	D3D11_MAPPED_SUBRESOURCE* pMappedResource
+)
+{
+	auto result = GetContextHooks(pContext).map.GetOriginal<decltype(Map)>()(pContext, pResource, Subresource, MapType, MapFlags, pMappedResource);
+	if (result != S_OK || pMappedResource == nullptr)
+		return result;
 
-ResultAvailable:
-	}
-	if (result != S_OK)
+	// whatever the resource was tagged for is about to be written over
+	if (s_isDrawSuppressing && MapType != D3D11_MAP_READ)
+		s_drawSuppressor.Untag(pResource);
+	// A deferred context only maps dynamic resources, while suspects are staging or default
+	// textures: there is nothing to look up.
+	if (IsBypassed() || pContext->GetType() == D3D11_DEVICE_CONTEXT_DEFERRED)
 		return result;
 
+	ScopedDetourTime detourTime(s_frameProfiler);
+	ScopedOverhead overhead(s_governor);
+	ScopedHookArena hookArena;
+
 #if TEXTURE_DUMPING_MODE
-	if (pMappedResource != nullptr)
-		s_mappedRes[pResource] = *pMappedResource;
+	RememberMapping(pResource, Subresource, *pMappedResource);
 #endif // TEXTURE_DUMPING_MODE
 
-	if (pMappedResource != nullptr)
+	// only a write-only map may be given a shadow buffer, as nothing the application writes
+	// reaches the GPU before Unmap()
+	if (MapType == D3D11_MAP_WRITE || MapType == D3D11_MAP_WRITE_DISCARD)
+		s_suspectList.SetShadowedMappedData(pResource, *pMappedResource, MapType == D3D11_MAP_WRITE_DISCARD);
+	else
 		s_suspectList.SetMappedData(pResource, *pMappedResource);
 
 	return S_OK;
@@ -225,35 +315,720 @@ ResultAvailable:
 
 
 void WINAPI Unmap(
-	[[maybe_unused]] ID3D11DeviceContext* pContext,
-	[[maybe_unused]] ID3D11Resource* pResource,
-	[[maybe_unused]] UINT Subresource
+	ID3D11DeviceContext* pContext,
+	ID3D11Resource* pResource,
+	UINT Subresource
 )
 {
-	s_suspectList.CollectGarbage();
-	if (!s_suspectList.ActOn(pResource))
-		s_suspectList.Remove(pResource);  // as mappedData will be invalid after Unmap(), we shouldn't keep it
+	auto& hooks = GetContextHooks(pContext);
+
+	// nothing a deferred context maps is a suspect, see Map()
+	if (pContext->GetType() == D3D11_DEVICE_CONTEXT_DEFERRED) {
+		hooks.unmap.GetOriginal<decltype(Unmap)>()(pContext, pResource, Subresource);
+		return;
+	}
+
+	// the copied actions are issued after the unmap has been forwarded
+	ScopedHookArena hookArena;
+	CopiedActionList copies;
+	{
+		ScopedDetourTime detourTime(s_frameProfiler);
+		ScopedOverhead overhead(s_governor);
+
+		if (IsBypassed()) {
+			// a mapping made before the bypass must still be settled, or its shadow buffer would
+			// never be written back; with nothing mapped this is a lookup
+			s_suspectList.ActOnUnmap(pResource, nullptr);
+		}
+		else {
+			s_suspectList.CollectGarbage();
+			if (s_suspectList.ActOnUnmap(pResource, &copies) && s_isDrawSuppressing)
+				TagResource(pResource);
 
 #if TEXTURE_DUMPING_MODE
-	DumpTexture(pContext, pResource, true);
+			DumpMappedTexture(pResource);
+#else
+			// a tag must see the Map() which writes over its content, so tags keep the hooks armed
+			s_governor.OnIdle([]() { return !s_suspectList.IsEmpty() || s_drawSuppressor.IsAnyTagged(); });
 #endif
+		}
+	}
 
-	__asm {
-		lea eax, pContext
-		push dword ptr[eax + 8h]
-		push dword ptr[eax + 4h]
-		push dword ptr[eax]
-		call Trampoline
-		jmp ResultAvailable
+	hooks.unmap.GetOriginal<decltype(Unmap)>()(pContext, pResource, Subresource);
 
-Trampoline:
-		push ebp
-		mov ebp, esp
-		mov eax, s_addrUnmap
-		add eax, 5
-		jmp eax
+	// queued behind the content just written, and ahead of any copy the application makes of it
+	if (!copies.empty())
+		s_copyPatcher.Issue(pContext, GetOriginalCopy(hooks), pResource, copies);
+}
 
-ResultAvailable:
+
+// map a suspect again on the immediate context to check the content lazy mode left pending
+void VerifyPending(ID3D11DeviceContext* pContext, ID3D11Resource* pResource)
+{
+	// suspects all come from CreateTexture2D(); without write access the content can't be ours to patch
+	D3D11_TEXTURE2D_DESC desc;
+	static_cast<ID3D11Texture2D*>(pResource)->GetDesc(&desc);
+	if ((desc.CPUAccessFlags & D3D11_CPU_ACCESS_WRITE) == 0)
+		return;
+	const D3D11_MAP mapType = (desc.CPUAccessFlags & D3D11_CPU_ACCESS_READ) != 0 ? D3D11_MAP_READ_WRITE : D3D11_MAP_WRITE;
+
+	ScopedHookArena hookArena;
+	auto& hooks = GetContextHooks(pContext);
+	D3D11_MAPPED_SUBRESOURCE mapped;
+	if (hooks.map.GetOriginal<decltype(Map)>()(pContext, pResource, 0, mapType, 0, &mapped) != S_OK)
+		return;
+	CopiedActionList copies;
+	if (s_suspectList.ActOnRemapped(pResource, mapped, &copies) && s_isDrawSuppressing)
+		TagResource(pResource);
+	hooks.unmap.GetOriginal<decltype(Unmap)>()(pContext, pResource, 0);
+
+	// before the copy which made the check happen is forwarded
+	if (!copies.empty())
+		s_copyPatcher.Issue(pContext, GetOriginalCopy(hooks), pResource, copies);
+}
+
+
+// Called before the copy is forwarded. Lazy mode checks the content of a suspect the first
+// time it's copied from, before the GPU can see it; a deferred context can't map it, so that
+// waits for the execution of the command list.
+void OnCopy(ID3D11DeviceContext* pContext, const PendingCopy& copy)
+{
+	if (s_isLazyVerifying && !IsBypassed() && s_suspectList.IsPending(copy.src)) {
+		if (pContext->GetType() == D3D11_DEVICE_CONTEXT_DEFERRED) {
+			auto state = s_deferredContexts.Find(pContext);
+			if (state != nullptr)
+				state->OnPendingCopy(copy);
+			return;
+		}
+		VerifyPending(pContext, static_cast<ID3D11Resource*>(copy.src));
+	}
+	if (s_isDrawSuppressing)
+		s_drawSuppressor.OnCopy(copy.dst, copy.src, copy.isWhole);
+}
+
+
+void WINAPI ExecuteCommandList(
+	ID3D11DeviceContext* pContext,
+	ID3D11CommandList* pCommandList,
+	BOOL RestoreContextState
+)
+{
+	{
+		ScopedDetourTime detourTime(s_frameProfiler);
+		auto work = s_deferredContexts.FindCommandListWork(pCommandList);
+		if (work != nullptr) {
+			if (pContext->GetType() == D3D11_DEVICE_CONTEXT_DEFERRED) {
+				auto state = s_deferredContexts.Find(pContext);
+				if (state != nullptr)
+					state->Inherit(*work);
+			}
+			else {
+				for (const auto& copy : work->pendingCopies)
+					OnCopy(pContext, copy);
+			}
+		}
+	}
+
+	GetContextHooks(pContext).executeCommandList.GetOriginal<decltype(ExecuteCommandList)>()(pContext, pCommandList, RestoreContextState);
+
+	// unless restored, the context is left in its default state
+	if (s_isDrawSuppressing && !RestoreContextState) {
+		auto bindings = GetDrawBindings(pContext);
+		if (bindings != nullptr)
+			bindings->Clear();
+	}
+}
+
+
+// the work of a command list is settled by every execution, so it's kept until the list is gone
+ULONG WINAPI CommandListRelease(ID3D11CommandList* pCommandList)
+{
+	return s_deferredContexts.ReleaseCommandList(pCommandList, [pCommandList]() {
+		return s_hookCommandListRelease.GetOriginal<decltype(CommandListRelease)>()(pCommandList);
+	});
+}
+
+
+// ref: ID3D11CommandListVtbl in d3d11.h
+void HookCommandListVtable(void** vtable)
+{
+	std::lock_guard<std::mutex> lock(s_hookLock);
+	if (s_hookCommandListRelease.Attach(vtable, 2, reinterpret_cast<void*>(CommandListRelease)))
+		s_hookCommandListRelease.Arm();
+}
+
+
+HRESULT WINAPI FinishCommandList(
+	ID3D11DeviceContext* pContext,
+	BOOL RestoreDeferredContextState,
+	ID3D11CommandList** ppCommandList
+)
+{
+	auto result = GetContextHooks(pContext).finishCommandList.GetOriginal<decltype(FinishCommandList)>()(pContext, RestoreDeferredContextState, ppCommandList);
+	if (result == S_OK && ppCommandList != nullptr && *ppCommandList != nullptr) {
+		ScopedDetourTime detourTime(s_frameProfiler);
+		if (!s_hookCommandListRelease.IsArmed())
+			HookCommandListVtable(*reinterpret_cast<void***>(*ppCommandList));
+		auto state = s_deferredContexts.Find(pContext);
+		if (state != nullptr) {
+			s_deferredContexts.AttachToCommandList(*ppCommandList, state->TakeWork());
+			if (!RestoreDeferredContextState)
+				state->GetDrawBindings().Clear();
+		}
+	}
+	return result;
+}
+
+
+ULONG WINAPI ContextRelease(ID3D11DeviceContext* pContext)
+{
+	auto original = GetContextHooks(pContext).release.GetOriginal<decltype(ContextRelease)>();
+	if (pContext->GetType() != D3D11_DEVICE_CONTEXT_DEFERRED)
+		return original(pContext);
+	return s_deferredContexts.ReleaseContext(pContext, [pContext, original]() {
+		return original(pContext);
+	});
+}
+
+
+HRESULT WINAPI CreateShaderResourceView(
+	ID3D11Device* pDevice,
+	ID3D11Resource* pResource,
+	const D3D11_SHADER_RESOURCE_VIEW_DESC* pDesc,
+	ID3D11ShaderResourceView** ppSRView
+)
+{
+	auto result = s_hookCreateShaderResourceView.GetOriginal<decltype(CreateShaderResourceView)>()(pDevice, pResource, pDesc, ppSRView);
+	if (result == S_OK && ppSRView != nullptr && *ppSRView != nullptr)
+		s_drawSuppressor.OnCreateView(*ppSRView, pResource);
+	return result;
+}
+
+
+void WINAPI PSSetShaderResources(
+	ID3D11DeviceContext* pContext,
+	UINT StartSlot,
+	UINT NumViews,
+	ID3D11ShaderResourceView* const* ppShaderResourceViews
+)
+{
+	{
+		ScopedDetourTime detourTime(s_frameProfiler);
+		auto bindings = GetDrawBindings(pContext);
+		if (bindings != nullptr)
+			s_drawSuppressor.OnSetShaderResources(*bindings, StartSlot, NumViews, reinterpret_cast<const void* const*>(ppShaderResourceViews));
+	}
+
+	GetContextHooks(pContext).psSetShaderResources.GetOriginal<decltype(PSSetShaderResources)>()(pContext, StartSlot, NumViews, ppShaderResourceViews);
+}
+
+
+// Bindings are tracked while bypassed as well, so that nothing is missed when the bypass ends.
+// @return whether the draw samples tagged content
+bool ShouldSkipDraw(ID3D11DeviceContext* pContext)
+{
+	if (IsBypassed())
+		return false;
+
+	ScopedDetourTime detourTime(s_frameProfiler);
+	auto bindings = GetDrawBindings(pContext);
+	return bindings != nullptr && s_drawSuppressor.OnDraw(*bindings);
+}
+
+
+void WINAPI DrawIndexed(
+	ID3D11DeviceContext* pContext,
+	UINT IndexCount,
+	UINT StartIndexLocation,
+	INT BaseVertexLocation
+)
+{
+	if (!ShouldSkipDraw(pContext))
+		GetContextHooks(pContext).drawIndexed.GetOriginal<decltype(DrawIndexed)>()(pContext, IndexCount, StartIndexLocation, BaseVertexLocation);
+}
+
+
+void WINAPI Draw(
+	ID3D11DeviceContext* pContext,
+	UINT VertexCount,
+	UINT StartVertexLocation
+)
+{
+	if (!ShouldSkipDraw(pContext))
+		GetContextHooks(pContext).draw.GetOriginal<decltype(Draw)>()(pContext, VertexCount, StartVertexLocation);
+}
+
+
+void WINAPI DrawIndexedInstanced(
+	ID3D11DeviceContext* pContext,
+	UINT IndexCountPerInstance,
+	UINT InstanceCount,
+	UINT StartIndexLocation,
+	INT BaseVertexLocation,
+	UINT StartInstanceLocation
+)
+{
+	if (!ShouldSkipDraw(pContext))
+		GetContextHooks(pContext).drawIndexedInstanced.GetOriginal<decltype(DrawIndexedInstanced)>()(pContext, IndexCountPerInstance, InstanceCount, StartIndexLocation, BaseVertexLocation, StartInstanceLocation);
+}
+
+
+void WINAPI DrawInstanced(
+	ID3D11DeviceContext* pContext,
+	UINT VertexCountPerInstance,
+	UINT InstanceCount,
+	UINT StartVertexLocation,
+	UINT StartInstanceLocation
+)
+{
+	if (!ShouldSkipDraw(pContext))
+		GetContextHooks(pContext).drawInstanced.GetOriginal<decltype(DrawInstanced)>()(pContext, VertexCountPerInstance, InstanceCount, StartVertexLocation, StartInstanceLocation);
+}
+
+
+void WINAPI DrawAuto(
+	ID3D11DeviceContext* pContext
+)
+{
+	if (!ShouldSkipDraw(pContext))
+		GetContextHooks(pContext).drawAuto.GetOriginal<decltype(DrawAuto)>()(pContext);
+}
+
+
+void WINAPI DrawIndexedInstancedIndirect(
+	ID3D11DeviceContext* pContext,
+	ID3D11Buffer* pBufferForArgs,
+	UINT AlignedByteOffsetForArgs
+)
+{
+	if (!ShouldSkipDraw(pContext))
+		GetContextHooks(pContext).drawIndexedInstancedIndirect.GetOriginal<decltype(DrawIndexedInstancedIndirect)>()(pContext, pBufferForArgs, AlignedByteOffsetForArgs);
+}
+
+
+void WINAPI DrawInstancedIndirect(
+	ID3D11DeviceContext* pContext,
+	ID3D11Buffer* pBufferForArgs,
+	UINT AlignedByteOffsetForArgs
+)
+{
+	if (!ShouldSkipDraw(pContext))
+		GetContextHooks(pContext).drawInstancedIndirect.GetOriginal<decltype(DrawInstancedIndirect)>()(pContext, pBufferForArgs, AlignedByteOffsetForArgs);
+}
+
+
+// Textures which are never mapped may be uploaded in bands of rows, each fingerprinted as it
+// comes. Only whole rows of the top level are; a band of part of the rows throws away the
+// fingerprint. Mapping can't tell which rows were written, so it isn't tracked this way.
+// @return whether the upload completed a fingerprint which hit
+bool TrackUpload(ID3D11Resource* pResource, UINT subresource, const D3D11_BOX* pBox, const void* pSrcData, UINT srcRowPitch, BandedUploadTracker::EraseList& erases)
+{
+	if (subresource != 0 || pSrcData == nullptr)
+		return false;
+	D3D11_RESOURCE_DIMENSION type;
+	pResource->GetType(&type);
+	if (type != D3D11_RESOURCE_DIMENSION_TEXTURE2D)
+		return false;
+	SharedDataFilterList filterList;
+	if (!s_suspectList.GetFilterList(pResource, filterList))
+		return false;
+
+	D3D11_TEXTURE2D_DESC desc;
+	static_cast<ID3D11Texture2D*>(pResource)->GetDesc(&desc);
+	UINT rowSize;
+	UINT rowCount;
+	if (IsBlockCompressed(desc.Format) || !GetFormatLayout(desc.Format, desc.Width, desc.Height, rowSize, rowCount) || srcRowPitch < rowSize)
+		return false;
+	if (pBox != nullptr && (pBox->left != 0 || pBox->right != desc.Width || pBox->top >= pBox->bottom || pBox->bottom > rowCount)) {
+		s_bandedUploads.Forget(pResource);
+		return false;
+	}
+
+	BandedUploadTracker::Band band;
+	band.data = static_cast<const uint8_t*>(pSrcData);
+	band.rowPitch = srcRowPitch;
+	band.rowSize = rowSize;
+	band.rowCount = rowCount;
+	band.firstRow = pBox != nullptr ? pBox->top : 0;
+	band.endRow = pBox != nullptr ? pBox->bottom : rowCount;
+	return s_bandedUploads.OnUpload(pResource, *filterList, band, erases);
+}
+
+
+// Lazy mode checks the source here; the tag of draw suppression follows the content from the
+// staging texture it was identified in to the one sampled.
+void WINAPI CopySubresourceRegion(
+	ID3D11DeviceContext* pContext,
+	ID3D11Resource* pDstResource,
+	UINT DstSubresource,
+	UINT DstX,
+	UINT DstY,
+	UINT DstZ,
+	ID3D11Resource* pSrcResource,
+	UINT SrcSubresource,
+	const D3D11_BOX* pSrcBox
+)
+{
+	{
+		ScopedDetourTime detourTime(s_frameProfiler);
+		ScopedHookArena hookArena;
+		OnCopy(pContext, PendingCopy { pSrcResource, pDstResource, false });
+	}
+	GetContextHooks(pContext).copySubresourceRegion.GetOriginal<decltype(CopySubresourceRegion)>()(pContext, pDstResource, DstSubresource, DstX, DstY, DstZ, pSrcResource, SrcSubresource, pSrcBox);
+}
+
+
+void WINAPI CopyResource(
+	ID3D11DeviceContext* pContext,
+	ID3D11Resource* pDstResource,
+	ID3D11Resource* pSrcResource
+)
+{
+	{
+		ScopedDetourTime detourTime(s_frameProfiler);
+		ScopedHookArena hookArena;
+		OnCopy(pContext, PendingCopy { pSrcResource, pDstResource, true });
+	}
+	GetContextHooks(pContext).copyResource.GetOriginal<decltype(CopyResource)>()(pContext, pDstResource, pSrcResource);
+}
+
+
+void WINAPI UpdateSubresource(
+	ID3D11DeviceContext* pContext,
+	ID3D11Resource* pDstResource,
+	UINT DstSubresource,
+	const D3D11_BOX* pDstBox,
+	const void* pSrcData,
+	UINT SrcRowPitch,
+	UINT SrcDepthPitch
+)
+{
+	// the erases and their zeros are needed after the upload has been forwarded, so the audit
+	// counts what the forwarded calls allocate as well
+	ScopedHookArena hookArena;
+	BandedUploadTracker::EraseList erases;
+	{
+		ScopedDetourTime detourTime(s_frameProfiler);
+		ScopedOverhead overhead(s_governor);
+
+		// only new content for the whole top level replaces what was identified
+		if (s_isDrawSuppressing && DstSubresource == 0 && pDstBox == nullptr)
+			s_drawSuppressor.Untag(pDstResource);
+		if (!IsBypassed() && TrackUpload(pDstResource, DstSubresource, pDstBox, pSrcData, SrcRowPitch, erases) && s_isDrawSuppressing)
+			TagResource(pDstResource);
+		// draw suppression leaves the content as it is
+		if (s_isDrawSuppressing)
+			erases.clear();
+	}
+
+	auto& hooks = GetContextHooks(pContext);
+	hooks.updateSubresource.GetOriginal<decltype(UpdateSubresource)>()(pContext, pDstResource, DstSubresource, pDstBox, pSrcData, SrcRowPitch, SrcDepthPitch);
+
+	// recorded right after the upload on a deferred context as well, so the order holds; a
+	// single row of zeros serves every row of every erase, so the arena holds no more than that
+	UINT zeroRowSize = 0;
+	for (const auto& erase : erases) {
+		const UINT rowSize = (erase.rect.right - erase.rect.left + 1) * erase.stride;
+		if (rowSize > zeroRowSize)
+			zeroRowSize = rowSize;
+	}
+	const ArenaVector<uint8_t> zeros(zeroRowSize);
+	for (const auto& erase : erases) {
+		const UINT rowSize = (erase.rect.right - erase.rect.left + 1) * erase.stride;
+		for (LONG y = erase.rect.top; y <= erase.rect.bottom; ++y) {
+			const D3D11_BOX box { static_cast<UINT>(erase.rect.left), static_cast<UINT>(y), 0, static_cast<UINT>(erase.rect.right) + 1, static_cast<UINT>(y) + 1, 1 };
+			hooks.updateSubresource.GetOriginal<decltype(UpdateSubresource)>()(pContext, pDstResource, 0, &box, zeros.data(), rowSize, 0);
+		}
+	}
+}
+
+
+void WINAPI ClearState(
+	ID3D11DeviceContext* pContext
+)
+{
+	auto bindings = GetDrawBindings(pContext);
+	if (bindings != nullptr)
+		bindings->Clear();
+	GetContextHooks(pContext).clearState.GetOriginal<decltype(ClearState)>()(pContext);
+}
+
+
+// a forced disarm may leave mapped data of suspects behind which Unmap() never saw
+void OnBudgetExceeded()
+{
+	s_suspectList.Clear();
+}
+
+
+// ref: ID3D11DeviceContextVtbl in d3d11.h
+void HookContextCopies(ContextHooks& hooks, void** vtable)
+{
+	if (hooks.copySubresourceRegion.Attach(vtable, 46, reinterpret_cast<void*>(CopySubresourceRegion))
+		&& hooks.copyResource.Attach(vtable, 47, reinterpret_cast<void*>(CopyResource))) {
+		hooks.copySubresourceRegion.Arm();
+		hooks.copyResource.Arm();
+	}
+}
+
+
+// ref: ID3D11DeviceContextVtbl in d3d11.h
+void HookContextDraws(ContextHooks& hooks, void** vtable)
+{
+	if (!hooks.psSetShaderResources.Attach(vtable, 8, reinterpret_cast<void*>(PSSetShaderResources))
+		|| !hooks.drawIndexed.Attach(vtable, 12, reinterpret_cast<void*>(DrawIndexed))
+		|| !hooks.draw.Attach(vtable, 13, reinterpret_cast<void*>(Draw))
+		|| !hooks.drawIndexedInstanced.Attach(vtable, 20, reinterpret_cast<void*>(DrawIndexedInstanced))
+		|| !hooks.drawInstanced.Attach(vtable, 21, reinterpret_cast<void*>(DrawInstanced))
+		|| !hooks.drawAuto.Attach(vtable, 38, reinterpret_cast<void*>(DrawAuto))
+		|| !hooks.drawIndexedInstancedIndirect.Attach(vtable, 39, reinterpret_cast<void*>(DrawIndexedInstancedIndirect))
+		|| !hooks.drawInstancedIndirect.Attach(vtable, 40, reinterpret_cast<void*>(DrawInstancedIndirect))
+		|| !hooks.clearState.Attach(vtable, 110, reinterpret_cast<void*>(ClearState)))
+		return;
+
+	hooks.clearState.Arm();
+	hooks.psSetShaderResources.Arm();
+	hooks.drawIndexed.Arm();
+	hooks.draw.Arm();
+	hooks.drawIndexedInstanced.Arm();
+	hooks.drawInstanced.Arm();
+	hooks.drawAuto.Arm();
+	hooks.drawIndexedInstancedIndirect.Arm();
+	hooks.drawInstancedIndirect.Arm();
+}
+
+
+// ref: ID3D11DeviceContextVtbl in d3d11.h
+void HookContextVtable(ContextHooks& hooks, void** vtable)
+{
+	if (!hooks.map.Attach(vtable, 14, reinterpret_cast<void*>(Map))
+		|| !hooks.unmap.Attach(vtable, 15, reinterpret_cast<void*>(Unmap))
+		|| !hooks.executeCommandList.Attach(vtable, 58, reinterpret_cast<void*>(ExecuteCommandList))
+		|| !hooks.finishCommandList.Attach(vtable, 114, reinterpret_cast<void*>(FinishCommandList))
+		|| !hooks.updateSubresource.Attach(vtable, 48, reinterpret_cast<void*>(UpdateSubresource))
+		|| !hooks.release.Attach(vtable, 2, reinterpret_cast<void*>(ContextRelease)))
+		return;
+	hooks.vtable = vtable;
+
+	// Map(), Unmap() and UpdateSubresource() are hooked through the vtable so that they can be
+	// disarmed while idle
+	s_governor.Govern(hooks.map);
+	s_governor.Govern(hooks.unmap);
+	s_governor.Govern(hooks.updateSubresource);
+	hooks.map.Arm();
+	hooks.unmap.Arm();
+	hooks.updateSubresource.Arm();
+	hooks.executeCommandList.Arm();
+	hooks.finishCommandList.Arm();
+	hooks.release.Arm();
+	// the copies are armed before the bindings so that no tag is missed once a draw can be skipped
+	if (s_isDrawSuppressing || s_isLazyVerifying)
+		HookContextCopies(hooks, vtable);
+	if (s_isDrawSuppressing)
+		HookContextDraws(hooks, vtable);
+	LOG_DEBUG(L"Context vtable %p hooked\n", vtable);
+}
+
+
+HRESULT WINAPI CreateDeferredContext(
+	ID3D11Device* pDevice,
+	UINT ContextFlags,
+	ID3D11DeviceContext** ppDeferredContext
+)
+{
+	auto result = s_hookCreateDeferredContext.GetOriginal<decltype(CreateDeferredContext)>()(pDevice, ContextFlags, ppDeferredContext);
+	if (result != S_OK || ppDeferredContext == nullptr || *ppDeferredContext == nullptr)
+		return result;
+
+	s_deferredContexts.Register(*ppDeferredContext);
+
+	std::lock_guard<std::mutex> lock(s_hookLock);
+	void** vtable = *reinterpret_cast<void***>(*ppDeferredContext);
+	if (vtable != s_contextHooks[0].vtable && s_contextHooks[1].vtable == nullptr)
+		HookContextVtable(s_contextHooks[1], vtable);
+	return result;
+}
+
+
+// Ctrl+Alt+B flips the bypass
+void PollBypassHotkey()
+{
+	static bool s_wasDown = false;
+	const bool isDown = (::GetAsyncKeyState(VK_CONTROL) & 0x8000) != 0
+		&& (::GetAsyncKeyState(VK_MENU) & 0x8000) != 0
+		&& (::GetAsyncKeyState('B') & 0x8000) != 0;
+	if (isDown && !s_wasDown) {
+		const bool isBypassed = !s_isBypassed.load();
+		s_isBypassed.store(isBypassed);
+		LOG_INFO(L"Detours %s\n", isBypassed ? L"bypassed" : L"active");
+	}
+	s_wasDown = isDown;
+}
+
+
+// toggles flipped through the handoff since the last frame; the hotkey may have moved the bypass
+// in the meantime, so only a change of the toggle itself is applied
+void ApplyHandoffToggles()
+{
+	const HandoffHeader* handoff = GetHandoff();
+	if (handoff == nullptr)
+		return;
+
+	static uint32_t s_lastBypassed = handoff->toggles.isBypassed.load(std::memory_order_relaxed);
+	static uint32_t s_lastLogLevel = handoff->toggles.logLevel.load(std::memory_order_relaxed);
+	const uint32_t isBypassed = handoff->toggles.isBypassed.load(std::memory_order_relaxed);
+	if (isBypassed != s_lastBypassed) {
+		s_lastBypassed = isBypassed;
+		s_isBypassed.store(isBypassed != 0);
+		LOG_INFO(L"Detours %s by toggle\n", isBypassed != 0 ? L"bypassed" : L"active");
+	}
+	const uint32_t logLevel = handoff->toggles.logLevel.load(std::memory_order_relaxed);
+	if (logLevel != s_lastLogLevel && logLevel <= static_cast<uint32_t>(LogLevel::Off)) {
+		s_lastLogLevel = logLevel;
+		// opens the log file of a release build the first time a level is enabled
+		SetLoggingLevel(static_cast<LogLevel>(logLevel));
+	}
+}
+
+
+HRESULT WINAPI Present(
+	IDXGISwapChain* pSwapChain,
+	UINT SyncInterval,
+	UINT Flags
+)
+{
+	PollBypassHotkey();
+	ApplyHandoffToggles();
+	s_governor.OnFrame();
+	s_frameProfiler.OnPresent(IsBypassed());
+	return s_hookPresent.GetOriginal<decltype(Present)>()(pSwapChain, SyncInterval, Flags);
+}
+
+
+// ref: IDXGISwapChainVtbl in dxgi.h; IDXGISwapChain1 extends the same vtable
+void HookSwapChainVtable(IDXGISwapChain* pSwapChain)
+{
+	std::lock_guard<std::mutex> lock(s_hookLock);
+	void** vtable = *reinterpret_cast<void***>(pSwapChain);
+	if (s_hookPresent.Attach(vtable, 8, reinterpret_cast<void*>(Present)) && !s_hookPresent.IsArmed() && s_hookPresent.Arm())
+		LOG_DEBUG(L"Swap chain vtable %p hooked\n", vtable);
+}
+
+
+HRESULT WINAPI CreateSwapChain(
+	IDXGIFactory* pFactory,
+	IUnknown* pDevice,
+	DXGI_SWAP_CHAIN_DESC* pDesc,
+	IDXGISwapChain** ppSwapChain
+)
+{
+	auto result = s_hookCreateSwapChain.GetOriginal<decltype(CreateSwapChain)>()(pFactory, pDevice, pDesc, ppSwapChain);
+	if (SUCCEEDED(result) && ppSwapChain != nullptr && *ppSwapChain != nullptr)
+		HookSwapChainVtable(*ppSwapChain);
+	return result;
+}
+
+
+HRESULT WINAPI CreateSwapChainForHwnd(
+	IDXGIFactory2* pFactory,
+	IUnknown* pDevice,
+	HWND hWnd,
+	const DXGI_SWAP_CHAIN_DESC1* pDesc,
+	const DXGI_SWAP_CHAIN_FULLSCREEN_DESC* pFullscreenDesc,
+	IDXGIOutput* pRestrictToOutput,
+	IDXGISwapChain1** ppSwapChain
+)
+{
+	auto result = s_hookCreateSwapChainForHwnd.GetOriginal<decltype(CreateSwapChainForHwnd)>()(pFactory, pDevice, hWnd, pDesc, pFullscreenDesc, pRestrictToOutput, ppSwapChain);
+	if (SUCCEEDED(result) && ppSwapChain != nullptr && *ppSwapChain != nullptr)
+		HookSwapChainVtable(*ppSwapChain);
+	return result;
+}
+
+
+// The swap chain of the game is created by the factory of the adapter of its device, so the
+// factory is hooked to catch it. ref: IDXGIFactoryVtbl in dxgi.h and IDXGIFactory2Vtbl in dxgi1_2.h
+void HookFactoryVtable(ID3D11Device* pDevice)
+{
+	Microsoft::WRL::ComPtr<IDXGIDevice> dxgiDevice;
+	Microsoft::WRL::ComPtr<IDXGIAdapter> adapter;
+	Microsoft::WRL::ComPtr<IDXGIFactory> factory;
+	if (FAILED(pDevice->QueryInterface(IID_PPV_ARGS(&dxgiDevice)))
+		|| FAILED(dxgiDevice->GetAdapter(&adapter))
+		|| FAILED(adapter->GetParent(IID_PPV_ARGS(&factory))))
+		return;
+
+	if (s_hookCreateSwapChain.Attach(*reinterpret_cast<void***>(factory.Get()), 10, reinterpret_cast<void*>(CreateSwapChain)))
+		s_hookCreateSwapChain.Arm();
+	Microsoft::WRL::ComPtr<IDXGIFactory2> factory2;
+	if (SUCCEEDED(factory.As(&factory2)) && s_hookCreateSwapChainForHwnd.Attach(*reinterpret_cast<void***>(factory2.Get()), 15, reinterpret_cast<void*>(CreateSwapChainForHwnd)))
+		s_hookCreateSwapChainForHwnd.Arm();
+}
+
+
+// Everything is hooked on the first device, and the filter set is published by the loading of the
+// scenario pack. Until then it's empty, so textures created in the meantime are left as they are.
+// ref: ID3D11DeviceVtbl and ID3D11DeviceContextVtbl in d3d11.h
+void SetUpDeviceHooks(ID3D11Device* pDevice)
+{
+	Microsoft::WRL::ComPtr<ID3D11DeviceContext> context;
+	pDevice->GetImmediateContext(context.GetAddressOf());
+	auto vtableDevice = *reinterpret_cast<void***>(pDevice);
+	{
+		s_addrCreateTexture2D = vtableDevice[5];
+		gan::Hook hook { reinterpret_cast<decltype(CreateTexture2D)*>(s_addrCreateTexture2D), CreateTexture2D };
+		hook.Install();
+		LOG_DEBUG(L"s_addrCreateTexture2D = %p\n", s_addrCreateTexture2D);
+	}
+	{
+		std::lock_guard<std::mutex> lock(s_hookLock);
+		s_hookCreateDeferredContext.Attach(vtableDevice, 27, reinterpret_cast<void*>(CreateDeferredContext));
+		s_hookCreateDeferredContext.Arm();
+
+		s_deviceContext = context.Get();  // the device holds it for as long as it lives
+
+		// views must be known from the start, since the resource of any of them may get tagged
+		uint32_t drawSuppression = 0;
+		GetEnvironmentUInt(L"HERBICIDE_DRAW_SUPPRESSION", drawSuppression);
+		if (drawSuppression != 0 && s_hookCreateShaderResourceView.Attach(vtableDevice, 7, reinterpret_cast<void*>(CreateShaderResourceView)) && s_hookCreateShaderResourceView.Arm()) {
+			s_isDrawSuppressing = true;
+			s_suspectList.SetMatchOnly(true);
+			LOG_INFO(L"Draw suppression enabled\n");
+		}
+		uint32_t lazyVerify = 0;
+		GetEnvironmentUInt(L"HERBICIDE_LAZY_VERIFY", lazyVerify);
+		if (lazyVerify != 0) {
+			s_isLazyVerifying = true;
+			s_suspectList.SetLazyMode(true);
+			LOG_INFO(L"Lazy verification enabled\n");
+		}
+
+		uint32_t watchReused = 1;
+		GetEnvironmentUInt(L"HERBICIDE_WATCH_REUSED", watchReused);
+		s_suspectList.SetWatchMode(watchReused != 0);
+
+		// a disarmed Unmap() would never write a shadow buffer back, so the budget can't apply
+		uint32_t shadowMap = 0;
+		GetEnvironmentUInt(L"HERBICIDE_SHADOW_MAP", shadowMap);
+		auto governorConfig = GetHookGovernorConfig();
+		if (shadowMap != 0) {
+			s_suspectList.SetShadowArena(&s_shadowArena);
+			governorConfig.frameBudgetUs = 0;
+		}
+		if (s_isDrawSuppressing)
+			governorConfig.frameBudgetUs = 0;  // nor see the Map() which writes over tagged content
+		s_governor.Configure(governorConfig, OnBudgetExceeded);
+		HookContextVtable(s_contextHooks[0], *reinterpret_cast<void***>(context.Get()));
+
+		// 1 logs a summary of the frames every so often; 2 also writes every frame to a trace
+		uint32_t frameProfile = 0;
+		GetEnvironmentUInt(L"HERBICIDE_FRAME_PROFILE", frameProfile);
+		if (frameProfile != 0)
+			s_frameProfiler.Start(frameProfile >= 2 ? GetFrameTracePath().c_str() : nullptr);
+		uint32_t bypass = 0;
+		GetEnvironmentUInt(L"HERBICIDE_BYPASS", bypass);
+		s_isBypassed.store(bypass != 0);
+		HookFactoryVtable(pDevice);
 	}
 }
 
@@ -281,28 +1056,10 @@ HRESULT WINAPI D3D11CreateDevice(
 {
 	auto result = gan::Hook::GetTrampoline(::D3D11CreateDevice)(pAdapter, DriverType, Software, Flags, pFeatureLevels, FeatureLevels, SDKVersion, ppDevice, pFeatureLevel, ppImmediateContext);
 
-	// hooking via vtable. ref: ID3D11DeviceVtbl and ID3D11DeviceContextVtbl in d3d11.h
-	auto vtableDevice = *reinterpret_cast<void***>(*ppDevice);
-	{
-		s_addrCreateTexture2D = vtableDevice[5];
-		gan::Hook hook { reinterpret_cast<decltype(CreateTexture2D)*>(s_addrCreateTexture2D), CreateTexture2D };
-		hook.Install();
-		DEBUG_MSG(L"s_addrCreateTexture2D = %p\n", s_addrCreateTexture2D);
-	}
-	auto vtableDeviceContext = *reinterpret_cast<void***>(*ppImmediateContext);
-	{
-		s_addrMap = vtableDeviceContext[14];
-		gan::Hook hook { reinterpret_cast<decltype(Map)*>(s_addrMap), Map };
-		hook.Install();
-		DEBUG_MSG(L"s_addrMap = %p\n", s_addrMap);
-	}
-	{
-		s_addrUnmap = vtableDeviceContext[15];
-		gan::Hook hook { reinterpret_cast<decltype(Unmap)*>(s_addrUnmap), Unmap };
-		hook.Install();
-		DEBUG_MSG(L"s_addrUnmap = %p\n", s_addrUnmap);
-	}
-
+	// a call may only ask for the feature level, and a failed one leaves the pointers unset
+	if (FAILED(result) || ppDevice == nullptr || *ppDevice == nullptr)
+		return result;
+	std::call_once(s_deviceSetupFlag, SetUpDeviceHooks, *ppDevice);
 	return result;
 }
 
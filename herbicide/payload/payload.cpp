@@ -16,49 +16,16 @@
  *  along with this program.  If not, see <http://www.gnu.org/licenses/>.
  */
 
-#include <vector>
-
-#include <Hook.h>
+#include <windows.h>
 
 #include "shared/herbicide.h"
 #include "shared/util.h"
-#include "detours/d3d11.h"
-
-
-
-class Scenario
-{
-public:
-	Scenario()
-		: m_hookList()
-	{ }
-
-	void Start()
-	{
-		for (auto& hook : m_hookList)
-			hook.Install();
-	}
-
-	void Stop()
-	{
-		for (auto& hook : m_hookList)
-			hook.Uninstall();
-	}
-
-protected:
-	std::vector<gan::Hook> m_hookList;
-};
-
-
-class ScenarioMirror : public Scenario
-{
-public:
-	ScenarioMirror()
-		: Scenario()
-	{
-		m_hookList.emplace_back(::D3D11CreateDevice, detour::D3D11CreateDevice);
-	}
-};
+#include "Handoff.h"
+#include "HookArena.h"
+#include "LogFile.h"
+#include "Scenario.h"
+#include "SignatureWatcher.h"
+#include "TextureDumper.h"
 
 
 
@@ -71,19 +38,39 @@ BOOL WINAPI DllMain(HINSTANCE, DWORD fdwReason, LPVOID)
 #ifdef _DEBUG
 		pDbgConsole = new DebugConsole;
 #endif  // _DEBUG
-
-		if (s_scenaro == nullptr) {
-			s_scenaro = new ScenarioMirror;
+		StartLogging(pDbgConsole != nullptr);
+
+		// only the pack of the running title gets its hooks installed; its signatures are
+		// loaded off the loader lock, and nothing is filtered until they are
+		wchar_t imagePath[MAX_PATH];
+		const DWORD length = ::GetModuleFileNameW(nullptr, imagePath, MAX_PATH);
+		const ScenarioPack* pack = nullptr;
+		if (length > 0 && length < MAX_PATH)
+			pack = SelectScenarioPack(imagePath, GetScenarioPacks());
+
+		if (pack == nullptr)
+			LOG_INFO(L"No scenario pack for this process\n");
+		else if (s_scenaro == nullptr) {
+			OpenHandoff();
+			s_scenaro = pack->createScenario();
 			s_scenaro->Start();
+			StartLoadingScenarioPack(*pack, imagePath);
 		}
 	}
 	else if (fdwReason == DLL_PROCESS_DETACH) {
+		StopSignatureWatcher();
+		StopTextureDumper();
+
 		if (s_scenaro != nullptr) {
 			s_scenaro->Stop();
 			delete s_scenaro;
 			s_scenaro = nullptr;
 		}
 
+#if HERBICIDE_AUDIT_ALLOCATIONS
+		LOG_INFO(L"Heap allocations in detours: %llu\n", GetHookAllocationCount());
+#endif  // HERBICIDE_AUDIT_ALLOCATIONS
+		StopLogging();
 		if (pDbgConsole != nullptr) {
 			delete pDbgConsole;
 			pDbgConsole = nullptr;
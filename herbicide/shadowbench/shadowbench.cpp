@@ -0,0 +1,176 @@
+/*
+ *  herbicide - removing flowers and rabbits in the game Mirror
+ *  Copyright (C) 2018 Mifan Bang <https://debug.tw>.
+ *
+ *  This program is free software: you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation, either version 3 of the License, or
+ *  (at your option) any later version.
+ *
+ *  This program is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+// Measures the shadow buffers of Map(): how much the arena saves over fresh pages for every
+// mapping, what the pitch of a mapping costs the copies in and out of its shadow, and the
+// throughput of StreamCopy() against memcpy(). The destination is ordinary cached memory
+// here, not a write-combined mapping, so streaming stores show what they cost rather than what
+// they save. Only standard C++ and payload/ShadowArena are used, so that it also builds on
+// POSIX:
+//   c++ -std=c++17 -O2 -I. shadowbench/shadowbench.cpp payload/ShadowArena.cpp
+
+#include <stdio.h>
+
+#include <chrono>
+#include <cstring>
+#include <vector>
+
+#include "payload/ShadowArena.h"
+
+
+
+namespace {
+
+
+
+constexpr size_t c_pageSize = 4096;
+constexpr size_t c_retainLimit = static_cast<size_t>(256) << 20;  // as the payload keeps
+constexpr unsigned int c_frameCount = 200;
+constexpr unsigned int c_copyRepeatCount = 20;
+
+
+double GetSeconds(std::chrono::steady_clock::time_point start)
+{
+	return std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+}
+
+
+// the textures mapped for writing in a frame, of 4 bytes per pixel
+struct MappedTexture
+{
+	unsigned int width;
+	unsigned int height;
+};
+
+const MappedTexture c_frameTextures[] = { { 256, 256 }, { 512, 128 }, { 1024, 1024 }, { 2048, 2048 } };
+
+
+// The shadows of a frame: acquired, written all over as the application would, released at
+// Unmap(). Without retention every acquisition is fresh pages, faulted in by the writes.
+// @return microseconds per frame, or a negative value if a block couldn't be acquired
+double MeasureFrames(size_t retainLimit, ShadowArena::Stats& stats)
+{
+	ShadowArena arena(retainLimit);
+	const auto start = std::chrono::steady_clock::now();
+	for (unsigned int frame = 0; frame < c_frameCount; ++frame) {
+		for (const auto& texture : c_frameTextures) {
+			const size_t size = static_cast<size_t>(texture.width) * 4 * texture.height;
+			ShadowArena::Block block;
+			if (!arena.Acquire(size, block))
+				return -1.0;
+			for (size_t offset = 0; offset < size; offset += c_pageSize)
+				block.data[offset] = static_cast<uint8_t>(frame);
+			arena.Release(block);
+		}
+	}
+	const double seconds = GetSeconds(start);
+	stats = arena.GetStats();
+	return seconds * 1e6 / c_frameCount;
+}
+
+
+// A shadow has the pitch of its mapping, padding included, so that it is copied in and out in
+// one go. Row by row would skip the padding at the cost of a call per row.
+// @return MiB/s of pixels, padding excluded
+double MeasurePitchCopy(unsigned int width, unsigned int height, unsigned int rowPitch, bool isByRow)
+{
+	const unsigned int rowSize = width * 4;
+	const size_t depthPitch = static_cast<size_t>(rowPitch) * height;
+	std::vector<uint8_t> mapping(depthPitch, 0x5A);
+	std::vector<uint8_t> shadow(depthPitch);
+
+	const auto start = std::chrono::steady_clock::now();
+	for (unsigned int n = 0; n < c_copyRepeatCount; ++n) {
+		if (isByRow) {
+			for (unsigned int row = 0; row < height; ++row)
+				memcpy(&shadow[static_cast<size_t>(row) * rowPitch], &mapping[static_cast<size_t>(row) * rowPitch], rowSize);
+			for (unsigned int row = 0; row < height; ++row)
+				StreamCopy(&mapping[static_cast<size_t>(row) * rowPitch], &shadow[static_cast<size_t>(row) * rowPitch], rowSize);
+		}
+		else {
+			memcpy(shadow.data(), mapping.data(), depthPitch);
+			StreamCopy(mapping.data(), shadow.data(), depthPitch);
+		}
+	}
+	const double seconds = GetSeconds(start);
+	return static_cast<double>(rowSize) * height * 2 * c_copyRepeatCount / seconds / (1 << 20);
+}
+
+
+// @return MiB/s
+double MeasureCopy(size_t size, size_t dstOffset, bool isStreamed)
+{
+	std::vector<uint8_t> src(size, 0x5A);
+	std::vector<uint8_t> dst(size + 64);
+	const unsigned int repeatCount = static_cast<unsigned int>((static_cast<size_t>(256) << 20) / size);
+
+	const auto start = std::chrono::steady_clock::now();
+	for (unsigned int n = 0; n < repeatCount; ++n) {
+		if (isStreamed)
+			StreamCopy(dst.data() + dstOffset, src.data(), size);
+		else
+			memcpy(dst.data() + dstOffset, src.data(), size);
+	}
+	const double seconds = GetSeconds(start);
+	return static_cast<double>(size) * repeatCount / seconds / (1 << 20);
+}
+
+
+int RunShadowBench()
+{
+	printf("%u frames of %zu mapped textures\n", c_frameCount, sizeof(c_frameTextures) / sizeof(c_frameTextures[0]));
+	printf("retain MiB  us/frame  reused\n");
+	for (const size_t retainLimit : { static_cast<size_t>(0), c_retainLimit }) {
+		ShadowArena::Stats stats;
+		const double us = MeasureFrames(retainLimit, stats);
+		if (us < 0.0) {
+			fprintf(stderr, "Failed to acquire a shadow buffer\n");
+			return -1;
+		}
+		printf("%10zu  %8.1f  %5.1f%%\n", retainLimit >> 20, us, stats.acquireCount > 0 ? 100.0 * stats.reuseCount / stats.acquireCount : 0.0);
+	}
+
+	// tight rows, and rows padded past a multiple of 256 bytes as a driver may lay them out;
+	// 1000 pixels make rows which are no multiple of 64 bytes
+	printf("\nwidth  row pitch  copies   MiB/s\n");
+	for (const unsigned int width : { 1024u, 1000u }) {
+		const unsigned int height = 1024;
+		for (const unsigned int rowPitch : { width * 4, (width * 4 + 255) / 256 * 256 + 256 }) {
+			for (const bool isByRow : { false, true })
+				printf("%5u  %9u  %-6s  %6.0f\n", width, rowPitch, isByRow ? "by row" : "whole", MeasurePitchCopy(width, height, rowPitch, isByRow));
+		}
+	}
+
+	printf("\nsize KiB  dst offset  memcpy MiB/s  StreamCopy MiB/s\n");
+	for (const size_t size : { static_cast<size_t>(64) << 10, static_cast<size_t>(1) << 20, static_cast<size_t>(16) << 20 }) {
+		for (const size_t dstOffset : { static_cast<size_t>(0), static_cast<size_t>(4) })
+			printf("%8zu  %10zu  %12.0f  %16.0f\n", size >> 10, dstOffset, MeasureCopy(size, dstOffset, false), MeasureCopy(size, dstOffset, true));
+	}
+	return 0;
+}
+
+
+
+}  // unnamed namespace
+
+
+
+int main()
+{
+	return RunShadowBench();
+}
@@ -0,0 +1,242 @@
+/*
+ *  herbicide - removing flowers and rabbits in the game Mirror
+ *  Copyright (C) 2018 Mifan Bang <https://debug.tw>.
+ *
+ *  This program is free software: you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation, either version 3 of the License, or
+ *  (at your option) any later version.
+ *
+ *  This program is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include <atomic>
+#include <cstring>
+#include <thread>
+
+#include "bundle.h"
+#include "file.h"
+#include "lz.h"
+
+
+
+namespace {
+
+
+
+constexpr uint32_t c_magic = 0x4E424248;  // "HBBN"
+constexpr uint32_t c_version = 1;
+constexpr uint64_t c_dataAlignment = 16;
+
+static_assert(sizeof(BundleHeader) == 16, "the bundle format must not change");
+static_assert(sizeof(BundleEntry) == 112, "the bundle format must not change");
+
+
+bool HashData(const uint8_t* data, size_t size, uint8_t (&digest)[StreamHasher::c_digestSize])
+{
+	StreamHasher hasher;
+	return hasher.Update(data, size) && hasher.Finish(digest);
+}
+
+
+void Unmask(uint8_t* dst, const uint8_t* src, size_t size, uint8_t mask)
+{
+	for (size_t i = 0; i < size; ++i)
+		dst[i] = static_cast<uint8_t>(src[i] ^ mask);
+}
+
+
+bool IsSameEntry(const BundleInput& lhs, const BundleInput& rhs)
+{
+	return lhs.name == rhs.name && lhs.arch == rhs.arch;
+}
+
+
+
+}  // unnamed namespace
+
+
+
+bool BuildBundle(const std::vector<BundleInput>& inputs, unsigned int threadCount, std::vector<uint8_t>& out)
+{
+	const size_t entryCount = inputs.size();
+	for (size_t i = 0; i < entryCount; ++i) {
+		const auto& input = inputs[i];
+		if (input.name.empty() || input.name.size() > BundleEntry::c_maxNameLength || (input.data == nullptr && input.size > 0))
+			return false;
+		for (size_t j = 0; j < i; ++j) {
+			if (IsSameEntry(inputs[j], input))
+				return false;
+		}
+	}
+
+	// compress and hash every entry; the slowest part, so spread over threads
+	std::vector<BundleEntry> entries(entryCount);
+	std::vector<std::vector<uint8_t>> compressed(entryCount);
+	std::atomic<size_t> next(0);
+	std::atomic<bool> isOk(true);
+	auto worker = [&]() {
+		for (size_t i = next.fetch_add(1); i < entryCount; i = next.fetch_add(1)) {
+			const auto& input = inputs[i];
+			BundleEntry& entry = entries[i];
+			memset(&entry, 0, sizeof(entry));
+			memcpy(entry.name, input.name.c_str(), input.name.size());
+			entry.arch = input.arch;
+			entry.size = input.size;
+			if (!HashData(input.data, input.size, entry.digest))
+				isOk.store(false);
+
+			auto& buffer = compressed[i];
+			buffer.resize(GetLzCompressBound(input.size));
+			const size_t compressedSize = LzCompress(input.data, input.size, buffer.data(), buffer.size());
+			if (compressedSize > 0 && compressedSize < input.size) {
+				buffer.resize(compressedSize);
+				entry.compression = BundleCompression::Lz;
+				entry.storedSize = compressedSize;
+			}
+			else {
+				buffer.clear();
+				entry.compression = BundleCompression::None;
+				entry.storedSize = input.size;
+			}
+		}
+	};
+
+	unsigned int extraThreads = threadCount > 1 ? threadCount - 1 : 0;
+	if (extraThreads + static_cast<size_t>(1) > entryCount)
+		extraThreads = entryCount > 1 ? static_cast<unsigned int>(entryCount - 1) : 0;
+	std::vector<std::thread> threads;
+	threads.reserve(extraThreads);
+	for (unsigned int i = 0; i < extraThreads; ++i)
+		threads.emplace_back(worker);
+	worker();
+	for (auto& thread : threads)
+		thread.join();
+	if (!isOk.load())
+		return false;
+
+	uint64_t offset = sizeof(BundleHeader) + static_cast<uint64_t>(entryCount) * sizeof(BundleEntry);
+	for (auto& entry : entries) {
+		offset = (offset + c_dataAlignment - 1) & ~(c_dataAlignment - 1);
+		entry.offset = offset;
+		offset += entry.storedSize;
+	}
+	if (offset > SIZE_MAX)
+		return false;
+
+	out.assign(static_cast<size_t>(offset), 0);
+	BundleHeader header { };
+	header.magic = c_magic;
+	header.version = c_version;
+	header.entryCount = static_cast<uint32_t>(entryCount);
+	memcpy(out.data(), &header, sizeof(header));
+	if (entryCount > 0)
+		memcpy(out.data() + sizeof(header), entries.data(), entryCount * sizeof(BundleEntry));
+	for (size_t i = 0; i < entryCount; ++i) {
+		const uint8_t* stored = entries[i].compression == BundleCompression::Lz ? compressed[i].data() : inputs[i].data;
+		if (entries[i].storedSize > 0)
+			memcpy(out.data() + entries[i].offset, stored, static_cast<size_t>(entries[i].storedSize));
+	}
+	return true;
+}
+
+
+bool ParseBundleArch(const char* text, BundleArch& arch)
+{
+	if (strcmp(text, "any") == 0)
+		arch = BundleArch::Any;
+	else if (strcmp(text, "x86") == 0)
+		arch = BundleArch::X86;
+	else if (strcmp(text, "x64") == 0)
+		arch = BundleArch::X64;
+	else
+		return false;
+	return true;
+}
+
+
+
+BundleReader::BundleReader()
+	: m_data(nullptr)
+	, m_size(0)
+	, m_mask(0)
+	, m_entries()
+{
+}
+
+
+bool BundleReader::Open(const uint8_t* data, size_t size, uint8_t mask)
+{
+	m_entries.clear();
+	BundleHeader header;
+	if (data == nullptr || size < sizeof(header))
+		return false;
+	Unmask(reinterpret_cast<uint8_t*>(&header), data, sizeof(header), mask);
+	if (header.magic != c_magic || header.version != c_version || (size - sizeof(header)) / sizeof(BundleEntry) < header.entryCount)
+		return false;
+
+	// only the table of contents is read here
+	std::vector<BundleEntry> entries(header.entryCount);
+	Unmask(reinterpret_cast<uint8_t*>(entries.data()), data + sizeof(header), entries.size() * sizeof(BundleEntry), mask);
+	for (const auto& entry : entries) {
+		const bool isValid = entry.name[BundleEntry::c_maxNameLength] == '\0'
+			&& entry.offset <= size
+			&& entry.storedSize <= size - entry.offset
+			&& entry.size <= SIZE_MAX
+			&& ((entry.compression == BundleCompression::None && entry.storedSize == entry.size) || entry.compression == BundleCompression::Lz);
+		if (!isValid)
+			return false;
+	}
+
+	m_data = data;
+	m_size = size;
+	m_mask = mask;
+	m_entries.swap(entries);
+	return true;
+}
+
+
+const BundleEntry* BundleReader::Find(const char* name, BundleArch arch) const
+{
+	const BundleEntry* fallback = nullptr;
+	for (const auto& entry : m_entries) {
+		if (strcmp(entry.name, name) != 0)
+			continue;
+		if (entry.arch == arch)
+			return &entry;
+		if (entry.arch == BundleArch::Any)
+			fallback = &entry;
+	}
+	return fallback;
+}
+
+
+bool BundleReader::Extract(const BundleEntry& entry, std::vector<uint8_t>& out) const
+{
+	const uint8_t* stored = m_data + entry.offset;
+	const size_t storedSize = static_cast<size_t>(entry.storedSize);
+	out.resize(static_cast<size_t>(entry.size));
+
+	if (entry.compression == BundleCompression::None) {
+		Unmask(out.data(), stored, storedSize, m_mask);
+	}
+	else {
+		std::vector<uint8_t> unmasked;
+		if (m_mask != 0) {
+			unmasked.resize(storedSize);
+			Unmask(unmasked.data(), stored, storedSize, m_mask);
+			stored = unmasked.data();
+		}
+		if (!LzDecompress(stored, storedSize, out.data(), out.size()))
+			return false;
+	}
+
+	uint8_t digest[StreamHasher::c_digestSize];
+	return HashData(out.data(), out.size(), digest) && memcmp(digest, entry.digest, sizeof(digest)) == 0;
+}
@@ -0,0 +1,121 @@
+/*
+ *  herbicide - removing flowers and rabbits in the game Mirror
+ *  Copyright (C) 2018 Mifan Bang <https://debug.tw>.
+ *
+ *  This program is free software: you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation, either version 3 of the License, or
+ *  (at your option) any later version.
+ *
+ *  This program is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#pragma once
+
+#include <cstddef>
+#include <cstdint>
+#include <string>
+#include <vector>
+
+
+
+// ---------------------------------------------------------------------------
+// Bundle of files shipped inside the launcher: payloads for each architecture,
+// signature packs and other assets.
+//
+// A bundle is a BundleHeader, a table of contents of BundleEntry and then the
+// data of the entries, each aligned to 16 bytes. All fields are little-endian.
+// Every entry can be located and extracted from the table of contents alone,
+// without reading the data of any other entry.
+// ---------------------------------------------------------------------------
+
+enum class BundleArch : uint32_t
+{
+	Any = 0,
+	X86 = 1,
+	X64 = 2,
+};
+
+
+enum class BundleCompression : uint32_t
+{
+	None = 0,
+	Lz = 1,  // see lz.h
+};
+
+
+struct BundleHeader
+{
+	uint32_t magic;  // "HBBN"
+	uint32_t version;
+	uint32_t entryCount;
+	uint32_t reserved;
+};
+
+
+struct BundleEntry
+{
+	static constexpr size_t c_maxNameLength = 47;
+
+	char name[c_maxNameLength + 1];  // NUL-terminated
+	BundleArch arch;
+	BundleCompression compression;
+	uint64_t offset;  // from the start of the bundle
+	uint64_t storedSize;
+	uint64_t size;  // once extracted
+	uint8_t digest[32];  // SHA-256 of the extracted data
+};
+
+
+struct BundleInput
+{
+	std::string name;
+	BundleArch arch;
+	const uint8_t* data;
+	size_t size;
+};
+
+
+// Build a bundle, compressing and hashing the entries on up to $threadCount threads.
+// An entry is stored uncompressed if compression doesn't make it smaller.
+bool BuildBundle(const std::vector<BundleInput>& inputs, unsigned int threadCount, std::vector<uint8_t>& out);
+
+// parse "any", "x86" or "x64"
+bool ParseBundleArch(const char* text, BundleArch& arch);
+
+
+
+// Random access to the entries of a bundle in memory. Every byte of the bundle may be
+// XOR-ed with a mask, which is undone only for the bytes actually read.
+class BundleReader
+{
+public:
+	BundleReader();
+
+	BundleReader(const BundleReader&) = delete;
+	BundleReader& operator=(const BundleReader&) = delete;
+
+	bool Open(const uint8_t* data, size_t size, uint8_t mask);
+
+	size_t GetEntryCount() const					{ return m_entries.size(); }
+	const BundleEntry& GetEntry(size_t index) const	{ return m_entries[index]; }
+
+	// the entry for exactly $arch, or else the one for any architecture
+	const BundleEntry* Find(const char* name, BundleArch arch) const;
+
+	// decompress an entry and check its digest
+	bool Extract(const BundleEntry& entry, std::vector<uint8_t>& out) const;
+
+
+private:
+	const uint8_t* m_data;
+	size_t m_size;
+	uint8_t m_mask;
+	std::vector<BundleEntry> m_entries;
+};
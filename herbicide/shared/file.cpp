@@ -0,0 +1,886 @@
+/*
+ *  herbicide - removing flowers and rabbits in the game Mirror
+ *  Copyright (C) 2018 Mifan Bang <https://debug.tw>.
+ *
+ *  This program is free software: you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation, either version 3 of the License, or
+ *  (at your option) any later version.
+ *
+ *  This program is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include <cstddef>
+#include <cstdio>
+#include <cstring>
+#include <cwchar>
+#include <string>
+
+#ifdef _WIN32
+	#include <windows.h>
+	#include <bcrypt.h>
+	#pragma comment(lib, "bcrypt.lib")
+#else
+	#include <errno.h>
+	#include <fcntl.h>
+	#include <sys/mman.h>
+	#include <sys/stat.h>
+	#include <unistd.h>
+#endif  // _WIN32
+
+#include "file.h"
+
+
+
+namespace {
+
+
+
+using PathString = std::basic_string<PathChar>;
+
+
+struct FileStamp
+{
+	static constexpr uint32_t c_magic = 0x504D5453;  // "STMP"
+	static constexpr uint32_t c_version = 1;
+
+	uint32_t magic;
+	uint32_t version;
+	uint64_t fileSize;
+	uint64_t lastWriteTime;
+	uint64_t fileIndex;
+	uint32_t volumeSerial;
+	uint32_t reserved;
+	uint8_t contentHash[StreamHasher::c_digestSize];
+	uint8_t signature[StreamHasher::c_digestSize];  // digest of all fields above and the key
+};
+
+static_assert(offsetof(FileStamp, signature) == 72, "the signed fields of a stamp must not contain padding");
+
+
+
+}  // unnamed namespace
+
+
+
+#ifdef _WIN32
+
+// ---------------------------------------------------------------------------
+// Win32 backend
+// ---------------------------------------------------------------------------
+
+const FileErrorCode c_fileErrorTruncated = ERROR_HANDLE_EOF;
+
+
+
+namespace {
+
+
+
+const PathChar c_stampSuffix[] = L".stamp";
+
+
+OVERLAPPED& GetOverlapped(uint64_t (&storage)[4])
+{
+	return *reinterpret_cast<OVERLAPPED*>(storage);
+}
+
+
+FILE* OpenStdioFile(const PathChar* path, bool isWriting)
+{
+	FILE* fp = nullptr;
+	if (_wfopen_s(&fp, path, isWriting ? L"wb" : L"rb") != 0)
+		return nullptr;
+	return fp;
+}
+
+
+// fill in the fields of a stamp which identify the file, by the metadata NTFS keeps
+bool DescribeFile(const PathChar* path, FileStamp& stamp)
+{
+	HANDLE hFile = ::CreateFileW(path, FILE_READ_ATTRIBUTES, FILE_SHARE_READ | FILE_SHARE_WRITE, nullptr, OPEN_EXISTING, 0, nullptr);
+	if (hFile == INVALID_HANDLE_VALUE)
+		return false;
+	BY_HANDLE_FILE_INFORMATION info;
+	const bool isDescribed = ::GetFileInformationByHandle(hFile, &info) != FALSE;
+	::CloseHandle(hFile);
+	if (!isDescribed)
+		return false;
+
+	stamp.fileSize = (static_cast<uint64_t>(info.nFileSizeHigh) << 32) | info.nFileSizeLow;
+	stamp.lastWriteTime = (static_cast<uint64_t>(info.ftLastWriteTime.dwHighDateTime) << 32) | info.ftLastWriteTime.dwLowDateTime;
+	stamp.fileIndex = (static_cast<uint64_t>(info.nFileIndexHigh) << 32) | info.nFileIndexLow;
+	stamp.volumeSerial = info.dwVolumeSerialNumber;
+	return true;
+}
+
+
+
+}  // unnamed namespace
+
+
+
+MappedFile::MappedFile()
+	: m_isOpen(false)
+	, m_data(nullptr)
+	, m_size(0)
+	, m_error(NO_ERROR)
+	, m_hFile(INVALID_HANDLE_VALUE)
+	, m_hMapping(nullptr)
+{
+}
+
+
+MappedFile::~MappedFile()
+{
+	Close();
+}
+
+
+bool MappedFile::Open(const PathChar* path)
+{
+	Close();
+
+	m_hFile = ::CreateFileW(path, GENERIC_READ, FILE_SHARE_READ, nullptr, OPEN_EXISTING, FILE_ATTRIBUTE_NORMAL, nullptr);
+	LARGE_INTEGER size;
+	if (m_hFile == INVALID_HANDLE_VALUE || ::GetFileSizeEx(m_hFile, &size) == FALSE) {
+		m_error = ::GetLastError();
+		Close();
+		return false;
+	}
+	m_size = static_cast<uint64_t>(size.QuadPart);
+
+	// an empty file cannot be mapped, but it's still a valid file
+	if (m_size > 0) {
+		if (m_size > SIZE_MAX) {
+			m_error = ERROR_NOT_ENOUGH_MEMORY;  // larger than the address space; use FileReader instead
+			Close();
+			return false;
+		}
+
+		m_hMapping = ::CreateFileMappingW(m_hFile, nullptr, PAGE_READONLY, 0, 0, nullptr);
+		if (m_hMapping != nullptr)
+			m_data = static_cast<const uint8_t*>(::MapViewOfFile(m_hMapping, FILE_MAP_READ, 0, 0, 0));
+		if (m_data == nullptr) {
+			m_error = ::GetLastError();
+			Close();
+			return false;
+		}
+	}
+
+	m_isOpen = true;
+	m_error = NO_ERROR;
+	return true;
+}
+
+
+void MappedFile::Close()
+{
+	if (m_data != nullptr)
+		::UnmapViewOfFile(m_data);
+	if (m_hMapping != nullptr)
+		::CloseHandle(m_hMapping);
+	if (m_hFile != INVALID_HANDLE_VALUE)
+		::CloseHandle(m_hFile);
+
+	m_isOpen = false;
+	m_data = nullptr;
+	m_size = 0;
+	m_hFile = INVALID_HANDLE_VALUE;
+	m_hMapping = nullptr;
+}
+
+
+
+FileReader::FileReader(uint32_t chunkSize)
+	: m_chunkSize(chunkSize > 0 ? chunkSize : c_defaultChunkSize)
+	, m_slots()
+	, m_currSlot(0)
+	, m_size(0)
+	, m_error(NO_ERROR)
+	, m_hFile(INVALID_HANDLE_VALUE)
+{
+}
+
+
+FileReader::~FileReader()
+{
+	Close();
+}
+
+
+bool FileReader::Open(const PathChar* path)
+{
+	static_assert(sizeof(Slot::overlapped) >= sizeof(OVERLAPPED), "storage too small for OVERLAPPED");
+	Close();
+
+	m_hFile = ::CreateFileW(path, GENERIC_READ, FILE_SHARE_READ, nullptr, OPEN_EXISTING, FILE_FLAG_OVERLAPPED | FILE_FLAG_SEQUENTIAL_SCAN, nullptr);
+	LARGE_INTEGER size;
+	if (m_hFile == INVALID_HANDLE_VALUE || ::GetFileSizeEx(m_hFile, &size) == FALSE) {
+		m_error = ::GetLastError();
+		Close();
+		return false;
+	}
+	m_size = static_cast<uint64_t>(size.QuadPart);
+
+	for (auto& slot : m_slots) {
+		slot.buffer.resize(m_chunkSize);
+		GetOverlapped(slot.overlapped).hEvent = ::CreateEventW(nullptr, TRUE, FALSE, nullptr);
+		if (GetOverlapped(slot.overlapped).hEvent == nullptr) {
+			m_error = ::GetLastError();
+			Close();
+			return false;
+		}
+	}
+
+	m_currSlot = 0;
+	m_error = NO_ERROR;
+	return IssueRead(m_slots[0], 0);
+}
+
+
+void FileReader::Close()
+{
+	if (m_hFile != INVALID_HANDLE_VALUE) {
+		::CancelIo(m_hFile);
+		for (auto& slot : m_slots) {
+			DWORD dwSizeRead;
+			if (slot.isPending)
+				::GetOverlappedResult(m_hFile, &GetOverlapped(slot.overlapped), &dwSizeRead, TRUE);
+		}
+		::CloseHandle(m_hFile);
+		m_hFile = INVALID_HANDLE_VALUE;
+	}
+
+	for (auto& slot : m_slots) {
+		if (GetOverlapped(slot.overlapped).hEvent != nullptr)
+			::CloseHandle(GetOverlapped(slot.overlapped).hEvent);
+		ZeroMemory(slot.overlapped, sizeof(slot.overlapped));
+		slot.offset = 0;
+		slot.isPending = false;
+	}
+	m_size = 0;
+}
+
+
+bool FileReader::IssueRead(Slot& slot, uint64_t offset)
+{
+	slot.offset = offset;
+	slot.isPending = false;
+	if (offset >= m_size)
+		return true;  // nothing left to read ahead
+
+	auto& overlapped = GetOverlapped(slot.overlapped);
+	overlapped.Offset = static_cast<DWORD>(offset);
+	overlapped.OffsetHigh = static_cast<DWORD>(offset >> 32);
+	if (::ReadFile(m_hFile, slot.buffer.data(), m_chunkSize, nullptr, &overlapped) == FALSE && ::GetLastError() != ERROR_IO_PENDING) {
+		m_error = ::GetLastError();
+		return false;
+	}
+	slot.isPending = true;
+	return true;
+}
+
+
+bool FileReader::CompleteRead(Slot& slot, uint32_t& size)
+{
+	size = 0;
+	if (!slot.isPending)
+		return true;  // end of file
+
+	DWORD dwSizeRead = 0;
+	slot.isPending = false;
+	if (::GetOverlappedResult(m_hFile, &GetOverlapped(slot.overlapped), &dwSizeRead, TRUE) == FALSE && ::GetLastError() != ERROR_HANDLE_EOF) {
+		m_error = ::GetLastError();
+		return false;
+	}
+	size = dwSizeRead;
+	return true;
+}
+
+
+
+StreamHasher::StreamHasher()
+	: m_hAlgorithm(nullptr)
+	, m_hHash(nullptr)
+	, m_isValid(false)
+{
+	BCRYPT_ALG_HANDLE hAlgorithm = nullptr;
+	BCRYPT_HASH_HANDLE hHash = nullptr;
+	if (BCRYPT_SUCCESS(::BCryptOpenAlgorithmProvider(&hAlgorithm, BCRYPT_SHA256_ALGORITHM, nullptr, 0))) {
+		m_hAlgorithm = hAlgorithm;
+		if (BCRYPT_SUCCESS(::BCryptCreateHash(hAlgorithm, &hHash, nullptr, 0, nullptr, 0, 0))) {
+			m_hHash = hHash;
+			m_isValid = true;
+		}
+	}
+}
+
+
+StreamHasher::~StreamHasher()
+{
+	if (m_hHash != nullptr)
+		::BCryptDestroyHash(m_hHash);
+	if (m_hAlgorithm != nullptr)
+		::BCryptCloseAlgorithmProvider(m_hAlgorithm, 0);
+}
+
+
+bool StreamHasher::Update(const void* data, uint64_t size)
+{
+	// BCryptHashData() takes 32-bit sizes
+	auto ptr = static_cast<const uint8_t*>(data);
+	while (m_isValid && size > 0) {
+		const ULONG sizeThisRound = static_cast<ULONG>(size < MAXDWORD ? size : MAXDWORD);
+		m_isValid = BCRYPT_SUCCESS(::BCryptHashData(m_hHash, const_cast<PUCHAR>(ptr), sizeThisRound, 0));
+		ptr += sizeThisRound;
+		size -= sizeThisRound;
+	}
+	return m_isValid;
+}
+
+
+bool StreamHasher::Finish(uint8_t (&digest)[c_digestSize])
+{
+	m_isValid = m_isValid && BCRYPT_SUCCESS(::BCryptFinishHash(m_hHash, digest, c_digestSize, 0));
+	return m_isValid;
+}
+
+
+
+bool ReadWholeFile(const PathChar* path, const std::function<uint8_t* (uint64_t size)>& allocate, FileErrorCode& errCode)
+{
+	HANDLE hFile = ::CreateFileW(path, GENERIC_READ, FILE_SHARE_READ, nullptr, OPEN_EXISTING, FILE_FLAG_SEQUENTIAL_SCAN, nullptr);
+	LARGE_INTEGER size;
+	if (hFile == INVALID_HANDLE_VALUE || ::GetFileSizeEx(hFile, &size) == FALSE) {
+		errCode = ::GetLastError();
+		if (hFile != INVALID_HANDLE_VALUE)
+			::CloseHandle(hFile);
+		return false;
+	}
+
+	// files larger than the address space should go through FileReader instead
+	const uint64_t sizeFile = static_cast<uint64_t>(size.QuadPart);
+	uint8_t* data = sizeFile <= SIZE_MAX ? allocate(sizeFile) : nullptr;
+	if (data == nullptr && sizeFile > 0) {
+		::CloseHandle(hFile);
+		errCode = ERROR_NOT_ENOUGH_MEMORY;
+		return false;
+	}
+
+	// a single ReadFile() may return fewer bytes than requested, and takes 32-bit sizes
+	uint64_t sizeTotal = 0;
+	errCode = NO_ERROR;
+	while (sizeTotal < sizeFile) {
+		const DWORD sizeThisRound = static_cast<DWORD>(sizeFile - sizeTotal < MAXDWORD ? sizeFile - sizeTotal : MAXDWORD);
+		DWORD dwSizeRead = 0;
+		if (::ReadFile(hFile, data + sizeTotal, sizeThisRound, &dwSizeRead, nullptr) == FALSE) {
+			errCode = ::GetLastError();
+			break;
+		}
+		if (dwSizeRead == 0) {
+			errCode = c_fileErrorTruncated;
+			break;
+		}
+		sizeTotal += dwSizeRead;
+	}
+
+	::CloseHandle(hFile);
+	return errCode == NO_ERROR;
+}
+
+
+
+#else
+
+// ---------------------------------------------------------------------------
+// POSIX backend
+// ---------------------------------------------------------------------------
+
+const FileErrorCode c_fileErrorTruncated = ENODATA;
+
+
+
+namespace {
+
+
+
+const PathChar c_stampSuffix[] = ".stamp";
+
+
+FILE* OpenStdioFile(const PathChar* path, bool isWriting)
+{
+	return fopen(path, isWriting ? "wb" : "rb");
+}
+
+
+// fill in the fields of a stamp which identify the file, by what stat() reports
+bool DescribeFile(const PathChar* path, FileStamp& stamp)
+{
+	struct stat st;
+	if (::stat(path, &st) != 0)
+		return false;
+
+	stamp.fileSize = static_cast<uint64_t>(st.st_size);
+	stamp.lastWriteTime = static_cast<uint64_t>(st.st_mtim.tv_sec) * 1000000000 + static_cast<uint64_t>(st.st_mtim.tv_nsec);
+	stamp.fileIndex = static_cast<uint64_t>(st.st_ino);
+	stamp.volumeSerial = static_cast<uint32_t>(st.st_dev);
+	return true;
+}
+
+
+
+}  // unnamed namespace
+
+
+
+MappedFile::MappedFile()
+	: m_isOpen(false)
+	, m_data(nullptr)
+	, m_size(0)
+	, m_error(0)
+	, m_fd(-1)
+{
+}
+
+
+MappedFile::~MappedFile()
+{
+	Close();
+}
+
+
+bool MappedFile::Open(const PathChar* path)
+{
+	Close();
+
+	struct stat st;
+	m_fd = ::open(path, O_RDONLY | O_CLOEXEC);
+	if (m_fd < 0 || ::fstat(m_fd, &st) != 0) {
+		m_error = static_cast<FileErrorCode>(errno);
+		Close();
+		return false;
+	}
+	m_size = static_cast<uint64_t>(st.st_size);
+
+	if (m_size > 0) {
+		void* addr = ::mmap(nullptr, static_cast<size_t>(m_size), PROT_READ, MAP_SHARED, m_fd, 0);
+		if (addr == MAP_FAILED) {
+			m_error = static_cast<FileErrorCode>(errno);
+			Close();
+			return false;
+		}
+		::madvise(addr, static_cast<size_t>(m_size), MADV_SEQUENTIAL);
+		m_data = static_cast<const uint8_t*>(addr);
+	}
+
+	m_isOpen = true;
+	m_error = 0;
+	return true;
+}
+
+
+void MappedFile::Close()
+{
+	if (m_data != nullptr)
+		::munmap(const_cast<uint8_t*>(m_data), static_cast<size_t>(m_size));
+	if (m_fd >= 0)
+		::close(m_fd);
+
+	m_isOpen = false;
+	m_data = nullptr;
+	m_size = 0;
+	m_fd = -1;
+}
+
+
+
+FileReader::FileReader(uint32_t chunkSize)
+	: m_chunkSize(chunkSize > 0 ? chunkSize : c_defaultChunkSize)
+	, m_slots()
+	, m_currSlot(0)
+	, m_size(0)
+	, m_error(0)
+	, m_fd(-1)
+{
+}
+
+
+FileReader::~FileReader()
+{
+	Close();
+}
+
+
+bool FileReader::Open(const PathChar* path)
+{
+	Close();
+
+	struct stat st;
+	m_fd = ::open(path, O_RDONLY | O_CLOEXEC);
+	if (m_fd < 0 || ::fstat(m_fd, &st) != 0) {
+		m_error = static_cast<FileErrorCode>(errno);
+		Close();
+		return false;
+	}
+	m_size = static_cast<uint64_t>(st.st_size);
+	::posix_fadvise(m_fd, 0, 0, POSIX_FADV_SEQUENTIAL);
+
+	for (auto& slot : m_slots)
+		slot.buffer.resize(m_chunkSize);
+
+	m_currSlot = 0;
+	m_error = 0;
+	return IssueRead(m_slots[0], 0);
+}
+
+
+void FileReader::Close()
+{
+	if (m_fd >= 0)
+		::close(m_fd);
+	m_fd = -1;
+
+	for (auto& slot : m_slots) {
+		slot.offset = 0;
+		slot.isPending = false;
+	}
+	m_size = 0;
+}
+
+
+// The kernel does the actual read-ahead: we only tell it which range comes next,
+// and the following pread() is then served from the page cache.
+bool FileReader::IssueRead(Slot& slot, uint64_t offset)
+{
+	slot.offset = offset;
+	slot.isPending = offset < m_size;
+	if (slot.isPending)
+		::posix_fadvise(m_fd, static_cast<off_t>(offset), static_cast<off_t>(m_chunkSize), POSIX_FADV_WILLNEED);
+	return true;
+}
+
+
+bool FileReader::CompleteRead(Slot& slot, uint32_t& size)
+{
+	size = 0;
+	if (!slot.isPending)
+		return true;  // end of file
+
+	slot.isPending = false;
+	while (size < m_chunkSize) {
+		const ssize_t sizeRead = ::pread(m_fd, slot.buffer.data() + size, m_chunkSize - size, static_cast<off_t>(slot.offset + size));
+		if (sizeRead < 0) {
+			if (errno == EINTR)
+				continue;
+			m_error = static_cast<FileErrorCode>(errno);
+			return false;
+		}
+		if (sizeRead == 0)
+			break;
+		size += static_cast<uint32_t>(sizeRead);
+	}
+	return true;
+}
+
+
+
+namespace {
+
+
+
+constexpr uint32_t c_sha256RoundConstants[64] = {
+	0x428a2f98, 0x71374491, 0xb5c0fbcf, 0xe9b5dba5, 0x3956c25b, 0x59f111f1, 0x923f82a4, 0xab1c5ed5,
+	0xd807aa98, 0x12835b01, 0x243185be, 0x550c7dc3, 0x72be5d74, 0x80deb1fe, 0x9bdc06a7, 0xc19bf174,
+	0xe49b69c1, 0xefbe4786, 0x0fc19dc6, 0x240ca1cc, 0x2de92c6f, 0x4a7484aa, 0x5cb0a9dc, 0x76f988da,
+	0x983e5152, 0xa831c66d, 0xb00327c8, 0xbf597fc7, 0xc6e00bf3, 0xd5a79147, 0x06ca6351, 0x14292967,
+	0x27b70a85, 0x2e1b2138, 0x4d2c6dfc, 0x53380d13, 0x650a7354, 0x766a0abb, 0x81c2c92e, 0x92722c85,
+	0xa2bfe8a1, 0xa81a664b, 0xc24b8b70, 0xc76c51a3, 0xd192e819, 0xd6990624, 0xf40e3585, 0x106aa070,
+	0x19a4c116, 0x1e376c08, 0x2748774c, 0x34b0bcb5, 0x391c0cb3, 0x4ed8aa4a, 0x5b9cca4f, 0x682e6ff3,
+	0x748f82ee, 0x78a5636f, 0x84c87814, 0x8cc70208, 0x90befffa, 0xa4506ceb, 0xbef9a3f7, 0xc67178f2
+};
+
+
+inline uint32_t RotateRight(uint32_t value, unsigned int count)
+{
+	return (value >> count) | (value << (32 - count));
+}
+
+
+void ProcessSha256Block(uint32_t (&state)[8], const uint8_t* block)
+{
+	uint32_t w[64];
+	for (unsigned int i = 0; i < 16; ++i)
+		w[i] = (static_cast<uint32_t>(block[i * 4]) << 24) | (static_cast<uint32_t>(block[i * 4 + 1]) << 16) | (static_cast<uint32_t>(block[i * 4 + 2]) << 8) | block[i * 4 + 3];
+	for (unsigned int i = 16; i < 64; ++i) {
+		const uint32_t s0 = RotateRight(w[i - 15], 7) ^ RotateRight(w[i - 15], 18) ^ (w[i - 15] >> 3);
+		const uint32_t s1 = RotateRight(w[i - 2], 17) ^ RotateRight(w[i - 2], 19) ^ (w[i - 2] >> 10);
+		w[i] = w[i - 16] + s0 + w[i - 7] + s1;
+	}
+
+	uint32_t a = state[0], b = state[1], c = state[2], d = state[3], e = state[4], f = state[5], g = state[6], h = state[7];
+	for (unsigned int i = 0; i < 64; ++i) {
+		const uint32_t t1 = h + (RotateRight(e, 6) ^ RotateRight(e, 11) ^ RotateRight(e, 25)) + ((e & f) ^ (~e & g)) + c_sha256RoundConstants[i] + w[i];
+		const uint32_t t2 = (RotateRight(a, 2) ^ RotateRight(a, 13) ^ RotateRight(a, 22)) + ((a & b) ^ (a & c) ^ (b & c));
+		h = g;
+		g = f;
+		f = e;
+		e = d + t1;
+		d = c;
+		c = b;
+		b = a;
+		a = t1 + t2;
+	}
+
+	state[0] += a;
+	state[1] += b;
+	state[2] += c;
+	state[3] += d;
+	state[4] += e;
+	state[5] += f;
+	state[6] += g;
+	state[7] += h;
+}
+
+
+
+}  // unnamed namespace
+
+
+
+StreamHasher::StreamHasher()
+	: m_state { 0x6a09e667, 0xbb67ae85, 0x3c6ef372, 0xa54ff53a, 0x510e527f, 0x9b05688c, 0x1f83d9ab, 0x5be0cd19 }
+	, m_totalSize(0)
+	, m_block()
+	, m_blockSize(0)
+{
+}
+
+
+StreamHasher::~StreamHasher()
+{
+}
+
+
+bool StreamHasher::Update(const void* data, uint64_t size)
+{
+	auto ptr = static_cast<const uint8_t*>(data);
+	m_totalSize += size;
+
+	// complete a partially filled block first
+	if (m_blockSize > 0) {
+		const uint32_t sizeToFill = static_cast<uint32_t>(size < sizeof(m_block) - m_blockSize ? size : sizeof(m_block) - m_blockSize);
+		memcpy(m_block + m_blockSize, ptr, sizeToFill);
+		m_blockSize += sizeToFill;
+		ptr += sizeToFill;
+		size -= sizeToFill;
+		if (m_blockSize < sizeof(m_block))
+			return true;
+		ProcessSha256Block(m_state, m_block);
+		m_blockSize = 0;
+	}
+
+	for (; size >= sizeof(m_block); ptr += sizeof(m_block), size -= sizeof(m_block))
+		ProcessSha256Block(m_state, ptr);
+
+	memcpy(m_block, ptr, static_cast<size_t>(size));
+	m_blockSize = static_cast<uint32_t>(size);
+	return true;
+}
+
+
+bool StreamHasher::Finish(uint8_t (&digest)[c_digestSize])
+{
+	const uint64_t sizeInBits = m_totalSize << 3;
+
+	m_block[m_blockSize++] = 0x80;
+	if (m_blockSize > sizeof(m_block) - 8) {
+		memset(m_block + m_blockSize, 0, sizeof(m_block) - m_blockSize);
+		ProcessSha256Block(m_state, m_block);
+		m_blockSize = 0;
+	}
+	memset(m_block + m_blockSize, 0, sizeof(m_block) - 8 - m_blockSize);
+	for (unsigned int i = 0; i < 8; ++i)
+		m_block[sizeof(m_block) - 1 - i] = static_cast<uint8_t>(sizeInBits >> (i * 8));
+	ProcessSha256Block(m_state, m_block);
+
+	for (unsigned int i = 0; i < 8; ++i) {
+		digest[i * 4] = static_cast<uint8_t>(m_state[i] >> 24);
+		digest[i * 4 + 1] = static_cast<uint8_t>(m_state[i] >> 16);
+		digest[i * 4 + 2] = static_cast<uint8_t>(m_state[i] >> 8);
+		digest[i * 4 + 3] = static_cast<uint8_t>(m_state[i]);
+	}
+	return true;
+}
+
+
+
+bool ReadWholeFile(const PathChar* path, const std::function<uint8_t* (uint64_t size)>& allocate, FileErrorCode& errCode)
+{
+	struct stat st;
+	const int fd = ::open(path, O_RDONLY | O_CLOEXEC);
+	if (fd < 0 || ::fstat(fd, &st) != 0) {
+		errCode = static_cast<FileErrorCode>(errno);
+		if (fd >= 0)
+			::close(fd);
+		return false;
+	}
+
+	// files larger than the address space should go through FileReader instead
+	const uint64_t sizeFile = static_cast<uint64_t>(st.st_size);
+	uint8_t* data = sizeFile <= SIZE_MAX ? allocate(sizeFile) : nullptr;
+	if (data == nullptr && sizeFile > 0) {
+		::close(fd);
+		errCode = ENOMEM;
+		return false;
+	}
+
+	uint64_t sizeTotal = 0;
+	errCode = 0;
+	while (sizeTotal < sizeFile) {
+		const ssize_t sizeRead = ::read(fd, data + sizeTotal, static_cast<size_t>(sizeFile - sizeTotal));
+		if (sizeRead < 0) {
+			if (errno == EINTR)
+				continue;
+			errCode = static_cast<FileErrorCode>(errno);
+			break;
+		}
+		if (sizeRead == 0) {
+			errCode = c_fileErrorTruncated;
+			break;
+		}
+		sizeTotal += static_cast<uint64_t>(sizeRead);
+	}
+
+	::close(fd);
+	return errCode == 0;
+}
+
+
+
+#endif  // _WIN32
+
+// ---------------------------------------------------------------------------
+// backend-independent functions
+// ---------------------------------------------------------------------------
+
+namespace {
+
+
+
+PathString GetStampPath(const PathChar* path)
+{
+	return PathString(path) + c_stampSuffix;
+}
+
+
+// fill in every field of a stamp except the signature
+bool MakeStamp(const PathChar* path, const uint8_t (&hash)[StreamHasher::c_digestSize], FileStamp& stamp)
+{
+	memset(&stamp, 0, sizeof(stamp));
+	stamp.magic = FileStamp::c_magic;
+	stamp.version = FileStamp::c_version;
+	memcpy(stamp.contentHash, hash, sizeof(stamp.contentHash));
+	return DescribeFile(path, stamp);
+}
+
+
+// The signature binds a stamp to a build through $key so that a stamp left by another version,
+// or one which has been corrupted, is never trusted. It is an integrity check rather than a
+// security boundary: anyone who can write next to the file can replace the file anyway.
+bool SignStamp(const FileStamp& stamp, const wchar_t* key, uint8_t (&signature)[StreamHasher::c_digestSize])
+{
+	StreamHasher hasher;
+	return hasher.Update(&stamp, offsetof(FileStamp, signature))
+		&& hasher.Update(key, wcslen(key) * sizeof(wchar_t))
+		&& hasher.Finish(signature);
+}
+
+
+
+}  // unnamed namespace
+
+
+
+
+const uint8_t* FileReader::ReadChunk(uint32_t& size)
+{
+	Slot& slot = m_slots[m_currSlot];
+	if (!CompleteRead(slot, size))
+		return nullptr;
+	if (size == 0)
+		return slot.buffer.data();  // end of file
+
+	// start reading the following chunk into the other buffer before handing this one out
+	m_currSlot ^= 1;
+	if (!IssueRead(m_slots[m_currSlot], slot.offset + size))
+		return nullptr;
+	return slot.buffer.data();
+}
+
+
+bool HashFile(const PathChar* path, uint8_t (&digest)[StreamHasher::c_digestSize], FileErrorCode& errCode)
+{
+	FileReader reader;
+	StreamHasher hasher;
+	if (!reader.Open(path)) {
+		errCode = reader.GetError();
+		return false;
+	}
+
+	const uint8_t* chunk;
+	uint32_t sizeChunk;
+	while ((chunk = reader.ReadChunk(sizeChunk)) != nullptr && sizeChunk > 0) {
+		if (!hasher.Update(chunk, sizeChunk))
+			break;
+	}
+
+	errCode = reader.GetError();
+	return chunk != nullptr && sizeChunk == 0 && hasher.Finish(digest);
+}
+
+
+bool CheckFileStamp(const PathChar* path, const uint8_t (&hash)[StreamHasher::c_digestSize], const wchar_t* key)
+{
+	FileStamp stampOnDisk;
+	{
+		FILE* fp = OpenStdioFile(GetStampPath(path).c_str(), false);
+		if (fp == nullptr)
+			return false;
+		const bool isRead = fread(&stampOnDisk, sizeof(stampOnDisk), 1, fp) == 1;
+		fclose(fp);
+		if (!isRead)
+			return false;
+	}
+
+	FileStamp stampExpected;
+	uint8_t signature[StreamHasher::c_digestSize];
+
+	bool bDoStampsMatch = true;
+	bDoStampsMatch = bDoStampsMatch && MakeStamp(path, hash, stampExpected);
+	bDoStampsMatch = bDoStampsMatch && memcmp(&stampExpected, &stampOnDisk, offsetof(FileStamp, signature)) == 0;
+	bDoStampsMatch = bDoStampsMatch && SignStamp(stampOnDisk, key, signature);
+	bDoStampsMatch = bDoStampsMatch && memcmp(signature, stampOnDisk.signature, sizeof(signature)) == 0;
+
+	return bDoStampsMatch;
+}
+
+
+bool WriteFileStamp(const PathChar* path, const uint8_t (&hash)[StreamHasher::c_digestSize], const wchar_t* key)
+{
+	FileStamp stamp;
+	if (!MakeStamp(path, hash, stamp) || !SignStamp(stamp, key, stamp.signature))
+		return false;
+
+	FILE* fp = OpenStdioFile(GetStampPath(path).c_str(), true);
+	if (fp == nullptr)
+		return false;
+	const bool isWritten = fwrite(&stamp, sizeof(stamp), 1, fp) == 1;
+	return fclose(fp) == 0 && isWritten;
+}
@@ -0,0 +1,183 @@
+/*
+ *  herbicide - removing flowers and rabbits in the game Mirror
+ *  Copyright (C) 2018 Mifan Bang <https://debug.tw>.
+ *
+ *  This program is free software: you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation, either version 3 of the License, or
+ *  (at your option) any later version.
+ *
+ *  This program is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#pragma once
+
+#include <cstdint>
+#include <functional>
+#include <vector>
+
+
+
+// ---------------------------------------------------------------------------
+// Portable file access for large inputs. Everything in this header is built on
+// Win32 for the launcher, packer and payload, and on POSIX for offline tools.
+// ---------------------------------------------------------------------------
+
+#ifdef _WIN32
+	using PathChar = wchar_t;
+#else
+	using PathChar = char;
+#endif  // _WIN32
+
+// GetLastError() on Win32; errno on POSIX
+using FileErrorCode = std::uint32_t;
+
+// of a file which ends before the size it had when opened: ERROR_HANDLE_EOF on Win32, ENODATA on POSIX
+extern const FileErrorCode c_fileErrorTruncated;
+
+
+
+// read-only, zero-copy view of a whole file
+class MappedFile
+{
+public:
+	MappedFile();
+	~MappedFile();
+
+	MappedFile(const MappedFile&) = delete;
+	MappedFile& operator=(const MappedFile&) = delete;
+
+	bool Open(const PathChar* path);
+	void Close();
+
+	bool IsOpen() const			{ return m_isOpen; }
+	const uint8_t* GetData() const	{ return m_data; }  // nullptr for an empty file
+	uint64_t GetSize() const		{ return m_size; }
+	FileErrorCode GetError() const	{ return m_error; }
+
+
+private:
+	bool m_isOpen;
+	const uint8_t* m_data;
+	uint64_t m_size;
+	FileErrorCode m_error;
+#ifdef _WIN32
+	void* m_hFile;
+	void* m_hMapping;
+#else
+	int m_fd;
+#endif  // _WIN32
+};
+
+
+
+// sequential reader which hands out a file chunk by chunk while the next chunk is being read ahead
+class FileReader
+{
+public:
+	static constexpr uint32_t c_defaultChunkSize = 1 << 20;
+
+	explicit FileReader(uint32_t chunkSize = c_defaultChunkSize);
+	~FileReader();
+
+	FileReader(const FileReader&) = delete;
+	FileReader& operator=(const FileReader&) = delete;
+
+	bool Open(const PathChar* path);
+	void Close();
+
+	// @return pointer to the next chunk, which stays valid until the next call; nullptr on error
+	// @remark $size is set to zero at the end of file
+	const uint8_t* ReadChunk(uint32_t& size);
+
+	uint64_t GetSize() const		{ return m_size; }
+	FileErrorCode GetError() const	{ return m_error; }
+
+
+private:
+	struct Slot
+	{
+		std::vector<uint8_t> buffer;
+		uint64_t offset;
+		bool isPending;
+#ifdef _WIN32
+		uint64_t overlapped[4];  // storage for OVERLAPPED so this header stays free of <windows.h>
+#endif  // _WIN32
+	};
+
+	bool IssueRead(Slot& slot, uint64_t offset);
+	bool CompleteRead(Slot& slot, uint32_t& size);
+
+	const uint32_t m_chunkSize;
+	Slot m_slots[2];
+	unsigned int m_currSlot;
+	uint64_t m_size;
+	FileErrorCode m_error;
+#ifdef _WIN32
+	void* m_hFile;
+#else
+	int m_fd;
+#endif  // _WIN32
+};
+
+
+
+// SHA-256 over data fed in arbitrary pieces, using constant memory
+class StreamHasher
+{
+public:
+	static constexpr unsigned int c_digestSize = 32;
+
+	StreamHasher();
+	~StreamHasher();
+
+	StreamHasher(const StreamHasher&) = delete;
+	StreamHasher& operator=(const StreamHasher&) = delete;
+
+	bool Update(const void* data, uint64_t size);
+	bool Finish(uint8_t (&digest)[c_digestSize]);  // the hasher must not be used afterwards
+
+
+private:
+#ifdef _WIN32
+	void* m_hAlgorithm;
+	void* m_hHash;
+	bool m_isValid;
+#else
+	uint32_t m_state[8];
+	uint64_t m_totalSize;
+	uint8_t m_block[64];
+	uint32_t m_blockSize;
+#endif  // _WIN32
+};
+
+
+
+// hash a whole file with a FileReader and a StreamHasher
+bool HashFile(const PathChar* path, uint8_t (&digest)[StreamHasher::c_digestSize], FileErrorCode& errCode);
+
+
+// Read a whole file into the memory $allocate returns for its size; nullptr gives up unless the
+// file is empty. A file which turns out shorter than that size fails with c_fileErrorTruncated.
+bool ReadWholeFile(const PathChar* path, const std::function<uint8_t* (uint64_t size)>& allocate, FileErrorCode& errCode);
+
+
+
+// ---------------------------------------------------------------------------
+// File stamps. A stamp is a small record saved next to a file, e.g., "foo.dll.stamp"
+// for "foo.dll". It describes the file by the metadata the file system keeps for
+// free, so that a file which is still the one hashed before needn't be hashed again.
+// ---------------------------------------------------------------------------
+
+// check if the stamp next to a file still describes that file and records a certain hash
+// @param key identifies the build which wrote the stamp; a stamp signed with another is never trusted
+bool CheckFileStamp(const PathChar* path, const uint8_t (&hash)[StreamHasher::c_digestSize], const wchar_t* key);
+
+// write a stamp next to a file recording its current identity and a hash which is known to be correct
+bool WriteFileStamp(const PathChar* path, const uint8_t (&hash)[StreamHasher::c_digestSize], const wchar_t* key);
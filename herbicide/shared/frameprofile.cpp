@@ -0,0 +1,127 @@
+/*
+ *  herbicide - removing flowers and rabbits in the game Mirror
+ *  Copyright (C) 2018 Mifan Bang <https://debug.tw>.
+ *
+ *  This program is free software: you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation, either version 3 of the License, or
+ *  (at your option) any later version.
+ *
+ *  This program is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include <algorithm>
+#include <cstring>
+
+#include "frameprofile.h"
+
+
+
+namespace {
+
+
+
+constexpr uint32_t c_magic = 0x54464248;  // "HBFT"
+constexpr uint32_t c_version = 1;
+
+static_assert(sizeof(FrameRecord) == 24, "the trace format must not change");
+static_assert(sizeof(FrameTraceHeader) == 16, "the trace format must not change");
+
+
+// nearest-rank percentile of sorted samples
+double GetPercentile(const std::vector<uint32_t>& sorted, unsigned int percent)
+{
+	size_t rank = (sorted.size() * percent + 99) / 100;
+	rank = rank > 0 ? rank - 1 : 0;
+	return static_cast<double>(sorted[rank]);
+}
+
+
+FrameDistribution Summarize(std::vector<uint32_t>& samples)
+{
+	std::sort(samples.begin(), samples.end());
+	uint64_t sum = 0;
+	for (uint32_t sample : samples)
+		sum += sample;
+
+	FrameDistribution distribution;
+	distribution.mean = static_cast<double>(sum) / static_cast<double>(samples.size()) / 1000.0;
+	distribution.p50 = GetPercentile(samples, 50) / 1000.0;
+	distribution.p90 = GetPercentile(samples, 90) / 1000.0;
+	distribution.p99 = GetPercentile(samples, 99) / 1000.0;
+	distribution.max = static_cast<double>(samples.back()) / 1000.0;
+	return distribution;
+}
+
+
+
+}  // unnamed namespace
+
+
+
+bool BuildFrameReport(const FrameRecord* records, size_t count, bool isBypassed, FrameReport& report)
+{
+	std::vector<uint32_t> frameNs;
+	std::vector<uint32_t> detourNs;
+	uint64_t totalFrameNs = 0;
+	uint64_t totalDetourNs = 0;
+	uint64_t totalCalls = 0;
+	for (size_t i = 0; i < count; ++i) {
+		const FrameRecord& record = records[i];
+		if (((record.flags & FrameRecord::c_bypassed) != 0) != isBypassed)
+			continue;
+		frameNs.push_back(record.frameNs);
+		detourNs.push_back(record.detourNs);
+		totalFrameNs += record.frameNs;
+		totalDetourNs += record.detourNs;
+		totalCalls += record.detourCalls;
+	}
+	if (frameNs.empty())
+		return false;
+
+	report.frameCount = frameNs.size();
+	report.frameUs = Summarize(frameNs);
+	report.detourUs = Summarize(detourNs);
+	report.detourShare = totalFrameNs > 0 ? static_cast<double>(totalDetourNs) / static_cast<double>(totalFrameNs) : 0.0;
+	report.callsPerFrame = static_cast<double>(totalCalls) / static_cast<double>(report.frameCount);
+	return true;
+}
+
+
+bool WriteFrameTraceHeader(FILE* fp)
+{
+	FrameTraceHeader header { };
+	header.magic = c_magic;
+	header.version = c_version;
+	header.recordSize = sizeof(FrameRecord);
+	return fwrite(&header, sizeof(header), 1, fp) == 1;
+}
+
+
+bool AppendFrameTrace(FILE* fp, const FrameRecord* records, size_t count)
+{
+	return count == 0 || fwrite(records, sizeof(FrameRecord), count, fp) == count;
+}
+
+
+bool ReadFrameTrace(const uint8_t* data, size_t size, std::vector<FrameRecord>& out)
+{
+	FrameTraceHeader header;
+	if (data == nullptr || size < sizeof(header))
+		return false;
+	memcpy(&header, data, sizeof(header));
+	if (header.magic != c_magic || header.version != c_version || header.recordSize != sizeof(FrameRecord))
+		return false;
+
+	const size_t count = (size - sizeof(header)) / sizeof(FrameRecord);
+	out.resize(count);
+	if (count > 0)
+		memcpy(out.data(), data + sizeof(header), count * sizeof(FrameRecord));
+	return true;
+}
@@ -0,0 +1,85 @@
+/*
+ *  herbicide - removing flowers and rabbits in the game Mirror
+ *  Copyright (C) 2018 Mifan Bang <https://debug.tw>.
+ *
+ *  This program is free software: you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation, either version 3 of the License, or
+ *  (at your option) any later version.
+ *
+ *  This program is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#pragma once
+
+#include <cstddef>
+#include <cstdint>
+#include <cstdio>
+#include <vector>
+
+
+
+// ---------------------------------------------------------------------------
+// Per-frame records of the payload and their analysis. The payload appends the
+// records to a trace file, a FrameTraceHeader followed by FrameRecord, so that
+// the same reports can be produced offline from a replayed trace.
+// ---------------------------------------------------------------------------
+
+struct FrameRecord
+{
+	static constexpr uint32_t c_bypassed = 1;  // the detours went straight to the original functions
+
+	uint64_t startNs;  // since the profiler started
+	uint32_t frameNs;  // from one Present() to the next, saturated
+	uint32_t detourNs;  // spent in detours during the frame, excluding the original functions
+	uint32_t detourCalls;
+	uint32_t flags;
+};
+
+
+struct FrameTraceHeader
+{
+	uint32_t magic;  // "HBFT"
+	uint32_t version;
+	uint32_t recordSize;
+	uint32_t reserved;
+};
+
+
+// in microseconds
+struct FrameDistribution
+{
+	double mean;
+	double p50;
+	double p90;
+	double p99;
+	double max;
+};
+
+
+struct FrameReport
+{
+	uint64_t frameCount;
+	FrameDistribution frameUs;
+	FrameDistribution detourUs;
+	double detourShare;  // of the total frame time
+	double callsPerFrame;
+};
+
+
+// summarize the frames which were bypassed, or those which weren't
+// @return false if there is no such frame
+bool BuildFrameReport(const FrameRecord* records, size_t count, bool isBypassed, FrameReport& report);
+
+
+bool WriteFrameTraceHeader(FILE* fp);
+bool AppendFrameTrace(FILE* fp, const FrameRecord* records, size_t count);
+
+// a torn record at the end, as left by a crash, is ignored
+bool ReadFrameTrace(const uint8_t* data, size_t size, std::vector<FrameRecord>& out);
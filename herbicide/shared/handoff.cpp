@@ -0,0 +1,166 @@
+/*
+ *  herbicide - removing flowers and rabbits in the game Mirror
+ *  Copyright (C) 2018 Mifan Bang <https://debug.tw>.
+ *
+ *  This program is free software: you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation, either version 3 of the License, or
+ *  (at your option) any later version.
+ *
+ *  This program is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include "handoff.h"
+
+#include <cstring>
+#include <new>
+
+#ifdef _WIN32
+#include <windows.h>
+#endif  // _WIN32
+
+
+
+namespace {
+
+
+
+constexpr size_t c_recordOffset = (sizeof(HandoffHeader) + 63) & ~static_cast<size_t>(63);
+
+
+
+}  // unnamed namespace
+
+
+
+size_t GetHandoffSize(size_t recordCount, size_t patchSize)
+{
+	return c_recordOffset + recordCount * sizeof(SignatureRecord) + patchSize;
+}
+
+
+HandoffHeader* WriteHandoff(void* dest, const SignatureRecordList& records, const std::vector<uint8_t>& patchData, uint64_t sourceWriteTime)
+{
+	auto header = new (dest) HandoffHeader();
+	header->magic = HandoffHeader::c_magic;
+	header->version = HandoffHeader::c_version;
+	header->size = static_cast<uint32_t>(GetHandoffSize(records.size(), patchData.size()));
+	header->recordOffset = static_cast<uint32_t>(c_recordOffset);
+	header->recordCount = static_cast<uint32_t>(records.size());
+	header->patchSize = static_cast<uint32_t>(patchData.size());
+	header->sourceWriteTime = sourceWriteTime;
+	header->toggles.isBypassed.store(0);
+	header->toggles.logLevel.store(0);
+	if (!records.empty())
+		memcpy(static_cast<uint8_t*>(dest) + c_recordOffset, records.data(), records.size() * sizeof(SignatureRecord));
+	if (!patchData.empty())
+		memcpy(static_cast<uint8_t*>(dest) + c_recordOffset + records.size() * sizeof(SignatureRecord), patchData.data(), patchData.size());
+	return header;
+}
+
+
+const HandoffHeader* GetHandoffHeader(const void* data, size_t size)
+{
+	if (data == nullptr || size < sizeof(HandoffHeader))
+		return nullptr;
+	auto header = static_cast<const HandoffHeader*>(data);
+	if (header->magic != HandoffHeader::c_magic || header->version != HandoffHeader::c_version || header->size > size
+		|| header->recordOffset != c_recordOffset || header->size != GetHandoffSize(header->recordCount, header->patchSize))
+		return nullptr;
+	return header;
+}
+
+
+HandoffHeader* GetHandoffHeader(void* data, size_t size)
+{
+	return const_cast<HandoffHeader*>(GetHandoffHeader(static_cast<const void*>(data), size));
+}
+
+
+const SignatureRecord* GetHandoffRecords(const HandoffHeader& header)
+{
+	return reinterpret_cast<const SignatureRecord*>(reinterpret_cast<const uint8_t*>(&header) + header.recordOffset);
+}
+
+
+const uint8_t* GetHandoffPatchData(const HandoffHeader& header)
+{
+	return reinterpret_cast<const uint8_t*>(GetHandoffRecords(header) + header.recordCount);
+}
+
+
+
+#ifdef _WIN32
+
+HandoffSection::HandoffSection()
+	: m_hSection(nullptr)
+	, m_data(nullptr)
+	, m_size(0)
+{
+}
+
+
+HandoffSection::~HandoffSection()
+{
+	Close();
+}
+
+
+bool HandoffSection::Create(const wchar_t* name, size_t size)
+{
+	Close();
+	const uint64_t sectionSize = size;
+	m_hSection = ::CreateFileMappingW(INVALID_HANDLE_VALUE, nullptr, PAGE_READWRITE, static_cast<DWORD>(sectionSize >> 32), static_cast<DWORD>(sectionSize), name);
+	if (m_hSection != nullptr && ::GetLastError() == ERROR_ALREADY_EXISTS) {
+		Close();
+		::SetLastError(ERROR_ALREADY_EXISTS);
+		return false;
+	}
+	if (m_hSection != nullptr)
+		m_data = ::MapViewOfFile(m_hSection, FILE_MAP_WRITE, 0, 0, size);
+	if (m_data == nullptr) {
+		Close();
+		return false;
+	}
+	m_size = size;
+	return true;
+}
+
+
+bool HandoffSection::Open(const wchar_t* name, bool isWritable)
+{
+	Close();
+	const DWORD access = isWritable ? FILE_MAP_WRITE : FILE_MAP_READ;
+	m_hSection = ::OpenFileMappingW(access, FALSE, name);
+	if (m_hSection != nullptr)
+		m_data = ::MapViewOfFile(m_hSection, access, 0, 0, 0);
+
+	// the view spans whole pages, which the header is checked against
+	MEMORY_BASIC_INFORMATION info;
+	if (m_data == nullptr || ::VirtualQuery(m_data, &info, sizeof(info)) == 0) {
+		Close();
+		return false;
+	}
+	m_size = info.RegionSize;
+	return true;
+}
+
+
+void HandoffSection::Close()
+{
+	if (m_data != nullptr)
+		::UnmapViewOfFile(m_data);
+	if (m_hSection != nullptr)
+		::CloseHandle(m_hSection);
+	m_hSection = nullptr;
+	m_data = nullptr;
+	m_size = 0;
+}
+
+#endif  // _WIN32
@@ -0,0 +1,107 @@
+/*
+ *  herbicide - removing flowers and rabbits in the game Mirror
+ *  Copyright (C) 2018 Mifan Bang <https://debug.tw>.
+ *
+ *  This program is free software: you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation, either version 3 of the License, or
+ *  (at your option) any later version.
+ *
+ *  This program is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#pragma once
+
+#include <atomic>
+#include <cstddef>
+#include <cstdint>
+#include <vector>
+
+#include "signature.h"
+
+
+
+// Switches which may be flipped while the game runs. The payload reads them at every Present()
+// with plain loads; nothing has to be polled through the system.
+struct HandoffToggles
+{
+	std::atomic<uint32_t> isBypassed;  // like HERBICIDE_BYPASS
+	std::atomic<uint32_t> logLevel;  // a LogLevel, like HERBICIDE_LOG_LEVEL
+
+	static_assert(std::atomic<uint32_t>::is_always_lock_free, "toggles live in shared memory");
+};
+
+
+// What the launcher hands over to the payload through a section of shared memory: the
+// signature file, parsed, validated and sorted by SortSignatureRecords() into the table the
+// payload looks descriptors up in, and the toggles. The records follow the header, and their
+// patch data follows the records.
+struct HandoffHeader
+{
+	static constexpr uint32_t c_magic = 0x4F484248;  // "HBHO"
+	static constexpr uint32_t c_version = 4;
+
+	uint32_t magic;
+	uint32_t version;  // of this layout
+	uint32_t size;  // of the whole handoff
+	uint32_t recordOffset;
+	uint32_t recordCount;
+	uint32_t patchSize;  // bytes of patch data
+	uint64_t sourceWriteTime;  // of the signature file the records come from; zero if none
+	HandoffToggles toggles;
+};
+
+
+size_t GetHandoffSize(size_t recordCount, size_t patchSize);
+
+// lay a handoff out in the GetHandoffSize() bytes at $dest, with every toggle off
+// @param records as sorted by SortSignatureRecords()
+// @param patchData as parsed along with $records
+HandoffHeader* WriteHandoff(void* dest, const SignatureRecordList& records, const std::vector<uint8_t>& patchData, uint64_t sourceWriteTime);
+
+// check what a handoff claims about itself against the $size bytes it was found in
+// @return nullptr if $data is not a handoff of this build
+const HandoffHeader* GetHandoffHeader(const void* data, size_t size);
+HandoffHeader* GetHandoffHeader(void* data, size_t size);  // to change its toggles
+
+const SignatureRecord* GetHandoffRecords(const HandoffHeader& header);
+const uint8_t* GetHandoffPatchData(const HandoffHeader& header);
+
+
+
+#ifdef _WIN32
+
+// Named section of shared memory holding a handoff. The launcher creates it before starting the
+// game and keeps it until the payload is loaded, which opens it from DllMain().
+class HandoffSection
+{
+public:
+	HandoffSection();
+	~HandoffSection();
+
+	HandoffSection(const HandoffSection&) = delete;
+	HandoffSection& operator=(const HandoffSection&) = delete;
+
+	// fails if a section of that name exists already, like that of a game launched before
+	bool Create(const wchar_t* name, size_t size);
+
+	bool Open(const wchar_t* name, bool isWritable);
+	void Close();
+
+	void* GetData() const		{ return m_data; }
+	size_t GetSize() const		{ return m_size; }
+
+
+private:
+	void* m_hSection;
+	void* m_data;
+	size_t m_size;
+};
+
+#endif  // _WIN32
@@ -19,8 +19,8 @@
 #pragma once
 
 
-constexpr wchar_t* c_appName = L"Herbicide";
-constexpr wchar_t* c_appVersion = L"1.0.0-pre";
+constexpr const wchar_t* c_appName = L"Herbicide";
+constexpr const wchar_t* c_appVersion = L"1.0.0-pre";
 
 
 // for resource file
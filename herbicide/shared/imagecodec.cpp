@@ -0,0 +1,492 @@
+/*
+ *  herbicide - removing flowers and rabbits in the game Mirror
+ *  Copyright (C) 2018 Mifan Bang <https://debug.tw>.
+ *
+ *  This program is free software: you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation, either version 3 of the License, or
+ *  (at your option) any later version.
+ *
+ *  This program is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include <atomic>
+#include <cstring>
+#include <thread>
+
+#if defined(_M_X64) || (defined(_M_IX86_FP) && _M_IX86_FP >= 2) || defined(__SSE2__)
+	#define IMAGECODEC_SSE2 1
+	#include <emmintrin.h>
+#else
+	#define IMAGECODEC_SSE2 0
+#endif
+
+#ifdef _MSC_VER
+	#include <intrin.h>
+#endif  // _MSC_VER
+
+#include "imagecodec.h"
+#include "jobs.h"
+
+
+
+namespace {
+
+
+
+// The container, with every field a little-endian uint32_t:
+//   "HBIM" <version> <width> <height> <format> <source format> <row size> <row count>
+//   <rows per stripe> <stripe count> <encoded size of each stripe> ... <stripes> ...
+constexpr uint32_t c_magic = 0x4D494248;  // "HBIM"
+constexpr uint32_t c_version = 1;
+constexpr size_t c_headerFieldCount = 10;
+constexpr size_t c_headerSize = c_headerFieldCount * sizeof(uint32_t);
+
+// small enough to keep a few threads busy on a 256x256 texture, large enough for QOI to warm up
+constexpr uint32_t c_stripeRows = 64;
+
+// ref: https://qoiformat.org/qoi-specification.pdf
+constexpr uint8_t c_opIndex = 0x00;
+constexpr uint8_t c_opDiff = 0x40;
+constexpr uint8_t c_opLuma = 0x80;
+constexpr uint8_t c_opRun = 0xC0;
+constexpr uint8_t c_opRgb = 0xFE;
+constexpr uint8_t c_opRgba = 0xFF;
+constexpr uint8_t c_opTagMask = 0xC0;
+constexpr uint32_t c_maxRun = 62;
+constexpr uint32_t c_initialPixel = 0xFF000000;
+
+// a pixel may take an RGBA op, i.e. 5 bytes for 4 bytes of input
+constexpr uint64_t c_worstCaseNumerator = 5;
+constexpr uint64_t c_worstCaseDenominator = 4;
+
+
+// Pixels are handled as little-endian words, so channel 0 is the lowest byte. The codec never
+// looks at which channel is red, so RGBA and BGRA go through the same code.
+inline uint32_t LoadPixel(const uint8_t* p)
+{
+	uint32_t value;
+	memcpy(&value, p, sizeof(value));
+	return value;
+}
+
+
+inline void StorePixel(uint8_t* p, uint32_t value)
+{
+	memcpy(p, &value, sizeof(value));
+}
+
+
+inline uint32_t LoadField(const uint8_t* p)
+{
+	return static_cast<uint32_t>(p[0]) | (static_cast<uint32_t>(p[1]) << 8) | (static_cast<uint32_t>(p[2]) << 16) | (static_cast<uint32_t>(p[3]) << 24);
+}
+
+
+inline void StoreField(uint8_t* p, uint32_t value)
+{
+	p[0] = static_cast<uint8_t>(value);
+	p[1] = static_cast<uint8_t>(value >> 8);
+	p[2] = static_cast<uint8_t>(value >> 16);
+	p[3] = static_cast<uint8_t>(value >> 24);
+}
+
+
+inline uint32_t GetIndexSlot(uint32_t pixel)
+{
+	return ((pixel & 0xFF) * 3 + ((pixel >> 8) & 0xFF) * 5 + ((pixel >> 16) & 0xFF) * 7 + (pixel >> 24) * 11) & 63;
+}
+
+
+// difference of channel $shift / 8 wrapped into [-128, 127]
+inline int GetChannelDiff(uint32_t pixel, uint32_t prev, int shift)
+{
+	return static_cast<int8_t>(static_cast<uint8_t>((pixel >> shift) - (prev >> shift)));
+}
+
+
+inline uint32_t AddToChannels(uint32_t pixel, int d0, int d1, int d2)
+{
+	const uint32_t c0 = (pixel + static_cast<uint32_t>(d0)) & 0xFF;
+	const uint32_t c1 = ((pixel >> 8) + static_cast<uint32_t>(d1)) & 0xFF;
+	const uint32_t c2 = ((pixel >> 16) + static_cast<uint32_t>(d2)) & 0xFF;
+	return c0 | (c1 << 8) | (c2 << 16) | (pixel & 0xFF000000);
+}
+
+
+#if IMAGECODEC_SSE2
+// @param mask not all ones in the lower 16 bits
+inline uint32_t CountTrailingOnes(uint32_t mask)
+{
+#ifdef _MSC_VER
+	unsigned long index;
+	_BitScanForward(&index, ~mask);
+	return index;
+#else
+	return static_cast<uint32_t>(__builtin_ctz(~mask));
+#endif  // _MSC_VER
+}
+#endif  // IMAGECODEC_SSE2
+
+
+// number of pixels from $begin on which equal $value, compared four at a time where possible
+uint32_t CountRun(const uint8_t* row, uint32_t begin, uint32_t end, uint32_t value)
+{
+	uint32_t i = begin;
+#if IMAGECODEC_SSE2
+	const __m128i needle = _mm_set1_epi32(static_cast<int>(value));
+	for (; i + 4 <= end; i += 4) {
+		const __m128i block = _mm_loadu_si128(reinterpret_cast<const __m128i*>(row + i * 4));
+		const uint32_t mask = static_cast<uint32_t>(_mm_movemask_epi8(_mm_cmpeq_epi32(block, needle)));
+		if (mask != 0xFFFF)
+			return i - begin + CountTrailingOnes(mask) / 4;
+	}
+#endif  // IMAGECODEC_SSE2
+	while (i < end && LoadPixel(row + i * 4) == value)
+		++i;
+	return i - begin;
+}
+
+
+size_t EncodeStripe(const uint8_t* rows, size_t rowPitch, uint32_t width, uint32_t rowCount, uint8_t* out)
+{
+	uint32_t index[64] = { };
+	uint32_t prev = c_initialPixel;
+	uint32_t run = 0;
+	uint8_t* p = out;
+
+	for (uint32_t y = 0; y < rowCount; ++y, rows += rowPitch) {
+		for (uint32_t x = 0; x < width; ) {
+			const uint32_t pixel = LoadPixel(rows + x * 4);
+			if (pixel == prev) {
+				const uint32_t length = CountRun(rows, x, width, prev);
+				x += length;
+				run += length;
+				for (; run >= c_maxRun; run -= c_maxRun)
+					*p++ = static_cast<uint8_t>(c_opRun | (c_maxRun - 1));
+				continue;
+			}
+
+			if (run > 0) {
+				*p++ = static_cast<uint8_t>(c_opRun | (run - 1));
+				run = 0;
+			}
+
+			const uint32_t slot = GetIndexSlot(pixel);
+			if (index[slot] == pixel) {
+				*p++ = static_cast<uint8_t>(c_opIndex | slot);
+			}
+			else if ((pixel ^ prev) >> 24 != 0) {
+				index[slot] = pixel;
+				*p++ = c_opRgba;
+				StorePixel(p, pixel);
+				p += 4;
+			}
+			else {
+				index[slot] = pixel;
+				const int d0 = GetChannelDiff(pixel, prev, 0);
+				const int d1 = GetChannelDiff(pixel, prev, 8);
+				const int d2 = GetChannelDiff(pixel, prev, 16);
+				const int d0d1 = d0 - d1;
+				const int d2d1 = d2 - d1;
+				if (d0 >= -2 && d0 <= 1 && d1 >= -2 && d1 <= 1 && d2 >= -2 && d2 <= 1) {
+					*p++ = static_cast<uint8_t>(c_opDiff | ((d0 + 2) << 4) | ((d1 + 2) << 2) | (d2 + 2));
+				}
+				else if (d1 >= -32 && d1 <= 31 && d0d1 >= -8 && d0d1 <= 7 && d2d1 >= -8 && d2d1 <= 7) {
+					*p++ = static_cast<uint8_t>(c_opLuma | (d1 + 32));
+					*p++ = static_cast<uint8_t>(((d0d1 + 8) << 4) | (d2d1 + 8));
+				}
+				else {
+					*p++ = c_opRgb;
+					*p++ = static_cast<uint8_t>(pixel);
+					*p++ = static_cast<uint8_t>(pixel >> 8);
+					*p++ = static_cast<uint8_t>(pixel >> 16);
+				}
+			}
+			prev = pixel;
+			++x;
+		}
+	}
+
+	if (run > 0)
+		*p++ = static_cast<uint8_t>(c_opRun | (run - 1));
+	return static_cast<size_t>(p - out);
+}
+
+
+bool DecodeStripe(const uint8_t* data, size_t size, uint8_t* rows, size_t rowPitch, uint32_t width, uint32_t rowCount)
+{
+	uint32_t index[64] = { };
+	uint32_t prev = c_initialPixel;
+	uint32_t run = 0;
+	const uint8_t* p = data;
+	const uint8_t* const end = data + size;
+
+	for (uint32_t y = 0; y < rowCount; ++y, rows += rowPitch) {
+		for (uint32_t x = 0; x < width; ++x) {
+			if (run > 0) {
+				--run;
+				StorePixel(rows + x * 4, prev);
+				continue;
+			}
+
+			if (p >= end)
+				return false;
+			const uint8_t op = *p++;
+			if (op == c_opRgb) {
+				if (end - p < 3)
+					return false;
+				prev = static_cast<uint32_t>(p[0]) | (static_cast<uint32_t>(p[1]) << 8) | (static_cast<uint32_t>(p[2]) << 16) | (prev & 0xFF000000);
+				p += 3;
+			}
+			else if (op == c_opRgba) {
+				if (end - p < 4)
+					return false;
+				prev = LoadPixel(p);
+				p += 4;
+			}
+			else {
+				switch (op & c_opTagMask) {
+				case c_opIndex:
+					prev = index[op & 63];
+					break;
+				case c_opDiff:
+					prev = AddToChannels(prev, ((op >> 4) & 3) - 2, ((op >> 2) & 3) - 2, (op & 3) - 2);
+					break;
+				case c_opLuma: {
+					if (p >= end)
+						return false;
+					const int d1 = (op & 63) - 32;
+					const uint8_t next = *p++;
+					prev = AddToChannels(prev, d1 + (next >> 4) - 8, d1, d1 + (next & 15) - 8);
+					break;
+				}
+				default:  // c_opRun
+					run = op & 63;
+					break;
+				}
+			}
+			index[GetIndexSlot(prev)] = prev;
+			StorePixel(rows + x * 4, prev);
+		}
+	}
+
+	// a run never crosses the end of a stripe
+	return run == 0 && p == end;
+}
+
+
+bool IsValidInfo(const ImageInfo& info)
+{
+	if (info.width == 0 || info.height == 0 || info.rowSize == 0 || info.rowCount == 0)
+		return false;
+	switch (info.format) {
+	case ImageFormat::Rgba8:
+	case ImageFormat::Bgra8:
+		return static_cast<uint64_t>(info.width) * 4 == info.rowSize && info.rowCount == info.height;
+	case ImageFormat::Raw:
+		return true;
+	default:
+		return false;
+	}
+}
+
+
+// upper bound of the encoded size of a full stripe
+uint64_t GetStripeBound(const ImageInfo& info, uint32_t stripeRows)
+{
+	const uint64_t size = static_cast<uint64_t>(info.rowSize) * stripeRows;
+	return info.format == ImageFormat::Raw ? size : size * c_worstCaseNumerator / c_worstCaseDenominator;
+}
+
+
+// Call $func for every stripe, spreading the stripes over up to $threadCount threads which
+// include the calling one. Stops handing out stripes after the first failure.
+template <typename Func>
+bool ForEachStripe(uint32_t stripeCount, unsigned int threadCount, const Func& func)
+{
+	std::atomic<uint32_t> next(0);
+	std::atomic<bool> isOk(true);
+	auto worker = [&]() {
+		for (uint32_t stripe = next.fetch_add(1); stripe < stripeCount; stripe = next.fetch_add(1)) {
+			if (!func(stripe)) {
+				isOk.store(false);
+				next.store(stripeCount);
+			}
+		}
+	};
+
+	unsigned int extraThreads = threadCount > 1 ? threadCount - 1 : 0;
+	if (extraThreads > stripeCount - 1)
+		extraThreads = stripeCount - 1;
+	std::vector<std::thread> threads;
+	threads.reserve(extraThreads);
+	for (unsigned int i = 0; i < extraThreads; ++i)
+		threads.emplace_back(worker);
+	worker();
+	for (auto& thread : threads)
+		thread.join();
+	return isOk.load();
+}
+
+
+struct Header
+{
+	ImageInfo info;
+	uint32_t stripeRows;
+	uint32_t stripeCount;
+};
+
+
+bool ReadHeader(const uint8_t* data, size_t size, Header& header)
+{
+	if (data == nullptr || size < c_headerSize)
+		return false;
+	if (LoadField(data) != c_magic || LoadField(data + 4) != c_version)
+		return false;
+
+	header.info.width = LoadField(data + 8);
+	header.info.height = LoadField(data + 12);
+	header.info.format = static_cast<ImageFormat>(LoadField(data + 16));
+	header.info.sourceFormat = LoadField(data + 20);
+	header.info.rowSize = LoadField(data + 24);
+	header.info.rowCount = LoadField(data + 28);
+	header.stripeRows = LoadField(data + 32);
+	header.stripeCount = LoadField(data + 36);
+	return IsValidInfo(header.info)
+		&& header.stripeRows > 0
+		&& header.stripeCount == (static_cast<uint64_t>(header.info.rowCount) + header.stripeRows - 1) / header.stripeRows
+		&& (size - c_headerSize) / sizeof(uint32_t) >= header.stripeCount;
+}
+
+
+// $forEachStripe(stripeCount, func) calls $func for every stripe, possibly concurrently
+template <typename ForEachStripeFunc>
+bool EncodeStripes(const ImageInfo& info, const uint8_t* pixels, size_t rowPitch, std::vector<uint8_t>& out, const ForEachStripeFunc& forEachStripe)
+{
+	if (!IsValidInfo(info) || pixels == nullptr || rowPitch < info.rowSize)
+		return false;
+
+	const uint32_t stripeCount = (info.rowCount + c_stripeRows - 1) / c_stripeRows;
+	const uint64_t stripeBound = GetStripeBound(info, c_stripeRows);
+	const uint64_t tableSize = c_headerSize + static_cast<uint64_t>(stripeCount) * sizeof(uint32_t);
+	const uint64_t scratchSize = tableSize + stripeBound * stripeCount;
+	if (stripeBound > UINT32_MAX || scratchSize > SIZE_MAX / 2)
+		return false;
+
+	// every stripe gets its worst-case slot, and the slots are packed once all are done
+	out.resize(static_cast<size_t>(scratchSize));
+	std::vector<uint32_t> stripeSizes(stripeCount);
+	uint8_t* const slots = out.data() + tableSize;
+	forEachStripe(stripeCount, [&](uint32_t stripe) {
+		const uint32_t firstRow = stripe * c_stripeRows;
+		const uint32_t rowCount = info.rowCount - firstRow < c_stripeRows ? info.rowCount - firstRow : c_stripeRows;
+		const uint8_t* rows = pixels + rowPitch * firstRow;
+		uint8_t* slot = slots + static_cast<size_t>(stripeBound) * stripe;
+		if (info.format == ImageFormat::Raw) {
+			for (uint32_t row = 0; row < rowCount; ++row, rows += rowPitch, slot += info.rowSize)
+				memcpy(slot, rows, info.rowSize);
+			stripeSizes[stripe] = info.rowSize * rowCount;
+		}
+		else {
+			stripeSizes[stripe] = static_cast<uint32_t>(EncodeStripe(rows, rowPitch, info.width, rowCount, slot));
+		}
+		return true;
+	});
+
+	uint8_t* p = out.data();
+	const uint32_t fields[c_headerFieldCount] = {
+		c_magic, c_version, info.width, info.height, static_cast<uint32_t>(info.format), info.sourceFormat,
+		info.rowSize, info.rowCount, c_stripeRows, stripeCount,
+	};
+	for (uint32_t field : fields) {
+		StoreField(p, field);
+		p += sizeof(field);
+	}
+	for (uint32_t stripeSize : stripeSizes) {
+		StoreField(p, stripeSize);
+		p += sizeof(stripeSize);
+	}
+
+	size_t offset = static_cast<size_t>(tableSize);
+	for (uint32_t stripe = 0; stripe < stripeCount; ++stripe) {
+		memmove(out.data() + offset, slots + static_cast<size_t>(stripeBound) * stripe, stripeSizes[stripe]);
+		offset += stripeSizes[stripe];
+	}
+	out.resize(offset);
+	return true;
+}
+
+
+
+}  // unnamed namespace
+
+
+
+bool EncodeImage(const ImageInfo& info, const uint8_t* pixels, size_t rowPitch, std::vector<uint8_t>& out, unsigned int threadCount)
+{
+	return EncodeStripes(info, pixels, rowPitch, out, [threadCount](uint32_t stripeCount, const auto& func) {
+		ForEachStripe(stripeCount, threadCount, func);
+	});
+}
+
+
+bool EncodeImage(const ImageInfo& info, const uint8_t* pixels, size_t rowPitch, std::vector<uint8_t>& out, JobSystem& jobs)
+{
+	return EncodeStripes(info, pixels, rowPitch, out, [&jobs](uint32_t stripeCount, const auto& func) {
+		jobs.ParallelFor(stripeCount, 1, [&func](size_t stripe) { func(static_cast<uint32_t>(stripe)); });
+	});
+}
+
+
+bool ReadImageInfo(const uint8_t* data, size_t size, ImageInfo& info)
+{
+	Header header;
+	if (!ReadHeader(data, size, header))
+		return false;
+	info = header.info;
+	return true;
+}
+
+
+bool DecodeImage(const uint8_t* data, size_t size, uint8_t* pixels, size_t rowPitch, unsigned int threadCount)
+{
+	Header header;
+	if (!ReadHeader(data, size, header) || pixels == nullptr || rowPitch < header.info.rowSize)
+		return false;
+	const ImageInfo& info = header.info;
+
+	std::vector<size_t> offsets(static_cast<size_t>(header.stripeCount) + 1);
+	offsets[0] = c_headerSize + static_cast<size_t>(header.stripeCount) * sizeof(uint32_t);
+	const uint64_t stripeBound = GetStripeBound(info, header.stripeRows);
+	for (uint32_t stripe = 0; stripe < header.stripeCount; ++stripe) {
+		const uint32_t stripeSize = LoadField(data + c_headerSize + stripe * sizeof(uint32_t));
+		if (stripeSize > stripeBound || size - offsets[stripe] < stripeSize)
+			return false;
+		offsets[stripe + 1] = offsets[stripe] + stripeSize;
+	}
+	if (offsets.back() != size)
+		return false;
+
+	return ForEachStripe(header.stripeCount, threadCount, [&](uint32_t stripe) {
+		const uint32_t firstRow = stripe * header.stripeRows;
+		const uint32_t rowCount = info.rowCount - firstRow < header.stripeRows ? info.rowCount - firstRow : header.stripeRows;
+		const uint8_t* src = data + offsets[stripe];
+		const size_t srcSize = offsets[stripe + 1] - offsets[stripe];
+		uint8_t* rows = pixels + rowPitch * firstRow;
+		if (info.format != ImageFormat::Raw)
+			return DecodeStripe(src, srcSize, rows, rowPitch, info.width, rowCount);
+
+		if (srcSize != static_cast<size_t>(info.rowSize) * rowCount)
+			return false;
+		for (uint32_t row = 0; row < rowCount; ++row, rows += rowPitch, src += info.rowSize)
+			memcpy(rows, src, info.rowSize);
+		return true;
+	});
+}
@@ -0,0 +1,73 @@
+/*
+ *  herbicide - removing flowers and rabbits in the game Mirror
+ *  Copyright (C) 2018 Mifan Bang <https://debug.tw>.
+ *
+ *  This program is free software: you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation, either version 3 of the License, or
+ *  (at your option) any later version.
+ *
+ *  This program is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#pragma once
+
+#include <cstddef>
+#include <cstdint>
+#include <vector>
+
+class JobSystem;
+
+
+
+// ---------------------------------------------------------------------------
+// Lossless image codec for texture dumps, in the style of QOI. It has no
+// dependency beyond the standard library so that offline tools can read dumps.
+//
+// The image is cut into stripes of rows which are encoded independently, each
+// starting from a fresh QOI state, so that stripes can be encoded and decoded on
+// several threads. Formats other than 32-bit RGBA and BGRA, such as the block
+// compressed ones, are stored as raw rows.
+// ---------------------------------------------------------------------------
+
+enum class ImageFormat : uint32_t
+{
+	Rgba8 = 1,
+	Bgra8 = 2,
+	Raw = 3,
+};
+
+
+struct ImageInfo
+{
+	uint32_t width;
+	uint32_t height;
+	ImageFormat format;
+	uint32_t sourceFormat;  // value of DXGI_FORMAT, for reference only
+
+	// layout of the rows as stored; for Rgba8 and Bgra8 it must be (width * 4, height),
+	// while for block compressed data a row is a row of blocks
+	uint32_t rowSize;
+	uint32_t rowCount;
+};
+
+
+// encode the rows at $pixels, which are $rowPitch bytes apart, replacing the content of $out
+// @param threadCount number of threads to encode with, the calling thread included
+bool EncodeImage(const ImageInfo& info, const uint8_t* pixels, size_t rowPitch, std::vector<uint8_t>& out, unsigned int threadCount);
+
+// the same, with the stripes spread over $jobs and the calling thread
+bool EncodeImage(const ImageInfo& info, const uint8_t* pixels, size_t rowPitch, std::vector<uint8_t>& out, JobSystem& jobs);
+
+// read the header of an encoded image
+bool ReadImageInfo(const uint8_t* data, size_t size, ImageInfo& info);
+
+// decode into rows of info.rowSize bytes which are $rowPitch bytes apart
+// @return false if the data is malformed, in which case the content of $pixels is undefined
+bool DecodeImage(const uint8_t* data, size_t size, uint8_t* pixels, size_t rowPitch, unsigned int threadCount);
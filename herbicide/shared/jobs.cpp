@@ -0,0 +1,279 @@
+/*
+ *  herbicide - removing flowers and rabbits in the game Mirror
+ *  Copyright (C) 2018 Mifan Bang <https://debug.tw>.
+ *
+ *  This program is free software: you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation, either version 3 of the License, or
+ *  (at your option) any later version.
+ *
+ *  This program is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include "jobs.h"
+
+#include <chrono>
+
+#ifdef _WIN32
+	#include <windows.h>
+#else
+	#include <sys/resource.h>
+#endif  // _WIN32
+
+
+
+namespace {
+
+
+
+// the worker the calling thread is, if any
+thread_local const JobSystem* t_system = nullptr;
+thread_local int t_workerIndex = -1;
+
+// a waiting thread looks for new jobs this often, as those it waits for may spawn more
+constexpr auto c_waitPollInterval = std::chrono::milliseconds(1);
+
+
+void LowerThreadPriority()
+{
+#ifdef _WIN32
+	::SetThreadPriority(::GetCurrentThread(), THREAD_PRIORITY_BELOW_NORMAL);
+#else
+	// on Linux the nice value belongs to the calling thread alone
+	setpriority(PRIO_PROCESS, 0, 5);
+#endif  // _WIN32
+}
+
+
+
+}  // unnamed namespace
+
+
+
+JobCounter::JobCounter()
+	: m_pending(0)
+	, m_lock()
+	, m_done()
+{
+}
+
+
+void JobCounter::Add()
+{
+	std::lock_guard<std::mutex> lock(m_lock);
+	m_pending.fetch_add(1, std::memory_order_relaxed);
+}
+
+
+// the lock is held until the waiter is notified, so that the waiter can't return and destroy
+// the counter before that
+void JobCounter::Done()
+{
+	std::lock_guard<std::mutex> lock(m_lock);
+	if (m_pending.fetch_sub(1, std::memory_order_acq_rel) == 1)
+		m_done.notify_all();
+}
+
+
+
+JobSystem::JobSystem()
+	: m_workers()
+	, m_threads()
+	, m_shared()
+	, m_sleepLock()
+	, m_wake()
+	, m_queuedCount(0)
+	, m_sleepingCount(0)
+	, m_isStopping(false)
+	, m_submitCount(0)
+	, m_runCount(0)
+	, m_stealCount(0)
+{
+}
+
+
+JobSystem::~JobSystem()
+{
+	Stop();
+}
+
+
+bool JobSystem::Start(unsigned int workerCount, bool isLowPriority)
+{
+	if (IsRunning() || workerCount > c_maxWorkers)
+		return false;
+
+	m_isStopping.store(false);
+	for (unsigned int i = 0; i < workerCount; ++i)
+		m_workers.push_back(std::make_unique<Worker>());
+	// every deque exists before any worker may steal from it
+	for (unsigned int i = 0; i < workerCount; ++i)
+		m_threads.emplace_back(&JobSystem::Run, this, i, isLowPriority);
+	return true;
+}
+
+
+void JobSystem::Stop()
+{
+	if (!IsRunning())
+		return;
+
+	{
+		std::lock_guard<std::mutex> lock(m_sleepLock);
+		m_isStopping.store(true);
+	}
+	m_wake.notify_all();
+	for (auto& thread : m_threads)
+		thread.join();
+	m_threads.clear();
+	m_workers.clear();
+}
+
+
+JobSystem::Stats JobSystem::GetStats() const
+{
+	Stats stats;
+	stats.submitCount = m_submitCount.load(std::memory_order_relaxed);
+	stats.runCount = m_runCount.load(std::memory_order_relaxed);
+	stats.stealCount = m_stealCount.load(std::memory_order_relaxed);
+	return stats;
+}
+
+
+void JobSystem::Submit(Job job, JobCounter* counter)
+{
+	m_submitCount.fetch_add(1, std::memory_order_relaxed);
+	Task task { std::move(job), counter };
+	if (counter != nullptr)
+		counter->Add();
+	if (!IsRunning()) {
+		Execute(task);
+		return;
+	}
+
+	const int index = GetWorkerIndex();
+	Worker& worker = index >= 0 ? *m_workers[index] : m_shared;
+	{
+		std::lock_guard<std::mutex> lock(worker.lock);
+		worker.tasks.push_back(std::move(task));
+	}
+
+	// Either a worker about to sleep sees the job, or it was counted as sleeping by then;
+	// taking the lock makes sure it is waiting before it's notified.
+	m_queuedCount.fetch_add(1);
+	if (m_sleepingCount.load() > 0) {
+		std::lock_guard<std::mutex> lock(m_sleepLock);
+		m_wake.notify_one();
+	}
+}
+
+
+void JobSystem::Wait(JobCounter& counter)
+{
+	while (!counter.IsDone()) {
+		if (RunOne())
+			continue;
+		std::unique_lock<std::mutex> lock(counter.m_lock);
+		counter.m_done.wait_for(lock, c_waitPollInterval, [&counter]() { return counter.IsDone(); });
+	}
+
+	// the last Done() may still hold the lock
+	std::lock_guard<std::mutex> lock(counter.m_lock);
+}
+
+
+void JobSystem::Run(unsigned int index, bool isLowPriority)
+{
+	t_system = this;
+	t_workerIndex = static_cast<int>(index);
+	if (isLowPriority)
+		LowerThreadPriority();
+
+	while (true) {
+		if (RunOne())
+			continue;
+
+		std::unique_lock<std::mutex> lock(m_sleepLock);
+		m_sleepingCount.fetch_add(1);
+		m_wake.wait(lock, [this]() { return m_queuedCount.load() > 0 || m_isStopping.load(); });
+		m_sleepingCount.fetch_sub(1);
+		// what was queued before Stop() still runs
+		if (m_isStopping.load() && m_queuedCount.load() == 0)
+			break;
+	}
+
+	t_system = nullptr;
+	t_workerIndex = -1;
+}
+
+
+bool JobSystem::RunOne()
+{
+	if (m_queuedCount.load() == 0)
+		return false;
+
+	Task task;
+	const int self = GetWorkerIndex();
+	bool isFound = self >= 0 && PopBack(*m_workers[self], task);
+	if (!isFound)
+		isFound = PopFront(m_shared, task);
+
+	// steal from the next worker on, so that thieves spread over the victims
+	const size_t workerCount = m_workers.size();
+	for (size_t i = 1; !isFound && i <= workerCount; ++i) {
+		const size_t victim = (static_cast<size_t>(self + 1) + i - 1) % workerCount;
+		if (static_cast<int>(victim) != self && PopFront(*m_workers[victim], task)) {
+			isFound = true;
+			m_stealCount.fetch_add(1, std::memory_order_relaxed);
+		}
+	}
+	if (!isFound)
+		return false;
+
+	m_queuedCount.fetch_sub(1);
+	Execute(task);
+	return true;
+}
+
+
+bool JobSystem::PopBack(Worker& worker, Task& task)
+{
+	std::lock_guard<std::mutex> lock(worker.lock);
+	if (worker.tasks.empty())
+		return false;
+	task = std::move(worker.tasks.back());
+	worker.tasks.pop_back();
+	return true;
+}
+
+
+bool JobSystem::PopFront(Worker& worker, Task& task)
+{
+	std::lock_guard<std::mutex> lock(worker.lock);
+	if (worker.tasks.empty())
+		return false;
+	task = std::move(worker.tasks.front());
+	worker.tasks.pop_front();
+	return true;
+}
+
+
+void JobSystem::Execute(Task& task)
+{
+	task.job();
+	m_runCount.fetch_add(1, std::memory_order_relaxed);
+	if (task.counter != nullptr)
+		task.counter->Done();
+}
+
+
+int JobSystem::GetWorkerIndex() const
+{
+	return t_system == this ? t_workerIndex : -1;
+}
@@ -0,0 +1,190 @@
+/*
+ *  herbicide - removing flowers and rabbits in the game Mirror
+ *  Copyright (C) 2018 Mifan Bang <https://debug.tw>.
+ *
+ *  This program is free software: you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation, either version 3 of the License, or
+ *  (at your option) any later version.
+ *
+ *  This program is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#pragma once
+
+#include <algorithm>
+#include <atomic>
+#include <condition_variable>
+#include <cstddef>
+#include <cstdint>
+#include <deque>
+#include <functional>
+#include <memory>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+
+
+// ---------------------------------------------------------------------------
+// Small work-stealing scheduler for background work inside the game process.
+//
+// Every worker owns a deque. The jobs it submits are pushed and popped at the
+// back, so that the latest and most cache-friendly one runs next, while idle
+// workers steal the oldest job from the front of another deque. Jobs submitted
+// by other threads go to a shared deque which all workers take from.
+//
+// Workers run below the normal priority and their number is bounded, so that
+// the render and streaming threads of the game keep the cores they need. A
+// thread waiting for jobs runs queued jobs meanwhile instead of just blocking.
+// ---------------------------------------------------------------------------
+
+// join point of a set of jobs; must outlive them
+class JobCounter
+{
+public:
+	JobCounter();
+
+	JobCounter(const JobCounter&) = delete;
+	JobCounter& operator=(const JobCounter&) = delete;
+
+	bool IsDone() const		{ return m_pending.load(std::memory_order_acquire) == 0; }
+
+
+private:
+	friend class JobSystem;
+
+	void Add();
+	void Done();
+
+	std::atomic<uint32_t> m_pending;  // only changed with $m_lock held
+	std::mutex m_lock;
+	std::condition_variable m_done;
+};
+
+
+
+class JobSystem
+{
+public:
+	static constexpr unsigned int c_maxWorkers = 8;
+
+	using Job = std::function<void()>;
+
+	struct Stats
+	{
+		uint64_t submitCount;
+		uint64_t runCount;  // by workers and waiting threads
+		uint64_t stealCount;  // taken from the deque of another worker
+	};
+
+
+	JobSystem();
+	~JobSystem();  // stops the workers
+
+	JobSystem(const JobSystem&) = delete;
+	JobSystem& operator=(const JobSystem&) = delete;
+
+	// @param workerCount up to c_maxWorkers; 0 runs every job on the thread submitting it
+	// @param isLowPriority run the workers below the normal priority
+	bool Start(unsigned int workerCount, bool isLowPriority);
+
+	// run what is queued and join the workers; not to be called under the loader lock
+	void Stop();
+
+	bool IsRunning() const				{ return !m_workers.empty(); }
+	unsigned int GetWorkerCount() const	{ return static_cast<unsigned int>(m_workers.size()); }
+	Stats GetStats() const;
+
+	// queue $job, counted by $counter if not nullptr; runs it right away if not running
+	void Submit(Job job, JobCounter* counter = nullptr);
+
+	// return once every job counted by $counter has run, running queued jobs meanwhile
+	void Wait(JobCounter& counter);
+
+	// Call $func(i) for every i in [0, count), in chunks of $grain indices taken in turn by
+	// the calling thread and up to one helper job per worker.
+	template <typename Func>
+	void ParallelFor(size_t count, size_t grain, const Func& func);
+
+	// call $first and $second concurrently
+	template <typename First, typename Second>
+	void Invoke(const First& first, const Second& second);
+
+
+private:
+	struct Task
+	{
+		Job job;
+		JobCounter* counter;
+	};
+
+	struct Worker
+	{
+		std::mutex lock;
+		std::deque<Task> tasks;
+	};
+
+	void Run(unsigned int index, bool isLowPriority);
+	bool RunOne();  // @return false if no job was found
+	bool PopBack(Worker& worker, Task& task);
+	bool PopFront(Worker& worker, Task& task);
+	void Execute(Task& task);
+	int GetWorkerIndex() const;  // of the calling thread, or -1
+
+	std::vector<std::unique_ptr<Worker>> m_workers;
+	std::vector<std::thread> m_threads;
+	Worker m_shared;  // jobs submitted from outside the workers
+
+	std::mutex m_sleepLock;
+	std::condition_variable m_wake;
+	std::atomic<uint32_t> m_queuedCount;
+	std::atomic<uint32_t> m_sleepingCount;
+	std::atomic<bool> m_isStopping;
+
+	std::atomic<uint64_t> m_submitCount;
+	std::atomic<uint64_t> m_runCount;
+	std::atomic<uint64_t> m_stealCount;
+};
+
+
+
+template <typename Func>
+void JobSystem::ParallelFor(size_t count, size_t grain, const Func& func)
+{
+	grain = grain > 0 ? grain : 1;
+	const size_t chunkCount = count / grain + (count % grain != 0 ? 1 : 0);
+	std::atomic<size_t> next(0);
+	auto runChunks = [&]() {
+		for (size_t chunk = next.fetch_add(1); chunk < chunkCount; chunk = next.fetch_add(1)) {
+			const size_t first = chunk * grain;
+			const size_t end = count - first < grain ? count : first + grain;
+			for (size_t i = first; i < end; ++i)
+				func(i);
+		}
+	};
+
+	// helpers which start late find nothing left and return at once
+	JobCounter counter;
+	const size_t helperCount = chunkCount > 1 ? std::min<size_t>(chunkCount - 1, m_workers.size()) : 0;
+	for (size_t i = 0; i < helperCount; ++i)
+		Submit(runChunks, &counter);
+	runChunks();
+	Wait(counter);
+}
+
+
+template <typename First, typename Second>
+void JobSystem::Invoke(const First& first, const Second& second)
+{
+	JobCounter counter;
+	Submit([&second]() { second(); }, &counter);
+	first();
+	Wait(counter);
+}
@@ -0,0 +1,548 @@
+/*
+ *  herbicide - removing flowers and rabbits in the game Mirror
+ *  Copyright (C) 2018 Mifan Bang <https://debug.tw>.
+ *
+ *  This program is free software: you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation, either version 3 of the License, or
+ *  (at your option) any later version.
+ *
+ *  This program is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include <wchar.h>
+
+#include <algorithm>
+#include <chrono>
+#include <cstring>
+#include <mutex>
+#include <string>
+#include <thread>
+#include <vector>
+
+#ifdef _WIN32
+	#include <windows.h>
+#endif  // _WIN32
+
+#include "logger.h"
+
+
+
+namespace {
+
+
+
+using Clock = std::chrono::steady_clock;
+
+constexpr uint8_t c_paddingLevel = 0xFF;
+constexpr size_t c_ringMask = Logger::c_ringSize - 1;
+static_assert((Logger::c_ringSize & c_ringMask) == 0, "the ring size must be a power of two");
+
+
+// Records are 8-byte aligned and never wrap around the end of the ring; the room left there
+// is filled by a padding record instead. Each argument takes 8 bytes, except that a string is
+// stored as its length followed by its characters.
+struct RecordHeader
+{
+	uint32_t size;  // of the whole record
+	uint8_t level;  // c_paddingLevel for padding
+	uint8_t argumentCount;
+	uint16_t reserved;
+	uint64_t timestamp;  // ns since the logger started
+	const wchar_t* format;
+	LogArgument::Type types[Logger::c_maxArguments];
+};
+
+constexpr size_t c_headerSize = (sizeof(RecordHeader) + 7) & ~static_cast<size_t>(7);
+
+
+inline size_t Align8(size_t size)
+{
+	return (size + 7) & ~static_cast<size_t>(7);
+}
+
+
+// single producer, the owning thread; single consumer, the drain
+struct ThreadRing
+{
+	uint8_t data[Logger::c_ringSize];
+	std::atomic<uint64_t> head;
+	std::atomic<uint64_t> tail;
+	std::atomic<uint64_t> written;
+	std::atomic<uint64_t> dropped;
+	std::atomic<bool> isRetired;  // the owning thread has exited
+	uint64_t reportedDropped;  // by the drain
+	uint32_t threadId;
+
+	uint8_t* Reserve(size_t size, uint64_t& newHead)
+	{
+		uint64_t pos = head.load(std::memory_order_relaxed);
+		const uint64_t freed = tail.load(std::memory_order_acquire);
+		const size_t offset = static_cast<size_t>(pos & c_ringMask);
+		const size_t padding = offset + size > Logger::c_ringSize ? Logger::c_ringSize - offset : 0;
+		if (pos + padding + size - freed > Logger::c_ringSize)
+			return nullptr;
+
+		if (padding > 0) {
+			auto filler = reinterpret_cast<RecordHeader*>(data + offset);
+			filler->size = static_cast<uint32_t>(padding);
+			filler->level = c_paddingLevel;
+			pos += padding;
+		}
+		newHead = pos + size;
+		return data + static_cast<size_t>(pos & c_ringMask);
+	}
+};
+
+
+struct FormattedRecord
+{
+	uint64_t timestamp;
+	std::wstring text;
+};
+
+
+struct LoggerState
+{
+	std::mutex ringMutex;  // guards $rings
+	std::vector<ThreadRing*> rings;
+	uint64_t retiredWritten = 0;
+	uint64_t retiredDropped = 0;
+
+	std::mutex drainMutex;  // guards the rest, which belongs to the drain
+	FILE* sink = nullptr;
+	std::vector<FormattedRecord> records;
+
+	Clock::time_point startTime;
+	std::atomic<bool> isStopping { false };
+	uint32_t nextThreadId = 1;
+};
+
+
+std::atomic<LoggerState*> s_state(nullptr);
+
+
+// retires the ring of its thread when the thread exits
+struct RingOwner
+{
+	ThreadRing* ring = nullptr;
+
+	~RingOwner()
+	{
+		if (ring != nullptr)
+			ring->isRetired.store(true, std::memory_order_release);
+	}
+};
+
+
+thread_local RingOwner t_ringOwner;
+
+
+ThreadRing* GetThreadRing(LoggerState& state)
+{
+	ThreadRing* ring = t_ringOwner.ring;
+	if (ring != nullptr)
+		return ring;
+
+	ring = new ThreadRing;
+	ring->head.store(0);
+	ring->tail.store(0);
+	ring->written.store(0);
+	ring->dropped.store(0);
+	ring->isRetired.store(false);
+	ring->reportedDropped = 0;
+
+	std::lock_guard<std::mutex> lock(state.ringMutex);
+#ifdef _WIN32
+	ring->threadId = ::GetCurrentThreadId();
+#else
+	ring->threadId = state.nextThreadId++;
+#endif  // _WIN32
+	state.rings.push_back(ring);
+	t_ringOwner.ring = ring;
+	return ring;
+}
+
+
+wchar_t GetLevelLetter(uint8_t level)
+{
+	static const wchar_t s_letters[] = L"DIWE";
+	return level < sizeof(s_letters) / sizeof(s_letters[0]) - 1 ? s_letters[level] : L'?';
+}
+
+
+// Format a single conversion. $spec holds the flags, width and precision of the conversion
+// without any length modifier, which is chosen here by the type actually recorded.
+void AppendConversion(std::wstring& out, std::wstring spec, wchar_t conversion, LogArgument::Type type, const uint8_t* value, size_t stringLength)
+{
+	using Type = LogArgument::Type;
+
+	uint64_t bits = 0;
+	if (type != Type::String)
+		memcpy(&bits, value, sizeof(bits));
+	const bool isNarrow = type == Type::Int32 || type == Type::UInt32;
+	const bool isSigned = type == Type::Int32 || type == Type::Int64;
+
+	wchar_t buffer[Logger::c_maxStringLength + 64];
+	const size_t capacity = sizeof(buffer) / sizeof(buffer[0]);
+	int written = -1;
+	switch (conversion) {
+	case L'd':
+	case L'i':
+	case L'u':
+	case L'x':
+	case L'X':
+	case L'o':
+	case L'c':
+		if (type == Type::String || type == Type::Double)
+			break;
+		if (conversion == L'c') {
+			spec += L'c';
+			written = swprintf(buffer, capacity, spec.c_str(), static_cast<int>(bits));
+		}
+		else if (isNarrow) {
+			spec += conversion;
+			if (conversion == L'd' || conversion == L'i')
+				written = swprintf(buffer, capacity, spec.c_str(), static_cast<int>(static_cast<int32_t>(bits)));
+			else
+				written = swprintf(buffer, capacity, spec.c_str(), static_cast<unsigned int>(bits));
+		}
+		else {
+			spec += L"ll";
+			spec += conversion;
+			if (conversion == L'd' || conversion == L'i')
+				written = swprintf(buffer, capacity, spec.c_str(), static_cast<long long>(bits));
+			else
+				written = swprintf(buffer, capacity, spec.c_str(), static_cast<unsigned long long>(bits));
+		}
+		break;
+
+	case L'f':
+	case L'F':
+	case L'e':
+	case L'E':
+	case L'g':
+	case L'G':
+	case L'a':
+	case L'A': {
+		double number;
+		if (type == Type::Double)
+			memcpy(&number, &bits, sizeof(number));
+		else if (type == Type::String)
+			break;
+		else
+			number = isSigned ? static_cast<double>(static_cast<int64_t>(bits)) : static_cast<double>(bits);
+		spec += conversion;
+		written = swprintf(buffer, capacity, spec.c_str(), number);
+		break;
+	}
+
+	case L'p':
+		if (type == Type::String || type == Type::Double)
+			break;
+		spec += L'p';
+		written = swprintf(buffer, capacity, spec.c_str(), reinterpret_cast<void*>(static_cast<uintptr_t>(bits)));
+		break;
+
+	case L's':
+	case L'S':
+		if (type != Type::String)
+			break;
+		spec += L"ls";  // wide on every CRT
+		{
+			const std::wstring text(reinterpret_cast<const wchar_t*>(value), stringLength);
+			written = swprintf(buffer, capacity, spec.c_str(), text.c_str());
+		}
+		break;
+
+	default:
+		break;
+	}
+
+	if (written >= 0)
+		out.append(buffer, static_cast<size_t>(written));
+	else
+		out += L"(?)";
+}
+
+
+void FormatRecord(const RecordHeader& header, std::wstring& out)
+{
+	const uint8_t* argument = reinterpret_cast<const uint8_t*>(&header) + c_headerSize;
+	size_t argumentIndex = 0;
+	for (const wchar_t* p = header.format; *p != L'\0'; ++p) {
+		if (*p != L'%') {
+			out += *p;
+			continue;
+		}
+		if (p[1] == L'%') {
+			out += L'%';
+			++p;
+			continue;
+		}
+
+		const wchar_t* const specStart = p;
+		std::wstring spec(1, L'%');
+		for (++p; *p != L'\0' && wcschr(L"-+ #0123456789.", *p) != nullptr; ++p)
+			spec += *p;
+		for (; *p != L'\0' && wcschr(L"hlLjztwqI0123456789", *p) != nullptr; ++p)
+			;  // length modifiers, including those of MSVC
+		if (*p == L'\0' || argumentIndex >= header.argumentCount) {
+			// not a conversion with an argument after all; keep the text as it is
+			out.append(specStart, *p == L'\0' ? wcslen(specStart) : static_cast<size_t>(p - specStart + 1));
+			if (*p == L'\0')
+				break;
+			continue;
+		}
+
+		const LogArgument::Type type = header.types[argumentIndex++];
+		size_t stringLength = 0;
+		const uint8_t* value = argument;
+		if (type == LogArgument::Type::String) {
+			uint32_t length;
+			memcpy(&length, argument, sizeof(length));
+			stringLength = length;
+			value = argument + sizeof(length);
+			argument += Align8(sizeof(length) + length * sizeof(wchar_t));
+		}
+		else {
+			argument += sizeof(uint64_t);
+		}
+		AppendConversion(out, spec, *p, type, value, stringLength);
+	}
+}
+
+
+void Drain(LoggerState& state)
+{
+	std::vector<ThreadRing*> rings;
+	{
+		std::lock_guard<std::mutex> lock(state.ringMutex);
+		rings = state.rings;
+	}
+
+	// the records of each thread are in order already; they are merged by time below
+	auto& records = state.records;
+	records.clear();
+	wchar_t prefix[64];
+	for (ThreadRing* ring : rings) {
+		const bool isRetired = ring->isRetired.load(std::memory_order_acquire);
+		const uint64_t head = ring->head.load(std::memory_order_acquire);
+		uint64_t tail = ring->tail.load(std::memory_order_relaxed);
+		while (tail < head) {
+			const auto& header = *reinterpret_cast<const RecordHeader*>(ring->data + static_cast<size_t>(tail & c_ringMask));
+			if (header.level != c_paddingLevel) {
+				FormattedRecord record;
+				record.timestamp = header.timestamp;
+				swprintf(prefix, sizeof(prefix) / sizeof(prefix[0]), L"%12.6f %5u %lc ",
+					static_cast<double>(header.timestamp) * 1e-9, ring->threadId, GetLevelLetter(header.level));
+				record.text = prefix;
+				FormatRecord(header, record.text);
+				if (record.text.empty() || record.text.back() != L'\n')
+					record.text += L'\n';
+				records.push_back(std::move(record));
+			}
+			tail += header.size;
+		}
+		ring->tail.store(tail, std::memory_order_release);
+
+		const uint64_t dropped = ring->dropped.load(std::memory_order_relaxed);
+		if (dropped != ring->reportedDropped) {
+			FormattedRecord record;
+			record.timestamp = records.empty() ? 0 : records.back().timestamp;
+			swprintf(prefix, sizeof(prefix) / sizeof(prefix[0]), L"%5u dropped %llu records\n",
+				ring->threadId, static_cast<unsigned long long>(dropped - ring->reportedDropped));
+			record.text = prefix;
+			records.push_back(std::move(record));
+			ring->reportedDropped = dropped;
+		}
+
+		if (isRetired) {
+			std::lock_guard<std::mutex> lock(state.ringMutex);
+			state.retiredWritten += ring->written.load(std::memory_order_relaxed);
+			state.retiredDropped += dropped;
+			state.rings.erase(std::find(state.rings.begin(), state.rings.end(), ring));
+			delete ring;
+		}
+	}
+
+	std::stable_sort(records.begin(), records.end(), [](const FormattedRecord& lhs, const FormattedRecord& rhs) {
+		return lhs.timestamp < rhs.timestamp;
+	});
+	if (state.sink != nullptr && !records.empty()) {
+		for (const auto& record : records)
+			fputws(record.text.c_str(), state.sink);
+		fflush(state.sink);
+	}
+}
+
+
+void RunDrain(LoggerState& state)
+{
+	while (!state.isStopping.load()) {
+		std::this_thread::sleep_for(std::chrono::milliseconds(Logger::c_drainIntervalMs));
+		std::lock_guard<std::mutex> lock(state.drainMutex);
+		if (!state.isStopping.load())
+			Drain(state);
+	}
+}
+
+
+#ifdef _WIN32
+DWORD WINAPI DrainThreadProc(LPVOID param)
+{
+	RunDrain(*reinterpret_cast<LoggerState*>(param));
+	return 0;
+}
+#endif  // _WIN32
+
+
+
+}  // unnamed namespace
+
+
+
+std::atomic<uint8_t> Logger::s_minLevel(static_cast<uint8_t>(LogLevel::Off));
+
+
+// the state is leaked on purpose, as the drain may still be running
+bool Logger::Start(FILE* sink, LogLevel level)
+{
+	LoggerState* state = s_state.load();
+	if (state == nullptr) {
+		auto created = new LoggerState;
+		created->sink = sink;
+		created->startTime = Clock::now();
+
+		// std::thread may wait for the new thread to start, which never happens under the loader lock
+#ifdef _WIN32
+		HANDLE hThread = ::CreateThread(nullptr, 0, DrainThreadProc, created, 0, nullptr);
+		if (hThread == nullptr) {
+			delete created;
+			return false;
+		}
+		::CloseHandle(hThread);
+#else
+		std::thread(RunDrain, std::ref(*created)).detach();
+#endif  // _WIN32
+		s_state.store(created);
+	}
+
+	SetLevel(level);
+	return true;
+}
+
+
+void Logger::Stop()
+{
+	LoggerState* state = s_state.load();
+	if (state == nullptr)
+		return;
+
+	SetLevel(LogLevel::Off);
+	std::lock_guard<std::mutex> lock(state->drainMutex);
+	if (!state->isStopping.exchange(true))
+		Drain(*state);
+}
+
+
+bool Logger::IsStarted()
+{
+	LoggerState* state = s_state.load();
+	return state != nullptr && !state->isStopping.load();
+}
+
+
+Logger::Stats Logger::GetStats()
+{
+	Stats stats = { 0, 0 };
+	LoggerState* state = s_state.load();
+	if (state == nullptr)
+		return stats;
+
+	std::lock_guard<std::mutex> lock(state->ringMutex);
+	stats.written = state->retiredWritten;
+	stats.dropped = state->retiredDropped;
+	for (const ThreadRing* ring : state->rings) {
+		stats.written += ring->written.load(std::memory_order_relaxed);
+		stats.dropped += ring->dropped.load(std::memory_order_relaxed);
+	}
+	return stats;
+}
+
+
+void Logger::Write(LogLevel level, const wchar_t* format, const LogArgument* arguments, size_t argumentCount)
+{
+	LoggerState* state = s_state.load(std::memory_order_acquire);
+	if (state == nullptr || format == nullptr || argumentCount > c_maxArguments)
+		return;
+	const uint64_t timestamp = static_cast<uint64_t>(std::chrono::duration_cast<std::chrono::nanoseconds>(Clock::now() - state->startTime).count());
+	ThreadRing* ring = GetThreadRing(*state);
+
+	size_t lengths[c_maxArguments];
+	size_t size = c_headerSize;
+	for (size_t i = 0; i < argumentCount; ++i) {
+		const LogArgument& argument = arguments[i];
+		if (argument.type == LogArgument::Type::String || argument.type == LogArgument::Type::NarrowString) {
+			size_t length = 0;
+			if (argument.type == LogArgument::Type::String && argument.s != nullptr) {
+				while (length < c_maxStringLength && argument.s[length] != L'\0')
+					++length;
+			}
+			else if (argument.type == LogArgument::Type::NarrowString && argument.ns != nullptr) {
+				while (length < c_maxStringLength && argument.ns[length] != '\0')
+					++length;
+			}
+			lengths[i] = length;
+			size += Align8(sizeof(uint32_t) + length * sizeof(wchar_t));
+		}
+		else {
+			size += sizeof(uint64_t);
+		}
+	}
+
+	uint64_t newHead;
+	uint8_t* p = ring->Reserve(size, newHead);
+	if (p == nullptr) {
+		ring->dropped.store(ring->dropped.load(std::memory_order_relaxed) + 1, std::memory_order_relaxed);
+		return;
+	}
+
+	auto header = reinterpret_cast<RecordHeader*>(p);
+	header->size = static_cast<uint32_t>(size);
+	header->level = static_cast<uint8_t>(level);
+	header->argumentCount = static_cast<uint8_t>(argumentCount);
+	header->reserved = 0;
+	header->timestamp = timestamp;
+	header->format = format;
+	p += c_headerSize;
+	for (size_t i = 0; i < argumentCount; ++i) {
+		const LogArgument& argument = arguments[i];
+		if (argument.type == LogArgument::Type::String || argument.type == LogArgument::Type::NarrowString) {
+			header->types[i] = LogArgument::Type::String;
+			const uint32_t length = static_cast<uint32_t>(lengths[i]);
+			memcpy(p, &length, sizeof(length));
+			auto chars = reinterpret_cast<wchar_t*>(p + sizeof(length));
+			if (argument.type == LogArgument::Type::String)
+				memcpy(chars, argument.s, length * sizeof(wchar_t));
+			else
+				for (uint32_t j = 0; j < length; ++j)
+					chars[j] = static_cast<wchar_t>(static_cast<unsigned char>(argument.ns[j]));
+			p += Align8(sizeof(length) + length * sizeof(wchar_t));
+		}
+		else {
+			header->types[i] = argument.type;
+			memcpy(p, &argument.u, sizeof(uint64_t));
+			p += sizeof(uint64_t);
+		}
+	}
+
+	ring->written.store(ring->written.load(std::memory_order_relaxed) + 1, std::memory_order_relaxed);
+	ring->head.store(newHead, std::memory_order_release);
+}
@@ -0,0 +1,152 @@
+/*
+ *  herbicide - removing flowers and rabbits in the game Mirror
+ *  Copyright (C) 2018 Mifan Bang <https://debug.tw>.
+ *
+ *  This program is free software: you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation, either version 3 of the License, or
+ *  (at your option) any later version.
+ *
+ *  This program is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#pragma once
+
+#include <atomic>
+#include <cstddef>
+#include <cstdint>
+#include <cstdio>
+#include <type_traits>
+
+
+
+// ---------------------------------------------------------------------------
+// Binary logger with deferred formatting. A log call only copies the address of
+// its format string and its raw arguments into a lock-free ring buffer owned by
+// the calling thread; a background thread formats the records with the rules of
+// wprintf() and writes them out, so that logging hardly changes the timing of
+// hooks.
+//
+// Hence the format must be a string literal. Strings given as arguments are
+// copied, up to c_maxStringLength characters; any other pointer is recorded as
+// a mere value. A record which doesn't fit into the ring is dropped and counted.
+// ---------------------------------------------------------------------------
+
+enum class LogLevel : uint8_t
+{
+	Debug = 0,
+	Info = 1,
+	Warning = 2,
+	Error = 3,
+	Off = 4,
+};
+
+
+// one argument of a log call, captured by value
+struct LogArgument
+{
+	enum class Type : uint8_t
+	{
+		None = 0,
+		Int32,
+		Int64,
+		UInt32,
+		UInt64,
+		Double,
+		Pointer,
+		String,
+		NarrowString,  // widened when recorded
+	};
+
+	Type type;
+	union
+	{
+		int64_t i;
+		uint64_t u;
+		double d;
+		const wchar_t* s;
+		const char* ns;
+	};
+
+	LogArgument() : type(Type::None), u(0) { }
+	LogArgument(double value) : type(Type::Double), d(value) { }
+	LogArgument(float value) : type(Type::Double), d(value) { }
+	LogArgument(const wchar_t* value) : type(Type::String), s(value) { }
+	LogArgument(const char* value) : type(Type::NarrowString), ns(value) { }
+	LogArgument(std::nullptr_t) : type(Type::Pointer), u(0) { }
+
+	template <typename T, typename std::enable_if<std::is_integral<T>::value && std::is_signed<T>::value, int>::type = 0>
+	LogArgument(T value) : type(sizeof(T) > 4 ? Type::Int64 : Type::Int32), i(value) { }
+
+	template <typename T, typename std::enable_if<std::is_integral<T>::value && std::is_unsigned<T>::value, int>::type = 0>
+	LogArgument(T value) : type(sizeof(T) > 4 ? Type::UInt64 : Type::UInt32), u(value) { }
+
+	template <typename T, typename std::enable_if<std::is_enum<T>::value, int>::type = 0>
+	LogArgument(T value) : LogArgument(static_cast<typename std::underlying_type<T>::type>(value)) { }
+
+	// strings are taken by the overloads above even when they aren't const
+	template <typename T, typename std::enable_if<!std::is_same<typename std::remove_cv<T>::type, wchar_t>::value && !std::is_same<typename std::remove_cv<T>::type, char>::value, int>::type = 0>
+	LogArgument(T* value) : type(Type::Pointer), u(reinterpret_cast<uintptr_t>(value)) { }
+};
+
+
+
+class Logger
+{
+public:
+	static constexpr size_t c_maxArguments = 8;
+	static constexpr size_t c_maxStringLength = 255;
+	static constexpr size_t c_ringSize = 256 * 1024;  // per thread
+	static constexpr unsigned int c_drainIntervalMs = 5;
+
+	struct Stats
+	{
+		uint64_t written;
+		uint64_t dropped;
+	};
+
+	// start the thread formatting records into $sink, which may be nullptr to discard them
+	// @remark only the first call starts anything; later calls merely change the level
+	static bool Start(FILE* sink, LogLevel level);
+
+	// stop the thread and format whatever is left on the calling thread
+	// @remark safe to call under the loader lock, as no thread is waited for
+	static void Stop();
+
+	// whether records are being formatted, between Start() and Stop()
+	static bool IsStarted();
+
+	static void SetLevel(LogLevel level)		{ s_minLevel.store(static_cast<uint8_t>(level), std::memory_order_relaxed); }
+	static bool IsEnabled(LogLevel level)		{ return static_cast<uint8_t>(level) >= s_minLevel.load(std::memory_order_relaxed); }
+
+	static Stats GetStats();
+
+	// @remark use the LOG_* macros instead, which don't evaluate the arguments of disabled levels
+	static void Write(LogLevel level, const wchar_t* format, const LogArgument* arguments, size_t argumentCount);
+
+
+private:
+	static std::atomic<uint8_t> s_minLevel;
+};
+
+
+template <typename... Args>
+inline void WriteLog(LogLevel level, const wchar_t* format, const Args&... args)
+{
+	static_assert(sizeof...(Args) <= Logger::c_maxArguments, "too many arguments for one log record");
+	const LogArgument arguments[] = { LogArgument(args)..., LogArgument() };
+	Logger::Write(level, format, arguments, sizeof...(Args));
+}
+
+
+#define HERBICIDE_LOG(level, ...)	do { if (Logger::IsEnabled(level)) WriteLog(level, __VA_ARGS__); } while (false)
+#define LOG_DEBUG(...)		HERBICIDE_LOG(LogLevel::Debug, __VA_ARGS__)
+#define LOG_INFO(...)		HERBICIDE_LOG(LogLevel::Info, __VA_ARGS__)
+#define LOG_WARNING(...)	HERBICIDE_LOG(LogLevel::Warning, __VA_ARGS__)
+#define LOG_ERROR(...)		HERBICIDE_LOG(LogLevel::Error, __VA_ARGS__)
@@ -0,0 +1,195 @@
+/*
+ *  herbicide - removing flowers and rabbits in the game Mirror
+ *  Copyright (C) 2018 Mifan Bang <https://debug.tw>.
+ *
+ *  This program is free software: you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation, either version 3 of the License, or
+ *  (at your option) any later version.
+ *
+ *  This program is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include <cstring>
+
+#include "lz.h"
+
+
+
+namespace {
+
+
+
+// ref: https://github.com/lz4/lz4/blob/dev/doc/lz4_Block_format.md
+constexpr unsigned int c_hashBits = 12;
+constexpr size_t c_minMatch = 4;
+constexpr size_t c_lastLiterals = 5;  // the block always ends with this many literals
+constexpr size_t c_matchStartLimit = 12;  // and its last match starts at least this far from the end
+constexpr size_t c_maxOffset = 65535;
+constexpr unsigned int c_tokenMax = 15;
+
+
+inline uint32_t Load32(const uint8_t* p)
+{
+	uint32_t value;
+	memcpy(&value, p, sizeof(value));
+	return value;
+}
+
+
+inline uint32_t HashSequence(uint32_t sequence)
+{
+	return (sequence * 2654435761u) >> (32 - c_hashBits);
+}
+
+
+// the part of a length which doesn't fit into the token
+uint8_t* WriteLength(uint8_t* p, size_t length)
+{
+	for (; length >= 255; length -= 255)
+		*p++ = 255;
+	*p++ = static_cast<uint8_t>(length);
+	return p;
+}
+
+
+bool ReadLength(const uint8_t*& p, const uint8_t* end, size_t& length)
+{
+	uint8_t byte;
+	do {
+		if (p >= end)
+			return false;
+		byte = *p++;
+		length += byte;
+	} while (byte == 255);
+	return true;
+}
+
+
+uint8_t* WriteSequence(uint8_t* p, const uint8_t* literals, size_t literalLength)
+{
+	*p++ = static_cast<uint8_t>((literalLength < c_tokenMax ? literalLength : c_tokenMax) << 4);
+	if (literalLength >= c_tokenMax)
+		p = WriteLength(p, literalLength - c_tokenMax);
+	memcpy(p, literals, literalLength);
+	return p + literalLength;
+}
+
+
+
+}  // unnamed namespace
+
+
+
+size_t GetLzCompressBound(size_t size)
+{
+	return size + size / 255 + 16;
+}
+
+
+size_t LzCompress(const uint8_t* src, size_t size, uint8_t* dst, size_t capacity)
+{
+	// with room for the worst case, the loop never checks the output
+	if (capacity < GetLzCompressBound(size) || size > UINT32_MAX)
+		return 0;
+
+	uint32_t table[1 << c_hashBits] = { };
+	const uint8_t* const end = src + size;
+	const uint8_t* anchor = src;
+	uint8_t* p = dst;
+	if (size > c_matchStartLimit) {
+		const uint8_t* const matchEnd = end - c_lastLiterals;
+		const uint8_t* const searchEnd = end - c_matchStartLimit;
+		for (const uint8_t* ip = src; ip < searchEnd; ) {
+			const uint32_t sequence = Load32(ip);
+			const uint32_t hash = HashSequence(sequence);
+			const uint8_t* ref = src + table[hash];
+			table[hash] = static_cast<uint32_t>(ip - src);
+			if (ref >= ip || static_cast<size_t>(ip - ref) > c_maxOffset || Load32(ref) != sequence) {
+				++ip;
+				continue;
+			}
+
+			const uint8_t* matchStart = ip;
+			while (matchStart > anchor && ref > src && matchStart[-1] == ref[-1]) {
+				--matchStart;
+				--ref;
+			}
+			const uint8_t* matchStop = ip + c_minMatch;
+			for (const uint8_t* refStop = ref + (matchStop - matchStart); matchStop < matchEnd && *matchStop == *refStop; ++refStop)
+				++matchStop;
+
+			uint8_t* const token = p;
+			p = WriteSequence(p, anchor, static_cast<size_t>(matchStart - anchor));
+			const size_t offset = static_cast<size_t>(matchStart - ref);
+			*p++ = static_cast<uint8_t>(offset);
+			*p++ = static_cast<uint8_t>(offset >> 8);
+			const size_t matchLength = static_cast<size_t>(matchStop - matchStart) - c_minMatch;
+			*token |= static_cast<uint8_t>(matchLength < c_tokenMax ? matchLength : c_tokenMax);
+			if (matchLength >= c_tokenMax)
+				p = WriteLength(p, matchLength - c_tokenMax);
+
+			ip = matchStop;
+			anchor = matchStop;
+		}
+	}
+
+	p = WriteSequence(p, anchor, static_cast<size_t>(end - anchor));
+	return static_cast<size_t>(p - dst);
+}
+
+
+bool LzDecompress(const uint8_t* src, size_t size, uint8_t* dst, size_t dstSize)
+{
+	const uint8_t* p = src;
+	const uint8_t* const end = src + size;
+	uint8_t* out = dst;
+	uint8_t* const outEnd = dst + dstSize;
+	for (;;) {
+		if (p >= end)
+			return false;
+		const uint8_t token = *p++;
+
+		size_t literalLength = token >> 4;
+		if (literalLength == c_tokenMax && !ReadLength(p, end, literalLength))
+			return false;
+		if (literalLength > static_cast<size_t>(end - p) || literalLength > static_cast<size_t>(outEnd - out))
+			return false;
+		memcpy(out, p, literalLength);
+		p += literalLength;
+		out += literalLength;
+		if (p == end)
+			return out == outEnd;  // the last sequence has no match
+
+		if (end - p < 2)
+			return false;
+		const size_t offset = static_cast<size_t>(p[0]) | (static_cast<size_t>(p[1]) << 8);
+		p += 2;
+		if (offset == 0 || offset > static_cast<size_t>(out - dst))
+			return false;
+
+		size_t matchLength = token & c_tokenMax;
+		if (matchLength == c_tokenMax && !ReadLength(p, end, matchLength))
+			return false;
+		matchLength += c_minMatch;
+		if (matchLength > static_cast<size_t>(outEnd - out))
+			return false;
+
+		// a match may overlap the bytes it produces
+		const uint8_t* ref = out - offset;
+		if (offset >= matchLength) {
+			memcpy(out, ref, matchLength);
+			out += matchLength;
+		}
+		else {
+			for (size_t i = 0; i < matchLength; ++i)
+				*out++ = *ref++;
+		}
+	}
+}
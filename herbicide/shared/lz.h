@@ -0,0 +1,39 @@
+/*
+ *  herbicide - removing flowers and rabbits in the game Mirror
+ *  Copyright (C) 2018 Mifan Bang <https://debug.tw>.
+ *
+ *  This program is free software: you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation, either version 3 of the License, or
+ *  (at your option) any later version.
+ *
+ *  This program is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#pragma once
+
+#include <cstddef>
+#include <cstdint>
+
+
+
+// ---------------------------------------------------------------------------
+// Byte-oriented LZ77 compression in the LZ4 block format: fast to decompress
+// and free of dependencies, at the cost of ratio.
+// ---------------------------------------------------------------------------
+
+// largest possible output of LzCompress() for $size bytes of input
+size_t GetLzCompressBound(size_t size);
+
+// @return size of the output, or zero if $capacity is too small
+size_t LzCompress(const uint8_t* src, size_t size, uint8_t* dst, size_t capacity);
+
+// decompress into exactly $dstSize bytes
+// @return false if the input is malformed or doesn't decompress to $dstSize bytes
+bool LzDecompress(const uint8_t* src, size_t size, uint8_t* dst, size_t dstSize);
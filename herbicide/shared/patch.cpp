@@ -0,0 +1,342 @@
+/*
+ *  herbicide - removing flowers and rabbits in the game Mirror
+ *  Copyright (C) 2018 Mifan Bang <https://debug.tw>.
+ *
+ *  This program is free software: you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation, either version 3 of the License, or
+ *  (at your option) any later version.
+ *
+ *  This program is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include <cstring>
+
+#if defined(_M_X64) || (defined(_M_IX86_FP) && _M_IX86_FP >= 2) || defined(__SSE2__)
+	#define PATCH_SSE2 1
+	#include <emmintrin.h>
+#else
+	#define PATCH_SSE2 0
+#endif
+
+#include "lz.h"
+#include "patch.h"
+
+
+
+namespace {
+
+
+
+// The header, with every field a little-endian uint32_t:
+//   "HBPT" <version> <width> <height> <stride> <op size> <stored size>
+constexpr uint32_t c_magic = 0x54504248;  // "HBPT"
+constexpr uint32_t c_version = 1;
+constexpr size_t c_headerFieldCount = 7;
+constexpr size_t c_headerSize = c_headerFieldCount * sizeof(uint32_t);
+
+constexpr uint32_t c_opSkip = 0;
+constexpr uint32_t c_opCopy = 1;
+constexpr uint32_t c_opFill = 2;
+constexpr uint32_t c_opEnd = 3;
+constexpr uint32_t c_maxCount = UINT32_MAX >> 2;
+
+// an LZ block expands at most 255 times, by a match whose length takes a byte per 255
+constexpr uint32_t c_maxLzRatio = 256;
+
+// a fill takes two words at most, and splitting a copy around it one more
+constexpr uint32_t c_minFillBytes = 16;
+
+
+// Ops are handled as words in the byte order of the host, which is little-endian wherever
+// patches are built or applied, like the pixels of imagecodec.h.
+inline uint32_t MakeOp(uint32_t op, uint32_t count)
+{
+	return (count << 2) | op;
+}
+
+
+inline size_t GetWordCount(size_t byteCount)
+{
+	return (byteCount + 3) / 4;
+}
+
+
+inline uint32_t LoadField(const uint8_t* p)
+{
+	return static_cast<uint32_t>(p[0]) | (static_cast<uint32_t>(p[1]) << 8) | (static_cast<uint32_t>(p[2]) << 16) | (static_cast<uint32_t>(p[3]) << 24);
+}
+
+
+inline void StoreField(uint8_t* p, uint32_t value)
+{
+	p[0] = static_cast<uint8_t>(value);
+	p[1] = static_cast<uint8_t>(value >> 8);
+	p[2] = static_cast<uint8_t>(value >> 16);
+	p[3] = static_cast<uint8_t>(value >> 24);
+}
+
+
+inline bool IsEqualPixel(const uint8_t* from, const uint8_t* to, uint32_t x, uint32_t stride)
+{
+	return memcmp(from + static_cast<size_t>(x) * stride, to + static_cast<size_t>(x) * stride, stride) == 0;
+}
+
+
+// an op followed by $size bytes of pixels, padded to whole words
+void AppendOp(std::vector<uint32_t>& ops, uint32_t op, uint32_t count, const uint8_t* pixels, size_t size)
+{
+	ops.push_back(MakeOp(op, count));
+	const size_t offset = ops.size();
+	ops.resize(offset + GetWordCount(size), 0);
+	memcpy(ops.data() + offset, pixels, size);
+}
+
+
+// changed pixels, with runs of the same one taken as fills
+void AppendChanged(std::vector<uint32_t>& ops, const uint8_t* pixels, uint32_t count, uint32_t stride)
+{
+	uint32_t copyBegin = 0;
+	uint32_t i = 0;
+	while (i < count) {
+		const uint8_t* pixel = pixels + static_cast<size_t>(i) * stride;
+		uint32_t run = 1;
+		while (i + run < count && memcmp(pixel + static_cast<size_t>(run) * stride, pixel, stride) == 0)
+			++run;
+		if (static_cast<uint64_t>(run) * stride >= c_minFillBytes) {
+			if (i > copyBegin)
+				AppendOp(ops, c_opCopy, i - copyBegin, pixels + static_cast<size_t>(copyBegin) * stride, static_cast<size_t>(i - copyBegin) * stride);
+			AppendOp(ops, c_opFill, run, pixel, stride);
+			copyBegin = i + run;
+		}
+		i += run;
+	}
+	if (count > copyBegin)
+		AppendOp(ops, c_opCopy, count - copyBegin, pixels + static_cast<size_t>(copyBegin) * stride, static_cast<size_t>(count - copyBegin) * stride);
+}
+
+
+void AppendRow(std::vector<uint32_t>& ops, const uint8_t* from, const uint8_t* to, uint32_t width, uint32_t stride)
+{
+	// equal pixels amid changed ones are copied along if that takes no more than the skip and
+	// the copy after it would
+	const uint32_t maxAbsorbed = 2 * sizeof(uint32_t) / stride;
+
+	uint32_t x = 0;
+	while (x < width) {
+		const uint32_t skipBegin = x;
+		while (x < width && IsEqualPixel(from, to, x, stride))
+			++x;
+		if (x == width)
+			break;
+		if (x > skipBegin)
+			ops.push_back(MakeOp(c_opSkip, x - skipBegin));
+
+		const uint32_t begin = x;
+		for (;;) {
+			while (x < width && !IsEqualPixel(from, to, x, stride))
+				++x;
+			uint32_t gap = 0;
+			while (x + gap < width && gap <= maxAbsorbed && IsEqualPixel(from, to, x + gap, stride))
+				++gap;
+			if (gap == 0 || gap > maxAbsorbed || x + gap == width)
+				break;
+			x += gap;
+		}
+		AppendChanged(ops, to + static_cast<size_t>(begin) * stride, x - begin, stride);
+	}
+	ops.push_back(MakeOp(c_opEnd, 0));
+}
+
+
+// Copies of 16 bytes or more go 16 bytes at a time, the last store overlapping the one before
+// it rather than finishing byte by byte.
+inline void CopyBytes(uint8_t* dst, const uint8_t* src, size_t size)
+{
+#if PATCH_SSE2
+	if (size >= 16) {
+		for (size_t offset = 0; offset + 16 < size; offset += 16)
+			_mm_storeu_si128(reinterpret_cast<__m128i*>(dst + offset), _mm_loadu_si128(reinterpret_cast<const __m128i*>(src + offset)));
+		_mm_storeu_si128(reinterpret_cast<__m128i*>(dst + size - 16), _mm_loadu_si128(reinterpret_cast<const __m128i*>(src + size - 16)));
+		return;
+	}
+#endif  // PATCH_SSE2
+	memcpy(dst, src, size);
+}
+
+
+// $size bytes of copies of $pixel; with a stride dividing 16, every 16-byte store starts on a
+// pixel, the last one included
+inline void FillPixels(uint8_t* dst, const uint8_t* pixel, size_t size, uint32_t stride)
+{
+#if PATCH_SSE2
+	if (size >= 16 && 16 % stride == 0) {
+		uint8_t pattern[16];
+		for (uint32_t offset = 0; offset < 16; offset += stride)
+			memcpy(pattern + offset, pixel, stride);
+		const __m128i value = _mm_loadu_si128(reinterpret_cast<const __m128i*>(pattern));
+		for (size_t offset = 0; offset + 16 < size; offset += 16)
+			_mm_storeu_si128(reinterpret_cast<__m128i*>(dst + offset), value);
+		_mm_storeu_si128(reinterpret_cast<__m128i*>(dst + size - 16), value);
+		return;
+	}
+#endif  // PATCH_SSE2
+	for (size_t offset = 0; offset < size; offset += stride)
+		memcpy(dst + offset, pixel, stride);
+}
+
+
+
+}  // unnamed namespace
+
+
+
+bool BuildPatch(const uint8_t* from, size_t fromPitch, const uint8_t* to, size_t toPitch, uint32_t width, uint32_t height, uint32_t stride, std::vector<uint8_t>& out)
+{
+	if (width == 0 || height == 0 || width > c_maxCount || stride == 0 || stride > c_maxPatchStride)
+		return false;
+
+	std::vector<uint32_t> ops;
+	for (uint32_t y = 0; y < height; ++y)
+		AppendRow(ops, from + fromPitch * y, to + toPitch * y, width, stride);
+	const size_t opSize = ops.size() * sizeof(uint32_t);
+	if (opSize > UINT32_MAX)
+		return false;
+
+	out.resize(c_headerSize + GetLzCompressBound(opSize));
+	const uint8_t* opBytes = reinterpret_cast<const uint8_t*>(ops.data());
+	size_t storedSize = LzCompress(opBytes, opSize, out.data() + c_headerSize, out.size() - c_headerSize);
+	if (storedSize == 0 || storedSize >= opSize) {
+		storedSize = opSize;
+		out.resize(c_headerSize + opSize);
+		memcpy(out.data() + c_headerSize, opBytes, opSize);
+	}
+	out.resize(c_headerSize + storedSize);
+
+	const uint32_t fields[c_headerFieldCount] = {
+		c_magic, c_version, width, height, stride, static_cast<uint32_t>(opSize), static_cast<uint32_t>(storedSize)
+	};
+	for (size_t i = 0; i < c_headerFieldCount; ++i)
+		StoreField(out.data() + i * sizeof(uint32_t), fields[i]);
+	return true;
+}
+
+
+// The op size is bounded by what the rectangle could take, a copy of every pixel on its own,
+// and by what the stored bytes can decompress to, so that a corrupt header can't ask for a huge
+// buffer.
+bool ReadPatchInfo(const uint8_t* data, size_t size, PatchInfo& info)
+{
+	if (size < c_headerSize || LoadField(data) != c_magic || LoadField(data + 4) != c_version)
+		return false;
+	info.width = LoadField(data + 8);
+	info.height = LoadField(data + 12);
+	info.stride = LoadField(data + 16);
+	info.opSize = LoadField(data + 20);
+	info.storedSize = LoadField(data + 24);
+
+	const uint64_t maxRowSize = static_cast<uint64_t>(info.width) * (sizeof(uint32_t) + GetWordCount(info.stride) * sizeof(uint32_t)) + sizeof(uint32_t);
+	return info.width > 0 && info.width <= c_maxCount
+		&& info.height > 0
+		&& info.stride > 0 && info.stride <= c_maxPatchStride
+		&& info.opSize % sizeof(uint32_t) == 0
+		&& info.opSize >= static_cast<uint64_t>(info.height) * sizeof(uint32_t)
+		&& info.opSize / info.height <= maxRowSize
+		&& info.storedSize <= info.opSize
+		&& info.opSize / c_maxLzRatio <= info.storedSize
+		&& info.storedSize == size - c_headerSize;
+}
+
+
+
+PixelPatch::PixelPatch()
+	: m_info()
+	, m_ops()
+	, m_isWhole(false)
+{
+}
+
+
+bool PixelPatch::Load(const uint8_t* data, size_t size)
+{
+	m_info = PatchInfo();
+	m_ops.clear();
+	m_isWhole = false;
+
+	PatchInfo info;
+	if (!ReadPatchInfo(data, size, info))
+		return false;
+	std::vector<uint32_t> ops(info.opSize / sizeof(uint32_t));
+	uint8_t* opBytes = reinterpret_cast<uint8_t*>(ops.data());
+	if (info.storedSize == info.opSize)
+		memcpy(opBytes, data + c_headerSize, info.opSize);
+	else if (!LzDecompress(data + c_headerSize, info.storedSize, opBytes, info.opSize))
+		return false;
+
+	// every row must end within the ops, and no op may run past the end of its row
+	size_t pos = 0;
+	bool isWhole = true;
+	for (uint32_t y = 0; y < info.height; ++y) {
+		uint64_t x = 0;
+		for (;;) {
+			if (pos >= ops.size())
+				return false;
+			const uint32_t op = ops[pos] & 3;
+			const uint32_t count = ops[pos] >> 2;
+			++pos;
+			if (op == c_opEnd) {
+				if (count != 0)
+					return false;
+				isWhole = isWhole && x == info.width;
+				break;
+			}
+			isWhole = isWhole && op != c_opSkip;
+			x += count;
+			if (count == 0 || x > info.width)
+				return false;
+			const size_t wordCount = op == c_opCopy ? GetWordCount(static_cast<size_t>(count) * info.stride) : op == c_opFill ? GetWordCount(info.stride) : 0;
+			if (ops.size() - pos < wordCount)
+				return false;
+			pos += wordCount;
+		}
+	}
+	if (pos != ops.size())
+		return false;
+
+	m_info = info;
+	m_ops.swap(ops);
+	m_isWhole = isWhole;
+	return true;
+}
+
+
+void PixelPatch::Apply(uint8_t* rows, size_t rowPitch) const
+{
+	const uint32_t stride = m_info.stride;
+	const uint32_t* op = m_ops.data();
+	for (uint32_t y = 0; y < m_info.height; ++y, rows += rowPitch) {
+		uint8_t* dst = rows;
+		for (uint32_t word = *op++; (word & 3) != c_opEnd; word = *op++) {
+			const size_t size = static_cast<size_t>(word >> 2) * stride;
+			switch (word & 3) {
+			case c_opCopy:
+				CopyBytes(dst, reinterpret_cast<const uint8_t*>(op), size);
+				op += GetWordCount(size);
+				break;
+			case c_opFill:
+				FillPixels(dst, reinterpret_cast<const uint8_t*>(op), size, stride);
+				op += GetWordCount(stride);
+				break;
+			default:
+				break;
+			}
+			dst += size;
+		}
+	}
+}
@@ -0,0 +1,91 @@
+/*
+ *  herbicide - removing flowers and rabbits in the game Mirror
+ *  Copyright (C) 2018 Mifan Bang <https://debug.tw>.
+ *
+ *  This program is free software: you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation, either version 3 of the License, or
+ *  (at your option) any later version.
+ *
+ *  This program is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#pragma once
+
+#include <cstddef>
+#include <cstdint>
+#include <vector>
+
+
+
+// ---------------------------------------------------------------------------
+// Pixel patches: the pixels of a rectangle which are to be replaced, stored
+// sparsely so that the pixels left as they are cost next to nothing.
+//
+// The ops of each row, top to bottom, are little-endian 32-bit words of
+// (count << 2 | op), where op is one of
+//   skip   leave $count pixels as they are
+//   copy   replace $count pixels with those following the word
+//   fill   replace $count pixels with the single one following the word
+//   end    end of the row; $count is zero
+// and the pixels following a word are padded to a multiple of 4 bytes. A
+// patch as stored is a small header and then its ops, compressed with lz.h
+// unless that doesn't make them smaller.
+// ---------------------------------------------------------------------------
+
+struct PatchInfo
+{
+	uint32_t width;  // of the rectangle, in pixels
+	uint32_t height;
+	uint32_t stride;  // bytes per pixel
+	uint32_t opSize;  // bytes of ops, once decompressed
+	uint32_t storedSize;  // ... as stored after the header
+};
+
+
+constexpr uint32_t c_maxPatchStride = 16;
+
+
+// Build the patch turning $from into $to, both $width x $height pixels of $stride bytes in rows
+// $fromPitch and $toPitch bytes apart, replacing the content of $out. Pixels which are equal
+// are skipped, unless copying a few of them saves an op.
+bool BuildPatch(const uint8_t* from, size_t fromPitch, const uint8_t* to, size_t toPitch, uint32_t width, uint32_t height, uint32_t stride, std::vector<uint8_t>& out);
+
+// read the header of a patch, checking it against the $size bytes it was found in
+bool ReadPatchInfo(const uint8_t* data, size_t size, PatchInfo& info);
+
+
+
+// A patch ready to be applied any number of times: decompressed once and checked through, so
+// that applying it decodes the ops of each row straight into the destination.
+class PixelPatch
+{
+public:
+	PixelPatch();
+
+	PixelPatch(const PixelPatch&) = delete;
+	PixelPatch& operator=(const PixelPatch&) = delete;
+
+	bool Load(const uint8_t* data, size_t size);
+
+	const PatchInfo& GetInfo() const	{ return m_info; }
+
+	// whether every pixel of the rectangle is replaced, so that the result doesn't depend on
+	// what was there before
+	bool IsWhole() const	{ return m_isWhole; }
+
+	// apply to the rectangle whose top-left pixel is at $rows, with rows $rowPitch bytes apart
+	void Apply(uint8_t* rows, size_t rowPitch) const;
+
+
+private:
+	PatchInfo m_info;
+	std::vector<uint32_t> m_ops;
+	bool m_isWhole;
+};
@@ -0,0 +1,274 @@
+/*
+ *  herbicide - removing flowers and rabbits in the game Mirror
+ *  Copyright (C) 2018 Mifan Bang <https://debug.tw>.
+ *
+ *  This program is free software: you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation, either version 3 of the License, or
+ *  (at your option) any later version.
+ *
+ *  This program is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include <algorithm>
+#include <cstdint>
+#include <cstring>
+#include <utility>
+
+#include "patch.h"
+#include "signature.h"
+
+
+
+namespace {
+
+
+
+// Tiny cursor over one line of text. All parsing functions return false without
+// consuming anything meaningful when the input doesn't match.
+class LineParser
+{
+public:
+	LineParser(const char* begin, const char* end)
+		: m_ptr(begin)
+		, m_end(end)
+	{ }
+
+	void SkipSpaces()
+	{
+		while (m_ptr < m_end && (*m_ptr == ' ' || *m_ptr == '\t' || *m_ptr == '\r'))
+			++m_ptr;
+	}
+
+	bool IsAtEnd()
+	{
+		SkipSpaces();
+		return m_ptr >= m_end;
+	}
+
+	bool IsAt(char ch)
+	{
+		SkipSpaces();
+		return m_ptr < m_end && *m_ptr == ch;
+	}
+
+	// consume $word if it comes next
+	bool Accept(const char* word)
+	{
+		SkipSpaces();
+		const size_t length = strlen(word);
+		if (static_cast<size_t>(m_end - m_ptr) < length || memcmp(m_ptr, word, length) != 0)
+			return false;
+		m_ptr += length;
+		return true;
+	}
+
+	bool ReadUInt(uint32_t& out)
+	{
+		SkipSpaces();
+		uint64_t value = 0;
+		const char* start = m_ptr;
+		for (; m_ptr < m_end && *m_ptr >= '0' && *m_ptr <= '9'; ++m_ptr) {
+			value = value * 10 + static_cast<uint64_t>(*m_ptr - '0');
+			if (value > UINT32_MAX)
+				return false;
+		}
+		out = static_cast<uint32_t>(value);
+		return m_ptr > start;
+	}
+
+	bool ReadHex(uint8_t* out, size_t size)
+	{
+		SkipSpaces();
+		if (static_cast<size_t>(m_end - m_ptr) < size * 2)
+			return false;
+		for (size_t i = 0; i < size * 2; ++i) {
+			const int nibble = ParseNibble(m_ptr[i]);
+			if (nibble < 0)
+				return false;
+			if ((i & 1) == 0)
+				out[i >> 1] = static_cast<uint8_t>(nibble << 4);
+			else
+				out[i >> 1] |= static_cast<uint8_t>(nibble);
+		}
+		m_ptr += size * 2;
+		return true;
+	}
+
+	// hex digits up to the next space, of any even number
+	bool ReadHexRun(std::vector<uint8_t>& out)
+	{
+		const char* start = m_ptr;
+		while (m_ptr < m_end && ParseNibble(*m_ptr) >= 0)
+			++m_ptr;
+		const size_t size = static_cast<size_t>(m_ptr - start) / 2;
+		if (size == 0 || (m_ptr - start) % 2 != 0)
+			return false;
+		m_ptr = start;
+		const size_t offset = out.size();
+		out.resize(offset + size);
+		return ReadHex(out.data() + offset, size);
+	}
+
+
+private:
+	static int ParseNibble(char ch)
+	{
+		if (ch >= '0' && ch <= '9')
+			return ch - '0';
+		if (ch >= 'a' && ch <= 'f')
+			return ch - 'a' + 10;
+		if (ch >= 'A' && ch <= 'F')
+			return ch - 'A' + 10;
+		return -1;
+	}
+
+	const char* m_ptr;
+	const char* m_end;
+};
+
+
+// the prefix of the digest, if any
+bool ReadFingerprintKind(LineParser& parser, FingerprintKind& kind)
+{
+	kind = parser.Accept("packed:") ? FingerprintKind::Packed : FingerprintKind::Padded;
+	return true;
+}
+
+
+// the patch at the end of a line, if any, which must cover the rectangle of the line
+bool ReadPatch(LineParser& parser, SignatureRecord& record, std::vector<uint8_t>& patchData)
+{
+	record.patchOffset = 0;
+	record.patchSize = 0;
+	if (!parser.Accept("patch:"))
+		return true;
+
+	const size_t offset = patchData.size();
+	PatchInfo info;
+	if (!parser.ReadHexRun(patchData)
+			|| patchData.size() > UINT32_MAX
+			|| !ReadPatchInfo(patchData.data() + offset, patchData.size() - offset, info)
+			|| info.width != record.eraseWidth
+			|| info.height != record.eraseHeight
+			|| info.stride != record.stride) {
+		patchData.resize(offset);
+		return false;
+	}
+	record.patchOffset = static_cast<uint32_t>(offset);
+	record.patchSize = static_cast<uint32_t>(patchData.size() - offset);
+	return true;
+}
+
+
+// the execution at the very end of a line, if any
+bool ReadExecution(LineParser& parser, ActionExecution& execution)
+{
+	execution = parser.Accept("copy") ? ActionExecution::Copy : ActionExecution::Cpu;
+	return true;
+}
+
+
+bool ParseSignatureLine(LineParser& parser, SignatureRecord& record, std::vector<uint8_t>& patchData)
+{
+	return parser.ReadUInt(record.width)
+		&& parser.ReadUInt(record.height)
+		&& parser.ReadUInt(record.format)
+		&& ReadFingerprintKind(parser, record.fingerprintKind)
+		&& parser.ReadHex(record.digest, sizeof(record.digest))
+		&& parser.ReadUInt(record.eraseX)
+		&& parser.ReadUInt(record.eraseY)
+		&& parser.ReadUInt(record.eraseWidth)
+		&& parser.ReadUInt(record.eraseHeight)
+		&& parser.ReadUInt(record.stride)
+		&& record.stride > 0
+		&& record.stride <= c_maxPatchStride  // of the widest format
+		&& record.eraseWidth > 0
+		&& record.eraseHeight > 0
+		&& static_cast<uint64_t>(record.eraseX) + record.eraseWidth <= record.width
+		&& static_cast<uint64_t>(record.eraseY) + record.eraseHeight <= record.height
+		&& ReadPatch(parser, record, patchData)
+		&& ReadExecution(parser, record.execution)
+		&& parser.IsAtEnd();
+}
+
+
+
+}  // unnamed namespace
+
+
+
+bool ParseSignatureText(const char* text, size_t size, SignatureRecordList& out, std::vector<uint8_t>& patchData, unsigned int& errorLine)
+{
+	SignatureRecordList result;
+	std::vector<uint8_t> patches;
+	const char* const end = text + size;
+	unsigned int lineNumber = 1;
+	for (const char* lineBegin = text; lineBegin < end; ++lineNumber) {
+		const char* lineEnd = lineBegin;
+		while (lineEnd < end && *lineEnd != '\n')
+			++lineEnd;
+
+		LineParser parser(lineBegin, lineEnd);
+		if (!parser.IsAtEnd() && !parser.IsAt('#')) {
+			SignatureRecord record { };
+			if (!ParseSignatureLine(parser, record, patches)) {
+				errorLine = lineNumber;
+				return false;
+			}
+			result.push_back(record);
+		}
+
+		lineBegin = lineEnd + 1;
+	}
+
+	errorLine = 0;
+	std::swap(out, result);
+	std::swap(patchData, patches);
+	return true;
+}
+
+
+bool LoadSignatureFile(const PathChar* path, SignatureRecordList& out, std::vector<uint8_t>& patchData, unsigned int& errorLine)
+{
+	MappedFile file;
+	errorLine = 0;
+	if (!file.Open(path) || file.GetSize() > SIZE_MAX)
+		return false;
+	return ParseSignatureText(reinterpret_cast<const char*>(file.GetData()), static_cast<size_t>(file.GetSize()), out, patchData, errorLine);
+}
+
+
+bool IsSignatureKeyLess(const SignatureRecord& lhs, const SignatureRecord& rhs)
+{
+	if (lhs.width != rhs.width)
+		return lhs.width < rhs.width;
+	if (lhs.height != rhs.height)
+		return lhs.height < rhs.height;
+	return lhs.format < rhs.format;
+}
+
+
+void SortSignatureRecords(SignatureRecordList& records)
+{
+	std::stable_sort(records.begin(), records.end(), IsSignatureKeyLess);
+}
+
+
+bool GetPackedFingerprint(const uint8_t* rows, size_t rowPitch, uint32_t rowSize, uint32_t rowCount, uint8_t (&digest)[StreamHasher::c_digestSize])
+{
+	StreamHasher hasher;
+	if (rowPitch == rowSize)
+		hasher.Update(rows, static_cast<uint64_t>(rowSize) * rowCount);
+	else {
+		for (uint32_t row = 0; row < rowCount; ++row)
+			hasher.Update(rows + rowPitch * row, rowSize);
+	}
+	return hasher.Finish(digest);
+}
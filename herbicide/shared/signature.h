@@ -0,0 +1,116 @@
+/*
+ *  herbicide - removing flowers and rabbits in the game Mirror
+ *  Copyright (C) 2018 Mifan Bang <https://debug.tw>.
+ *
+ *  This program is free software: you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation, either version 3 of the License, or
+ *  (at your option) any later version.
+ *
+ *  This program is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#pragma once
+
+#include <cstddef>
+#include <cstdint>
+#include <vector>
+
+#include "file.h"
+
+
+
+// signatures fingerprint up to this many rows from the top of a texture
+constexpr unsigned int c_fingerprintRowCount = 256;
+
+
+// How the rows of a fingerprint are taken. A padded fingerprint hashes c_fingerprintRowCount
+// rows of the mapping with its row pitch, padding included, so it depends on the driver which
+// chose the pitch and reads past textures of fewer rows. It is kept for the signatures taken
+// that way. A packed fingerprint hashes only the pixels of each row, the row size of the
+// layout of the format, over the first c_fingerprintRowCount rows or all of them if fewer.
+enum class FingerprintKind : uint32_t
+{
+	Padded = 0,
+	Packed = 1,
+};
+
+
+// How the action of a signature is carried out once the texture has been written. The CPU
+// writes into the mapped data. A copy leaves the data alone and has the GPU copy the pixels
+// over from a texture holding them; it needs a texture the GPU may copy to, and the pixels
+// of the action alone, so that erasing and patches replacing the whole rectangle qualify.
+enum class ActionExecution : uint32_t
+{
+	Cpu = 0,
+	Copy = 1,
+};
+
+
+// plain description of a signature as stored in a signature file
+struct SignatureRecord
+{
+	// descriptor of the staging texture
+	uint32_t width;
+	uint32_t height;
+	uint32_t format;  // value of DXGI_FORMAT
+
+	// SHA-256 digest of the first rows
+	uint8_t digest[32];
+	FingerprintKind fingerprintKind;
+
+	// rectangle to be erased
+	uint32_t eraseX;
+	uint32_t eraseY;
+	uint32_t eraseWidth;
+	uint32_t eraseHeight;
+	uint32_t stride;  // bytes per pixel
+
+	// patch of shared/patch.h replacing pixels of the rectangle instead of erasing it, as a
+	// range of the patch data which comes with the records; a size of zero to erase
+	uint32_t patchOffset;
+	uint32_t patchSize;
+
+	ActionExecution execution;  // preferred, when the texture allows for it
+};
+
+using SignatureRecordList = std::vector<SignatureRecord>;
+
+
+// Parse the text of a signature file, which has one signature per line:
+//   <width> <height> <format> <digest as 64 hex digits> <x> <y> <w> <h> <bytes per pixel>
+// The digest is that of a padded fingerprint, or of a packed one if written "packed:<digest>".
+// A line may end with "patch:<hex digits>", a patch of the rectangle which replaces erasing it;
+// the patches go to $patchData, where the records point. A final "copy" asks for the action
+// to be carried out by a copy.
+// Empty lines and lines starting with '#' are ignored.
+// @return false if any line is malformed, with $errorLine set to its 1-based number
+bool ParseSignatureText(const char* text, size_t size, SignatureRecordList& out, std::vector<uint8_t>& patchData, unsigned int& errorLine);
+
+// read and parse a signature file
+bool LoadSignatureFile(const PathChar* path, SignatureRecordList& out, std::vector<uint8_t>& patchData, unsigned int& errorLine);
+
+
+// Order of signature tables: by the descriptor a signature applies to, so that the signatures
+// of a descriptor sit next to each other and are found by binary search.
+bool IsSignatureKeyLess(const SignatureRecord& lhs, const SignatureRecord& rhs);
+
+// sort into the order above, keeping that of the file among signatures of the same descriptor
+void SortSignatureRecords(SignatureRecordList& records);
+
+
+// number of rows a packed fingerprint covers in a surface of $rowCount rows
+inline uint32_t GetFingerprintRowCount(uint32_t rowCount)
+{
+	return rowCount < c_fingerprintRowCount ? rowCount : c_fingerprintRowCount;
+}
+
+// Packed fingerprint of $rowCount rows of $rowSize bytes which are $rowPitch bytes apart; the
+// padding between rows is skipped.
+bool GetPackedFingerprint(const uint8_t* rows, size_t rowPitch, uint32_t rowSize, uint32_t rowCount, uint8_t (&digest)[StreamHasher::c_digestSize]);
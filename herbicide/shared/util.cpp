@@ -16,6 +16,9 @@
  *  along with this program.  If not, see <http://www.gnu.org/licenses/>.
  */
 
+#include <cstddef>
+#include <cstdint>
+#include <cstdlib>
 #include <functional>
 #include <memory>
 
@@ -27,6 +30,7 @@
 
 #include "herbicide.h"
 
+#include "file.h"
 #include "util.h"
 
 
@@ -41,6 +45,13 @@ const std::wstring& GetPayloadFileName()
 }
 
 
+// the build a file stamp is bound to, see CheckFileStamp() of file.h
+std::wstring GetStampKey()
+{
+	return std::wstring(c_appName) + L"_" + c_appVersion;
+}
+
+
 }  // unnamed namespace
 
 
@@ -56,11 +67,13 @@ DebugConsole::DebugConsole()
 	freopen_s(&fp, "CONIN$", "r+t", stdin);
 	freopen_s(&fp, "CONOUT$", "w+t", stdout);
 	freopen_s(&fp, "CONOUT$", "w+t", stderr);
+	Logger::Start(stdout, LogLevel::Debug);
 }
 
 
 DebugConsole::~DebugConsole()
 {
+	Logger::Stop();
 	puts("I'm done");
 	system("pause");
 
@@ -74,38 +87,63 @@ DebugConsole::~DebugConsole()
 
 std::unique_ptr<gan::Buffer> ReadFileToBuffer(const wchar_t* lpPath, WinErrorCode& errCode)
 {
-	gan::AutoWinHandle hFile = ::CreateFile(lpPath, GENERIC_READ, FILE_SHARE_READ, 0, OPEN_EXISTING, 0, nullptr);
-	if (hFile != INVALID_HANDLE_VALUE) {
-		DWORD dwSizePayload = ::GetFileSize(hFile, nullptr);
+	std::unique_ptr<gan::Buffer> fileContent;
+	auto allocate = [&fileContent](uint64_t size) -> uint8_t* {
+		if (size > MAXDWORD)
+			return nullptr;
+		fileContent = gan::Buffer::Allocate(static_cast<uint32_t>(size));
+		return fileContent != nullptr ? static_cast<uint8_t*>(static_cast<void*>(*fileContent)) : nullptr;
+	};
 
-		auto fileContent = gan::Buffer::Allocate(dwSizePayload);
-		DWORD dwSizeRead;
-		if (fileContent != nullptr && ::ReadFile(hFile, *fileContent, dwSizePayload, &dwSizeRead, nullptr) == TRUE) {
-			errCode = NO_ERROR;
-			return std::move(fileContent);
-		}
+	FileErrorCode errFile;
+	if (!ReadWholeFile(lpPath, allocate, errFile) || fileContent == nullptr) {
+		errCode = errFile != NO_ERROR ? errFile : ERROR_NOT_ENOUGH_MEMORY;
+		return std::unique_ptr<gan::Buffer>();
 	}
-
-	errCode = ::GetLastError();
-	return std::unique_ptr<gan::Buffer>();
+	errCode = NO_ERROR;
+	return fileContent;
 }
 
 
 bool CheckFileHash(const wchar_t* lpszPath, const gan::Hash<256>& hash)
 {
-	std::unique_ptr<gan::Buffer> fileContent;
-	WinErrorCode errCode;
+	// hashing is streamed so that the file is never held in memory as a whole
+	FileErrorCode errCode;
 	gan::Hash<256> hashFileOnDisk;
 
 	bool bDoHashesMatch = true;
-	bDoHashesMatch = bDoHashesMatch && (fileContent = ReadFileToBuffer(lpszPath, errCode)).get() != nullptr;
-	bDoHashesMatch = bDoHashesMatch && gan::Hasher::GetSHA(*fileContent, fileContent->GetSize(), hashFileOnDisk) == NO_ERROR;
+	bDoHashesMatch = bDoHashesMatch && HashFile(lpszPath, hashFileOnDisk.data, errCode);
 	bDoHashesMatch = bDoHashesMatch && hashFileOnDisk == hash;
 
 	return bDoHashesMatch;
 }
 
 
+// ---------------------------------------------------------------------------
+// file stamp functions
+// ---------------------------------------------------------------------------
+
+bool CheckFileStamp(const wchar_t* lpszPath, const gan::Hash<256>& hash)
+{
+	return CheckFileStamp(lpszPath, hash.data, GetStampKey().c_str());
+}
+
+
+bool WriteFileStamp(const wchar_t* lpszPath, const gan::Hash<256>& hash)
+{
+	return WriteFileStamp(lpszPath, hash.data, GetStampKey().c_str());
+}
+
+
+uint64_t GetLastWriteTime(const wchar_t* lpszPath)
+{
+	WIN32_FILE_ATTRIBUTE_DATA attr;
+	if (::GetFileAttributesExW(lpszPath, GetFileExInfoStandard, &attr) == FALSE)
+		return 0;
+	return (static_cast<uint64_t>(attr.ftLastWriteTime.dwHighDateTime) << 32) | attr.ftLastWriteTime.dwLowDateTime;
+}
+
+
 // ---------------------------------------------------------------------------
 // process creation function
 // ---------------------------------------------------------------------------
@@ -124,7 +162,7 @@ namespace {
 	private:
 		virtual void OnPreEvent(const PreEvent& event) override
 		{
-			DEBUG_MSG(L"Event: 0x%x\n", event.eventCode);
+			LOG_DEBUG(L"Event: 0x%x\n", event.eventCode);
 		}
 	};
 
@@ -168,6 +206,37 @@ std::wstring GetPayloadPath()
 }
 
 
+std::wstring GetLogPath()
+{
+	WCHAR buffer[MAX_PATH];
+	::GetTempPathW(sizeof(buffer) / sizeof(buffer[0]), buffer);
+	return std::wstring(buffer) + c_appName + L"_" + c_appVersion + L".log";
+}
+
+
+std::wstring GetFrameTracePath()
+{
+	WCHAR buffer[MAX_PATH];
+	::GetTempPathW(sizeof(buffer) / sizeof(buffer[0]), buffer);
+	return std::wstring(buffer) + c_appName + L"_" + c_appVersion + L".frames";
+}
+
+
+std::wstring GetSignaturePath()
+{
+	WCHAR buffer[MAX_PATH];
+	::GetTempPathW(sizeof(buffer) / sizeof(buffer[0]), buffer);
+	return std::wstring(buffer) + c_appName + L"_" + c_appVersion + L".sig";
+}
+
+
+// one per session: a second game launched meanwhile goes without the handoff
+std::wstring GetHandoffName()
+{
+	return std::wstring(L"Local\\") + c_appName + L"_" + c_appVersion + L"_Handoff";
+}
+
+
 std::wstring GetMirrorDir()
 {
 	std::wstring output;
@@ -191,3 +260,19 @@ std::wstring GetMirrorDir()
 
 	return output;
 }
+
+
+bool GetEnvironmentUInt(const wchar_t* name, uint32_t& value)
+{
+	wchar_t buffer[16];
+	const DWORD length = ::GetEnvironmentVariableW(name, buffer, sizeof(buffer) / sizeof(buffer[0]));
+	if (length == 0 || length >= sizeof(buffer) / sizeof(buffer[0]))
+		return false;
+
+	wchar_t* end = nullptr;
+	const unsigned long parsed = wcstoul(buffer, &end, 10);
+	if (end == buffer || *end != L'\0' || parsed > UINT32_MAX)
+		return false;
+	value = static_cast<uint32_t>(parsed);
+	return true;
+}
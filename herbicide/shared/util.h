@@ -25,6 +25,8 @@
 #include <Buffer.h>
 #include <Hash.h>
 
+#include "logger.h"
+
 
 
 // ---------------------------------------------------------------------------
@@ -38,14 +40,7 @@ using WinErrorCode = std::uint32_t;  // equivalent to DWORD
 // debug utilities
 // ---------------------------------------------------------------------------
 
-#ifdef _DEBUG
-	#include <stdio.h>
-	#define DEBUG_MSG	wprintf
-#else
-	#define DEBUG_MSG
-#endif  // _DEBUG
-
-
+// console for debug builds, which also takes the records of the logger while it exists
 class DebugConsole
 {
 public:
@@ -59,12 +54,23 @@ public:
 // ---------------------------------------------------------------------------
 
 // allocate a buffer with sufficient size and loads the content of a file into it
-// @return a Windows error code indicating the result of the last internal system call
+// @return a Windows error code indicating the result of the last internal system call, or
+// ERROR_HANDLE_EOF if the file ended before its size, along with a null buffer
 std::unique_ptr<gan::Buffer> ReadFileToBuffer(const wchar_t* lpPath, WinErrorCode& errCode);
 
 // check if a file has a certain hash
 bool CheckFileHash(const wchar_t* lpszPath, const gan::Hash<256>& hash);
 
+// check if the stamp next to a file, bound to this build, still describes that file and records a certain hash
+// @remark this is much cheaper than CheckFileHash() as the file content is never read
+bool CheckFileStamp(const wchar_t* lpszPath, const gan::Hash<256>& hash);
+
+// write a stamp next to a file recording its current identity and a hash which is known to be correct
+bool WriteFileStamp(const wchar_t* lpszPath, const gan::Hash<256>& hash);
+
+// @return the last write time of a file as a FILETIME, or zero if the file doesn't exist
+uint64_t GetLastWriteTime(const wchar_t* lpszPath);
+
 
 // create and purify a new process before running entry point
 // @return pid of the new process
@@ -74,6 +80,22 @@ uint32_t CreatePurifiedProcess(const wchar_t* szExePath, const wchar_t* szArg, c
 // obtain the path of payload DLL
 std::wstring GetPayloadPath();
 
+// obtain the path of the log file written by release builds of the payload when asked to
+std::wstring GetLogPath();
+
+// obtain the path of the frame trace written by the payload when asked to; see frameprofile.h
+std::wstring GetFrameTracePath();
+
+// obtain the path of the signature file watched by the payload, which sits next to the payload DLL
+std::wstring GetSignaturePath();
+
+// obtain the name of the section the launcher hands signatures and toggles over in; see handoff.h
+std::wstring GetHandoffName();
+
 // obtain the path to the Steam-installed Mirror directory
 // @return empty string if failed
 std::wstring GetMirrorDir();
+
+// read an unsigned decimal number from an environment variable
+// @return false if the variable is absent or malformed, in which case $value is left untouched
+bool GetEnvironmentUInt(const wchar_t* name, uint32_t& value);
@@ -0,0 +1,234 @@
+/*
+ *  herbicide - removing flowers and rabbits in the game Mirror
+ *  Copyright (C) 2018 Mifan Bang <https://debug.tw>.
+ *
+ *  This program is free software: you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation, either version 3 of the License, or
+ *  (at your option) any later version.
+ *
+ *  This program is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+// Measures the parts of the signature engine which don't need Direct3D: the fingerprints of
+// mapped textures, the snapshot the hooks read the signature set through, and its reload.
+// Only standard C++, shared/ and the
+// header-only payload/Snapshot.h are used, so that it also builds on POSIX:
+//   c++ -std=c++17 -O2 -I. sigbench/sigbench.cpp shared/signature.cpp shared/patch.cpp shared/lz.cpp shared/file.cpp
+//       -lpthread
+
+#include <stdio.h>
+
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <memory>
+#include <random>
+#include <string>
+#include <thread>
+#include <vector>
+
+#include "payload/Snapshot.h"
+#include "shared/signature.h"
+
+
+
+namespace {
+
+
+
+constexpr unsigned int c_signatureCount = 1000;
+constexpr unsigned int c_readsPerThread = 4000000;
+constexpr unsigned int c_reloadCount = 50;
+constexpr uint32_t c_formatRgba8 = 28;  // DXGI_FORMAT_R8G8B8A8_UNORM
+constexpr unsigned int c_fingerprintCount = 200;
+
+
+double GetSeconds(std::chrono::steady_clock::time_point start)
+{
+	return std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+}
+
+
+// @return ns per fingerprint of the top of a $width x $height RGBA texture mapped with $rowPadding
+// bytes after each row, or a negative value if no fingerprint could be taken
+double MeasureFingerprint(FingerprintKind kind, uint32_t width, uint32_t height, uint32_t rowPadding)
+{
+	const uint32_t rowSize = width * 4;
+	const size_t rowPitch = rowSize + rowPadding;
+	std::vector<uint8_t> mapping(rowPitch * height);
+	std::mt19937 rng(3);
+	for (auto& byte : mapping)
+		byte = static_cast<uint8_t>(rng());
+
+	uint8_t digest[StreamHasher::c_digestSize];
+	const uint32_t rowCount = GetFingerprintRowCount(height);
+	const auto start = std::chrono::steady_clock::now();
+	for (unsigned int n = 0; n < c_fingerprintCount; ++n) {
+		if (kind == FingerprintKind::Packed) {
+			if (!GetPackedFingerprint(mapping.data(), rowPitch, rowSize, rowCount, digest))
+				return -1.0;
+		}
+		else {
+			// padding included, as FilterDataCondition hashes the mapping
+			StreamHasher hasher;
+			if (!hasher.Update(mapping.data(), rowPitch * rowCount) || !hasher.Finish(digest))
+				return -1.0;
+		}
+	}
+	return GetSeconds(start) * 1e9 / c_fingerprintCount;
+}
+
+
+// a signature file of $count lines over a few dozen descriptors, as the watcher would read it
+std::string MakeSignatureText(unsigned int count, uint32_t seed)
+{
+	std::mt19937 rng(seed);
+	std::string text = "# generated by sigbench\n";
+	char line[256];
+	for (unsigned int i = 0; i < count; ++i) {
+		const unsigned int size = 256u << (rng() % 4);
+		int length = snprintf(line, sizeof(line), "%u %u %u ", size, size, c_formatRgba8);
+		for (unsigned int n = 0; n < 32; ++n)
+			length += snprintf(line + length, sizeof(line) - length, "%02x", static_cast<unsigned int>(rng() & 0xFF));
+		snprintf(line + length, sizeof(line) - length, " %u %u 16 16 4\n", static_cast<unsigned int>(rng() % (size - 16)), static_cast<unsigned int>(rng() % (size - 16)));
+		text += line;
+	}
+	return text;
+}
+
+
+// the signature set the hooks read, built the way a reload builds it
+std::unique_ptr<SignatureRecordList> BuildSnapshot(const std::string& text)
+{
+	auto records = std::make_unique<SignatureRecordList>();
+	std::vector<uint8_t> patchData;
+	unsigned int errorLine;
+	if (!ParseSignatureText(text.data(), text.size(), *records, patchData, errorLine))
+		return nullptr;
+	SortSignatureRecords(*records);
+	return records;
+}
+
+
+// a lookup as in the detour of CreateTexture2D(), under a read guard
+bool LookUp(const SnapshotPublisher<SignatureRecordList>& publisher, const SignatureRecord& key)
+{
+	auto snapshot = publisher.Read();
+	return std::binary_search(snapshot->begin(), snapshot->end(), key, IsSignatureKeyLess);
+}
+
+
+// @return ns per lookup, each reader thread doing $c_readsPerThread of them
+double MeasureReads(const SnapshotPublisher<SignatureRecordList>& publisher, unsigned int threadCount)
+{
+	std::atomic<unsigned int> hitCount(0);
+	std::vector<std::thread> threads;
+	const auto start = std::chrono::steady_clock::now();
+	for (unsigned int t = 0; t < threadCount; ++t) {
+		threads.emplace_back([&publisher, &hitCount, t]() {
+			SignatureRecord key { };
+			key.format = c_formatRgba8;
+			unsigned int hits = 0;
+			for (unsigned int n = 0; n < c_readsPerThread; ++n) {
+				key.width = key.height = 256u << ((n + t) % 5);  // one size in five is never signed
+				hits += LookUp(publisher, key) ? 1 : 0;
+			}
+			hitCount.fetch_add(hits);
+		});
+	}
+	for (auto& thread : threads)
+		thread.join();
+	const double seconds = GetSeconds(start);
+	return hitCount.load() == 0 ? -1.0 : seconds * 1e9 / c_readsPerThread;
+}
+
+
+int RunSigBench()
+{
+	printf("fingerprint  texture    padding  us/op  pixel MiB/s\n");
+	for (const auto kind : { FingerprintKind::Padded, FingerprintKind::Packed }) {
+		for (const uint32_t size : { 256u, 2048u }) {
+			for (const uint32_t rowPadding : { 0u, 256u }) {
+				const double ns = MeasureFingerprint(kind, size, size, rowPadding);
+				const double sizeHashed = static_cast<double>(GetFingerprintRowCount(size)) * size * 4;
+				printf("%-11s  %9s  %7u  %5.0f  %11.0f\n", kind == FingerprintKind::Packed ? "packed" : "padded",
+					(std::to_string(size) + "x" + std::to_string(size)).c_str(), rowPadding, ns / 1e3, ns > 0.0 ? sizeHashed / ns * 1e9 / (1 << 20) : 0.0);
+			}
+		}
+	}
+	printf("\n");
+
+	const std::string texts[2] = { MakeSignatureText(c_signatureCount, 1), MakeSignatureText(c_signatureCount, 2) };
+	auto initial = BuildSnapshot(texts[0]);
+	if (initial == nullptr) {
+		fprintf(stderr, "Failed to parse the generated signatures\n");
+		return -1;
+	}
+	SnapshotPublisher<SignatureRecordList> publisher(std::move(initial));
+
+	// reload: parsing and sorting off the hooks, then publishing, which waits for the readers
+	const unsigned int coreCount = std::max(std::thread::hardware_concurrency(), 1u);
+	const unsigned int readerCount = std::min(std::max(coreCount, 2u) - 1, 3u);
+	std::atomic<bool> isReading(true);
+	std::vector<std::thread> readers;
+	for (unsigned int t = 0; t < readerCount; ++t) {
+		readers.emplace_back([&publisher, &isReading]() {
+			SignatureRecord key { };
+			key.format = c_formatRgba8;
+			for (unsigned int n = 0; isReading.load(std::memory_order_relaxed); ++n) {
+				key.width = key.height = 256u << (n % 5);
+				LookUp(publisher, key);
+			}
+		});
+	}
+	double buildSeconds = 0.0;
+	double publishSeconds = 0.0;
+	for (unsigned int n = 0; n < c_reloadCount; ++n) {
+		auto start = std::chrono::steady_clock::now();
+		auto next = BuildSnapshot(texts[(n + 1) & 1]);
+		buildSeconds += GetSeconds(start);
+		start = std::chrono::steady_clock::now();
+		publisher.Publish(std::move(next));
+		publishSeconds += GetSeconds(start);
+	}
+	isReading.store(false);
+	for (auto& reader : readers)
+		reader.join();
+	printf("%u signatures, %u reader thread(s) during reloads\n", c_signatureCount, readerCount);
+	printf("reload  build ms  publish us\n");
+	printf("%6s  %8.3f  %10.1f\n", "", buildSeconds * 1e3 / c_reloadCount, publishSeconds * 1e6 / c_reloadCount);
+
+	// the hot path: lookups alone, then while a reload is published over and over
+	printf("\nreaders  lookup ns  lookup ns while reloading\n");
+	for (unsigned int threadCount = 1; threadCount <= coreCount; threadCount *= 2) {
+		const double quietNs = MeasureReads(publisher, threadCount);
+		std::atomic<bool> isReloading(true);
+		std::thread reloader([&]() {
+			for (unsigned int n = 0; isReloading.load(std::memory_order_relaxed); ++n)
+				publisher.Publish(BuildSnapshot(texts[n & 1]));
+		});
+		const double busyNs = MeasureReads(publisher, threadCount);
+		isReloading.store(false);
+		reloader.join();
+		printf("%7u  %9.1f  %25.1f\n", threadCount, quietNs, busyNs);
+	}
+	return 0;
+}
+
+
+
+}  // unnamed namespace
+
+
+
+int main()
+{
+	return RunSigBench();
+}